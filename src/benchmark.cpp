@@ -0,0 +1,260 @@
+#include "drawlist.h"
+#include "imagedecoder.h"
+#include "scene.h"
+#include "statistics.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+// Children per node when building a hierarchy.
+//
+const uint32_t BENCHMARK_BRANCHING = 8;
+
+// Images decoded by the decode benchmark, and how often each one is
+// decoded per codec and thread.
+//
+const char *const BENCHMARK_IMAGE_PATHS[] = { "textures/chalet.jpg", "textures/texture.jpg", "textures/teapot.png" };
+const uint32_t BENCHMARK_DECODE_REPEATS = 8;
+
+/**************************************************************
+* Description
+*		Builds a scene of the given number of nodes, either all
+*		roots or a tree where every node has up to eight children.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+static void buildScene(Scene &scene, uint32_t nodeCount, bool fHierarchy)
+{
+	scene.reserve(nodeCount);
+	for (uint32_t i = 0; i < nodeCount; ++i)
+	{
+		uint32_t parent = (fHierarchy && i > 0) ? (i - 1) / BENCHMARK_BRANCHING : INVALID_SCENE_NODE;
+		uint32_t node = scene.addNode(parent);
+		scene.setPosition(node, glm::vec3(static_cast<float>(i % 100), static_cast<float>(i / 100 % 100), static_cast<float>(i / 10000)));
+		scene.setLocalBounds(node, glm::vec3(-0.5f), glm::vec3(0.5f));
+	}
+}
+
+/**************************************************************
+* Description
+*		Rotates every node and updates the scene for a number of
+*		frames.
+* Returns
+*		The average time of Scene::update in milliseconds.
+* Notes
+*		Every node is modified each frame, which is the worst
+*		case for the update.
+*
+**************************************************************/
+static double timeSceneUpdate(uint32_t nodeCount, bool fHierarchy, ThreadPool *pThreadPool)
+{
+	Scene scene;
+	buildScene(scene, nodeCount, fHierarchy);
+	scene.update(pThreadPool);
+
+	const uint32_t frameCount = std::min<uint32_t>(std::max<uint32_t>(10000000 / nodeCount, 10), 1000);
+	const glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f);
+	double totalMilliseconds = 0.0;
+	for (uint32_t frame = 0; frame < frameCount; ++frame)
+	{
+		for (uint32_t node = 0; node < nodeCount; ++node)
+		{
+			scene.rotate(node, 0.01f, axis);
+		}
+
+		CpuTimer timer;
+		scene.update(pThreadPool);
+		totalMilliseconds += timer.elapsedMilliseconds();
+	}
+	return totalMilliseconds / frameCount;
+}
+
+/**************************************************************
+* Description
+*		Measures the transform update of the scene from one
+*		thousand to one million objects, flat and as a hierarchy,
+*		on the calling thread and on the thread pool.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+static void benchmarkSceneUpdate(ThreadPool &threadPool)
+{
+	std::cout << "Scene update, every node modified each frame (" << threadPool.getThreadCount() << " worker threads)" << std::endl;
+	std::cout << std::setw(10) << "objects" << std::setw(12) << "layout"
+		<< std::setw(16) << "serial (ms)" << std::setw(16) << "parallel (ms)" << std::setw(10) << "speedup" << std::endl;
+
+	const uint32_t nodeCounts[] = { 1000, 10000, 100000, 1000000 };
+	for (uint32_t nodeCount : nodeCounts)
+	{
+		for (int hierarchy = 0; hierarchy < 2; ++hierarchy)
+		{
+			double serialMilliseconds = timeSceneUpdate(nodeCount, 0 != hierarchy, nullptr);
+			double parallelMilliseconds = timeSceneUpdate(nodeCount, 0 != hierarchy, &threadPool);
+			std::cout << std::fixed << std::setprecision(3)
+				<< std::setw(10) << nodeCount << std::setw(12) << (0 != hierarchy ? "hierarchy" : "flat")
+				<< std::setw(16) << serialMilliseconds << std::setw(16) << parallelMilliseconds
+				<< std::setw(10) << serialMilliseconds / parallelMilliseconds << std::endl;
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Compares the radix sort of draw items with std::sort
+*		from one thousand to one million draws.
+* Returns
+*		void
+* Notes
+*		The keys use a handful of pipelines and meshes with
+*		random depths, like a typical frame.
+*
+**************************************************************/
+static void benchmarkDrawSort()
+{
+	std::cout << "Draw sort" << std::endl;
+	std::cout << std::setw(10) << "draws" << std::setw(16) << "radix (ms)" << std::setw(16) << "std::sort (ms)" << std::endl;
+
+	std::mt19937 random(1);
+	const uint32_t drawCounts[] = { 1000, 10000, 100000, 1000000 };
+	for (uint32_t drawCount : drawCounts)
+	{
+		std::vector<DrawItem> items(drawCount);
+		for (uint32_t i = 0; i < drawCount; ++i)
+		{
+			items[i].m_sortKey = makeDrawSortKey(random() % 4, 0, random() % 64, (random() % 10000) / 10000.0f, true);
+			items[i].m_drawIndex = i;
+		}
+
+		std::vector<DrawItem> radixItems = items;
+		std::vector<DrawItem> scratch;
+		CpuTimer radixTimer;
+		sortDrawItems(radixItems, scratch);
+		double radixMilliseconds = radixTimer.elapsedMilliseconds();
+
+		CpuTimer stdTimer;
+		std::sort(items.begin(), items.end(), [](const DrawItem &a, const DrawItem &b) { return a.m_sortKey < b.m_sortKey; });
+		double stdMilliseconds = stdTimer.elapsedMilliseconds();
+
+		std::cout << std::fixed << std::setprecision(3)
+			<< std::setw(10) << drawCount << std::setw(16) << radixMilliseconds << std::setw(16) << stdMilliseconds << std::endl;
+	}
+}
+
+/**************************************************************
+* Description
+*		Reads a whole file.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+static bool readFile(const std::string &path, std::vector<char> &content)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	content.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(content.data(), content.size());
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Measures the decode throughput of every codec reading
+*		each benchmark image, on the calling thread and with
+*		every worker of the thread pool decoding a copy.
+* Returns
+*		void
+* Notes
+*		Throughput is given in MB of the file read and of RGBA8
+*		texels written per second. Images that cannot be read
+*		are skipped. Notes when the SIMD JPEG codec is not
+*		built, as JPEG files then only go through stb_image.
+*
+**************************************************************/
+static void benchmarkImageDecoding(ThreadPool &threadPool)
+{
+	std::cout << "Image decoding (" << threadPool.getThreadCount() << " worker threads)" << std::endl;
+	if (!fImageCodecAvailable(IMAGE_CODEC_TURBOJPEG))
+	{
+		std::cout << "The " << getImageCodecName(IMAGE_CODEC_TURBOJPEG) << " codec is not built, define IMAGE_DECODER_TURBOJPEG"
+			<< " to decode JPEG files with SIMD instead of stb_image." << std::endl;
+	}
+	std::cout << std::setw(24) << "image" << std::setw(16) << "codec"
+		<< std::setw(14) << "file MB/s" << std::setw(14) << "texel MB/s" << std::setw(18) << "parallel MB/s" << std::endl;
+
+	for (const char *path : BENCHMARK_IMAGE_PATHS)
+	{
+		std::vector<char> content;
+		uint32_t width, height;
+		std::string error;
+		if (!readFile(path, content) || !readImageHeader(content.data(), content.size(), width, height, error))
+		{
+			std::cout << std::setw(24) << path << "  could not be read" << std::endl;
+			continue;
+		}
+
+		const size_t imageSize = static_cast<size_t>(width) * height * 4;
+		for (uint32_t codecIndex = 0; codecIndex < IMAGE_CODEC_COUNT; ++codecIndex)
+		{
+			ImageCodec codec = static_cast<ImageCodec>(codecIndex);
+			if (!fImageCodecReads(codec, content.data(), content.size()))
+			{
+				continue;
+			}
+
+			std::vector<uint8_t> pixels(imageSize);
+			bool fDecoded = true;
+			CpuTimer serialTimer;
+			for (uint32_t repeat = 0; repeat < BENCHMARK_DECODE_REPEATS; ++repeat)
+			{
+				fDecoded = decodeImage(content.data(), content.size(), codec, pixels.data(), error) && fDecoded;
+			}
+			double serialSeconds = serialTimer.elapsedMilliseconds() / 1000.0;
+
+			const size_t decodeCount = static_cast<size_t>(threadPool.getThreadCount()) * BENCHMARK_DECODE_REPEATS;
+			std::vector<std::vector<uint8_t>> threadPixels(threadPool.getThreadCount(), std::vector<uint8_t>(imageSize));
+			std::vector<char> fThreadDecoded(decodeCount, 1);
+			CpuTimer parallelTimer;
+			threadPool.parallelFor(decodeCount, 1, [&](size_t batchIndex, size_t begin, size_t end)
+			{
+				std::string threadError;
+				for (size_t i = begin; i < end; ++i)
+				{
+					fThreadDecoded[i] = decodeImage(content.data(), content.size(), codec, threadPixels[batchIndex].data(), threadError);
+				}
+			}, threadPool.getThreadCount());
+			double parallelSeconds = parallelTimer.elapsedMilliseconds() / 1000.0;
+
+			if (!fDecoded || fThreadDecoded.end() != std::find(fThreadDecoded.begin(), fThreadDecoded.end(), 0))
+			{
+				std::cout << std::setw(24) << path << std::setw(16) << getImageCodecName(codec) << "  " << error << std::endl;
+				continue;
+			}
+			const double megabyte = 1024.0 * 1024.0;
+			std::cout << std::fixed << std::setprecision(1)
+				<< std::setw(24) << path << std::setw(16) << getImageCodecName(codec)
+				<< std::setw(14) << content.size() * BENCHMARK_DECODE_REPEATS / megabyte / serialSeconds
+				<< std::setw(14) << imageSize * BENCHMARK_DECODE_REPEATS / megabyte / serialSeconds
+				<< std::setw(18) << imageSize * decodeCount / megabyte / parallelSeconds << std::endl;
+		}
+	}
+}
+
+int main()
+{
+	ThreadPool threadPool;
+	benchmarkSceneUpdate(threadPool);
+	benchmarkDrawSort();
+	benchmarkImageDecoding(threadPool);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,344 @@
+#include "benchmarkscript.h"
+#include "statistics.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+/**************************************************************
+* Description
+*		Escapes a string for a JSON string literal.
+* Returns
+*		The escaped string, without the quotes.
+* Notes
+*		Paths on Windows hold backslashes.
+*
+**************************************************************/
+static std::string escapeJson(const std::string &text)
+{
+	std::string escaped;
+	for (char c : text)
+	{
+		if ('"' == c || '\\' == c)
+		{
+			escaped += '\\';
+			escaped += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			std::ostringstream code;
+			code << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+			escaped += code.str();
+		}
+		else
+		{
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+/**************************************************************
+* Description
+*		Constructor.
+* Returns
+*
+* Notes
+*
+**************************************************************/
+BenchmarkScript::BenchmarkScript() :
+	m_timestep(1.0f / 60.0f),
+	m_warmupFrameCount(0),
+	m_frameCount(0)
+{
+}
+
+/**************************************************************
+* Description
+*		Reads a scene description and its animation from a file.
+* Returns
+*		true/false
+* Notes
+*		Fails with the error set, naming the line, if a
+*		statement cannot be read, or if the script has no
+*		model, camera keyframe or measured frame.
+*
+**************************************************************/
+bool BenchmarkScript::load(const std::string &path, std::string &error)
+{
+	std::ifstream file(path);
+	if (!file.is_open())
+	{
+		error = "Could not open " + path;
+		return false;
+	}
+
+	*this = BenchmarkScript();
+	m_path = path;
+	std::string line;
+	for (uint32_t lineNumber = 1; std::getline(file, line); ++lineNumber)
+	{
+		if (!parseLine(line, error))
+		{
+			error = path + ":" + std::to_string(lineNumber) + ": " + error;
+			return false;
+		}
+	}
+
+	if (m_models.empty() || m_cameraKeyframes.empty() || 0 == m_frameCount)
+	{
+		error = path + ": a script needs a model, a camera keyframe and a frame count";
+		return false;
+	}
+	for (const auto &spin : m_spins)
+	{
+		if (spin.m_modelIndex >= m_models.size())
+		{
+			error = path + ": spin of model " + std::to_string(spin.m_modelIndex) + ", which does not exist";
+			return false;
+		}
+	}
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Reads one statement of a script.
+* Returns
+*		true/false
+* Notes
+*		Empty lines and comments are skipped.
+*
+**************************************************************/
+bool BenchmarkScript::parseLine(const std::string &line, std::string &error)
+{
+	std::istringstream stream(line.substr(0, line.find('#')));
+	std::string statement;
+	if (!(stream >> statement))
+	{
+		return true;
+	}
+
+	if ("timestep" == statement)
+	{
+		if (!(stream >> m_timestep) || m_timestep <= 0.0f)
+		{
+			error = "timestep needs a positive number of seconds";
+			return false;
+		}
+	}
+	else if ("warmup" == statement)
+	{
+		if (!(stream >> m_warmupFrameCount))
+		{
+			error = "warmup needs a frame count";
+			return false;
+		}
+	}
+	else if ("frames" == statement)
+	{
+		if (!(stream >> m_frameCount))
+		{
+			error = "frames needs a frame count";
+			return false;
+		}
+	}
+	else if ("model" == statement)
+	{
+		ScriptedModel model = {};
+		std::string shading;
+		if (!(stream >> model.m_modelPath >> shading >> model.m_position.x >> model.m_position.y >> model.m_position.z >> model.m_scale) ||
+			("color" != shading && "texture" != shading))
+		{
+			error = "model needs a path, color or texture, a position and a scale";
+			return false;
+		}
+		model.m_fTextured = "texture" == shading;
+		m_models.push_back(model);
+	}
+	else if ("texture" == statement)
+	{
+		if (m_models.empty() || !m_models.back().m_fTextured || !(stream >> m_models.back().m_texturePath))
+		{
+			error = "texture needs a path and a texture shaded model above it";
+			return false;
+		}
+	}
+	else if ("virtualtexture" == statement)
+	{
+		if (m_models.empty() || !m_models.back().m_fTextured || !(stream >> m_models.back().m_virtualTexturePath))
+		{
+			error = "virtualtexture needs a path and a texture shaded model above it";
+			return false;
+		}
+	}
+	else if ("spin" == statement)
+	{
+		ModelSpin spin = {};
+		if (!(stream >> spin.m_modelIndex >> spin.m_axis.x >> spin.m_axis.y >> spin.m_axis.z >> spin.m_degreesPerSecond) ||
+			glm::vec3(0.0f) == spin.m_axis)
+		{
+			error = "spin needs a model index, an axis and degrees per second";
+			return false;
+		}
+		spin.m_axis = glm::normalize(spin.m_axis);
+		m_spins.push_back(spin);
+	}
+	else if ("camera" == statement)
+	{
+		CameraKeyframe keyframe = {};
+		if (!(stream >> keyframe.m_time >>
+				keyframe.m_eye.x >> keyframe.m_eye.y >> keyframe.m_eye.z >>
+				keyframe.m_target.x >> keyframe.m_target.y >> keyframe.m_target.z) ||
+			(!m_cameraKeyframes.empty() && keyframe.m_time <= m_cameraKeyframes.back().m_time))
+		{
+			error = "camera needs a time after the previous keyframe, an eye and a target";
+			return false;
+		}
+		m_cameraKeyframes.push_back(keyframe);
+	}
+	else
+	{
+		error = "unknown statement " + statement;
+		return false;
+	}
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Gets where the camera is at a time of the script,
+*		between the keyframes around it.
+* Returns
+*		void
+* Notes
+*		The first and last keyframes hold before and after the
+*		path.
+*
+**************************************************************/
+void BenchmarkScript::getCamera(float time, glm::vec3 &eye, glm::vec3 &target) const
+{
+	auto next = std::upper_bound(
+		m_cameraKeyframes.begin(),
+		m_cameraKeyframes.end(),
+		time,
+		[](float value, const CameraKeyframe &keyframe) { return value < keyframe.m_time; });
+	if (m_cameraKeyframes.begin() == next || m_cameraKeyframes.end() == next)
+	{
+		const CameraKeyframe &keyframe = m_cameraKeyframes.begin() == next ? m_cameraKeyframes.front() : m_cameraKeyframes.back();
+		eye = keyframe.m_eye;
+		target = keyframe.m_target;
+		return;
+	}
+
+	const CameraKeyframe &previous = *(next - 1);
+	float blend = (time - previous.m_time) / (next->m_time - previous.m_time);
+	eye = glm::mix(previous.m_eye, next->m_eye, blend);
+	target = glm::mix(previous.m_target, next->m_target, blend);
+}
+
+/**************************************************************
+* Description
+*		Gets the orientation of a model at a time of the script,
+*		its spins applied in the order of the script.
+* Returns
+*		The orientation.
+* Notes
+*		Computed from the time rather than accumulated per
+*		frame, so it does not drift with the frame count.
+*
+**************************************************************/
+glm::quat BenchmarkScript::getOrientation(uint32_t modelIndex, float time) const
+{
+	glm::quat orientation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	for (const auto &spin : m_spins)
+	{
+		if (modelIndex == spin.m_modelIndex)
+		{
+			float angle = glm::radians(fmodf(spin.m_degreesPerSecond * time, 360.0f));
+			orientation = glm::angleAxis(angle, spin.m_axis) * orientation;
+		}
+	}
+	return orientation;
+}
+
+/**************************************************************
+* Description
+*		Checks if the script spins a model.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+bool BenchmarkScript::fAnimated(uint32_t modelIndex) const
+{
+	return m_spins.end() != std::find_if(m_spins.begin(), m_spins.end(), [modelIndex](const ModelSpin &spin)
+	{
+		return modelIndex == spin.m_modelIndex;
+	});
+}
+
+/**************************************************************
+* Description
+*		Writes the results of a scripted run as JSON, the run
+*		settings followed by the statistics of every sample.
+* Returns
+*		true/false
+* Notes
+*		Fails if the file cannot be written.
+*
+**************************************************************/
+bool writeBenchmarkResults(const std::string &path, const BenchmarkResults &results)
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		return false;
+	}
+
+	file << std::setprecision(6);
+	file << "{" << std::endl;
+	file << "\t\"script\": \"" << escapeJson(results.m_scriptPath) << "\"," << std::endl;
+	file << "\t\"device\": \"" << escapeJson(results.m_deviceName) << "\"," << std::endl;
+	file << "\t\"width\": " << results.m_width << "," << std::endl;
+	file << "\t\"height\": " << results.m_height << "," << std::endl;
+	file << "\t\"timestep\": " << results.m_timestep << "," << std::endl;
+	file << "\t\"warmup_frames\": " << results.m_warmupFrameCount << "," << std::endl;
+	file << "\t\"frames\": " << results.m_frameCount << "," << std::endl;
+	file << "\t\"seconds\": " << results.m_seconds << "," << std::endl;
+	file << "\t\"samples\": {";
+
+	bool fFirst = true;
+	for (const auto &sample : results.m_samples)
+	{
+		std::vector<double> values = sample.second;
+		if (values.empty())
+		{
+			continue;
+		}
+		double sum = 0.0;
+		for (double value : values)
+		{
+			sum += value;
+		}
+
+		file << (fFirst ? "" : ",") << std::endl;
+		file << "\t\t\"" << escapeJson(sample.first) << "\": { ";
+		file << "\"count\": " << values.size();
+		file << ", \"mean\": " << sum / values.size();
+		for (double percent : BENCHMARK_PERCENTILES)
+		{
+			file << ", \"p" << percent << "\": " << computePercentile(values, percent);
+		}
+		// computePercentile sorted the values.
+		//
+		file << ", \"min\": " << values.front();
+		file << ", \"max\": " << values.back() << " }";
+		fFirst = false;
+	}
+
+	file << std::endl << "\t}" << std::endl;
+	file << "}" << std::endl;
+	return file.good();
+}
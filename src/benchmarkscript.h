@@ -0,0 +1,103 @@
+#pragma once
+
+#include "model.h"
+#include<map>
+#include<string>
+#include<vector>
+
+// Percentiles of every frame sample written to the results.
+//
+const double BENCHMARK_PERCENTILES[] = { 50.0, 95.0, 99.0 };
+
+// A model of a scripted scene, placed at its position with a uniform
+// scale.
+//
+struct ScriptedModel
+{
+	std::string m_modelPath;
+	bool m_fTextured; // Drawn with the texture shading pipeline instead of the color one.
+	std::string m_texturePath; // Replaces the texture of the material library unless empty.
+	std::string m_virtualTexturePath; // Sampled through the virtual texture system unless empty.
+	glm::vec3 m_position;
+	float m_scale;
+};
+
+// Where the camera is at a point of the script. The camera moves in a
+// straight line from one keyframe to the next.
+//
+struct CameraKeyframe
+{
+	float m_time; // Seconds from the start of the script.
+	glm::vec3 m_eye;
+	glm::vec3 m_target;
+};
+
+// A constant rotation of a model around an axis through its center.
+//
+struct ModelSpin
+{
+	uint32_t m_modelIndex;
+	glm::vec3 m_axis; // Normalized.
+	float m_degreesPerSecond;
+};
+
+// A scene description with a camera path and object animation, played
+// back on a fixed timestep so every run renders the same frames. The
+// file has one statement per line, # starts a comment:
+//
+//	timestep <seconds>
+//	warmup <frames>
+//	frames <frames>
+//	model <obj path> <color|texture> <x> <y> <z> <scale>
+//	texture <image path>
+//	virtualtexture <image path>
+//	spin <model index> <axis x> <y> <z> <degrees per second>
+//	camera <seconds> <eye x> <y> <z> <target x> <y> <z>
+//
+// texture and virtualtexture apply to the model above it. Camera keyframes are in
+// time order, the camera stays at the last one once the path ends.
+//
+class BenchmarkScript
+{
+public:
+	BenchmarkScript();
+	bool load(const std::string &path, std::string &error);
+	const std::string &getPath() const { return m_path; }
+	float getTimestep() const { return m_timestep; }
+	uint32_t getWarmupFrameCount() const { return m_warmupFrameCount; }
+	uint32_t getFrameCount() const { return m_frameCount; }
+	const std::vector<ScriptedModel> &getModels() const { return m_models; }
+	void getCamera(float time, glm::vec3 &eye, glm::vec3 &target) const;
+	glm::quat getOrientation(uint32_t modelIndex, float time) const;
+	bool fAnimated(uint32_t modelIndex) const;
+private:
+	bool parseLine(const std::string &line, std::string &error);
+
+	std::string m_path;
+	float m_timestep;
+	uint32_t m_warmupFrameCount; // Rendered before the measured frames, and left out of the results.
+	uint32_t m_frameCount; // Measured.
+	std::vector<ScriptedModel> m_models;
+	std::vector<CameraKeyframe> m_cameraKeyframes;
+	std::vector<ModelSpin> m_spins;
+};
+
+// What a scripted run measured.
+//
+struct BenchmarkResults
+{
+	std::string m_scriptPath;
+	std::string m_deviceName;
+	uint32_t m_width;
+	uint32_t m_height;
+	float m_timestep;
+	uint32_t m_warmupFrameCount;
+	uint32_t m_frameCount;
+	double m_seconds; // Wall clock time of the measured frames.
+	std::map<std::string, std::vector<double>> m_samples; // Every frame sample of the measured frames, by name.
+};
+
+// Writes the results as JSON, with the count, mean, minimum, maximum and
+// BENCHMARK_PERCENTILES of every sample.
+//
+bool writeBenchmarkResults(const std::string &path, const BenchmarkResults &results);
@@ -26,23 +26,44 @@ glm::vec3 sphericalToNormal(float radius, float theta, float phi)
 * Notes
 *
 **************************************************************/
-Camera::Camera():m_fMousePressed(false)
+Camera::Camera():m_fMousePressed(false),
+	m_fLookAt(false)
 {
 	m_phi = 90.0f;
 	m_theta = 0.0f;
 	m_radius = 8.0f;
+	m_lastMousePosition[0] = m_lastMousePosition[1] = 0.0;
+	m_currentMousePosition[0] = m_currentMousePosition[1] = 0.0;
+	m_viewMatrix = glm::mat4(1.0f);
+	m_eye = glm::vec3(0.0f);
+	m_target = glm::vec3(0.0f);
+	m_fViewDirty = true;
 }
 
 /**************************************************************
 * Description
 *		Returns the rotation matrix based based on the current state.
 * Returns
-*		void
+*		view matrix
 * Notes
+*		The matrix is cached and only rebuilt when the camera
+*		has moved since the last call.
 *
 **************************************************************/
-glm::mat4 Camera::getViewMatrix()
+const glm::mat4 &Camera::getViewMatrix()
 {
+	if (!m_fViewDirty)
+	{
+		return m_viewMatrix;
+	}
+
+	if (m_fLookAt)
+	{
+		m_viewMatrix = glm::lookAt(m_eye, m_target, glm::vec3(0.0f, 1.0f, 0.0f));
+		m_fViewDirty = false;
+		return m_viewMatrix;
+	}
+
 	float modifiedTheta = m_theta;
 	float modifiedPhi = m_phi;
 
@@ -58,7 +79,9 @@ glm::mat4 Camera::getViewMatrix()
 		0.0,
 		-m_radius * glm::cos(glm::radians(modifiedPhi)));
 	glm::vec3 upVector = glm::cross(eyeVector, rightVector);
-	return glm::lookAt(eyeVector, glm::vec3(0.0f, 0.0f, 0.0f), upVector);
+	m_viewMatrix = glm::lookAt(eyeVector, glm::vec3(0.0f, 0.0f, 0.0f), upVector);
+	m_fViewDirty = false;
+	return m_viewMatrix;
 }
 
 /**************************************************************
@@ -78,4 +101,67 @@ void Camera::setMouseButtonPressed(bool fMouseButtonPressed)
 		m_phi += (m_currentMousePosition[0] - m_lastMousePosition[0]) / 10.0f;
 	}
 	m_fMousePressed = fMouseButtonPressed;
+	m_fViewDirty = true;
+}
+
+/**************************************************************
+* Description
+*		Sets the mouse position at which the drag started.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Camera::setInitialMousePosition(double xPos, double yPos)
+{
+	m_lastMousePosition[0] = xPos;
+	m_lastMousePosition[1] = yPos;
+	m_currentMousePosition[0] = xPos;
+	m_currentMousePosition[1] = yPos;
+	m_fViewDirty = true;
+}
+
+/**************************************************************
+* Description
+*		Sets the current mouse position during a drag. The view
+*		only needs rebuilding if the cursor actually moved.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Camera::setCurrentMousePosition(double xPos, double yPos)
+{
+	if (xPos == m_currentMousePosition[0] && yPos == m_currentMousePosition[1])
+	{
+		return;
+	}
+
+	m_currentMousePosition[0] = xPos;
+	m_currentMousePosition[1] = yPos;
+	m_fViewDirty = true;
+}
+
+/**************************************************************
+* Description
+*		Places the camera at the eye, looking at the target with
+*		the y axis up. Used by scripted camera paths, the mouse
+*		no longer moves the camera once it is called.
+* Returns
+*		void
+* Notes
+*		The view only needs rebuilding if the camera moved.
+*
+**************************************************************/
+void Camera::setLookAt(const glm::vec3 &eye, const glm::vec3 &target)
+{
+	if (m_fLookAt && eye == m_eye && target == m_target)
+	{
+		return;
+	}
+
+	m_fLookAt = true;
+	m_eye = eye;
+	m_target = target;
+	m_fViewDirty = true;
 }
\ No newline at end of file
@@ -15,16 +15,23 @@ class Camera
 {
 public:
 	Camera();
-	glm::mat4 getViewMatrix();
+	const glm::mat4 &getViewMatrix();
+	bool fViewDirty() const { return m_fViewDirty; }
 	void setMouseButtonPressed(bool fMouseButtonPressed);
 	bool fMouseButtonPressed() { return m_fMousePressed; }
-	void setInitialMousePosition(double xPos, double yPos) { m_lastMousePosition[0] = xPos; m_lastMousePosition[1] = yPos; }
-	void setCurrentMousePosition(double xPos, double yPos) { m_currentMousePosition[0] = xPos; m_currentMousePosition[1] = yPos; }
+	void setInitialMousePosition(double xPos, double yPos);
+	void setCurrentMousePosition(double xPos, double yPos);
+	void setLookAt(const glm::vec3 &eye, const glm::vec3 &target);
 private:
+	glm::mat4 m_viewMatrix; // Cached, rebuilt by getViewMatrix() when dirty.
+	bool m_fViewDirty;
 	double m_lastMousePosition[2];
 	double m_currentMousePosition[2];
 	bool m_fMousePressed;
 	float m_radius;
 	float m_theta;
 	float m_phi;
+	bool m_fLookAt; // Set by setLookAt, the eye and target replace the mouse orbit.
+	glm::vec3 m_eye;
+	glm::vec3 m_target;
 };
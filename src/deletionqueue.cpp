@@ -0,0 +1,306 @@
+#include "deletionqueue.h"
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+DeletionQueue::DeletionQueue()
+	:m_vkDevice(VK_NULL_HANDLE)
+{
+}
+
+/**************************************************************
+* Description
+*		Sets the device the queued objects belong to.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::create(VkDevice vkDevice)
+{
+	m_vkDevice = vkDevice;
+}
+
+/**************************************************************
+* Description
+*		Queues a buffer for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueueBuffer(uint64_t value, VkBuffer vkBuffer)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_BUFFER;
+	deletion.m_vkBuffer = vkBuffer;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues an image for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueueImage(uint64_t value, VkImage vkImage)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_IMAGE;
+	deletion.m_vkImage = vkImage;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues an image view for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueueImageView(uint64_t value, VkImageView vkImageView)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_IMAGE_VIEW;
+	deletion.m_vkImageView = vkImageView;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues a framebuffer for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueueFramebuffer(uint64_t value, VkFramebuffer vkFramebuffer)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_FRAMEBUFFER;
+	deletion.m_vkFramebuffer = vkFramebuffer;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues a pipeline for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueuePipeline(uint64_t value, VkPipeline vkPipeline)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_PIPELINE;
+	deletion.m_vkPipeline = vkPipeline;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues a render pass for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueueRenderPass(uint64_t value, VkRenderPass vkRenderPass)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_RENDER_PASS;
+	deletion.m_vkRenderPass = vkRenderPass;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues device memory to be freed.
+* Returns
+*		void
+* Notes
+*		Queue the objects bound to the memory with the same or
+*		an earlier value, so they are destroyed first.
+*
+**************************************************************/
+void DeletionQueue::enqueueMemory(uint64_t value, VkDeviceMemory vkMemory)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_MEMORY;
+	deletion.m_vkMemory = vkMemory;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues a retired swapchain for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueueSwapchain(uint64_t value, VkSwapchainKHR vkSwapchain)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_SWAPCHAIN;
+	deletion.m_vkSwapchain = vkSwapchain;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues a semaphore for destruction.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::enqueueSemaphore(uint64_t value, VkSemaphore vkSemaphore)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_SEMAPHORE;
+	deletion.m_vkSemaphore = vkSemaphore;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Queues a command buffer to be freed back to its pool.
+* Returns
+*		void
+* Notes
+*		The pool has to be used on the thread that releases the
+*		queue.
+*
+**************************************************************/
+void DeletionQueue::enqueueCommandBuffer(uint64_t value, VkCommandPool vkCommandPool, VkCommandBuffer vkCommandBuffer)
+{
+	PendingDeletion deletion = {};
+	deletion.m_value = value;
+	deletion.m_type = DELETION_COMMAND_BUFFER;
+	deletion.m_vkCommandPool = vkCommandPool;
+	deletion.m_vkCommandBuffer = vkCommandBuffer;
+	enqueue(deletion);
+}
+
+/**************************************************************
+* Description
+*		Adds the object to the queue.
+* Returns
+*		void
+* Notes
+*		Null handles are allowed, destroying them does nothing.
+*
+**************************************************************/
+void DeletionQueue::enqueue(const PendingDeletion &deletion)
+{
+	m_pendingDeletions.push_back(deletion);
+}
+
+/**************************************************************
+* Description
+*		Destroys the objects whose value has completed.
+* Returns
+*		void
+* Notes
+*		Objects are destroyed in the order they were queued, so
+*		the memory behind a buffer or image is freed after it.
+*
+**************************************************************/
+void DeletionQueue::release(uint64_t completedValue)
+{
+	size_t pendingCount = 0;
+	for (size_t i = 0; i < m_pendingDeletions.size(); ++i)
+	{
+		if (m_pendingDeletions[i].m_value <= completedValue)
+		{
+			destroy(m_pendingDeletions[i]);
+		}
+		else
+		{
+			m_pendingDeletions[pendingCount++] = m_pendingDeletions[i];
+		}
+	}
+	m_pendingDeletions.resize(pendingCount);
+}
+
+/**************************************************************
+* Description
+*		Destroys every queued object.
+* Returns
+*		void
+* Notes
+*		The device must be idle.
+*
+**************************************************************/
+void DeletionQueue::flush()
+{
+	for (const auto &deletion : m_pendingDeletions)
+	{
+		destroy(deletion);
+	}
+	m_pendingDeletions.clear();
+}
+
+/**************************************************************
+* Description
+*		Destroys a queued object.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DeletionQueue::destroy(const PendingDeletion &deletion)
+{
+	switch (deletion.m_type)
+	{
+	case DELETION_BUFFER:
+		vkDestroyBuffer(m_vkDevice, deletion.m_vkBuffer, nullptr);
+		break;
+	case DELETION_IMAGE:
+		vkDestroyImage(m_vkDevice, deletion.m_vkImage, nullptr);
+		break;
+	case DELETION_IMAGE_VIEW:
+		vkDestroyImageView(m_vkDevice, deletion.m_vkImageView, nullptr);
+		break;
+	case DELETION_FRAMEBUFFER:
+		vkDestroyFramebuffer(m_vkDevice, deletion.m_vkFramebuffer, nullptr);
+		break;
+	case DELETION_PIPELINE:
+		vkDestroyPipeline(m_vkDevice, deletion.m_vkPipeline, nullptr);
+		break;
+	case DELETION_RENDER_PASS:
+		vkDestroyRenderPass(m_vkDevice, deletion.m_vkRenderPass, nullptr);
+		break;
+	case DELETION_MEMORY:
+		vkFreeMemory(m_vkDevice, deletion.m_vkMemory, nullptr);
+		break;
+	case DELETION_SWAPCHAIN:
+		vkDestroySwapchainKHR(m_vkDevice, deletion.m_vkSwapchain, nullptr);
+		break;
+	case DELETION_SEMAPHORE:
+		vkDestroySemaphore(m_vkDevice, deletion.m_vkSemaphore, nullptr);
+		break;
+	case DELETION_COMMAND_BUFFER:
+		vkFreeCommandBuffers(m_vkDevice, deletion.m_vkCommandPool, 1, &deletion.m_vkCommandBuffer);
+		break;
+	}
+}
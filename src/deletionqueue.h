@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include<vector>
+
+// The kinds of objects the deletion queue can destroy.
+//
+enum DeletionType
+{
+	DELETION_BUFFER,
+	DELETION_IMAGE,
+	DELETION_IMAGE_VIEW,
+	DELETION_FRAMEBUFFER,
+	DELETION_PIPELINE,
+	DELETION_RENDER_PASS,
+	DELETION_MEMORY,
+	DELETION_SWAPCHAIN,
+	DELETION_SEMAPHORE,
+	DELETION_COMMAND_BUFFER
+};
+
+// An object waiting for the GPU work that uses it to complete.
+//
+struct PendingDeletion
+{
+	uint64_t m_value; // Destroyed once this value has completed.
+	DeletionType m_type;
+	VkCommandPool m_vkCommandPool; // The pool of a command buffer, unused otherwise.
+	union
+	{
+		VkBuffer m_vkBuffer;
+		VkImage m_vkImage;
+		VkImageView m_vkImageView;
+		VkFramebuffer m_vkFramebuffer;
+		VkPipeline m_vkPipeline;
+		VkRenderPass m_vkRenderPass;
+		VkDeviceMemory m_vkMemory;
+		VkSwapchainKHR m_vkSwapchain;
+		VkSemaphore m_vkSemaphore;
+		VkCommandBuffer m_vkCommandBuffer;
+	};
+};
+
+// Destroys Vulkan objects once the GPU is done with them, instead of
+// waiting for the device to go idle. Every object is queued with the
+// value of the last frame or submission that uses it, and is destroyed
+// by the first release with a completed value at least as large.
+// The names differ by type because non-dispatchable handles are all the
+// same integer type on 32 bit builds.
+//
+class DeletionQueue
+{
+public:
+	DeletionQueue();
+	void create(VkDevice vkDevice);
+	void enqueueBuffer(uint64_t value, VkBuffer vkBuffer);
+	void enqueueImage(uint64_t value, VkImage vkImage);
+	void enqueueImageView(uint64_t value, VkImageView vkImageView);
+	void enqueueFramebuffer(uint64_t value, VkFramebuffer vkFramebuffer);
+	void enqueuePipeline(uint64_t value, VkPipeline vkPipeline);
+	void enqueueRenderPass(uint64_t value, VkRenderPass vkRenderPass);
+	void enqueueMemory(uint64_t value, VkDeviceMemory vkMemory);
+	void enqueueSwapchain(uint64_t value, VkSwapchainKHR vkSwapchain);
+	void enqueueSemaphore(uint64_t value, VkSemaphore vkSemaphore);
+	void enqueueCommandBuffer(uint64_t value, VkCommandPool vkCommandPool, VkCommandBuffer vkCommandBuffer);
+	void release(uint64_t completedValue);
+	void flush();
+	size_t getPendingCount() const { return m_pendingDeletions.size(); }
+private:
+	void enqueue(const PendingDeletion &deletion);
+	void destroy(const PendingDeletion &deletion);
+
+	VkDevice m_vkDevice;
+	std::vector<PendingDeletion> m_pendingDeletions; // In the order they were queued.
+};
@@ -0,0 +1,329 @@
+#include "descriptorallocator.h"
+#include "utilities.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+
+// Descriptors of each type a pool holds per set, unless the allocator
+// is given its own.
+//
+const VkDescriptorPoolSize DESCRIPTOR_POOL_RATIOS[] =
+{
+	{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+	{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 },
+	{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+};
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+DescriptorAllocator::DescriptorAllocator()
+	:m_vkDevice(VK_NULL_HANDLE),
+	m_persistentPoolSets(DESCRIPTOR_POOL_INITIAL_SETS),
+	m_cachedSetCount(0)
+{
+}
+
+/**************************************************************
+* Description
+*		Sets the device the pools are created on and the
+*		descriptors of each type they hold per set. No pool is
+*		created until the first set is allocated.
+* Returns
+*		void
+* Notes
+*		Without ratios the pools are sized for the sets of the
+*		renderer.
+*
+**************************************************************/
+void DescriptorAllocator::create(VkDevice vkDevice, const std::vector<VkDescriptorPoolSize> &poolRatios)
+{
+	m_vkDevice = vkDevice;
+	if (poolRatios.empty())
+	{
+		m_poolRatios.assign(std::begin(DESCRIPTOR_POOL_RATIOS), std::end(DESCRIPTOR_POOL_RATIOS));
+	}
+	else
+	{
+		m_poolRatios = poolRatios;
+	}
+}
+
+/**************************************************************
+* Description
+*		Destroys the pools, which frees every set, and the
+*		update templates.
+* Returns
+*		void
+* Notes
+*		None of the sets may be in use on the GPU.
+*
+**************************************************************/
+void DescriptorAllocator::destroy()
+{
+	for (auto pool : m_vkPersistentPools)
+	{
+		vkDestroyDescriptorPool(m_vkDevice, pool, nullptr);
+	}
+	m_vkPersistentPools.clear();
+
+	for (const auto &pool : m_transientPools)
+	{
+		vkDestroyDescriptorPool(m_vkDevice, pool.m_vkPool, nullptr);
+	}
+	m_transientPools.clear();
+	m_frameTransientPools.clear();
+
+	for (auto updateTemplate : m_vkTemplates)
+	{
+		vkDestroyDescriptorUpdateTemplate(m_vkDevice, updateTemplate, nullptr);
+	}
+	m_vkTemplates.clear();
+	m_cachedSets.clear();
+	m_cachedSetCount = 0;
+}
+
+/**************************************************************
+* Description
+*		Creates an update template writing the sets of the
+*		layout from a structure described by the entries.
+* Returns
+*		The template, owned by the allocator.
+* Notes
+*
+**************************************************************/
+VkDescriptorUpdateTemplate DescriptorAllocator::createUpdateTemplate(
+	VkDescriptorSetLayout vkLayout,
+	const std::vector<VkDescriptorUpdateTemplateEntry> &entries)
+{
+	VkDescriptorUpdateTemplateCreateInfo templateInfo = {};
+	templateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO;
+	templateInfo.descriptorUpdateEntryCount = static_cast<uint32_t>(entries.size());
+	templateInfo.pDescriptorUpdateEntries = entries.data();
+	templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+	templateInfo.descriptorSetLayout = vkLayout;
+
+	VkDescriptorUpdateTemplate updateTemplate;
+	if (VK_SUCCESS != vkCreateDescriptorUpdateTemplate(m_vkDevice, &templateInfo, nullptr, &updateTemplate))
+	{
+		throw std::runtime_error("Could not create descriptor update template.");
+	}
+	m_vkTemplates.push_back(updateTemplate);
+	return updateTemplate;
+}
+
+/**************************************************************
+* Description
+*		Returns a set of the layout written with the data,
+*		allocating and writing it only the first time the
+*		contents are seen.
+* Returns
+*		The descriptor set, valid until the allocator is
+*		destroyed.
+* Notes
+*		The data is compared byte by byte, so clear it before
+*		filling it in to keep padding from causing misses.
+*		Contents whose hashes collide are cached side by side.
+*
+**************************************************************/
+VkDescriptorSet DescriptorAllocator::getCachedSet(
+	VkDescriptorSetLayout vkLayout,
+	VkDescriptorUpdateTemplate vkTemplate,
+	const void *pData,
+	size_t dataSize)
+{
+	uint64_t hash = hashBytes(pData, dataSize, hashBytes(&vkLayout, sizeof(vkLayout)));
+	std::vector<CachedDescriptorSet> &bucket = m_cachedSets[hash];
+	for (const auto &entry : bucket)
+	{
+		if (entry.m_vkLayout == vkLayout &&
+			entry.m_data.size() == dataSize &&
+			0 == memcmp(entry.m_data.data(), pData, dataSize))
+		{
+			return entry.m_vkDescriptorSet;
+		}
+	}
+
+	VkDescriptorSet descriptorSet = allocateSet(vkLayout, false);
+	vkUpdateDescriptorSetWithTemplate(m_vkDevice, descriptorSet, vkTemplate, pData);
+	CachedDescriptorSet entry = {};
+	entry.m_vkLayout = vkLayout;
+	entry.m_data.assign(static_cast<const uint8_t*>(pData), static_cast<const uint8_t*>(pData) + dataSize);
+	entry.m_vkDescriptorSet = descriptorSet;
+	bucket.push_back(entry);
+	++m_cachedSetCount;
+	return descriptorSet;
+}
+
+/**************************************************************
+* Description
+*		Allocates a set of the layout for the current frame and
+*		writes it with the data.
+* Returns
+*		The descriptor set, valid until the frame completes.
+* Notes
+*
+**************************************************************/
+VkDescriptorSet DescriptorAllocator::allocateTransientSet(
+	VkDescriptorSetLayout vkLayout,
+	VkDescriptorUpdateTemplate vkTemplate,
+	const void *pData)
+{
+	VkDescriptorSet descriptorSet = allocateSet(vkLayout, true);
+	vkUpdateDescriptorSetWithTemplate(m_vkDevice, descriptorSet, vkTemplate, pData);
+	return descriptorSet;
+}
+
+/**************************************************************
+* Description
+*		Resets the transient pools of the frames that have
+*		completed, so their sets can be allocated again.
+* Returns
+*		void
+* Notes
+*		Call before the first transient set of a frame.
+*
+**************************************************************/
+void DescriptorAllocator::beginFrame(uint64_t completedValue)
+{
+	for (auto &pool : m_transientPools)
+	{
+		if (!pool.m_fFree && pool.m_value <= completedValue)
+		{
+			vkResetDescriptorPool(m_vkDevice, pool.m_vkPool, 0);
+			pool.m_fFree = true;
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Tags the transient pools allocated from this frame with
+*		the timeline value the frame was submitted with.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void DescriptorAllocator::endFrame(uint64_t frameValue)
+{
+	for (size_t poolIndex : m_frameTransientPools)
+	{
+		m_transientPools[poolIndex].m_value = frameValue;
+	}
+	m_frameTransientPools.clear();
+}
+
+/**************************************************************
+* Description
+*		Creates a pool for the given number of sets, with the
+*		descriptor counts scaled from the per set ratios.
+* Returns
+*		VkDescriptorPool
+* Notes
+*
+**************************************************************/
+VkDescriptorPool DescriptorAllocator::createPool(uint32_t maxSets)
+{
+	std::vector<VkDescriptorPoolSize> poolSizes;
+	for (const auto &ratio : m_poolRatios)
+	{
+		VkDescriptorPoolSize poolSize = {};
+		poolSize.type = ratio.type;
+		poolSize.descriptorCount = ratio.descriptorCount * maxSets;
+		poolSizes.push_back(poolSize);
+	}
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = maxSets;
+
+	VkDescriptorPool pool;
+	if (VK_SUCCESS != vkCreateDescriptorPool(m_vkDevice, &poolInfo, nullptr, &pool))
+	{
+		throw std::runtime_error("Could not create descriptor pool");
+	}
+	return pool;
+}
+
+/**************************************************************
+* Description
+*		Allocates a set from the current persistent or transient
+*		pool, moving on to another pool when it is full.
+* Returns
+*		VkDescriptorSet
+* Notes
+*		A free transient pool is reused before a new one is
+*		created. New pools double in size up to the maximum.
+*
+**************************************************************/
+VkDescriptorSet DescriptorAllocator::allocateSet(VkDescriptorSetLayout vkLayout, bool fTransient)
+{
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &vkLayout;
+
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	bool fNewPool = false;
+	for (;;)
+	{
+		VkDescriptorPool pool = VK_NULL_HANDLE;
+		if (fTransient && !m_frameTransientPools.empty())
+		{
+			pool = m_transientPools[m_frameTransientPools.back()].m_vkPool;
+		}
+		else if (!fTransient && !m_vkPersistentPools.empty())
+		{
+			pool = m_vkPersistentPools.back();
+		}
+
+		if (VK_NULL_HANDLE != pool)
+		{
+			allocInfo.descriptorPool = pool;
+			VkResult result = vkAllocateDescriptorSets(m_vkDevice, &allocInfo, &descriptorSet);
+			if (VK_SUCCESS == result)
+			{
+				return descriptorSet;
+			}
+			if ((VK_ERROR_OUT_OF_POOL_MEMORY != result && VK_ERROR_FRAGMENTED_POOL != result) || fNewPool)
+			{
+				throw std::runtime_error("Could not create descriptor set");
+			}
+		}
+
+		// The current pool is full, or there is none yet.
+		//
+		if (fTransient)
+		{
+			auto freePool = std::find_if(m_transientPools.begin(), m_transientPools.end(),
+				[](const TransientDescriptorPool &transientPool) { return transientPool.m_fFree; });
+			if (m_transientPools.end() == freePool)
+			{
+				uint32_t maxSets = DESCRIPTOR_POOL_INITIAL_SETS << std::min<size_t>(m_transientPools.size(), 6);
+				TransientDescriptorPool transientPool = {};
+				transientPool.m_vkPool = createPool(std::min(maxSets, DESCRIPTOR_POOL_MAX_SETS));
+				transientPool.m_fFree = true;
+				m_transientPools.push_back(transientPool);
+				freePool = m_transientPools.end() - 1;
+				fNewPool = true;
+			}
+			freePool->m_fFree = false;
+			m_frameTransientPools.push_back(freePool - m_transientPools.begin());
+		}
+		else
+		{
+			m_vkPersistentPools.push_back(createPool(m_persistentPoolSets));
+			m_persistentPoolSets = std::min(m_persistentPoolSets * 2, DESCRIPTOR_POOL_MAX_SETS);
+			fNewPool = true;
+		}
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include<unordered_map>
+#include<vector>
+
+// Descriptor sets a pool holds to start with. Every new pool holds twice
+// as many as the last, up to the maximum.
+//
+const uint32_t DESCRIPTOR_POOL_INITIAL_SETS = 64;
+const uint32_t DESCRIPTOR_POOL_MAX_SETS = 4096;
+
+// A set allocated from the persistent pools, found by the hash of its
+// layout and contents.
+//
+struct CachedDescriptorSet
+{
+	VkDescriptorSetLayout m_vkLayout;
+	std::vector<uint8_t> m_data; // The template data the set was written with.
+	VkDescriptorSet m_vkDescriptorSet;
+};
+
+// A transient pool and the timeline value of the last frame allocating
+// from it.
+//
+struct TransientDescriptorPool
+{
+	VkDescriptorPool m_vkPool;
+	uint64_t m_value;
+	bool m_fFree; // Reset and not used by the current frame.
+};
+
+// Allocates descriptor sets from pools that are created as they fill up,
+// so the number of sets is not fixed up front. Sets that never change
+// come from persistent pools and are cached by content, so objects with
+// the same descriptors share one set. Sets written every frame come from
+// transient pools that are reset once the frame using them completes.
+// Sets are written through update templates, one call per set.
+//
+class DescriptorAllocator
+{
+public:
+	DescriptorAllocator();
+	void create(VkDevice vkDevice, const std::vector<VkDescriptorPoolSize> &poolRatios = std::vector<VkDescriptorPoolSize>());
+	void destroy();
+	VkDescriptorUpdateTemplate createUpdateTemplate(
+		VkDescriptorSetLayout vkLayout,
+		const std::vector<VkDescriptorUpdateTemplateEntry> &entries);
+	VkDescriptorSet getCachedSet(
+		VkDescriptorSetLayout vkLayout,
+		VkDescriptorUpdateTemplate vkTemplate,
+		const void *pData,
+		size_t dataSize);
+	VkDescriptorSet allocateTransientSet(
+		VkDescriptorSetLayout vkLayout,
+		VkDescriptorUpdateTemplate vkTemplate,
+		const void *pData);
+	void beginFrame(uint64_t completedValue);
+	void endFrame(uint64_t frameValue);
+	size_t getPoolCount() const { return m_vkPersistentPools.size() + m_transientPools.size(); }
+	size_t getCachedSetCount() const { return m_cachedSetCount; }
+private:
+	VkDescriptorPool createPool(uint32_t maxSets);
+	VkDescriptorSet allocateSet(VkDescriptorSetLayout vkLayout, bool fTransient);
+
+	VkDevice m_vkDevice;
+	std::vector<VkDescriptorPoolSize> m_poolRatios; // Descriptors of each type per set.
+	std::vector<VkDescriptorPool> m_vkPersistentPools; // The last one is allocated from.
+	uint32_t m_persistentPoolSets; // Size of the next persistent pool.
+	std::vector<TransientDescriptorPool> m_transientPools; // Every transient pool, free or in use.
+	std::vector<size_t> m_frameTransientPools; // Indices of the pools allocated from this frame, the last one is current.
+	std::vector<VkDescriptorUpdateTemplate> m_vkTemplates;
+	std::unordered_map<uint64_t, std::vector<CachedDescriptorSet>> m_cachedSets; // By hash, the sets of colliding contents share a bucket.
+	size_t m_cachedSetCount;
+};
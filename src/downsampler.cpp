@@ -0,0 +1,362 @@
+#include "downsampler.h"
+#include "utilities.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+// Texels of level 0 reduced by one workgroup in each direction.
+//
+const uint32_t DOWNSAMPLER_TILE_SIZE = 64;
+
+// Push constants of the shader.
+//
+struct DownsamplePushConstants
+{
+	uint32_t m_mipLevels;
+	uint32_t m_groupCount;
+};
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+ComputeDownsampler::ComputeDownsampler()
+	:m_vkDevice(VK_NULL_HANDLE),
+	m_vkSetLayout(VK_NULL_HANDLE),
+	m_vkPipelineLayout(VK_NULL_HANDLE),
+	m_vkPipeline(VK_NULL_HANDLE),
+	m_vkTemplate(VK_NULL_HANDLE),
+	m_vkCounterBuffer(VK_NULL_HANDLE),
+	m_vkCounterMemory(VK_NULL_HANDLE)
+{
+}
+
+/**************************************************************
+* Description
+*		Creates the compute pipeline, its descriptor set layout
+*		and update template, and the zeroed counter buffer.
+* Returns
+*		void
+* Notes
+*		The uploads are recorded on the graphics queue, which is
+*		expected to support compute as well.
+*
+**************************************************************/
+void ComputeDownsampler::create(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice, const std::vector<char> &shaderCode)
+{
+	m_vkDevice = vkDevice;
+
+	std::vector<VkDescriptorPoolSize> poolRatios =
+	{
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, DOWNSAMPLER_MAX_LEVELS },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+	};
+	m_descriptorAllocator.create(m_vkDevice, poolRatios);
+
+	VkDescriptorSetLayoutBinding bindings[2] = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[0].descriptorCount = DOWNSAMPLER_MAX_LEVELS;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+	if (VK_SUCCESS != vkCreateDescriptorSetLayout(m_vkDevice, &layoutInfo, nullptr, &m_vkSetLayout))
+	{
+		throw std::runtime_error("Could not create downsampler descriptor set layout.");
+	}
+
+	std::vector<VkDescriptorUpdateTemplateEntry> entries(2);
+	entries[0].dstBinding = 0;
+	entries[0].dstArrayElement = 0;
+	entries[0].descriptorCount = DOWNSAMPLER_MAX_LEVELS;
+	entries[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	entries[0].offset = offsetof(DownsampleDescriptors, m_levels);
+	entries[0].stride = sizeof(VkDescriptorImageInfo);
+	entries[1].dstBinding = 1;
+	entries[1].dstArrayElement = 0;
+	entries[1].descriptorCount = 1;
+	entries[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	entries[1].offset = offsetof(DownsampleDescriptors, m_counter);
+	entries[1].stride = sizeof(VkDescriptorBufferInfo);
+	m_vkTemplate = m_descriptorAllocator.createUpdateTemplate(m_vkSetLayout, entries);
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DownsamplePushConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_vkSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+	if (VK_SUCCESS != vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, nullptr, &m_vkPipelineLayout))
+	{
+		throw std::runtime_error("Could not create downsampler pipeline layout.");
+	}
+
+	VkShaderModuleCreateInfo shaderModuleInfo = {};
+	shaderModuleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	shaderModuleInfo.codeSize = shaderCode.size();
+	shaderModuleInfo.pCode = reinterpret_cast<const uint32_t*>(shaderCode.data());
+	VkShaderModule shaderModule;
+	if (VK_SUCCESS != vkCreateShaderModule(m_vkDevice, &shaderModuleInfo, nullptr, &shaderModule))
+	{
+		throw std::runtime_error("Could not create shader module.");
+	}
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = m_vkPipelineLayout;
+	VkResult result = vkCreateComputePipelines(m_vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_vkPipeline);
+	vkDestroyShaderModule(m_vkDevice, shaderModule, nullptr);
+	if (VK_SUCCESS != result)
+	{
+		throw std::runtime_error("Could not create downsampler pipeline.");
+	}
+
+	createBuffer(m_vkDevice,
+		vkPhysicalDevice,
+		sizeof(uint32_t),
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_vkCounterBuffer,
+		m_vkCounterMemory);
+	void *data = nullptr;
+	vkMapMemory(m_vkDevice, m_vkCounterMemory, 0, sizeof(uint32_t), 0, &data);
+	memset(data, 0, sizeof(uint32_t));
+	vkUnmapMemory(m_vkDevice, m_vkCounterMemory);
+}
+
+/**************************************************************
+* Description
+*		Destroys the pipeline, the descriptor sets and the
+*		counter buffer.
+* Returns
+*		void
+* Notes
+*		No dispatch may be pending.
+*
+**************************************************************/
+void ComputeDownsampler::destroy()
+{
+	for (auto view : m_vkBatchViews)
+	{
+		vkDestroyImageView(m_vkDevice, view, nullptr);
+	}
+	m_vkBatchViews.clear();
+
+	m_descriptorAllocator.destroy();
+	vkDestroyPipeline(m_vkDevice, m_vkPipeline, nullptr);
+	vkDestroyPipelineLayout(m_vkDevice, m_vkPipelineLayout, nullptr);
+	vkDestroyDescriptorSetLayout(m_vkDevice, m_vkSetLayout, nullptr);
+	vkDestroyBuffer(m_vkDevice, m_vkCounterBuffer, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkCounterMemory, nullptr);
+	m_vkPipeline = VK_NULL_HANDLE;
+	m_vkPipelineLayout = VK_NULL_HANDLE;
+	m_vkSetLayout = VK_NULL_HANDLE;
+	m_vkTemplate = VK_NULL_HANDLE;
+	m_vkCounterBuffer = VK_NULL_HANDLE;
+	m_vkCounterMemory = VK_NULL_HANDLE;
+}
+
+/**************************************************************
+* Description
+*		Starts a batch of dispatches recorded into one command
+*		buffer, reusing the descriptor sets of the batches that
+*		have completed.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void ComputeDownsampler::beginBatch(uint64_t completedValue)
+{
+	m_descriptorAllocator.beginFrame(completedValue);
+}
+
+/**************************************************************
+* Description
+*		Records the dispatch building levels 1 and below of the
+*		image from level 0, with one barrier before and one
+*		after it.
+* Returns
+*		void
+* Notes
+*		Expects level 0 to have just been copied to and every
+*		level to be in the transfer destination layout. Leaves
+*		them all shader readable.
+*		Dispatches share the counter, the barrier before each
+*		one orders it after the dispatches recorded earlier.
+*
+**************************************************************/
+void ComputeDownsampler::record(VkCommandBuffer commandBuffer, VkImage vkImage, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	DownsampleDescriptors descriptors = {};
+	for (uint32_t level = 0; level < mipLevels; ++level)
+	{
+		VkImageViewCreateInfo viewInfo = {};
+		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		viewInfo.image = vkImage;
+		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		viewInfo.subresourceRange.baseMipLevel = level;
+		viewInfo.subresourceRange.levelCount = 1;
+		viewInfo.subresourceRange.baseArrayLayer = 0;
+		viewInfo.subresourceRange.layerCount = 1;
+		VkImageView view;
+		if (VK_SUCCESS != vkCreateImageView(m_vkDevice, &viewInfo, nullptr, &view))
+		{
+			throw std::runtime_error("Could not create image view.");
+		}
+		m_vkBatchViews.push_back(view);
+		descriptors.m_levels[level].imageView = view;
+		descriptors.m_levels[level].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	}
+
+	// The shader never touches the levels past the last one, they
+	// repeat it so every descriptor is valid.
+	//
+	for (uint32_t level = mipLevels; level < DOWNSAMPLER_MAX_LEVELS; ++level)
+	{
+		descriptors.m_levels[level] = descriptors.m_levels[mipLevels - 1];
+	}
+	descriptors.m_counter.buffer = m_vkCounterBuffer;
+	descriptors.m_counter.offset = 0;
+	descriptors.m_counter.range = sizeof(uint32_t);
+	VkDescriptorSet descriptorSet = m_descriptorAllocator.allocateTransientSet(m_vkSetLayout, m_vkTemplate, &descriptors);
+
+	VkImageMemoryBarrier barriers[2] = {};
+	for (auto &barrier : barriers)
+	{
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = vkImage;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	}
+	barriers[0].subresourceRange.baseMipLevel = 0;
+	barriers[0].subresourceRange.levelCount = 1;
+	barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barriers[1].subresourceRange.baseMipLevel = 1;
+	barriers[1].subresourceRange.levelCount = mipLevels - 1;
+	barriers[1].srcAccessMask = 0;
+	barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	VkMemoryBarrier counterBarrier = {};
+	counterBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	counterBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	counterBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1,
+		&counterBarrier,
+		0,
+		nullptr,
+		2,
+		barriers);
+
+	uint32_t groupsX = (width + DOWNSAMPLER_TILE_SIZE - 1) / DOWNSAMPLER_TILE_SIZE;
+	uint32_t groupsY = (height + DOWNSAMPLER_TILE_SIZE - 1) / DOWNSAMPLER_TILE_SIZE;
+	DownsamplePushConstants pushConstants = {};
+	pushConstants.m_mipLevels = mipLevels;
+	pushConstants.m_groupCount = groupsX * groupsY;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_vkPipelineLayout, 0, 1, &descriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_vkPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pushConstants), &pushConstants);
+	vkCmdDispatch(commandBuffer, groupsX, groupsY, 1);
+
+	VkImageMemoryBarrier barrier = barriers[0];
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0,
+		0,
+		nullptr,
+		0,
+		nullptr,
+		1,
+		&barrier);
+}
+
+/**************************************************************
+* Description
+*		Ends the batch submitted with the timeline value. Its
+*		views are destroyed and its descriptor sets reused once
+*		the value has been reached.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void ComputeDownsampler::endBatch(uint64_t value, DeletionQueue &deletionQueue)
+{
+	m_descriptorAllocator.endFrame(value);
+	for (auto view : m_vkBatchViews)
+	{
+		deletionQueue.enqueueImageView(value, view);
+	}
+	m_vkBatchViews.clear();
+}
+
+/**************************************************************
+* Description
+*		Checks if the downsampler can build the mip chain of an
+*		image of the size.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+bool ComputeDownsampler::fSupported(uint32_t width, uint32_t height) const
+{
+	return fCreated() && std::max(width, height) <= (1u << (DOWNSAMPLER_MAX_LEVELS - 1));
+}
+
+/**************************************************************
+* Description
+*		Checks if the device can use RGBA8 images as storage
+*		images.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+bool ComputeDownsampler::fDeviceSupported(VkPhysicalDevice vkPhysicalDevice)
+{
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(vkPhysicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &props);
+	return 0 != (props.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT);
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "descriptorallocator.h"
+#include "deletionqueue.h"
+#include<string>
+#include<vector>
+
+const std::string DOWNSAMPLE_SHADER_PATH = "shaders/downsample.spv";
+
+// Levels the downsampler writes, level 0 included. Textures up to
+// 4096x4096 fit, larger ones have to be blitted.
+//
+const uint32_t DOWNSAMPLER_MAX_LEVELS = 13;
+
+// What the descriptor set of one dispatch is written from.
+//
+struct DownsampleDescriptors
+{
+	VkDescriptorImageInfo m_levels[DOWNSAMPLER_MAX_LEVELS];
+	VkDescriptorBufferInfo m_counter;
+};
+
+// Builds the mip chain of an RGBA8 image with a compute shader, every
+// level in a single dispatch. The levels are bound as storage images,
+// one view each, so the image needs the storage usage. Descriptor sets
+// and views are kept until the upload recording them has completed.
+//
+class ComputeDownsampler
+{
+public:
+	ComputeDownsampler();
+	void create(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice, const std::vector<char> &shaderCode);
+	void destroy();
+	void beginBatch(uint64_t completedValue);
+	void record(VkCommandBuffer commandBuffer, VkImage vkImage, uint32_t width, uint32_t height, uint32_t mipLevels);
+	void endBatch(uint64_t value, DeletionQueue &deletionQueue);
+	bool fCreated() const { return VK_NULL_HANDLE != m_vkPipeline; }
+	bool fSupported(uint32_t width, uint32_t height) const;
+	static bool fDeviceSupported(VkPhysicalDevice vkPhysicalDevice);
+private:
+	VkDevice m_vkDevice;
+	VkDescriptorSetLayout m_vkSetLayout;
+	VkPipelineLayout m_vkPipelineLayout;
+	VkPipeline m_vkPipeline;
+	VkDescriptorUpdateTemplate m_vkTemplate;
+	DescriptorAllocator m_descriptorAllocator; // Transient sets, one per dispatch.
+	VkBuffer m_vkCounterBuffer; // Counts the finished workgroups, reset by the last one.
+	VkDeviceMemory m_vkCounterMemory;
+	std::vector<VkImageView> m_vkBatchViews; // Created by the current batch.
+};
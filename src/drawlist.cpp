@@ -0,0 +1,90 @@
+#include "drawlist.h"
+#include <algorithm>
+
+// Key bits handled by each pass of the radix sort.
+//
+const uint32_t RADIX_BITS = 8;
+const uint32_t RADIX_SIZE = 1 << RADIX_BITS;
+
+/**************************************************************
+* Description
+*		Packs the draw state into a 64 bit sort key.
+* Returns
+*		The sort key.
+* Notes
+*		Identifiers wider than their field are truncated, which
+*		only costs some redundant state changes.
+*
+**************************************************************/
+uint64_t makeDrawSortKey(
+	uint32_t pipelineId,
+	uint32_t descriptorSetId,
+	uint32_t meshId,
+	float normalizedDepth,
+	bool fOpaque)
+{
+	const uint64_t depthMax = (1ull << DRAW_KEY_DEPTH_BITS) - 1;
+	uint64_t depth = static_cast<uint64_t>(std::min(std::max(normalizedDepth, 0.0f), 1.0f) * depthMax);
+	if (!fOpaque)
+	{
+		depth = depthMax - depth;
+	}
+
+	uint64_t key = pipelineId & ((1ull << DRAW_KEY_PIPELINE_BITS) - 1);
+	key = (key << DRAW_KEY_DESCRIPTOR_SET_BITS) | (descriptorSetId & ((1ull << DRAW_KEY_DESCRIPTOR_SET_BITS) - 1));
+	key = (key << DRAW_KEY_DEPTH_BITS) | depth;
+	key = (key << DRAW_KEY_MESH_BITS) | (meshId & ((1ull << DRAW_KEY_MESH_BITS) - 1));
+	return key;
+}
+
+/**************************************************************
+* Description
+*		Sorts the draw items by key, eight bits per pass.
+* Returns
+*		void
+* Notes
+*		The sort is stable. Passes over bits that are the same in
+*		every key are skipped, which makes the usual case of few
+*		pipelines and descriptor sets cheaper.
+*
+**************************************************************/
+void sortDrawItems(std::vector<DrawItem> &items, std::vector<DrawItem> &scratch)
+{
+	scratch.resize(items.size());
+	DrawItem *pSource = items.data();
+	DrawItem *pDestination = scratch.data();
+	const size_t count = items.size();
+
+	for (uint32_t shift = 0; shift < 64; shift += RADIX_BITS)
+	{
+		size_t offsets[RADIX_SIZE] = {};
+		for (size_t i = 0; i < count; ++i)
+		{
+			++offsets[(pSource[i].m_sortKey >> shift) & (RADIX_SIZE - 1)];
+		}
+
+		if (count > 0 && offsets[(pSource[0].m_sortKey >> shift) & (RADIX_SIZE - 1)] == count)
+		{
+			continue;
+		}
+
+		size_t total = 0;
+		for (uint32_t digit = 0; digit < RADIX_SIZE; ++digit)
+		{
+			size_t digitCount = offsets[digit];
+			offsets[digit] = total;
+			total += digitCount;
+		}
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			pDestination[offsets[(pSource[i].m_sortKey >> shift) & (RADIX_SIZE - 1)]++] = pSource[i];
+		}
+		std::swap(pSource, pDestination);
+	}
+
+	if (pSource != items.data())
+	{
+		std::copy(pSource, pSource + count, items.data());
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include<cstdint>
+#include<vector>
+
+// Bits of the draw sort key, from the most significant down. Draws are
+// grouped by pipeline first, since that is the most expensive state to
+// change, then by descriptor set, then ordered by depth and finally
+// grouped by mesh among draws at similar depth.
+//
+const uint32_t DRAW_KEY_PIPELINE_BITS = 12;
+const uint32_t DRAW_KEY_DESCRIPTOR_SET_BITS = 12;
+const uint32_t DRAW_KEY_DEPTH_BITS = 16;
+const uint32_t DRAW_KEY_MESH_BITS = 24;
+
+static_assert(
+	DRAW_KEY_PIPELINE_BITS + DRAW_KEY_DESCRIPTOR_SET_BITS + DRAW_KEY_DEPTH_BITS + DRAW_KEY_MESH_BITS == 64,
+	"The draw sort key fields must fill 64 bits.");
+
+// A draw to be sorted, with the index of what it draws.
+//
+struct DrawItem
+{
+	uint64_t m_sortKey;
+	uint32_t m_drawIndex;
+};
+
+// Packs the draw state into a sort key. The depth is the view space depth
+// divided by the far plane distance. Opaque draws sort front to back so
+// early depth testing rejects hidden fragments, the others back to front.
+//
+uint64_t makeDrawSortKey(
+	uint32_t pipelineId,
+	uint32_t descriptorSetId,
+	uint32_t meshId,
+	float normalizedDepth,
+	bool fOpaque);
+
+// Sorts the items by key with a least significant digit radix sort. The
+// scratch vector is resized as needed, and can be kept across calls to
+// avoid allocating every frame.
+//
+void sortDrawItems(std::vector<DrawItem> &items, std::vector<DrawItem> &scratch);
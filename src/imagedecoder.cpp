@@ -0,0 +1,675 @@
+#include "imagedecoder.h"
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include<stb_image.h>
+
+#if defined(IMAGE_DECODER_TURBOJPEG)
+#include<turbojpeg.h>
+#endif
+
+const uint8_t PNG_SIGNATURE[8] = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
+const uint8_t JPEG_SIGNATURE[3] = { 0xFF, 0xD8, 0xFF };
+
+// Length, type and CRC around the data of a PNG chunk.
+//
+const size_t PNG_CHUNK_OVERHEAD = 12;
+const size_t PNG_IHDR_SIZE = 13;
+
+// PNG color types with 8 bit samples.
+//
+const uint8_t PNG_COLOR_GRAY = 0;
+const uint8_t PNG_COLOR_RGB = 2;
+const uint8_t PNG_COLOR_PALETTE = 3;
+const uint8_t PNG_COLOR_GRAY_ALPHA = 4;
+const uint8_t PNG_COLOR_RGBA = 6;
+
+// The filter byte in front of each row of a PNG.
+//
+const uint8_t PNG_FILTER_NONE = 0;
+const uint8_t PNG_FILTER_SUB = 1;
+const uint8_t PNG_FILTER_UP = 2;
+const uint8_t PNG_FILTER_AVERAGE = 3;
+const uint8_t PNG_FILTER_PAETH = 4;
+
+// The chunks of a PNG file needed to decode it, pointing into the file.
+//
+struct PngImage
+{
+	uint32_t m_width;
+	uint32_t m_height;
+	uint8_t m_bitDepth;
+	uint8_t m_colorType;
+	uint8_t m_interlace;
+	const uint8_t *m_pPalette; // PLTE, RGB entries.
+	size_t m_paletteSize;
+	const uint8_t *m_pTransparency; // tRNS, palette alpha or the color made transparent.
+	size_t m_transparencySize;
+	std::vector<std::pair<const uint8_t*, size_t>> m_data; // IDAT, in file order.
+};
+
+/**************************************************************
+* Description
+*		Reads a big endian 32 bit value.
+* Returns
+*		The value.
+* Notes
+*
+**************************************************************/
+static uint32_t readBigEndian32(const uint8_t *pData)
+{
+	return (static_cast<uint32_t>(pData[0]) << 24) |
+		(static_cast<uint32_t>(pData[1]) << 16) |
+		(static_cast<uint32_t>(pData[2]) << 8) |
+		static_cast<uint32_t>(pData[3]);
+}
+
+/**************************************************************
+* Description
+*		Checks if the data starts with a signature.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+static bool fStartsWith(const void *pData, size_t size, const uint8_t *pSignature, size_t signatureSize)
+{
+	return size >= signatureSize && 0 == memcmp(pData, pSignature, signatureSize);
+}
+
+/**************************************************************
+* Description
+*		Walks the chunks of a PNG file, keeping the ones needed
+*		to decode it.
+* Returns
+*		true/false
+* Notes
+*		CRCs are not checked. Fails if the file is truncated or
+*		has no IHDR first.
+*
+**************************************************************/
+static bool parsePng(const uint8_t *pData, size_t size, PngImage &image)
+{
+	image = {};
+	if (!fStartsWith(pData, size, PNG_SIGNATURE, sizeof(PNG_SIGNATURE)))
+	{
+		return false;
+	}
+
+	size_t offset = sizeof(PNG_SIGNATURE);
+	bool fHeader = false;
+	while (offset + PNG_CHUNK_OVERHEAD <= size)
+	{
+		size_t length = readBigEndian32(pData + offset);
+		const uint8_t *pType = pData + offset + 4;
+		const uint8_t *pChunk = pData + offset + 8;
+		if (length > size - offset - PNG_CHUNK_OVERHEAD)
+		{
+			return false;
+		}
+		if (!fHeader)
+		{
+			if (0 != memcmp(pType, "IHDR", 4) || PNG_IHDR_SIZE != length)
+			{
+				return false;
+			}
+			image.m_width = readBigEndian32(pChunk);
+			image.m_height = readBigEndian32(pChunk + 4);
+			image.m_bitDepth = pChunk[8];
+			image.m_colorType = pChunk[9];
+			image.m_interlace = pChunk[12];
+			fHeader = true;
+		}
+		else if (0 == memcmp(pType, "PLTE", 4))
+		{
+			image.m_pPalette = pChunk;
+			image.m_paletteSize = length;
+		}
+		else if (0 == memcmp(pType, "tRNS", 4))
+		{
+			image.m_pTransparency = pChunk;
+			image.m_transparencySize = length;
+		}
+		else if (0 == memcmp(pType, "IDAT", 4))
+		{
+			image.m_data.push_back(std::make_pair(pChunk, length));
+		}
+		else if (0 == memcmp(pType, "IEND", 4))
+		{
+			break;
+		}
+		offset += PNG_CHUNK_OVERHEAD + length;
+	}
+	return fHeader && !image.m_data.empty();
+}
+
+/**************************************************************
+* Description
+*		Checks if a PNG file can be decoded by the PNG codec.
+* Returns
+*		true/false
+* Notes
+*		Interlaced files and sample depths other than 8 bits
+*		are left to stb_image.
+*
+**************************************************************/
+static bool fPngSupported(const PngImage &image)
+{
+	if (0 == image.m_width || 0 == image.m_height || 8 != image.m_bitDepth || 0 != image.m_interlace)
+	{
+		return false;
+	}
+	switch (image.m_colorType)
+	{
+	case PNG_COLOR_GRAY:
+		return !image.m_pTransparency || image.m_transparencySize >= 2;
+	case PNG_COLOR_RGB:
+		return !image.m_pTransparency || image.m_transparencySize >= 6;
+	case PNG_COLOR_PALETTE:
+		return image.m_pPalette && 0 == image.m_paletteSize % 3;
+	case PNG_COLOR_GRAY_ALPHA:
+	case PNG_COLOR_RGBA:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**************************************************************
+* Description
+*		Gets the bytes of a texel of a PNG.
+* Returns
+*		The byte count.
+* Notes
+*		Only 8 bit samples are handled.
+*
+**************************************************************/
+static size_t getPngTexelBytes(uint8_t colorType)
+{
+	switch (colorType)
+	{
+	case PNG_COLOR_RGB:
+		return 3;
+	case PNG_COLOR_GRAY_ALPHA:
+		return 2;
+	case PNG_COLOR_RGBA:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+/**************************************************************
+* Description
+*		The Paeth predictor of the PNG specification.
+* Returns
+*		Whichever of the left, above and upper left bytes is
+*		closest to their gradient.
+* Notes
+*
+**************************************************************/
+static uint8_t paethPredictor(int left, int above, int upperLeft)
+{
+	int estimate = left + above - upperLeft;
+	int distanceLeft = std::abs(estimate - left);
+	int distanceAbove = std::abs(estimate - above);
+	int distanceUpperLeft = std::abs(estimate - upperLeft);
+	if (distanceLeft <= distanceAbove && distanceLeft <= distanceUpperLeft)
+	{
+		return static_cast<uint8_t>(left);
+	}
+	return static_cast<uint8_t>((distanceAbove <= distanceUpperLeft) ? above : upperLeft);
+}
+
+/**************************************************************
+* Description
+*		Reverses the filter of a row of a PNG in place.
+* Returns
+*		true/false
+* Notes
+*		The row above has to be unfiltered already, the first
+*		row is given a row of zeros. Fails on an unknown filter.
+*		Each loop only depends on bytes a texel back, which
+*		the compiler keeps in registers.
+*
+**************************************************************/
+static bool unfilterRow(uint8_t filter, uint8_t *pRow, const uint8_t *pAbove, size_t rowBytes, size_t texelBytes)
+{
+	switch (filter)
+	{
+	case PNG_FILTER_NONE:
+		return true;
+	case PNG_FILTER_SUB:
+		for (size_t i = texelBytes; i < rowBytes; ++i)
+		{
+			pRow[i] = static_cast<uint8_t>(pRow[i] + pRow[i - texelBytes]);
+		}
+		return true;
+	case PNG_FILTER_UP:
+		for (size_t i = 0; i < rowBytes; ++i)
+		{
+			pRow[i] = static_cast<uint8_t>(pRow[i] + pAbove[i]);
+		}
+		return true;
+	case PNG_FILTER_AVERAGE:
+		for (size_t i = 0; i < texelBytes; ++i)
+		{
+			pRow[i] = static_cast<uint8_t>(pRow[i] + (pAbove[i] >> 1));
+		}
+		for (size_t i = texelBytes; i < rowBytes; ++i)
+		{
+			pRow[i] = static_cast<uint8_t>(pRow[i] + ((pRow[i - texelBytes] + pAbove[i]) >> 1));
+		}
+		return true;
+	case PNG_FILTER_PAETH:
+		for (size_t i = 0; i < texelBytes; ++i)
+		{
+			pRow[i] = static_cast<uint8_t>(pRow[i] + pAbove[i]);
+		}
+		for (size_t i = texelBytes; i < rowBytes; ++i)
+		{
+			pRow[i] = static_cast<uint8_t>(pRow[i] + paethPredictor(pRow[i - texelBytes], pAbove[i], pAbove[i - texelBytes]));
+		}
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**************************************************************
+* Description
+*		Expands an unfiltered row of a PNG to RGBA8.
+* Returns
+*		void
+* Notes
+*		The palette has 256 RGBA entries, those the file does
+*		not define are opaque black.
+*
+**************************************************************/
+static void expandRow(const PngImage &image, const uint8_t *pRow, const uint32_t *pPalette, uint8_t *pDestination)
+{
+	uint32_t width = image.m_width;
+	switch (image.m_colorType)
+	{
+	case PNG_COLOR_RGBA:
+		memcpy(pDestination, pRow, static_cast<size_t>(width) * 4);
+		break;
+	case PNG_COLOR_RGB:
+		for (uint32_t x = 0; x < width; ++x, pRow += 3, pDestination += 4)
+		{
+			pDestination[0] = pRow[0];
+			pDestination[1] = pRow[1];
+			pDestination[2] = pRow[2];
+			pDestination[3] = 255;
+			if (image.m_pTransparency &&
+				pRow[0] == image.m_pTransparency[1] &&
+				pRow[1] == image.m_pTransparency[3] &&
+				pRow[2] == image.m_pTransparency[5])
+			{
+				pDestination[3] = 0;
+			}
+		}
+		break;
+	case PNG_COLOR_GRAY:
+		for (uint32_t x = 0; x < width; ++x, ++pRow, pDestination += 4)
+		{
+			pDestination[0] = pDestination[1] = pDestination[2] = pRow[0];
+			pDestination[3] = (image.m_pTransparency && pRow[0] == image.m_pTransparency[1]) ? 0 : 255;
+		}
+		break;
+	case PNG_COLOR_GRAY_ALPHA:
+		for (uint32_t x = 0; x < width; ++x, pRow += 2, pDestination += 4)
+		{
+			pDestination[0] = pDestination[1] = pDestination[2] = pRow[0];
+			pDestination[3] = pRow[1];
+		}
+		break;
+	case PNG_COLOR_PALETTE:
+		for (uint32_t x = 0; x < width; ++x, pDestination += 4)
+		{
+			memcpy(pDestination, &pPalette[pRow[x]], 4);
+		}
+		break;
+	}
+}
+
+/**************************************************************
+* Description
+*		Decodes a PNG file with stb_image's inflate, reversing
+*		the filters in the inflated data and writing the rows
+*		straight to the destination.
+* Returns
+*		true/false
+* Notes
+*		The file has to have been checked by fPngSupported.
+*		An image stored in a single IDAT chunk is inflated
+*		without copying it first.
+*
+**************************************************************/
+static bool decodePng(const PngImage &image, uint8_t *pDestination, std::string &error)
+{
+	std::vector<uint8_t> joined;
+	const uint8_t *pCompressed = image.m_data[0].first;
+	size_t compressedSize = image.m_data[0].second;
+	if (image.m_data.size() > 1)
+	{
+		for (const auto &data : image.m_data)
+		{
+			joined.insert(joined.end(), data.first, data.first + data.second);
+		}
+		pCompressed = joined.data();
+		compressedSize = joined.size();
+	}
+
+	size_t rowBytes = static_cast<size_t>(image.m_width) * getPngTexelBytes(image.m_colorType);
+	size_t filteredSize = (rowBytes + 1) * image.m_height;
+	if (compressedSize > INT_MAX || filteredSize > INT_MAX)
+	{
+		error = "the image is too large";
+		return false;
+	}
+
+	int inflatedSize = 0;
+	uint8_t *pInflated = reinterpret_cast<uint8_t*>(stbi_zlib_decode_malloc_guesssize_headerflag(
+		reinterpret_cast<const char*>(pCompressed),
+		static_cast<int>(compressedSize),
+		static_cast<int>(filteredSize),
+		&inflatedSize,
+		1));
+	if (!pInflated)
+	{
+		error = stbi_failure_reason();
+		return false;
+	}
+	if (static_cast<size_t>(inflatedSize) < filteredSize)
+	{
+		stbi_image_free(pInflated);
+		error = "the image data is truncated";
+		return false;
+	}
+
+	uint32_t palette[256];
+	if (PNG_COLOR_PALETTE == image.m_colorType)
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint8_t entry[4] = { 0, 0, 0, 255 };
+			if (3 * i < image.m_paletteSize)
+			{
+				memcpy(entry, image.m_pPalette + 3 * i, 3);
+			}
+			if (image.m_pTransparency && i < image.m_transparencySize)
+			{
+				entry[3] = image.m_pTransparency[i];
+			}
+			memcpy(&palette[i], entry, 4);
+		}
+	}
+
+	std::vector<uint8_t> zeros(rowBytes, 0);
+	const uint8_t *pAbove = zeros.data();
+	for (uint32_t y = 0; y < image.m_height; ++y)
+	{
+		uint8_t *pFiltered = pInflated + y * (rowBytes + 1);
+		uint8_t *pRow = pFiltered + 1;
+		if (!unfilterRow(pFiltered[0], pRow, pAbove, rowBytes, getPngTexelBytes(image.m_colorType)))
+		{
+			stbi_image_free(pInflated);
+			error = "unknown row filter";
+			return false;
+		}
+		expandRow(image, pRow, palette, pDestination + static_cast<size_t>(y) * image.m_width * 4);
+		pAbove = pRow;
+	}
+	stbi_image_free(pInflated);
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Decodes a JPEG file with libjpeg-turbo's SIMD decoder.
+* Returns
+*		true/false
+* Notes
+*		Fails with the error set when built without
+*		IMAGE_DECODER_TURBOJPEG.
+*
+**************************************************************/
+static bool decodeTurboJpeg(const void *pData, size_t size, uint8_t *pDestination, std::string &error)
+{
+#if defined(IMAGE_DECODER_TURBOJPEG)
+	tjhandle decompressor = tjInitDecompress();
+	if (!decompressor)
+	{
+		error = tjGetErrorStr();
+		return false;
+	}
+
+	const unsigned char *pJpeg = static_cast<const unsigned char*>(pData);
+	int width, height, subsampling, colorspace;
+	bool fDecoded =
+		0 == tjDecompressHeader3(decompressor, pJpeg, static_cast<unsigned long>(size), &width, &height, &subsampling, &colorspace) &&
+		0 == tjDecompress2(decompressor, pJpeg, static_cast<unsigned long>(size), pDestination, width, width * 4, height, TJPF_RGBA, 0);
+	if (!fDecoded)
+	{
+		error = tjGetErrorStr2(decompressor);
+	}
+	tjDestroy(decompressor);
+	return fDecoded;
+#else
+	(void)pData;
+	(void)size;
+	(void)pDestination;
+	error = "built without libjpeg-turbo";
+	return false;
+#endif
+}
+
+/**************************************************************
+* Description
+*		Decodes an image with stb_image and copies it to the
+*		destination.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+static bool decodeStb(const void *pData, size_t size, uint8_t *pDestination, std::string &error)
+{
+	int width, height, channels;
+	stbi_uc *pPixels = stbi_load_from_memory(
+		static_cast<const stbi_uc*>(pData),
+		static_cast<int>(size),
+		&width,
+		&height,
+		&channels,
+		STBI_rgb_alpha);
+	if (!pPixels)
+	{
+		error = stbi_failure_reason();
+		return false;
+	}
+	memcpy(pDestination, pPixels, static_cast<size_t>(width) * height * 4);
+	stbi_image_free(pPixels);
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Reads the size of an image in memory without decoding
+*		it.
+* Returns
+*		true/false
+* Notes
+*		Fails with the error set if no codec reads the image.
+*
+**************************************************************/
+bool readImageHeader(const void *pData, size_t size, uint32_t &width, uint32_t &height, std::string &error)
+{
+	int imageWidth, imageHeight, channels;
+	if (size > INT_MAX)
+	{
+		error = "the file is too large";
+		return false;
+	}
+	if (!stbi_info_from_memory(static_cast<const stbi_uc*>(pData), static_cast<int>(size), &imageWidth, &imageHeight, &channels))
+	{
+		error = stbi_failure_reason();
+		return false;
+	}
+	width = static_cast<uint32_t>(imageWidth);
+	height = static_cast<uint32_t>(imageHeight);
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Picks the fastest available codec that reads an image.
+* Returns
+*		The codec.
+* Notes
+*		stb_image is returned for anything no other codec
+*		reads.
+*
+**************************************************************/
+ImageCodec selectImageCodec(const void *pData, size_t size)
+{
+	if (fImageCodecReads(IMAGE_CODEC_TURBOJPEG, pData, size))
+	{
+		return IMAGE_CODEC_TURBOJPEG;
+	}
+	if (fImageCodecReads(IMAGE_CODEC_PNG, pData, size))
+	{
+		return IMAGE_CODEC_PNG;
+	}
+	return IMAGE_CODEC_STB;
+}
+
+/**************************************************************
+* Description
+*		Checks if a codec was built in.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+bool fImageCodecAvailable(ImageCodec codec)
+{
+	switch (codec)
+	{
+	case IMAGE_CODEC_STB:
+	case IMAGE_CODEC_PNG:
+		return true;
+	case IMAGE_CODEC_TURBOJPEG:
+#if defined(IMAGE_DECODER_TURBOJPEG)
+		return true;
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+}
+
+/**************************************************************
+* Description
+*		Checks if a codec is available and reads an image.
+* Returns
+*		true/false
+* Notes
+*		stb_image is assumed to read anything, its errors are
+*		reported when decoding.
+*
+**************************************************************/
+bool fImageCodecReads(ImageCodec codec, const void *pData, size_t size)
+{
+	if (!fImageCodecAvailable(codec))
+	{
+		return false;
+	}
+	switch (codec)
+	{
+	case IMAGE_CODEC_STB:
+		return true;
+	case IMAGE_CODEC_TURBOJPEG:
+		return fStartsWith(pData, size, JPEG_SIGNATURE, sizeof(JPEG_SIGNATURE));
+	case IMAGE_CODEC_PNG:
+	{
+		PngImage image;
+		return parsePng(static_cast<const uint8_t*>(pData), size, image) && fPngSupported(image);
+	}
+	default:
+		return false;
+	}
+}
+
+/**************************************************************
+* Description
+*		Gets the name of a codec.
+* Returns
+*		The name.
+* Notes
+*
+**************************************************************/
+const char *getImageCodecName(ImageCodec codec)
+{
+	switch (codec)
+	{
+	case IMAGE_CODEC_STB:
+		return "stb_image";
+	case IMAGE_CODEC_TURBOJPEG:
+		return "libjpeg-turbo";
+	case IMAGE_CODEC_PNG:
+		return "png";
+	default:
+		return "unknown";
+	}
+}
+
+/**************************************************************
+* Description
+*		Decodes an image to RGBA8 with the codec given.
+* Returns
+*		true/false
+* Notes
+*		The destination has to hold width * height * 4 bytes,
+*		as read by readImageHeader. Fails with the error set
+*		if the codec does not read the image.
+*
+**************************************************************/
+bool decodeImage(
+	const void *pData,
+	size_t size,
+	ImageCodec codec,
+	uint8_t *pDestination,
+	std::string &error)
+{
+	if (size > INT_MAX)
+	{
+		error = "the file is too large";
+		return false;
+	}
+	if (!fImageCodecReads(codec, pData, size))
+	{
+		error = std::string(getImageCodecName(codec)) + " cannot read the image";
+		return false;
+	}
+
+	switch (codec)
+	{
+	case IMAGE_CODEC_TURBOJPEG:
+		return decodeTurboJpeg(pData, size, pDestination, error);
+	case IMAGE_CODEC_PNG:
+	{
+		PngImage image;
+		parsePng(static_cast<const uint8_t*>(pData), size, image);
+		return decodePng(image, pDestination, error);
+	}
+	default:
+		return decodeStb(pData, size, pDestination, error);
+	}
+}
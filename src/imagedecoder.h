@@ -0,0 +1,47 @@
+#pragma once
+
+#include<cstddef>
+#include<cstdint>
+#include<string>
+
+// The decoders image files can be read with. Every codec writes RGBA8
+// texels to memory given by the caller, rows tightly packed, so a file
+// can be decoded straight into a mapped staging buffer.
+//
+enum ImageCodec
+{
+	IMAGE_CODEC_STB, // Any format stb_image reads, decoded into an allocation of its own and copied.
+	IMAGE_CODEC_TURBOJPEG, // JPEG through libjpeg-turbo, only built with IMAGE_DECODER_TURBOJPEG defined.
+	IMAGE_CODEC_PNG, // Non-interlaced 8 bit PNG, inflated by stb_image and unfiltered in place.
+	IMAGE_CODEC_COUNT
+};
+
+// Reads the size of an image in memory without decoding it.
+//
+bool readImageHeader(const void *pData, size_t size, uint32_t &width, uint32_t &height, std::string &error);
+
+// The fastest available codec that reads the image, stb_image if no
+// other one does.
+//
+ImageCodec selectImageCodec(const void *pData, size_t size);
+
+// Whether the codec was built in.
+//
+bool fImageCodecAvailable(ImageCodec codec);
+
+// Whether the codec is available and reads the image.
+//
+bool fImageCodecReads(ImageCodec codec, const void *pData, size_t size);
+
+const char *getImageCodecName(ImageCodec codec);
+
+// Decodes an image with the codec given to RGBA8, writing width * height
+// * 4 bytes to the destination. Fails with the error set if the codec
+// does not read the image.
+//
+bool decodeImage(
+	const void *pData,
+	size_t size,
+	ImageCodec codec,
+	uint8_t *pDestination,
+	std::string &error);
@@ -0,0 +1,382 @@
+#include "ktx2.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// Identifier, header and index, followed by the level index.
+//
+const size_t KTX2_HEADER_SIZE = 80;
+const size_t KTX2_LEVEL_INDEX_ENTRY_SIZE = 24;
+
+// Values of the basic data format descriptor written for each format.
+//
+const uint8_t KHR_DF_MODEL_RGBSDA = 1;
+const uint8_t KHR_DF_MODEL_BC1A = 128;
+const uint8_t KHR_DF_MODEL_BC3 = 130;
+const uint8_t KHR_DF_MODEL_BC5 = 132;
+const uint8_t KHR_DF_MODEL_BC7 = 134;
+const uint8_t KHR_DF_MODEL_ETC2 = 161;
+const uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+const uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+const uint8_t KHR_DF_TRANSFER_SRGB = 2;
+const uint8_t KHR_DF_CHANNEL_RED = 0;
+const uint8_t KHR_DF_CHANNEL_GREEN = 1;
+const uint8_t KHR_DF_CHANNEL_BLUE = 2;
+const uint8_t KHR_DF_CHANNEL_ALPHA = 15;
+const uint8_t KHR_DF_CHANNEL_ETC2_COLOR = 2;
+const uint8_t KHR_DF_SAMPLE_DATATYPE_LINEAR = 0x10;
+
+// One sample of the data format descriptor.
+//
+struct DfdSample
+{
+	uint16_t m_bitOffset;
+	uint8_t m_bitLength; // Minus one.
+	uint8_t m_channelType;
+	uint32_t m_upper;
+};
+
+/**************************************************************
+* Description
+*		Reads a little endian value at the offset.
+* Returns
+*		The value.
+* Notes
+*
+**************************************************************/
+template<typename T>
+static T readValue(const uint8_t *pData, size_t offset)
+{
+	T value;
+	memcpy(&value, pData + offset, sizeof(value));
+	return value;
+}
+
+/**************************************************************
+* Description
+*		Appends a little endian value to the buffer.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+template<typename T>
+static void writeValue(std::vector<uint8_t> &buffer, T value)
+{
+	const uint8_t *pBytes = reinterpret_cast<const uint8_t*>(&value);
+	buffer.insert(buffer.end(), pBytes, pBytes + sizeof(value));
+}
+
+/**************************************************************
+* Description
+*		Gets the block size of a format.
+* Returns
+*		true/false
+* Notes
+*		Uncompressed RGBA is handled as a block of one texel.
+*
+**************************************************************/
+bool getFormatBlock(VkFormat vkFormat, uint32_t &blockBytes, uint32_t &blockWidth, uint32_t &blockHeight)
+{
+	blockWidth = 4;
+	blockHeight = 4;
+	switch (vkFormat)
+	{
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		blockBytes = 4;
+		blockWidth = 1;
+		blockHeight = 1;
+		return true;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+		blockBytes = 8;
+		return true;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_UNORM_BLOCK:
+	case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+		blockBytes = 16;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**************************************************************
+* Description
+*		Gets the color model, transfer function and samples of
+*		the data format descriptor of a format.
+* Returns
+*		void
+* Notes
+*		Expects a format getFormatBlock accepts.
+*
+**************************************************************/
+static void getFormatDescriptor(
+	VkFormat vkFormat,
+	uint8_t &colorModel,
+	uint8_t &transferFunction,
+	std::vector<DfdSample> &samples)
+{
+	transferFunction = KHR_DF_TRANSFER_LINEAR;
+	switch (vkFormat)
+	{
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		transferFunction = KHR_DF_TRANSFER_SRGB;
+		// Fall through.
+	case VK_FORMAT_R8G8B8A8_UNORM:
+		colorModel = KHR_DF_MODEL_RGBSDA;
+		samples.push_back({ 0, 7, KHR_DF_CHANNEL_RED, 255 });
+		samples.push_back({ 8, 7, KHR_DF_CHANNEL_GREEN, 255 });
+		samples.push_back({ 16, 7, KHR_DF_CHANNEL_BLUE, 255 });
+		samples.push_back({ 24, 7, KHR_DF_CHANNEL_ALPHA | KHR_DF_SAMPLE_DATATYPE_LINEAR, 255 });
+		return;
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		transferFunction = KHR_DF_TRANSFER_SRGB;
+		// Fall through.
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		colorModel = KHR_DF_MODEL_BC1A;
+		samples.push_back({ 0, 63, 0, 0xFFFFFFFF });
+		return;
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		transferFunction = KHR_DF_TRANSFER_SRGB;
+		// Fall through.
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		colorModel = KHR_DF_MODEL_BC1A;
+		samples.push_back({ 0, 63, KHR_DF_CHANNEL_ALPHA, 0xFFFFFFFF });
+		return;
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		transferFunction = KHR_DF_TRANSFER_SRGB;
+		// Fall through.
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+		colorModel = KHR_DF_MODEL_BC3;
+		samples.push_back({ 0, 63, KHR_DF_CHANNEL_ALPHA | KHR_DF_SAMPLE_DATATYPE_LINEAR, 0xFFFFFFFF });
+		samples.push_back({ 64, 63, 0, 0xFFFFFFFF });
+		return;
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+		colorModel = KHR_DF_MODEL_BC5;
+		samples.push_back({ 0, 63, KHR_DF_CHANNEL_RED, 0xFFFFFFFF });
+		samples.push_back({ 64, 63, KHR_DF_CHANNEL_GREEN, 0xFFFFFFFF });
+		return;
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		transferFunction = KHR_DF_TRANSFER_SRGB;
+		// Fall through.
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+		colorModel = KHR_DF_MODEL_BC7;
+		samples.push_back({ 0, 127, 0, 0xFFFFFFFF });
+		return;
+	case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+		transferFunction = KHR_DF_TRANSFER_SRGB;
+		// Fall through.
+	case VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK:
+		colorModel = KHR_DF_MODEL_ETC2;
+		samples.push_back({ 0, 63, KHR_DF_CHANNEL_ETC2_COLOR, 0xFFFFFFFF });
+		return;
+	case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+		transferFunction = KHR_DF_TRANSFER_SRGB;
+		// Fall through.
+	default:
+		colorModel = KHR_DF_MODEL_ETC2;
+		samples.push_back({ 0, 63, KHR_DF_CHANNEL_ALPHA | KHR_DF_SAMPLE_DATATYPE_LINEAR, 0xFFFFFFFF });
+		samples.push_back({ 64, 63, KHR_DF_CHANNEL_ETC2_COLOR, 0xFFFFFFFF });
+		return;
+	}
+}
+
+/**************************************************************
+* Description
+*		Parses the header and level index of a KTX2 file and
+*		checks every level lies within the data.
+* Returns
+*		true/false
+* Notes
+*		A file without levels asks for them to be generated, it
+*		is loaded with only its first level.
+*
+**************************************************************/
+bool parseKtx2(const void *pData, size_t size, Ktx2Texture &texture, std::string &error)
+{
+	const uint8_t *pBytes = static_cast<const uint8_t*>(pData);
+	if (size < KTX2_HEADER_SIZE || 0 != memcmp(pBytes, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)))
+	{
+		error = "not a KTX2 file";
+		return false;
+	}
+
+	texture.m_vkFormat = static_cast<VkFormat>(readValue<uint32_t>(pBytes, 12));
+	texture.m_width = readValue<uint32_t>(pBytes, 20);
+	texture.m_height = readValue<uint32_t>(pBytes, 24);
+	uint32_t depth = readValue<uint32_t>(pBytes, 28);
+	uint32_t layerCount = readValue<uint32_t>(pBytes, 32);
+	uint32_t faceCount = readValue<uint32_t>(pBytes, 36);
+	uint32_t levelCount = std::max(readValue<uint32_t>(pBytes, 40), 1u);
+	uint32_t supercompressionScheme = readValue<uint32_t>(pBytes, 44);
+
+	uint32_t blockBytes, blockWidth, blockHeight;
+	if (!getFormatBlock(texture.m_vkFormat, blockBytes, blockWidth, blockHeight))
+	{
+		error = "unsupported format " + std::to_string(texture.m_vkFormat);
+		return false;
+	}
+	if (0 != supercompressionScheme)
+	{
+		error = "supercompression is not supported";
+		return false;
+	}
+	if (0 == texture.m_width || 0 == texture.m_height || 0 != depth || layerCount > 1 || 1 != faceCount)
+	{
+		error = "only 2D textures are supported";
+		return false;
+	}
+
+	uint32_t maxLevels = 1;
+	while ((std::max(texture.m_width, texture.m_height) >> maxLevels) > 0)
+	{
+		++maxLevels;
+	}
+	if (levelCount > maxLevels || size < KTX2_HEADER_SIZE + levelCount * KTX2_LEVEL_INDEX_ENTRY_SIZE)
+	{
+		error = "invalid level index";
+		return false;
+	}
+
+	texture.m_levels.resize(levelCount);
+	for (uint32_t level = 0; level < levelCount; ++level)
+	{
+		size_t entry = KTX2_HEADER_SIZE + level * KTX2_LEVEL_INDEX_ENTRY_SIZE;
+		Ktx2Level &ktx2Level = texture.m_levels[level];
+		ktx2Level.m_byteOffset = readValue<uint64_t>(pBytes, entry);
+		ktx2Level.m_byteLength = readValue<uint64_t>(pBytes, entry + 8);
+
+		uint64_t levelWidth = std::max(texture.m_width >> level, 1u);
+		uint64_t levelHeight = std::max(texture.m_height >> level, 1u);
+		uint64_t expectedLength =
+			((levelWidth + blockWidth - 1) / blockWidth) *
+			((levelHeight + blockHeight - 1) / blockHeight) *
+			blockBytes;
+		if (ktx2Level.m_byteLength < expectedLength ||
+			ktx2Level.m_byteOffset > size ||
+			ktx2Level.m_byteLength > size - ktx2Level.m_byteOffset)
+		{
+			error = "level " + std::to_string(level) + " lies outside the file";
+			return false;
+		}
+		ktx2Level.m_byteLength = expectedLength;
+	}
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Writes the texture to a KTX2 file.
+* Returns
+*		true/false
+* Notes
+*		The levels are stored smallest first, as the format
+*		expects, each aligned to a block. No key/value data is
+*		written.
+*
+**************************************************************/
+bool writeKtx2(
+	const std::string &path,
+	VkFormat vkFormat,
+	uint32_t width,
+	uint32_t height,
+	const std::vector<std::vector<uint8_t>> &levels)
+{
+	uint32_t blockBytes, blockWidth, blockHeight;
+	if (levels.empty() || !getFormatBlock(vkFormat, blockBytes, blockWidth, blockHeight))
+	{
+		return false;
+	}
+
+	uint8_t colorModel, transferFunction;
+	std::vector<DfdSample> samples;
+	getFormatDescriptor(vkFormat, colorModel, transferFunction, samples);
+	uint32_t descriptorBlockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+	uint32_t dfdSize = 4 + descriptorBlockSize;
+	uint32_t dfdOffset = static_cast<uint32_t>(KTX2_HEADER_SIZE + levels.size() * KTX2_LEVEL_INDEX_ENTRY_SIZE);
+
+	// Levels start after the descriptor, smallest first.
+	//
+	std::vector<uint64_t> levelOffsets(levels.size());
+	uint64_t offset = dfdOffset + dfdSize;
+	for (size_t level = levels.size(); level-- > 0;)
+	{
+		offset = (offset + blockBytes - 1) / blockBytes * blockBytes;
+		levelOffsets[level] = offset;
+		offset += levels[level].size();
+	}
+
+	std::vector<uint8_t> file(KTX2_IDENTIFIER, KTX2_IDENTIFIER + sizeof(KTX2_IDENTIFIER));
+	writeValue<uint32_t>(file, vkFormat);
+	writeValue<uint32_t>(file, 1); // typeSize, the size of a byte.
+	writeValue<uint32_t>(file, width);
+	writeValue<uint32_t>(file, height);
+	writeValue<uint32_t>(file, 0); // pixelDepth
+	writeValue<uint32_t>(file, 0); // layerCount
+	writeValue<uint32_t>(file, 1); // faceCount
+	writeValue<uint32_t>(file, static_cast<uint32_t>(levels.size()));
+	writeValue<uint32_t>(file, 0); // supercompressionScheme
+	writeValue<uint32_t>(file, dfdOffset);
+	writeValue<uint32_t>(file, dfdSize);
+	writeValue<uint32_t>(file, 0); // kvdByteOffset
+	writeValue<uint32_t>(file, 0); // kvdByteLength
+	writeValue<uint64_t>(file, 0); // sgdByteOffset
+	writeValue<uint64_t>(file, 0); // sgdByteLength
+	for (size_t level = 0; level < levels.size(); ++level)
+	{
+		writeValue<uint64_t>(file, levelOffsets[level]);
+		writeValue<uint64_t>(file, levels[level].size());
+		writeValue<uint64_t>(file, levels[level].size());
+	}
+
+	// Basic data format descriptor.
+	//
+	writeValue<uint32_t>(file, dfdSize);
+	writeValue<uint32_t>(file, 0); // Khronos vendor, basic descriptor type.
+	writeValue<uint32_t>(file, 2 | (descriptorBlockSize << 16)); // Version 1.3.
+	file.push_back(colorModel);
+	file.push_back(KHR_DF_PRIMARIES_BT709);
+	file.push_back(transferFunction);
+	file.push_back(0); // Straight alpha.
+	file.push_back(static_cast<uint8_t>(blockWidth - 1));
+	file.push_back(static_cast<uint8_t>(blockHeight - 1));
+	file.push_back(0);
+	file.push_back(0);
+	file.push_back(static_cast<uint8_t>(blockBytes));
+	file.insert(file.end(), 7, 0);
+	for (const auto &sample : samples)
+	{
+		writeValue<uint16_t>(file, sample.m_bitOffset);
+		file.push_back(sample.m_bitLength);
+		file.push_back(sample.m_channelType);
+		writeValue<uint32_t>(file, 0); // Sample position.
+		writeValue<uint32_t>(file, 0); // Lower.
+		writeValue<uint32_t>(file, sample.m_upper);
+	}
+
+	for (size_t level = levels.size(); level-- > 0;)
+	{
+		file.resize(static_cast<size_t>(levelOffsets[level]), 0);
+		file.insert(file.end(), levels[level].begin(), levels[level].end());
+	}
+
+	std::ofstream output(path, std::ios::binary);
+	if (!output.is_open())
+	{
+		return false;
+	}
+	output.write(reinterpret_cast<const char*>(file.data()), file.size());
+	return output.good();
+}
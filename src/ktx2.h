@@ -0,0 +1,46 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+#include<cstdint>
+#include<string>
+#include<vector>
+
+// Where a mip level is stored in a KTX2 file.
+//
+struct Ktx2Level
+{
+	uint64_t m_byteOffset; // From the start of the file.
+	uint64_t m_byteLength;
+};
+
+// The parts of a KTX2 file needed to upload it: a single 2D image with
+// all its mip levels stored in the Vulkan format they are sampled in.
+//
+struct Ktx2Texture
+{
+	VkFormat m_vkFormat;
+	uint32_t m_width;
+	uint32_t m_height;
+	std::vector<Ktx2Level> m_levels; // Level 0 first.
+};
+
+// Parses the header and level index of a KTX2 file in memory.
+// Supercompressed files, arrays, cube maps and 3D textures are
+// rejected with the error set.
+//
+bool parseKtx2(const void *pData, size_t size, Ktx2Texture &texture, std::string &error);
+
+// Writes a 2D texture to a KTX2 file, with the levels given largest
+// first, each holding the blocks of the format row by row.
+//
+bool writeKtx2(
+	const std::string &path,
+	VkFormat vkFormat,
+	uint32_t width,
+	uint32_t height,
+	const std::vector<std::vector<uint8_t>> &levels);
+
+// Bytes of one block of the format and the texels it covers in x and
+// y. Returns false for formats the loader does not handle.
+//
+bool getFormatBlock(VkFormat vkFormat, uint32_t &blockBytes, uint32_t &blockWidth, uint32_t &blockHeight);
@@ -1,14 +1,184 @@
 #include "vulkan.h"
+#include <cstdlib>
+#include <string>
 
-int main() 
+/**************************************************************
+* Description
+*		Prints the command line options.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+static void printUsage()
 {
+	std::cerr << "Usage: tutorial_vulkan [options]" << std::endl;
+	std::cerr << "\t--headless                Render offscreen, without a window. Always set in builds without GLFW." << std::endl;
+	std::cerr << "\t--frames <count>          Exit after rendering the frames, " << HEADLESS_FRAME_COUNT << " by default when headless." << std::endl;
+	std::cerr << "\t--size <width> <height>   Size of the offscreen image." << std::endl;
+	std::cerr << "\t--readback <prefix>       Write headless frames to <prefix><frame>.png." << std::endl;
+	std::cerr << "\t--readback-interval <n>   Write every n frames instead of the last one only." << std::endl;
+	std::cerr << "\t--benchmark <script>      Play back a scene script on a fixed timestep, for as many frames as it sets." << std::endl;
+	std::cerr << "\t--results <file>          Where benchmark results are written, " << BENCHMARK_RESULTS_PATH << " by default." << std::endl;
+	std::cerr << "\t--compare <reference>     Fail unless the last headless frame matches the PNG file, or on validation errors." << std::endl;
+	std::cerr << "\t--fail-on-validation      Fail if the validation layers report an error, which they only check in debug builds." << std::endl;
+	std::cerr << "\t--benchmark-mips          Time the mip generation of each kind before the first frame." << std::endl;
+	std::cerr << "\t--mips <blit|compute|cpu> How mip chains of images are built, blit by default. CPU chains are cached in " << MIP_CACHE_DIRECTORY << "." << std::endl;
+}
+
+/**************************************************************
+* Description
+*		Reads an unsigned number argument.
+* Returns
+*		true/false
+* Notes
+*		Fails if the argument is not a number.
+*
+**************************************************************/
+static bool parseNumber(const char *pArgument, uint32_t &value)
+{
+	char *pEnd = nullptr;
+	unsigned long number = std::strtoul(pArgument, &pEnd, 10);
+	if (pEnd == pArgument || '\0' != *pEnd)
+	{
+		return false;
+	}
+	value = static_cast<uint32_t>(number);
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Reads the run options from the command line.
+* Returns
+*		true/false
+* Notes
+*		Fails on an unknown option or a missing or invalid
+*		value.
+*
+**************************************************************/
+static bool parseOptions(int argc, char **argv, RunOptions &options)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string option = argv[i];
+		int valueCount = argc - i - 1;
+		if ("--headless" == option)
+		{
+			options.m_fHeadless = true;
+		}
+		else if ("--frames" == option && valueCount >= 1)
+		{
+			if (!parseNumber(argv[++i], options.m_frameCount))
+			{
+				return false;
+			}
+		}
+		else if ("--size" == option && valueCount >= 2)
+		{
+			if (!parseNumber(argv[++i], options.m_width) || !parseNumber(argv[++i], options.m_height))
+			{
+				return false;
+			}
+		}
+		else if ("--readback" == option && valueCount >= 1)
+		{
+			options.m_readbackPrefix = argv[++i];
+		}
+		else if ("--readback-interval" == option && valueCount >= 1)
+		{
+			if (!parseNumber(argv[++i], options.m_readbackInterval))
+			{
+				return false;
+			}
+		}
+		else if ("--benchmark" == option && valueCount >= 1)
+		{
+			options.m_benchmarkScriptPath = argv[++i];
+		}
+		else if ("--results" == option && valueCount >= 1)
+		{
+			options.m_benchmarkResultsPath = argv[++i];
+		}
+		else if ("--compare" == option && valueCount >= 1)
+		{
+			options.m_comparePath = argv[++i];
+		}
+		else if ("--fail-on-validation" == option)
+		{
+			options.m_fFailOnValidationErrors = true;
+		}
+		else if ("--benchmark-mips" == option)
+		{
+			options.m_fBenchmarkMipGeneration = true;
+		}
+		else if ("--mips" == option && valueCount >= 1)
+		{
+			std::string mipGeneration = argv[++i];
+			if ("blit" == mipGeneration)
+			{
+				options.m_mipGeneration = MIP_GENERATION_BLIT;
+			}
+			else if ("compute" == mipGeneration)
+			{
+				options.m_mipGeneration = MIP_GENERATION_COMPUTE;
+			}
+			else if ("cpu" == mipGeneration)
+			{
+				options.m_mipGeneration = MIP_GENERATION_CPU;
+			}
+			else
+			{
+				return false;
+			}
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	if (0 == options.m_width || 0 == options.m_height)
+	{
+		return false;
+	}
+
+#ifndef RENDERER_GLFW
+	options.m_fHeadless = true;
+#endif
+
+	// Swapchain images cannot be copied once presented, frames are only
+	// read back from the offscreen image.
+	//
+	if ((!options.m_readbackPrefix.empty() || !options.m_comparePath.empty()) && !options.m_fHeadless)
+	{
+		return false;
+	}
+
+	if (options.m_fHeadless && 0 == options.m_frameCount)
+	{
+		options.m_frameCount = HEADLESS_FRAME_COUNT;
+	}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	RunOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		printUsage();
+		return EXIT_FAILURE;
+	}
+
 	HelloTriangleApplication app;
+	app.setOptions(options);
 
-	try 
+	try
 	{
 		app.run();
 	}
-	
+
 	catch (const std::runtime_error& e)
 	{
 		std::cerr << e.what() << std::endl;
@@ -16,4 +186,4 @@ int main()
 	}
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,267 @@
+#include "materialtable.h"
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+MaterialTable::MaterialTable()
+	:m_vkDevice(VK_NULL_HANDLE),
+	m_vkLayout(VK_NULL_HANDLE),
+	m_vkPool(VK_NULL_HANDLE),
+	m_vkDescriptorSet(VK_NULL_HANDLE),
+	m_vkMaterialBuffer(VK_NULL_HANDLE),
+	m_vkMaterialMemory(VK_NULL_HANDLE),
+	m_pMaterials(nullptr),
+	m_maxTextures(0),
+	m_textureCount(0),
+	m_materialCount(0)
+{
+}
+
+/**************************************************************
+* Description
+*		Checks the descriptor indexing features the table needs.
+* Returns
+*		true/false
+* Notes
+*		These are core in Vulkan 1.2 but optional. The shaders
+*		index the texture array with the material of the draw,
+*		which is dynamically uniform, so the core dynamic
+*		indexing feature is needed as well.
+*
+**************************************************************/
+bool MaterialTable::fDeviceSupported(VkPhysicalDevice vkPhysicalDevice)
+{
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &indexingFeatures;
+	vkGetPhysicalDeviceFeatures2(vkPhysicalDevice, &deviceFeatures2);
+
+	return deviceFeatures2.features.shaderSampledImageArrayDynamicIndexing &&
+		indexingFeatures.runtimeDescriptorArray &&
+		indexingFeatures.descriptorBindingPartiallyBound &&
+		indexingFeatures.descriptorBindingSampledImageUpdateAfterBind;
+}
+
+/**************************************************************
+* Description
+*		Creates the set layout, the set and the material buffer.
+* Returns
+*		void
+* Notes
+*		The texture array is sized to MAX_BINDLESS_TEXTURES or
+*		the update after bind limits of the device, whichever is
+*		lower.
+*
+**************************************************************/
+void MaterialTable::create(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice)
+{
+	m_vkDevice = vkDevice;
+
+	VkPhysicalDeviceDescriptorIndexingProperties indexingProperties = {};
+	indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+	VkPhysicalDeviceProperties2 deviceProperties2 = {};
+	deviceProperties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	deviceProperties2.pNext = &indexingProperties;
+	vkGetPhysicalDeviceProperties2(vkPhysicalDevice, &deviceProperties2);
+	m_maxTextures = std::min({
+		MAX_BINDLESS_TEXTURES,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSamplers,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages });
+
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].descriptorCount = m_maxTextures;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	// Only the slots the shaders actually read have to be written.
+	//
+	std::array<VkDescriptorBindingFlags, 2> bindingFlags = {
+		0,
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT };
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+	bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+	if (VK_SUCCESS != vkCreateDescriptorSetLayout(m_vkDevice, &layoutInfo, nullptr, &m_vkLayout))
+	{
+		throw std::runtime_error("Could not create material table set layout.");
+	}
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = 1;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = m_maxTextures;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = 1;
+	if (VK_SUCCESS != vkCreateDescriptorPool(m_vkDevice, &poolInfo, nullptr, &m_vkPool))
+	{
+		throw std::runtime_error("Could not create material table descriptor pool.");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_vkPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_vkLayout;
+	if (VK_SUCCESS != vkAllocateDescriptorSets(m_vkDevice, &allocInfo, &m_vkDescriptorSet))
+	{
+		throw std::runtime_error("Could not create material table descriptor set.");
+	}
+
+	VkDeviceSize size = sizeof(Material) * MAX_MATERIALS;
+	createBuffer(m_vkDevice,
+		vkPhysicalDevice,
+		size,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_vkMaterialBuffer,
+		m_vkMaterialMemory);
+	if (VK_SUCCESS != vkMapMemory(m_vkDevice, m_vkMaterialMemory, 0, size, 0, reinterpret_cast<void**>(&m_pMaterials)))
+	{
+		throw std::runtime_error("Could not map material buffer memory.");
+	}
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = m_vkMaterialBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = size;
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = m_vkDescriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.pBufferInfo = &bufferInfo;
+	vkUpdateDescriptorSets(m_vkDevice, 1, &descriptorWrite, 0, nullptr);
+}
+
+/**************************************************************
+* Description
+*		Destroys the set, its pool and the material buffer.
+* Returns
+*		void
+* Notes
+*		The set may not be in use on the GPU. The textures are
+*		owned by the caller.
+*
+**************************************************************/
+void MaterialTable::destroy()
+{
+	if (VK_NULL_HANDLE != m_vkMaterialMemory)
+	{
+		vkUnmapMemory(m_vkDevice, m_vkMaterialMemory);
+	}
+	vkDestroyBuffer(m_vkDevice, m_vkMaterialBuffer, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkMaterialMemory, nullptr);
+	vkDestroyDescriptorPool(m_vkDevice, m_vkPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_vkDevice, m_vkLayout, nullptr);
+	m_pMaterials = nullptr;
+	m_vkMaterialBuffer = VK_NULL_HANDLE;
+	m_vkMaterialMemory = VK_NULL_HANDLE;
+	m_vkPool = VK_NULL_HANDLE;
+	m_vkLayout = VK_NULL_HANDLE;
+	m_vkDescriptorSet = VK_NULL_HANDLE;
+	m_textureCount = 0;
+	m_materialCount = 0;
+}
+
+/**************************************************************
+* Description
+*		Writes the texture into the next free slot of the
+*		bindless array.
+* Returns
+*		Index of the texture, for Material::m_textureIndex.
+* Notes
+*		The image has to be in the shader read only layout by
+*		the time a draw samples it.
+*
+**************************************************************/
+uint32_t MaterialTable::addTexture(VkImageView vkImageView, VkSampler vkSampler)
+{
+	if (m_textureCount == m_maxTextures)
+	{
+		throw std::runtime_error("The bindless texture array is full.");
+	}
+	setTexture(m_textureCount, vkImageView, vkSampler);
+	return m_textureCount++;
+}
+
+/**************************************************************
+* Description
+*		Points a slot of the bindless array at another texture.
+* Returns
+*		void
+* Notes
+*		No command buffer using the set may be pending, so call
+*		it between frames, once the last one has completed.
+*
+**************************************************************/
+void MaterialTable::setTexture(uint32_t textureIndex, VkImageView vkImageView, VkSampler vkSampler)
+{
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = vkImageView;
+	imageInfo.sampler = vkSampler;
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = m_vkDescriptorSet;
+	descriptorWrite.dstBinding = 1;
+	descriptorWrite.dstArrayElement = textureIndex;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_vkDevice, 1, &descriptorWrite, 0, nullptr);
+}
+
+/**************************************************************
+* Description
+*		Appends the material to the table.
+* Returns
+*		Index of the material, pushed with the draws using it.
+* Notes
+*		Entries are never rewritten, so frames in flight keep
+*		reading the materials they were recorded with.
+*
+**************************************************************/
+uint32_t MaterialTable::addMaterial(const Material &material)
+{
+	if (m_materialCount == MAX_MATERIALS)
+	{
+		throw std::runtime_error("The material table is full.");
+	}
+	m_pMaterials[m_materialCount] = material;
+	return m_materialCount++;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "model.h"
+#include<vector>
+
+// Textures the bindless array holds, lowered to the device limits.
+//
+const uint32_t MAX_BINDLESS_TEXTURES = 4096;
+const uint32_t MAX_MATERIALS = 1024;
+
+// Every texture and material of the scene in one descriptor set. The
+// textures live in a partially bound array of combined image samplers
+// and the materials in a storage buffer indexing into it, so a draw only
+// pushes its material index and the set is bound once per command buffer.
+// The texture array is update after bind, so textures can be added while
+// recorded command buffers, such as the cached draw segments, still bind
+// the set. Slots are only written between frames, once the timeline shows
+// the previous frame has completed, never while a submission using the
+// set is pending.
+//
+class MaterialTable
+{
+public:
+	MaterialTable();
+	void create(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice);
+	void destroy();
+	uint32_t addTexture(VkImageView vkImageView, VkSampler vkSampler);
+	void setTexture(uint32_t textureIndex, VkImageView vkImageView, VkSampler vkSampler);
+	uint32_t addMaterial(const Material &material);
+	VkDescriptorSetLayout getLayout() const { return m_vkLayout; }
+	VkDescriptorSet getSet() const { return m_vkDescriptorSet; }
+	uint32_t getTextureCount() const { return m_textureCount; }
+	uint32_t getMaterialCount() const { return m_materialCount; }
+	static bool fDeviceSupported(VkPhysicalDevice vkPhysicalDevice);
+private:
+	VkDevice m_vkDevice;
+	VkDescriptorSetLayout m_vkLayout;
+	VkDescriptorPool m_vkPool; // Holds the one set, with the update after bind flag.
+	VkDescriptorSet m_vkDescriptorSet;
+	VkBuffer m_vkMaterialBuffer;
+	VkDeviceMemory m_vkMaterialMemory;
+	Material *m_pMaterials; // Persistently mapped, the memory is host coherent.
+	uint32_t m_maxTextures;
+	uint32_t m_textureCount;
+	uint32_t m_materialCount;
+};
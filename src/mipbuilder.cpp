@@ -0,0 +1,312 @@
+#include "mipbuilder.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define MIP_BUILDER_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define MIP_BUILDER_AVX2
+#else
+#define MIP_BUILDER_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Rows of a level below which a batch is not worth queuing.
+//
+const size_t MIP_ROWS_PER_BATCH = 32;
+
+// Linear values are encoded through a table of this many steps.
+//
+const uint32_t LINEAR_STEPS = 4096;
+
+// Conversion tables shared by the scalar and the AVX2 filters, so both
+// give the same results. Entries past the color entries handle alpha,
+// which is not encoded, letting a texel be converted with one lookup
+// per channel. The AVX2 filter gathers 32 bits at each byte of the
+// encoding table, so it is padded by three bytes.
+//
+struct MipTables
+{
+	float m_toLinear[256 * 2]; // sRGB byte to linear, then byte to [0, 1].
+	uint8_t m_fromLinear[LINEAR_STEPS + 256 + 3]; // Linear step to sRGB byte, then byte to itself.
+
+	MipTables()
+	{
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			float value = i / 255.0f;
+			m_toLinear[i] = (value <= 0.04045f) ? value / 12.92f : std::pow((value + 0.055f) / 1.055f, 2.4f);
+			m_toLinear[256 + i] = value;
+			m_fromLinear[LINEAR_STEPS + i] = static_cast<uint8_t>(i);
+		}
+		for (uint32_t i = 0; i < LINEAR_STEPS; ++i)
+		{
+			float value = i / static_cast<float>(LINEAR_STEPS - 1);
+			float encoded = (value <= 0.0031308f) ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+			m_fromLinear[i] = static_cast<uint8_t>(std::min(encoded * 255.0f + 0.5f, 255.0f));
+		}
+		std::fill(m_fromLinear + LINEAR_STEPS + 256, m_fromLinear + sizeof(m_fromLinear), static_cast<uint8_t>(0));
+	}
+};
+
+/**************************************************************
+* Description
+*		Gets the conversion tables, building them the first
+*		time.
+* Returns
+*		The tables.
+* Notes
+*
+**************************************************************/
+static const MipTables &getMipTables()
+{
+	static const MipTables tables;
+	return tables;
+}
+
+/**************************************************************
+* Description
+*		Checks if the CPU and the operating system support
+*		AVX2.
+* Returns
+*		true/false
+* Notes
+*		The result is computed once.
+*
+**************************************************************/
+bool fAvx2Supported()
+{
+#if defined(MIP_BUILDER_X86) && defined(_MSC_VER)
+	static const bool fSupported = []()
+	{
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+		{
+			return false;
+		}
+		__cpuid(info, 1);
+		bool fAvx = 0 != (info[2] & (1 << 28));
+		bool fOsSaves = 0 != (info[2] & (1 << 27));
+		__cpuidex(info, 7, 0);
+		bool fAvx2 = 0 != (info[1] & (1 << 5));
+		return fAvx && fOsSaves && fAvx2 && 6 == (_xgetbv(0) & 6);
+	}();
+	return fSupported;
+#elif defined(MIP_BUILDER_X86)
+	static const bool fSupported = (0 != __builtin_cpu_supports("avx2"));
+	return fSupported;
+#else
+	return false;
+#endif
+}
+
+#if defined(MIP_BUILDER_X86)
+/**************************************************************
+* Description
+*		Averages 2x2 texels of two rows of unencoded values into
+*		a row of the next level, four output texels at a time.
+* Returns
+*		The number of output texels written.
+* Notes
+*		The rows are widened to 16 bits and summed, then the
+*		neighboring texels of each pair are added within the
+*		128 bit lanes and the sums packed back in order.
+*
+**************************************************************/
+MIP_BUILDER_AVX2 static uint32_t downsampleRowAvx2(const uint8_t *pRow0, const uint8_t *pRow1, uint8_t *pOut, uint32_t outWidth)
+{
+	const __m256i rounding = _mm256_set1_epi16(2);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	uint32_t x = 0;
+	for (; x + 4 <= outWidth; x += 4)
+	{
+		__m256i top = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pRow0 + x * 8));
+		__m256i bottom = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pRow1 + x * 8));
+		__m256i low = _mm256_add_epi16(
+			_mm256_cvtepu8_epi16(_mm256_castsi256_si128(top)),
+			_mm256_cvtepu8_epi16(_mm256_castsi256_si128(bottom)));
+		__m256i high = _mm256_add_epi16(
+			_mm256_cvtepu8_epi16(_mm256_extracti128_si256(top, 1)),
+			_mm256_cvtepu8_epi16(_mm256_extracti128_si256(bottom, 1)));
+		low = _mm256_add_epi16(low, _mm256_srli_si256(low, 8));
+		high = _mm256_add_epi16(high, _mm256_srli_si256(high, 8));
+		__m256i sums = _mm256_unpacklo_epi64(low, high);
+		sums = _mm256_srli_epi16(_mm256_add_epi16(sums, rounding), 2);
+		__m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(sums, sums), order);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(pOut + x * 4), _mm256_castsi256_si128(packed));
+	}
+	return x;
+}
+
+/**************************************************************
+* Description
+*		Averages 2x2 texels of two rows of sRGB encoded color
+*		into a row of the next level, in linear space, two
+*		output texels at a time.
+* Returns
+*		The number of output texels written.
+* Notes
+*		Two texels of a row are decoded with one gather. Both
+*		averages are encoded with one more, reading 32 bits at
+*		each step of the byte table and keeping the low byte,
+*		then packed and stored together.
+*
+**************************************************************/
+MIP_BUILDER_AVX2 static uint32_t downsampleRowSrgbAvx2(const uint8_t *pRow0, const uint8_t *pRow1, uint8_t *pOut, uint32_t outWidth)
+{
+	const MipTables &tables = getMipTables();
+	const __m256i alphaOffset = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+	const __m256i encodeOffset = _mm256_setr_epi32(0, 0, 0, LINEAR_STEPS, 0, 0, 0, LINEAR_STEPS);
+	const __m256i lowByte = _mm256_set1_epi32(0xFF);
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	const __m256 scale = _mm256_setr_ps(
+		(LINEAR_STEPS - 1) * 0.25f,
+		(LINEAR_STEPS - 1) * 0.25f,
+		(LINEAR_STEPS - 1) * 0.25f,
+		255.0f * 0.25f,
+		(LINEAR_STEPS - 1) * 0.25f,
+		(LINEAR_STEPS - 1) * 0.25f,
+		(LINEAR_STEPS - 1) * 0.25f,
+		255.0f * 0.25f);
+	const int *pFromLinear = reinterpret_cast<const int*>(tables.m_fromLinear);
+	uint32_t x = 0;
+	for (; x + 2 <= outWidth; x += 2)
+	{
+		__m128i top = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow0 + x * 8));
+		__m128i bottom = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pRow1 + x * 8));
+
+		// The texel pairs of the first and of the second output texel.
+		//
+		__m256 first = _mm256_add_ps(
+			_mm256_i32gather_ps(tables.m_toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(top), alphaOffset), 4),
+			_mm256_i32gather_ps(tables.m_toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(bottom), alphaOffset), 4));
+		__m256 second = _mm256_add_ps(
+			_mm256_i32gather_ps(tables.m_toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(top, 8)), alphaOffset), 4),
+			_mm256_i32gather_ps(tables.m_toLinear, _mm256_add_epi32(_mm256_cvtepu8_epi32(_mm_srli_si128(bottom, 8)), alphaOffset), 4));
+		__m256 texels = _mm256_add_ps(
+			_mm256_permute2f128_ps(first, second, 0x20),
+			_mm256_permute2f128_ps(first, second, 0x31));
+
+		__m256i steps = _mm256_add_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(texels, scale)), encodeOffset);
+		__m256i encoded = _mm256_and_si256(_mm256_i32gather_epi32(pFromLinear, steps, 1), lowByte);
+		encoded = _mm256_packus_epi32(encoded, encoded);
+		encoded = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(encoded, encoded), order);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(pOut + x * 4), _mm256_castsi256_si128(encoded));
+	}
+	return x;
+}
+#endif
+
+/**************************************************************
+* Description
+*		Writes rows [begin, end) of the next level from the
+*		level above it.
+* Returns
+*		void
+* Notes
+*		A dimension of one stays one, the last row or column of
+*		an odd dimension is dropped. The texels the vector
+*		filters leave over are done here.
+*
+**************************************************************/
+static void downsampleRows(
+	const uint8_t *pSource,
+	uint32_t width,
+	uint32_t height,
+	uint8_t *pDestination,
+	uint32_t nextWidth,
+	size_t begin,
+	size_t end,
+	bool fSrgb,
+	bool fAvx2)
+{
+	const MipTables &tables = getMipTables();
+	uint32_t xStep = (width > 1) ? 1 : 0;
+	uint32_t yStep = (height > 1) ? 1 : 0;
+	for (size_t y = begin; y < end; ++y)
+	{
+		const uint8_t *pRow0 = pSource + (y * 2) * width * 4;
+		const uint8_t *pRow1 = pSource + (y * 2 + yStep) * width * 4;
+		uint8_t *pOut = pDestination + y * nextWidth * 4;
+
+		uint32_t x = 0;
+#if defined(MIP_BUILDER_X86)
+		if (fAvx2 && 0 != xStep)
+		{
+			x = fSrgb ? downsampleRowSrgbAvx2(pRow0, pRow1, pOut, nextWidth) : downsampleRowAvx2(pRow0, pRow1, pOut, nextWidth);
+		}
+#endif
+		for (; x < nextWidth; ++x)
+		{
+			uint32_t x0 = x * 2 * 4;
+			uint32_t x1 = (x * 2 + xStep) * 4;
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				if (fSrgb)
+				{
+					uint32_t offset = (3 == c) ? 256 : 0;
+					// Summed and rounded like the vector filter.
+					//
+					float sum =
+						(tables.m_toLinear[offset + pRow0[x0 + c]] + tables.m_toLinear[offset + pRow1[x0 + c]]) +
+						(tables.m_toLinear[offset + pRow0[x1 + c]] + tables.m_toLinear[offset + pRow1[x1 + c]]);
+					float steps = (3 == c) ? 255.0f : LINEAR_STEPS - 1.0f;
+					uint32_t step = static_cast<uint32_t>(std::lrint(sum * (steps * 0.25f)));
+					pOut[x * 4 + c] = tables.m_fromLinear[((3 == c) ? LINEAR_STEPS : 0) + step];
+				}
+				else
+				{
+					uint32_t sum = pRow0[x0 + c] + pRow0[x1 + c] + pRow1[x0 + c] + pRow1[x1 + c];
+					pOut[x * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Builds every mip level of the image.
+* Returns
+*		void
+* Notes
+*		Each level is built from the one above it.
+*
+**************************************************************/
+void buildMipChain(
+	const uint8_t *pPixels,
+	uint32_t width,
+	uint32_t height,
+	bool fSrgb,
+	ThreadPool *pThreadPool,
+	std::vector<std::vector<uint8_t>> &levels)
+{
+	bool fAvx2 = fAvx2Supported();
+	levels.clear();
+	levels.emplace_back(pPixels, pPixels + static_cast<size_t>(width) * height * 4);
+	while (width > 1 || height > 1)
+	{
+		uint32_t nextWidth = std::max(width / 2, 1u);
+		uint32_t nextHeight = std::max(height / 2, 1u);
+		std::vector<uint8_t> next(static_cast<size_t>(nextWidth) * nextHeight * 4);
+		const uint8_t *pSource = levels.back().data();
+		auto rows = [&](size_t, size_t begin, size_t end)
+		{
+			downsampleRows(pSource, width, height, next.data(), nextWidth, begin, end, fSrgb, fAvx2);
+		};
+		if (nullptr != pThreadPool)
+		{
+			pThreadPool->parallelFor(nextHeight, MIP_ROWS_PER_BATCH, rows);
+		}
+		else
+		{
+			rows(0, 0, nextHeight);
+		}
+		levels.push_back(std::move(next));
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
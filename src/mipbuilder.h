@@ -0,0 +1,22 @@
+#pragma once
+
+#include "threadpool.h"
+#include<cstdint>
+#include<vector>
+
+// Builds the whole mip chain of an RGBA8 image on the CPU with a 2x2
+// box filter, level 0 first and including it. sRGB encoded color is
+// averaged in linear space, alpha always is. The rows of each level
+// are split across the thread pool if one is given, which must not be
+// done from one of its workers. The filter runs on AVX2 when the CPU
+// has it.
+//
+void buildMipChain(
+	const uint8_t *pPixels,
+	uint32_t width,
+	uint32_t height,
+	bool fSrgb,
+	ThreadPool *pThreadPool,
+	std::vector<std::vector<uint8_t>> &levels);
+
+bool fAvx2Supported();
@@ -1,4 +1,5 @@
 #include "model.h"
+#include "scene.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include<tiny_obj_loader.h>
 
@@ -15,17 +16,20 @@
 **************************************************************/
 Model::Model()
 :m_vkVertexBuffer(VK_NULL_HANDLE),
-m_vkVertexBufferMemory(VK_NULL_HANDLE)
+m_vkVertexBufferMemory(VK_NULL_HANDLE),
+m_sceneNode(INVALID_SCENE_NODE),
+m_pipelineIndex(0),
+m_materialIndex(0)
 {
-	m_durations.m_xDuration = 0.0;
-	m_durations.m_yDuration = 0.0;
-	m_durations.m_zDuration = 0.0;
 	m_fKeyPressed[0] = false;
 	m_fKeyPressed[1] = false;
 	m_fKeyPressed[2] = false;
-	m_position = glm::vec3(0.0f);
-	m_center = glm::vec3(0.0f);
-	m_scale = glm::vec3(1.0f);
+	m_fDirectionPositive[0] = false;
+	m_fDirectionPositive[1] = false;
+	m_fDirectionPositive[2] = false;
+	m_boundsMin = glm::vec3(0.0f);
+	m_boundsMax = glm::vec3(0.0f);
+	m_diffuseColor = glm::vec3(1.0f);
 }
 
 /**************************************************************
@@ -42,116 +46,33 @@ Model::~Model()
 
 /**************************************************************
 * Description
-*		updates the rotation around x axis based on the time
-*		since last key stroke.
+*		Advances the model by the frame time. Rotates its scene
+*		node around the axes whose keys are pressed, at 90
+*		degrees per second.
 * Returns
 *		void
 * Notes
+*		The frame time is sampled once per frame by the caller.
+*		The matrices are rebuilt by the next scene update.
 *
 **************************************************************/
-void Model::rotateX()
+void Model::update(Scene &scene, float deltaTime)
 {
-	if (m_fKeyPressed[0])
-	{
-		if (m_fDirectionPositive[0])
-		{
-			m_durations.m_xDuration += getDuration(m_lastUpdateTime[0]);
-		}
-		else
-		{
-			m_durations.m_xDuration -= getDuration(m_lastUpdateTime[0]);
-		}
-	}
-}
+	const glm::vec3 axes[3] = {
+		glm::vec3(1.0f, 0.0f, 0.0f),
+		glm::vec3(0.0f, 1.0f, 0.0f),
+		glm::vec3(0.0f, 0.0f, 1.0f) };
 
-/**************************************************************
-* Description
-*		updates the rotation around y axis based on time since
-*		last key stroke.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void Model::rotateY()
-{
-	if (m_fKeyPressed[1])
-	{
-		if (m_fDirectionPositive[1])
-		{
-			m_durations.m_yDuration += getDuration(m_lastUpdateTime[1]);
-		}
-		else
-		{
-			m_durations.m_yDuration -= getDuration(m_lastUpdateTime[1]);
-		}
-	}
-}
-
-/**************************************************************
-* Description
-*		updates the rotation around z axis based on time elapsed
-*		since last key stroke.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void Model::rotateZ()
-{
-	if (m_fKeyPressed[2])
+	for (int axis = 0; axis < 3; ++axis)
 	{
-		if (m_fDirectionPositive[2])
+		if (m_fKeyPressed[axis])
 		{
-			m_durations.m_zDuration += getDuration(m_lastUpdateTime[2]);
-		}
-		else
-		{
-			m_durations.m_zDuration -= getDuration(m_lastUpdateTime[2]);
+			float angle = deltaTime * glm::radians(90.0f);
+			scene.rotate(m_sceneNode, m_fDirectionPositive[axis] ? angle : -angle, axes[axis]);
 		}
 	}
 }
 
-/**************************************************************
-* Description
-*		Returns the rotation matrix based based on the current state.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-glm::mat4 Model::getModelMatrix()
-{
-	rotateX();
-	rotateY();
-	rotateZ();
-
-	return
-		glm::translate(glm::mat4(1.0f), m_position) *
-		glm::translate(glm::mat4(1.0f), -m_center) *
-		glm::rotate(glm::mat4(1.0f), m_durations.m_xDuration * glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f))*
-		glm::rotate(glm::mat4(1.0f), m_durations.m_yDuration * glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f))*
-		glm::rotate(glm::mat4(1.0f), m_durations.m_zDuration * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f))*
-		glm::scale(glm::mat4(1.0f), m_scale)*
-		glm::translate(glm::mat4(1.0f), m_center);
-}
-
-/**************************************************************
-* Description
-*		Gets the duration by looking at current time and last time.
-* Returns
-*		duration
-* Notes
-*
-**************************************************************/
-float Model::getDuration(StdTime &lastTime)
-{
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float duration = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastTime).count();
-	lastTime = currentTime;
-	return duration;
-}
-
 /**************************************************************
 * Description
 *		Sets the state of the key for x axis rotation
@@ -163,7 +84,6 @@ float Model::getDuration(StdTime &lastTime)
 void Model::setXKeyPressed(bool fKeyPressed)
 {
 	m_fKeyPressed[0] = fKeyPressed;
-	m_lastUpdateTime[0] = std::chrono::high_resolution_clock::now();
 }
 
 /**************************************************************
@@ -177,7 +97,6 @@ void Model::setXKeyPressed(bool fKeyPressed)
 void Model::setYKeyPressed(bool fKeyPressed)
 {
 	m_fKeyPressed[1] = fKeyPressed;
-	m_lastUpdateTime[1] = std::chrono::high_resolution_clock::now();
 }
 
 /**************************************************************
@@ -191,7 +110,6 @@ void Model::setYKeyPressed(bool fKeyPressed)
 void Model::setZKeyPressed(bool fKeyPressed)
 {
 	m_fKeyPressed[2] = fKeyPressed;
-	m_lastUpdateTime[2] = std::chrono::high_resolution_clock::now();
 }
 
 /**************************************************************
@@ -239,6 +157,9 @@ void Model::fZDirectionPositive(bool fPositive)
 * Returns
 *		void
 * Notes
+*		The model is drawn with a single material, the first
+*		one of its material library. Its texture path is
+*		relative to the directory of the obj file.
 *
 **************************************************************/
 void Model::loadModel()
@@ -248,11 +169,28 @@ void Model::loadModel()
 	std::vector<tinyobj::material_t> materials;
 	std::string err;
 
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, m_modelPath.c_str()))
+	std::string baseDirectory;
+	size_t separator = m_modelPath.find_last_of("/\\");
+	if (std::string::npos != separator)
+	{
+		baseDirectory = m_modelPath.substr(0, separator + 1);
+	}
+
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &err, m_modelPath.c_str(), baseDirectory.c_str()))
 	{
 		throw std::runtime_error(err);
 	}
 
+	if (!materials.empty())
+	{
+		const tinyobj::material_t &material = materials[0];
+		m_diffuseColor = glm::vec3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+		if (!material.diffuse_texname.empty() && m_diffuseTexturePath.empty())
+		{
+			m_diffuseTexturePath = baseDirectory + material.diffuse_texname;
+		}
+	}
+
 	std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
 	for (const auto& shape : shapes)
 	{
@@ -279,6 +217,14 @@ void Model::loadModel()
 					attrib.normals[3 * index.normal_index + 2] };
 			}
 
+			if (m_vertices.empty())
+			{
+				m_boundsMin = vertex.m_position;
+				m_boundsMax = vertex.m_position;
+			}
+			m_boundsMin = glm::min(m_boundsMin, vertex.m_position);
+			m_boundsMax = glm::max(m_boundsMax, vertex.m_position);
+
 			vertex.m_color = { 1.0f, 0.0f, 0.0f };
 			if (0 == uniqueVertices.count(vertex))
 			{
@@ -296,13 +242,16 @@ void Model::loadModel()
 * Returns
 *		void
 * Notes
+*		The staging buffer is released by the deletion queue
+*		once the copy has completed.
 *
 **************************************************************/
 void Model::createVertexBuffer(
 	VkDevice vkDevice,
 	VkPhysicalDevice vkPhysicalDevice,
 	VkCommandPool vkCommandPool,
-	VkQueue vkQueue)
+	Timeline &timeline,
+	DeletionQueue &deletionQueue)
 {
 	uint32_t size = sizeof(m_vertices[0]) * m_vertices.size();
 	VkBuffer stagingBuffer;
@@ -328,9 +277,9 @@ void Model::createVertexBuffer(
 		m_vkVertexBuffer,
 		m_vkVertexBufferMemory);
 
-	copyBuffer(vkDevice, vkCommandPool, vkQueue, stagingBuffer, m_vkVertexBuffer, size);
-	vkDestroyBuffer(vkDevice, stagingBuffer, nullptr);
-	vkFreeMemory(vkDevice, stagingMemory, nullptr);
+	uint64_t value = copyBuffer(vkDevice, vkCommandPool, timeline, stagingBuffer, m_vkVertexBuffer, size, deletionQueue);
+	deletionQueue.enqueueBuffer(value, stagingBuffer);
+	deletionQueue.enqueueMemory(value, stagingMemory);
 }
 
 
@@ -346,7 +295,8 @@ void Model::createIndexBuffer(
 	VkDevice vkDevice,
 	VkPhysicalDevice vkPhysicalDevice,
 	VkCommandPool vkCommandPool,
-	VkQueue vkQueue)
+	Timeline &timeline,
+	DeletionQueue &deletionQueue)
 {
 	uint32_t size = sizeof(m_indices[0]) * m_indices.size();
 	VkBuffer stagingBuffer;
@@ -372,31 +322,9 @@ void Model::createIndexBuffer(
 		m_vkIndexBuffer,
 		m_vkIndexBufferMemory);
 
-	copyBuffer(vkDevice, vkCommandPool, vkQueue, stagingBuffer, m_vkIndexBuffer, size);
-	vkDestroyBuffer(vkDevice, stagingBuffer, nullptr);
-	vkFreeMemory(vkDevice, stagingMemory, nullptr);
-}
-
-/**************************************************************
-* Description
-*		Creates uniform buffer and memory associated with it.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void Model::createUniformBuffer(
-	VkDevice vkDevice,
-	VkPhysicalDevice vkPhysicalDevice)
-{
-	uint32_t size = sizeof(UniformBufferObject);
-	createBuffer(vkDevice,
-		vkPhysicalDevice,
-		size,
-		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		m_vkUniformBuffer,
-		m_vkUniformBufferMemory);
+	uint64_t value = copyBuffer(vkDevice, vkCommandPool, timeline, stagingBuffer, m_vkIndexBuffer, size, deletionQueue);
+	deletionQueue.enqueueBuffer(value, stagingBuffer);
+	deletionQueue.enqueueMemory(value, stagingMemory);
 }
 
 /**************************************************************
@@ -413,34 +341,4 @@ void Model::cleanup(VkDevice vkDevice)
 	vkFreeMemory(vkDevice, m_vkVertexBufferMemory, nullptr);
 	vkDestroyBuffer(vkDevice, m_vkIndexBuffer, nullptr);
 	vkFreeMemory(vkDevice, m_vkIndexBufferMemory, nullptr);
-	vkDestroyBuffer(vkDevice, m_vkUniformBuffer, nullptr);
-	vkFreeMemory(vkDevice, m_vkUniformBufferMemory, nullptr);
-}
-
-
-/**************************************************************
-* Description
-*		Translates the object by given vector.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void Model::translate(glm::vec3 translationVector)
-{
-	m_position += translationVector;
 }
-
-/**************************************************************
-* Description
-*		Sets the center for the model. We will use the center to
-*		ensure that rotation happens around this axis.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void Model::setCenter(glm::vec3 centerVector)
-{
-	m_center = centerVector;
-}
\ No newline at end of file
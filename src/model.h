@@ -7,6 +7,7 @@
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include<iostream>
 #include<chrono>
 
@@ -16,17 +17,6 @@ typedef std::chrono::time_point<std::chrono::steady_clock> StdTime;
 #include<array>
 #include<vector>
 
-// We keep this structure to keep track of durations for
-// rotations in each axis.
-// TODO : Consider using glm for this.
-//
-struct DurationForRotation
-{
-	float m_xDuration;
-	float m_yDuration;
-	float m_zDuration;
-};
-
 struct Vertex
 {
 	glm::vec3 m_position;
@@ -76,11 +66,59 @@ struct Vertex
 	}
 };
 
+// Per-frame data shared by every draw.
+//
 struct UniformBufferObject
 {
-	glm::mat4 m_model;
 	glm::mat4 m_view;
 	glm::mat4 m_proj;
+	glm::mat4 m_viewProj;
+};
+
+// Per-draw data pushed inline into the command buffer. Must stay
+// within the 128 bytes of push constant space guaranteed by Vulkan.
+// Both matrices are computed on the CPU once per object.
+//
+struct PushConstantObject
+{
+	glm::mat4 m_mvp;
+	glm::mat3x4 m_normalMatrix; // mat3 in GLSL, whose columns are padded to vec4.
+};
+
+// Index into the material table, pushed to the fragment shader after
+// the transforms.
+//
+struct MaterialPushConstant
+{
+	uint32_t m_materialIndex;
+};
+
+static_assert(
+	sizeof(PushConstantObject) + sizeof(MaterialPushConstant) <= 128,
+	"Push constants exceed the guaranteed minimum size.");
+
+// Texture index of a material that has no texture.
+//
+const uint32_t NO_TEXTURE = 0xFFFFFFFF;
+
+// Virtual texture index of a material that has no virtual texture.
+//
+const uint32_t NO_VIRTUAL_TEXTURE = 0xFFFFFFFF;
+
+// Texture rectangle of a material whose texture fills its image.
+//
+const glm::vec4 FULL_UV_RECT = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+
+// An entry of the material table, laid out as the std430 structure the
+// fragment shaders read.
+//
+struct Material
+{
+	glm::vec4 m_baseColor; // Multiplied with the vertex or texture color.
+	glm::vec4 m_uvRect; // Offset in xy and size in zw of the texture in its image, FULL_UV_RECT unless in an atlas.
+	uint32_t m_textureIndex; // Into the bindless texture array, or NO_TEXTURE.
+	uint32_t m_virtualTextureIndex; // Sampled instead of the texture unless NO_VIRTUAL_TEXTURE.
+	uint32_t m_padding[2];
 };
 
 namespace std
@@ -96,18 +134,21 @@ namespace std
 }
 
 
-// Keeps track of the state of a model.
+class Scene;
+
+// Keeps track of the state of a model. Its transform lives in the
+// scene, in the node the model is attached to.
 //
 class Model
 {
 public:
 	Model();
 	~Model();
-	void rotateX();
-	void rotateY();
-	void rotateZ();
-	float getDuration(StdTime &lastTime);
-	glm::mat4 getModelMatrix();
+	void update(Scene &scene, float deltaTime);
+	void setSceneNode(uint32_t sceneNode) { m_sceneNode = sceneNode; }
+	uint32_t getSceneNode() const { return m_sceneNode; }
+	const glm::vec3 &getBoundsMin() const { return m_boundsMin; }
+	const glm::vec3 &getBoundsMax() const { return m_boundsMax; }
 	void setXKeyPressed(bool fKeyPressed);
 	void fXDirectionPositive(bool fPositive);
 	void setYKeyPressed(bool fKeyPressed);
@@ -115,24 +156,33 @@ public:
 	void setZKeyPressed(bool fKeyPressed);
 	void fZDirectionPositive(bool fPositive);
 	void loadModel();
-	void createVertexBuffer(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice, VkCommandPool vkCommandPool, VkQueue vkQueue);
-	void createIndexBuffer(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice, VkCommandPool vkCommandPool, VkQueue vkQueue);
-	void createUniformBuffer(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice);
+	void createVertexBuffer(
+		VkDevice vkDevice,
+		VkPhysicalDevice vkPhysicalDevice,
+		VkCommandPool vkCommandPool,
+		Timeline &timeline,
+		DeletionQueue &deletionQueue);
+	void createIndexBuffer(
+		VkDevice vkDevice,
+		VkPhysicalDevice vkPhysicalDevice,
+		VkCommandPool vkCommandPool,
+		Timeline &timeline,
+		DeletionQueue &deletionQueue);
 	void cleanup(VkDevice vkDevice);
-	void translate(glm::vec3 translationVector);
-	void setCenter(glm::vec3 center);
 	VkBuffer getVertexBuffer() { return m_vkVertexBuffer; }
 	VkBuffer getIndexBuffer() { return m_vkIndexBuffer; }
-	VkBuffer getUniformBuffer() { return m_vkUniformBuffer; }
-	VkDeviceMemory getUniformBufferMemory() { return m_vkUniformBufferMemory; }
 	uint32_t getIndicesSize() { return static_cast<uint32_t>(m_indices.size()); }
 	void setModelPath(std::string modelPath) { m_modelPath = modelPath; }
-	void setGraphicsPipeline(VkPipeline pipeline) { m_vkGraphicsPipeline = pipeline; }
-	VkPipeline getGraphicsPipeline() { return m_vkGraphicsPipeline; }
-	void setScale(glm::vec3 scale) { m_scale = scale; }
+	void setPipelineIndex(uint32_t pipelineIndex) { m_pipelineIndex = pipelineIndex; }
+	uint32_t getPipelineIndex() const { return m_pipelineIndex; }
+	void setMaterialIndex(uint32_t materialIndex) { m_materialIndex = materialIndex; }
+	uint32_t getMaterialIndex() const { return m_materialIndex; }
+	void setDiffuseTexturePath(std::string diffuseTexturePath) { m_diffuseTexturePath = diffuseTexturePath; }
+	const std::string &getDiffuseTexturePath() const { return m_diffuseTexturePath; }
+	const glm::vec3 &getDiffuseColor() const { return m_diffuseColor; }
+	void setVirtualTexturePath(std::string virtualTexturePath) { m_virtualTexturePath = virtualTexturePath; }
+	const std::string &getVirtualTexturePath() const { return m_virtualTexturePath; }
 private:
-	DurationForRotation m_durations;
-	StdTime m_lastUpdateTime[3];
 	bool m_fKeyPressed[3];
 	bool m_fDirectionPositive[3];
 	std::vector<Vertex> m_vertices;
@@ -141,12 +191,14 @@ private:
 	VkDeviceMemory m_vkVertexBufferMemory;
 	VkBuffer m_vkIndexBuffer;
 	VkDeviceMemory m_vkIndexBufferMemory;
-	VkBuffer m_vkUniformBuffer;
-	VkDeviceMemory m_vkUniformBufferMemory;
 	std::string m_modelPath;
-	glm::vec3 m_position;
-	glm::vec3 m_center;
-	glm::vec3 m_scale;
-	VkPipeline m_vkGraphicsPipeline;
+	uint32_t m_sceneNode;
+	glm::vec3 m_boundsMin; // Bounding box of the vertices in model space.
+	glm::vec3 m_boundsMax;
+	uint32_t m_pipelineIndex; // Index of the graphics pipeline the model is drawn with.
+	uint32_t m_materialIndex; // Index into the material table, pushed with every draw.
+	std::string m_diffuseTexturePath; // Set before loading, or from the material library of the obj file. Empty if none.
+	glm::vec3 m_diffuseColor;
+	std::string m_virtualTexturePath; // Sampled through the virtual texture system, empty if none.
 };
 
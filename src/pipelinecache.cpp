@@ -0,0 +1,224 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+#include "pipelinecache.h"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+const uint32_t PIPELINE_CACHE_FILE_MAGIC = 0x43504B56; // "VKPC"
+const uint32_t PIPELINE_CACHE_FILE_VERSION = 1;
+
+// Written in front of the data returned by vkGetPipelineCacheData.
+//
+struct PipelineCacheFileHeader
+{
+	uint32_t m_magic;
+	uint32_t m_version;
+	uint32_t m_vendorId;
+	uint32_t m_deviceId;
+	uint32_t m_driverVersion;
+	uint8_t m_pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t m_dataSize;
+};
+
+// The header Vulkan puts at the start of the cache data itself.
+//
+struct VulkanPipelineCacheHeader
+{
+	uint32_t m_headerSize;
+	uint32_t m_headerVersion;
+	uint32_t m_vendorId;
+	uint32_t m_deviceId;
+	uint8_t m_pipelineCacheUUID[VK_UUID_SIZE];
+};
+
+/**************************************************************
+* Description
+*		Replaces the destination file with the source file.
+* Returns
+*		true on success.
+* Notes
+*		The replacement is atomic, readers see either the old or
+*		the new file, never a partially written one.
+*
+**************************************************************/
+static bool replaceFile(const std::string &source, const std::string &destination)
+{
+#ifdef _WIN32
+	return 0 != MoveFileExA(source.c_str(), destination.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+	return 0 == std::rename(source.c_str(), destination.c_str());
+#endif
+}
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+PipelineCache::PipelineCache()
+	:m_vkDevice(VK_NULL_HANDLE),
+	m_vkPipelineCache(VK_NULL_HANDLE),
+	m_fLoadedFromDisk(false)
+{
+	memset(&m_deviceProperties, 0, sizeof(m_deviceProperties));
+}
+
+/**************************************************************
+* Description
+*		Creates the pipeline cache, with the data from the file
+*		if it was written for the same device and driver.
+* Returns
+*		void
+* Notes
+*		A missing, truncated or stale file starts an empty cache.
+*
+**************************************************************/
+void PipelineCache::create(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice, const std::string &path)
+{
+	m_vkDevice = vkDevice;
+	m_path = path;
+	vkGetPhysicalDeviceProperties(vkPhysicalDevice, &m_deviceProperties);
+
+	std::vector<char> data;
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (file.is_open())
+	{
+		size_t fileSize = static_cast<size_t>(file.tellg());
+		PipelineCacheFileHeader header = {};
+		file.seekg(0);
+		if (fileSize >= sizeof(header) && file.read(reinterpret_cast<char*>(&header), sizeof(header)))
+		{
+			bool fValid =
+				PIPELINE_CACHE_FILE_MAGIC == header.m_magic &&
+				PIPELINE_CACHE_FILE_VERSION == header.m_version &&
+				m_deviceProperties.vendorID == header.m_vendorId &&
+				m_deviceProperties.deviceID == header.m_deviceId &&
+				m_deviceProperties.driverVersion == header.m_driverVersion &&
+				0 == memcmp(m_deviceProperties.pipelineCacheUUID, header.m_pipelineCacheUUID, VK_UUID_SIZE) &&
+				fileSize - sizeof(header) == header.m_dataSize;
+
+			if (fValid)
+			{
+				data.resize(static_cast<size_t>(header.m_dataSize));
+				if (!file.read(data.data(), data.size()))
+				{
+					data.clear();
+				}
+			}
+		}
+
+		// Check the header of the data itself as well, in case the
+		// file was written by something else.
+		//
+		VulkanPipelineCacheHeader vulkanHeader = {};
+		if (data.size() >= sizeof(vulkanHeader))
+		{
+			memcpy(&vulkanHeader, data.data(), sizeof(vulkanHeader));
+		}
+		if (VK_PIPELINE_CACHE_HEADER_VERSION_ONE != vulkanHeader.m_headerVersion ||
+			m_deviceProperties.vendorID != vulkanHeader.m_vendorId ||
+			m_deviceProperties.deviceID != vulkanHeader.m_deviceId ||
+			0 != memcmp(m_deviceProperties.pipelineCacheUUID, vulkanHeader.m_pipelineCacheUUID, VK_UUID_SIZE))
+		{
+			std::cout << "Ignoring pipeline cache " << path << ", it was written for another device or driver." << std::endl;
+			data.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo cacheInfo = {};
+	cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize = data.size();
+	cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+	if (VK_SUCCESS != vkCreatePipelineCache(m_vkDevice, &cacheInfo, nullptr, &m_vkPipelineCache))
+	{
+		throw std::runtime_error("Could not create pipeline cache.");
+	}
+	m_fLoadedFromDisk = !data.empty();
+}
+
+/**************************************************************
+* Description
+*		Writes the contents of the cache to its file.
+* Returns
+*		void
+* Notes
+*		The data goes to a temporary file first, which then
+*		replaces the old one, so a crash while saving cannot leave
+*		a corrupt cache behind. Failing to save is not fatal.
+*
+**************************************************************/
+void PipelineCache::save()
+{
+	if (VK_NULL_HANDLE == m_vkPipelineCache)
+	{
+		return;
+	}
+
+	size_t dataSize = 0;
+	if (VK_SUCCESS != vkGetPipelineCacheData(m_vkDevice, m_vkPipelineCache, &dataSize, nullptr) || 0 == dataSize)
+	{
+		return;
+	}
+
+	std::vector<char> data(dataSize);
+	if (VK_SUCCESS != vkGetPipelineCacheData(m_vkDevice, m_vkPipelineCache, &dataSize, data.data()))
+	{
+		return;
+	}
+
+	PipelineCacheFileHeader header = {};
+	header.m_magic = PIPELINE_CACHE_FILE_MAGIC;
+	header.m_version = PIPELINE_CACHE_FILE_VERSION;
+	header.m_vendorId = m_deviceProperties.vendorID;
+	header.m_deviceId = m_deviceProperties.deviceID;
+	header.m_driverVersion = m_deviceProperties.driverVersion;
+	memcpy(header.m_pipelineCacheUUID, m_deviceProperties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.m_dataSize = dataSize;
+
+	std::string temporaryPath = m_path + ".tmp";
+	{
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), dataSize);
+		file.flush();
+		if (!file)
+		{
+			std::cout << "Could not write pipeline cache " << temporaryPath << std::endl;
+			return;
+		}
+	}
+
+	if (!replaceFile(temporaryPath, m_path))
+	{
+		std::cout << "Could not replace pipeline cache " << m_path << std::endl;
+		std::remove(temporaryPath.c_str());
+	}
+}
+
+/**************************************************************
+* Description
+*		Destroys the pipeline cache.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void PipelineCache::destroy()
+{
+	if (VK_NULL_HANDLE != m_vkPipelineCache)
+	{
+		vkDestroyPipelineCache(m_vkDevice, m_vkPipelineCache, nullptr);
+		m_vkPipelineCache = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include<string>
+
+// A VkPipelineCache persisted to a file between runs. The file starts with
+// a header identifying the device and driver the data was created by, and
+// is ignored if either has changed since.
+//
+class PipelineCache
+{
+public:
+	PipelineCache();
+	void create(VkDevice vkDevice, VkPhysicalDevice vkPhysicalDevice, const std::string &path);
+	void save();
+	void destroy();
+	VkPipelineCache get() const { return m_vkPipelineCache; }
+	bool fLoadedFromDisk() const { return m_fLoadedFromDisk; }
+private:
+	VkDevice m_vkDevice;
+	VkPhysicalDeviceProperties m_deviceProperties;
+	VkPipelineCache m_vkPipelineCache;
+	std::string m_path;
+	bool m_fLoadedFromDisk;
+};
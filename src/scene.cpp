@@ -0,0 +1,378 @@
+#include "scene.h"
+#include "transform.h"
+
+// Nodes handed to a worker thread at a time. Smaller batches cost more
+// in scheduling than they gain from running in parallel.
+//
+const size_t SCENE_UPDATE_BATCH_SIZE = 1024;
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+Scene::Scene()
+	:m_fLevelsDirty(false)
+{
+}
+
+/**************************************************************
+* Description
+*		Reserves storage for the given number of nodes.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::reserve(size_t nodeCount)
+{
+	m_positions.reserve(nodeCount);
+	m_centers.reserve(nodeCount);
+	m_orientations.reserve(nodeCount);
+	m_scales.reserve(nodeCount);
+	m_parents.reserve(nodeCount);
+	m_depths.reserve(nodeCount);
+	m_dirty.reserve(nodeCount);
+	m_changed.reserve(nodeCount);
+	m_localMatrices.reserve(nodeCount);
+	m_worldMatrices.reserve(nodeCount);
+	m_localBoundsMin.reserve(nodeCount);
+	m_localBoundsMax.reserve(nodeCount);
+	m_worldBoundsMin.reserve(nodeCount);
+	m_worldBoundsMax.reserve(nodeCount);
+	m_dirtyNodes.reserve(nodeCount);
+}
+
+/**************************************************************
+* Description
+*		Adds a node with an identity transform under the given
+*		parent.
+* Returns
+*		The index of the new node.
+* Notes
+*		The parent has to be added before its children.
+*
+**************************************************************/
+uint32_t Scene::addNode(uint32_t parent)
+{
+	uint32_t node = static_cast<uint32_t>(m_positions.size());
+	if (INVALID_SCENE_NODE != parent && parent >= node)
+	{
+		throw std::runtime_error("Scene node parent must be added before its children.");
+	}
+
+	m_positions.push_back(glm::vec3(0.0f));
+	m_centers.push_back(glm::vec3(0.0f));
+	m_orientations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+	m_scales.push_back(glm::vec3(1.0f));
+	m_parents.push_back(parent);
+	m_depths.push_back(INVALID_SCENE_NODE == parent ? 0 : m_depths[parent] + 1);
+	m_dirty.push_back(0);
+	m_changed.push_back(0);
+	m_localMatrices.push_back(glm::mat4(1.0f));
+	m_worldMatrices.push_back(glm::mat4(1.0f));
+	m_localBoundsMin.push_back(glm::vec3(0.0f));
+	m_localBoundsMax.push_back(glm::vec3(0.0f));
+	m_worldBoundsMin.push_back(glm::vec3(0.0f));
+	m_worldBoundsMax.push_back(glm::vec3(0.0f));
+	markDirty(node);
+
+	if (INVALID_SCENE_NODE != parent)
+	{
+		m_fLevelsDirty = true;
+	}
+	return node;
+}
+
+/**************************************************************
+* Description
+*		Queues the node for the next update.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::markDirty(uint32_t node)
+{
+	if (0 == m_dirty[node])
+	{
+		m_dirty[node] = 1;
+		m_dirtyNodes.push_back(node);
+	}
+}
+
+/**************************************************************
+* Description
+*		Sets the position of the node relative to its parent.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::setPosition(uint32_t node, const glm::vec3 &position)
+{
+	m_positions[node] = position;
+	markDirty(node);
+}
+
+/**************************************************************
+* Description
+*		Translates the node by given vector.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::translate(uint32_t node, const glm::vec3 &translation)
+{
+	m_positions[node] += translation;
+	markDirty(node);
+}
+
+/**************************************************************
+* Description
+*		Sets the center the node rotates and scales around.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::setCenter(uint32_t node, const glm::vec3 &center)
+{
+	m_centers[node] = center;
+	markDirty(node);
+}
+
+/**************************************************************
+* Description
+*		Sets the scale of the node.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::setScale(uint32_t node, const glm::vec3 &scale)
+{
+	m_scales[node] = scale;
+	markDirty(node);
+}
+
+/**************************************************************
+* Description
+*		Sets the orientation of the node.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::setOrientation(uint32_t node, const glm::quat &orientation)
+{
+	m_orientations[node] = orientation;
+	markDirty(node);
+}
+
+/**************************************************************
+* Description
+*		Rotates the node around the given axis in its local space.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::rotate(uint32_t node, float angle, const glm::vec3 &axis)
+{
+	m_orientations[node] = glm::normalize(m_orientations[node] * glm::angleAxis(angle, axis));
+	markDirty(node);
+}
+
+/**************************************************************
+* Description
+*		Sets the bounding box of the node in its local space.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::setLocalBounds(uint32_t node, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax)
+{
+	m_localBoundsMin[node] = boundsMin;
+	m_localBoundsMax[node] = boundsMax;
+	markDirty(node);
+}
+
+/**************************************************************
+* Description
+*		Groups the child nodes by their depth in the hierarchy,
+*		so each level can be updated in parallel once the level
+*		above it is done.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::buildLevels()
+{
+	m_levels.clear();
+	for (uint32_t node = 0; node < m_depths.size(); ++node)
+	{
+		uint32_t depth = m_depths[node];
+		if (0 == depth)
+		{
+			continue;
+		}
+
+		if (m_levels.size() < depth)
+		{
+			m_levels.resize(depth);
+		}
+		m_levels[depth - 1].push_back(node);
+	}
+	m_fLevelsDirty = false;
+}
+
+/**************************************************************
+* Description
+*		Transforms the local bounding box of the node into world
+*		space.
+* Returns
+*		void
+* Notes
+*		The result is the box enclosing the transformed box.
+*
+**************************************************************/
+void Scene::updateWorldBounds(uint32_t node)
+{
+	const glm::mat4 &world = m_worldMatrices[node];
+	glm::vec3 center = (m_localBoundsMin[node] + m_localBoundsMax[node]) * 0.5f;
+	glm::vec3 extent = (m_localBoundsMax[node] - m_localBoundsMin[node]) * 0.5f;
+	glm::vec3 worldCenter = glm::vec3(world * glm::vec4(center, 1.0f));
+	glm::vec3 worldExtent =
+		glm::abs(glm::vec3(world[0])) * extent.x +
+		glm::abs(glm::vec3(world[1])) * extent.y +
+		glm::abs(glm::vec3(world[2])) * extent.z;
+	m_worldBoundsMin[node] = worldCenter - worldExtent;
+	m_worldBoundsMax[node] = worldCenter + worldExtent;
+}
+
+/**************************************************************
+* Description
+*		Runs the function over [0, count), split across the
+*		thread pool if there is one and the range is large
+*		enough.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void Scene::updateNodes(
+	ThreadPool *pThreadPool,
+	size_t count,
+	const std::function<void(size_t begin, size_t end)> &function)
+{
+	if (nullptr == pThreadPool || count <= SCENE_UPDATE_BATCH_SIZE)
+	{
+		function(0, count);
+		return;
+	}
+
+	pThreadPool->parallelFor(count, SCENE_UPDATE_BATCH_SIZE, [&function](size_t, size_t begin, size_t end)
+	{
+		function(begin, end);
+	});
+}
+
+/**************************************************************
+* Description
+*		Rebuilds the local matrices of the nodes modified since
+*		the last update and the world matrices and bounds of
+*		those nodes and everything below them.
+* Returns
+*		The nodes whose world matrix changed.
+* Notes
+*		The local matrices are independent of each other and are
+*		built in parallel. World matrices are built one level of
+*		the hierarchy at a time, each level in parallel, since a
+*		child needs the world matrix of its parent.
+*		Pass a null thread pool to run on the calling thread.
+*
+**************************************************************/
+const std::vector<uint32_t> &Scene::update(ThreadPool *pThreadPool)
+{
+	for (uint32_t node : m_changedNodes)
+	{
+		m_changed[node] = 0;
+	}
+	m_changedNodes.clear();
+
+	if (m_fLevelsDirty)
+	{
+		buildLevels();
+	}
+
+	updateNodes(pThreadPool, m_dirtyNodes.size(), [this](size_t begin, size_t end)
+	{
+		composeLocalMatrices(
+			m_positions.data(),
+			m_centers.data(),
+			m_orientations.data(),
+			m_scales.data(),
+			m_dirtyNodes.data() + begin,
+			end - begin,
+			m_localMatrices.data());
+
+		for (size_t i = begin; i < end; ++i)
+		{
+			uint32_t node = m_dirtyNodes[i];
+			if (INVALID_SCENE_NODE == m_parents[node])
+			{
+				m_worldMatrices[node] = m_localMatrices[node];
+				m_changed[node] = 1;
+				updateWorldBounds(node);
+			}
+		}
+	});
+
+	for (uint32_t node : m_dirtyNodes)
+	{
+		if (INVALID_SCENE_NODE == m_parents[node])
+		{
+			m_changedNodes.push_back(node);
+		}
+	}
+
+	for (const auto &level : m_levels)
+	{
+		updateNodes(pThreadPool, level.size(), [this, &level](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				uint32_t node = level[i];
+				uint32_t parent = m_parents[node];
+				if (0 != m_dirty[node] || 0 != m_changed[parent])
+				{
+					multiplyMatrices(m_worldMatrices[parent], m_localMatrices[node], m_worldMatrices[node]);
+					m_changed[node] = 1;
+					updateWorldBounds(node);
+				}
+			}
+		});
+
+		for (uint32_t node : level)
+		{
+			if (0 != m_changed[node])
+			{
+				m_changedNodes.push_back(node);
+			}
+		}
+	}
+
+	for (uint32_t node : m_dirtyNodes)
+	{
+		m_dirty[node] = 0;
+	}
+	m_dirtyNodes.clear();
+	return m_changedNodes;
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "model.h"
+#include "threadpool.h"
+#include<vector>
+
+const uint32_t INVALID_SCENE_NODE = 0xFFFFFFFF;
+
+// Transform hierarchy of the scene stored as a structure of arrays, one
+// array per component indexed by node, so the per-frame update can walk
+// contiguous memory and process several nodes per SIMD instruction.
+// A parent always has a lower index than its children.
+//
+class Scene
+{
+public:
+	Scene();
+	void reserve(size_t nodeCount);
+	uint32_t addNode(uint32_t parent = INVALID_SCENE_NODE);
+	size_t getNodeCount() const { return m_positions.size(); }
+	void setPosition(uint32_t node, const glm::vec3 &position);
+	void translate(uint32_t node, const glm::vec3 &translation);
+	void setCenter(uint32_t node, const glm::vec3 &center);
+	void setScale(uint32_t node, const glm::vec3 &scale);
+	void setOrientation(uint32_t node, const glm::quat &orientation);
+	void rotate(uint32_t node, float angle, const glm::vec3 &axis);
+	void setLocalBounds(uint32_t node, const glm::vec3 &boundsMin, const glm::vec3 &boundsMax);
+	uint32_t getParent(uint32_t node) const { return m_parents[node]; }
+	const glm::mat4 &getWorldMatrix(uint32_t node) const { return m_worldMatrices[node]; }
+	const glm::vec3 &getWorldBoundsMin(uint32_t node) const { return m_worldBoundsMin[node]; }
+	const glm::vec3 &getWorldBoundsMax(uint32_t node) const { return m_worldBoundsMax[node]; }
+	bool fWorldMatrixChanged(uint32_t node) const { return 0 != m_changed[node]; }
+	const std::vector<uint32_t> &update(ThreadPool *pThreadPool);
+private:
+	void markDirty(uint32_t node);
+	void buildLevels();
+	void updateWorldBounds(uint32_t node);
+	void updateNodes(
+		ThreadPool *pThreadPool,
+		size_t count,
+		const std::function<void(size_t begin, size_t end)> &function);
+
+	// Per node components.
+	std::vector<glm::vec3> m_positions;
+	std::vector<glm::vec3> m_centers;
+	std::vector<glm::quat> m_orientations;
+	std::vector<glm::vec3> m_scales;
+	std::vector<uint32_t> m_parents;
+	std::vector<uint32_t> m_depths;
+	std::vector<uint8_t> m_dirty; // Local components changed since the last update.
+	std::vector<uint8_t> m_changed; // World matrix changed by the last update.
+	std::vector<glm::mat4> m_localMatrices;
+	std::vector<glm::mat4> m_worldMatrices;
+	std::vector<glm::vec3> m_localBoundsMin;
+	std::vector<glm::vec3> m_localBoundsMax;
+	std::vector<glm::vec3> m_worldBoundsMin;
+	std::vector<glm::vec3> m_worldBoundsMax;
+
+	std::vector<uint32_t> m_dirtyNodes;
+	std::vector<std::vector<uint32_t>> m_levels; // Child nodes grouped by depth, starting at depth one.
+	bool m_fLevelsDirty;
+	std::vector<uint32_t> m_changedNodes;
+};
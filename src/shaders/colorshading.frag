@@ -6,10 +6,27 @@ layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 normal;
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 1) uniform sampler2D texSampler;
+struct Material
+{
+	vec4 baseColor;
+	vec4 uvRect;
+	uint textureIndex;
+	uint virtualTextureIndex;
+};
+
+layout(set = 1, binding = 0) readonly buffer MaterialTable
+{
+	Material materials[];
+};
+
+layout(push_constant) uniform MaterialPushConstant
+{
+	layout(offset = 112) uint materialIndex;
+} pushConstants;
 
 vec3 lightVector = vec3(0.0f, 0.0f, -1.0f);
 void main()
 {
-	outColor = vec4(max(0.0f, dot(lightVector, normal)) * fragColor, 1.0f) + vec4(fragColor, 1.0f) * 0.3f;
+	vec4 color = vec4(fragColor, 1.0f) * materials[pushConstants.materialIndex].baseColor;
+	outColor = max(0.0f, dot(lightVector, normal)) * color + color * 0.3f;
 }
\ No newline at end of file
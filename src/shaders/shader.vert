@@ -1,13 +1,19 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 0) uniform UniformBufferObject
+layout(set = 0, binding = 0) uniform UniformBufferObject
 {
-	mat4 model;
 	mat4 view;
 	mat4 proj;
+	mat4 viewProj;
 }  ubo;
 
+layout(push_constant) uniform PushConstantObject
+{
+	mat4 mvp;
+	mat3 normalMatrix;
+} pushConstants;
+
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
@@ -24,12 +30,8 @@ out gl_PerVertex
 
 void main()
 {
-	mat4 mvp = ubo.proj * ubo.view * ubo.model;
-	mat3 normalMatrix = mat3(mvp);
-	normalMatrix = inverse(normalMatrix);
-	normalMatrix = transpose(normalMatrix);
-	gl_Position = mvp * vec4(inPosition, 1.0);
+	gl_Position = pushConstants.mvp * vec4(inPosition, 1.0);
 	fragColor = inColor;
 	fragTexCoord = inTexCoord;
-	normal = normalize(normalMatrix * inNormal);
+	normal = normalize(pushConstants.normalMatrix * inNormal);
 }
\ No newline at end of file
@@ -1,16 +1,55 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "virtualtexture.glsl"
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 normal;
 layout(location = 0) out vec4 outColor;
 
-layout(binding = 1) uniform sampler2D texSampler;
+struct Material
+{
+	vec4 baseColor;
+	vec4 uvRect;
+	uint textureIndex;
+	uint virtualTextureIndex;
+};
+
+layout(set = 1, binding = 0) readonly buffer MaterialTable
+{
+	Material materials[];
+};
+
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+layout(push_constant) uniform MaterialPushConstant
+{
+	layout(offset = 112) uint materialIndex;
+} pushConstants;
 
 vec3 lightVector = vec3(0.0f, 0.0f, -1.0f);
 void main()
 {
-	vec4 color = texture(texSampler, fragTexCoord);	
+	Material material = materials[pushConstants.materialIndex];
+	vec4 color;
+	if (NO_VIRTUAL_TEXTURE != material.virtualTextureIndex)
+	{
+		color = sampleVirtual(material.virtualTextureIndex, fragTexCoord) * material.baseColor;
+	}
+	else
+	{
+		// The coordinates repeat within the rectangle of the texture,
+		// which is the whole image unless it is in an atlas. Gradients
+		// of the unwrapped coordinates keep the seams from sampling the
+		// smallest level.
+		//
+		vec2 atlasCoord = material.uvRect.xy + fract(fragTexCoord) * material.uvRect.zw;
+		vec2 gradientX = dFdx(fragTexCoord) * material.uvRect.zw;
+		vec2 gradientY = dFdy(fragTexCoord) * material.uvRect.zw;
+		color = textureGrad(textures[material.textureIndex], atlasCoord, gradientX, gradientY) * material.baseColor;
+	}
 	outColor = max(0.0f, dot(lightVector, normal)) * color + color * 0.3;
 }
\ No newline at end of file
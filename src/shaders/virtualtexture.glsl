@@ -0,0 +1,72 @@
+// Sampling through the page table of the virtual texture system. Must
+// match the constants in virtualtexture.h.
+//
+const uint NO_VIRTUAL_TEXTURE = 0xFFFFFFFFu;
+const uint NO_PAGE_REQUEST = 0xFFFFFFFFu;
+const uint MAX_VIRTUAL_TEXTURES = 16u;
+const float VIRTUAL_PAGE_SIZE = 128.0;
+const float VIRTUAL_PAGE_BORDER = 4.0;
+const float VIRTUAL_PAGE_STRIDE = VIRTUAL_PAGE_SIZE + 2.0 * VIRTUAL_PAGE_BORDER;
+const float VIRTUAL_CACHE_SIZE = 16.0 * VIRTUAL_PAGE_STRIDE;
+
+layout(set = 2, binding = 0) uniform VirtualTextureParameters
+{
+	float feedbackLodBias;
+	uvec4 textures[MAX_VIRTUAL_TEXTURES]; // Width, height and level count.
+} virtualParameters;
+
+layout(set = 2, binding = 1) uniform sampler2D pageCache;
+layout(set = 2, binding = 2) uniform usampler2D indirection[MAX_VIRTUAL_TEXTURES];
+
+// The level the texture coordinates need, from their screen space
+// derivatives, clamped to the levels of the texture.
+//
+uint getVirtualLevel(uint textureIndex, vec2 texCoord, float lodBias)
+{
+	uvec4 info = virtualParameters.textures[textureIndex];
+	vec2 texels = texCoord * vec2(info.xy);
+	vec2 dx = dFdx(texels);
+	vec2 dy = dFdy(texels);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-8)) + lodBias;
+	return uint(clamp(lod, 0.0, float(info.z - 1u)));
+}
+
+// The page of the level covering the texture coordinates, which wrap.
+//
+uvec2 getVirtualPage(uint textureIndex, vec2 texCoord, uint level)
+{
+	uvec2 levelSize = max(virtualParameters.textures[textureIndex].xy >> level, uvec2(1u));
+	uvec2 texel = min(uvec2(fract(texCoord) * vec2(levelSize)), levelSize - 1u);
+	return texel / uint(VIRTUAL_PAGE_SIZE);
+}
+
+// The page request the feedback pass writes, packed as the CPU reads it.
+//
+uint getPageRequest(uint textureIndex, vec2 texCoord)
+{
+	uint level = getVirtualLevel(textureIndex, texCoord, virtualParameters.feedbackLodBias);
+	uvec2 page = getVirtualPage(textureIndex, texCoord, level);
+	return (textureIndex << 28) | (level << 24) | (page.y << 12) | page.x;
+}
+
+// Samples the texture from the page cache, at the level the indirection
+// maps the page to. Gray until the texture has any page resident. The
+// texture comes from the material of the draw, so the indirection array
+// is indexed with a dynamically uniform value.
+//
+vec4 sampleVirtual(uint textureIndex, vec2 texCoord)
+{
+	uint level = getVirtualLevel(textureIndex, texCoord, 0.0);
+	uvec2 page = getVirtualPage(textureIndex, texCoord, level);
+	uvec4 entry = texelFetch(indirection[textureIndex], ivec2(page), int(level));
+	if (0u == entry.w)
+	{
+		return vec4(0.5, 0.5, 0.5, 1.0);
+	}
+
+	vec2 mappedSize = vec2(max(virtualParameters.textures[textureIndex].xy >> entry.z, uvec2(1u)));
+	vec2 texel = fract(texCoord) * mappedSize;
+	vec2 inPage = texel - floor(min(texel, mappedSize - 1.0) / VIRTUAL_PAGE_SIZE) * VIRTUAL_PAGE_SIZE;
+	vec2 cacheTexel = vec2(entry.xy) * VIRTUAL_PAGE_STRIDE + VIRTUAL_PAGE_BORDER + inPage;
+	return textureLod(pageCache, cacheTexel / VIRTUAL_CACHE_SIZE, 0.0);
+}
@@ -0,0 +1,43 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : enable
+
+#include "virtualtexture.glsl"
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 normal;
+layout(location = 0) out uint outRequest;
+
+struct Material
+{
+	vec4 baseColor;
+	vec4 uvRect;
+	uint textureIndex;
+	uint virtualTextureIndex;
+};
+
+layout(set = 1, binding = 0) readonly buffer MaterialTable
+{
+	Material materials[];
+};
+
+layout(push_constant) uniform MaterialPushConstant
+{
+	layout(offset = 112) uint materialIndex;
+} pushConstants;
+
+// Writes the page each texel of a virtually textured model needs, at
+// the level the full resolution frame samples. Other models only
+// occlude, writing no request.
+//
+void main()
+{
+	uint virtualTextureIndex = materials[pushConstants.materialIndex].virtualTextureIndex;
+	if (NO_VIRTUAL_TEXTURE == virtualTextureIndex)
+	{
+		outRequest = NO_PAGE_REQUEST;
+		return;
+	}
+	outRequest = getPageRequest(virtualTextureIndex, fragTexCoord);
+}
@@ -0,0 +1,116 @@
+#include "statistics.h"
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+/**************************************************************
+* Description
+*		Finds the value below which the given percent of the
+*		values fall, using the nearest rank.
+* Returns
+*		The percentile, 0 for no values.
+* Notes
+*		The values are sorted in place.
+*
+**************************************************************/
+double computePercentile(std::vector<double> &values, double percent)
+{
+	if (values.empty())
+	{
+		return 0.0;
+	}
+
+	std::sort(values.begin(), values.end());
+	size_t rank = static_cast<size_t>(std::ceil(percent / 100.0 * values.size()));
+	return values[std::min(std::max<size_t>(rank, 1), values.size()) - 1];
+}
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+FrameStatistics::FrameStatistics()
+	:m_frameCount(0),
+	m_reportInterval(500),
+	m_fReportEnabled(false),
+	m_fHistoryEnabled(false)
+{
+}
+
+/**************************************************************
+* Description
+*		Adds a sample for the current frame. Samples with the
+*		same name are averaged over the report interval.
+* Returns
+*		void
+* Notes
+*		The sample is kept in the history if it is enabled.
+*
+**************************************************************/
+void FrameStatistics::addSample(const std::string &name, double value)
+{
+	if (m_fHistoryEnabled)
+	{
+		m_history[name].push_back(value);
+	}
+
+	auto it = m_samples.find(name);
+	if (m_samples.end() == it)
+	{
+		m_samples[name] = { value, value, 1 };
+		return;
+	}
+
+	it->second.m_sum += value;
+	it->second.m_max = std::max(it->second.m_max, value);
+	++it->second.m_count;
+}
+
+/**************************************************************
+* Description
+*		Marks the end of a frame. Once the report interval has
+*		passed, the averages are printed and the totals reset.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void FrameStatistics::endFrame()
+{
+	++m_frameCount;
+	if (m_frameCount < m_reportInterval)
+	{
+		return;
+	}
+
+	if (m_fReportEnabled)
+	{
+		report();
+	}
+	m_samples.clear();
+	m_frameCount = 0;
+}
+
+/**************************************************************
+* Description
+*		Prints the average and maximum of every sample collected
+*		since the last report.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void FrameStatistics::report()
+{
+	std::cout << "Statistics over " << m_frameCount << " frames" << std::endl;
+	for (const auto &sample : m_samples)
+	{
+		std::cout << "\t" << sample.first
+			<< " avg: " << sample.second.m_sum / sample.second.m_count
+			<< " max: " << sample.second.m_max << std::endl;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include<chrono>
+#include<cstdint>
+#include<map>
+#include<string>
+#include<vector>
+
+// Measures the wall clock time elapsed since it was created or last reset.
+//
+class CpuTimer
+{
+public:
+	CpuTimer() { reset(); }
+	void reset() { m_startTime = std::chrono::steady_clock::now(); }
+	double elapsedMilliseconds() const
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_startTime).count();
+	}
+	double elapsedMicroseconds() const { return elapsedMilliseconds() * 1000.0; }
+private:
+	std::chrono::steady_clock::time_point m_startTime;
+};
+
+// Running totals for a single named sample.
+//
+struct SampleAccumulator
+{
+	double m_sum;
+	double m_max;
+	uint32_t m_count;
+};
+
+// The value below which the given percent of the values fall, nearest
+// rank. The values are sorted in place.
+//
+double computePercentile(std::vector<double> &values, double percent);
+
+// Collects named per-frame samples (timings and counters) and prints
+// their averages once every report interval. With the history enabled,
+// every sample is also kept until the history is cleared, so runs can
+// report percentiles.
+//
+class FrameStatistics
+{
+public:
+	FrameStatistics();
+	void addSample(const std::string &name, double value);
+	void endFrame();
+	void setReportInterval(uint32_t frameCount) { m_reportInterval = frameCount; }
+	void setReportEnabled(bool fEnabled) { m_fReportEnabled = fEnabled; }
+	void setHistoryEnabled(bool fEnabled) { m_fHistoryEnabled = fEnabled; }
+	void clearHistory() { m_history.clear(); }
+	const std::map<std::string, std::vector<double>> &getHistory() const { return m_history; }
+	void report();
+private:
+	std::map<std::string, SampleAccumulator> m_samples;
+	std::map<std::string, std::vector<double>> m_history; // Every sample in order, by name.
+	uint32_t m_frameCount;
+	uint32_t m_reportInterval;
+	bool m_fReportEnabled;
+	bool m_fHistoryEnabled;
+};
@@ -0,0 +1,220 @@
+#include "ktx2.h"
+#include "mipbuilder.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include<stb_image.h>
+#define STB_DXT_IMPLEMENTATION
+#include<stb_dxt.h>
+
+// Converted when no files are given, relative to the working directory
+// of the application.
+//
+const char *DEFAULT_SOURCES[] =
+{
+	"textures/chalet.jpg",
+	"textures/teapot.png",
+	"textures/texture.jpg",
+};
+
+// Block compressed formats the converter encodes.
+//
+enum TargetFormat
+{
+	TARGET_FORMAT_AUTO, // BC1, or BC3 if any texel is not opaque.
+	TARGET_FORMAT_BC1,
+	TARGET_FORMAT_BC3,
+	TARGET_FORMAT_BC5,
+	TARGET_FORMAT_RGBA
+};
+
+/**************************************************************
+* Description
+*		Encodes a mip level into blocks of the format, row by
+*		row. Blocks past the edge repeat the last texels.
+* Returns
+*		The blocks.
+* Notes
+*
+**************************************************************/
+static std::vector<uint8_t> encodeLevel(const std::vector<uint8_t> &pixels, uint32_t width, uint32_t height, TargetFormat format)
+{
+	if (TARGET_FORMAT_RGBA == format)
+	{
+		return pixels;
+	}
+
+	uint32_t blocksX = (width + 3) / 4;
+	uint32_t blocksY = (height + 3) / 4;
+	uint32_t blockBytes = (TARGET_FORMAT_BC1 == format) ? 8 : 16;
+	std::vector<uint8_t> blocks(blocksX * blocksY * blockBytes);
+	for (uint32_t by = 0; by < blocksY; ++by)
+	{
+		for (uint32_t bx = 0; bx < blocksX; ++bx)
+		{
+			uint8_t texels[16 * 4];
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				uint32_t x = std::min(bx * 4 + i % 4, width - 1);
+				uint32_t y = std::min(by * 4 + i / 4, height - 1);
+				memcpy(&texels[i * 4], &pixels[(y * width + x) * 4], 4);
+			}
+
+			uint8_t *pBlock = &blocks[(by * blocksX + bx) * blockBytes];
+			if (TARGET_FORMAT_BC5 == format)
+			{
+				uint8_t redGreen[16 * 2];
+				for (uint32_t i = 0; i < 16; ++i)
+				{
+					redGreen[i * 2] = texels[i * 4];
+					redGreen[i * 2 + 1] = texels[i * 4 + 1];
+				}
+				stb_compress_bc5_block(pBlock, redGreen);
+			}
+			else
+			{
+				stb_compress_dxt_block(pBlock, texels, (TARGET_FORMAT_BC3 == format) ? 1 : 0, STB_DXT_HIGHQUAL);
+			}
+		}
+	}
+	return blocks;
+}
+
+/**************************************************************
+* Description
+*		Converts an image file into a KTX2 file next to it, with
+*		the whole mip chain encoded in the format.
+* Returns
+*		true/false
+* Notes
+*		Color is filtered in linear space, the two channels of a
+*		BC5 texture are taken as data and filtered as they are.
+*
+**************************************************************/
+static bool convert(const std::string &path, TargetFormat format, bool fSrgb, ThreadPool &threadPool)
+{
+	int width, height, channels;
+	stbi_uc *pPixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+	if (!pPixels)
+	{
+		std::cerr << path << ": " << stbi_failure_reason() << std::endl;
+		return false;
+	}
+	if (TARGET_FORMAT_AUTO == format)
+	{
+		format = TARGET_FORMAT_BC1;
+		for (int i = 0; i < width * height; ++i)
+		{
+			if (255 != pPixels[i * 4 + 3])
+			{
+				format = TARGET_FORMAT_BC3;
+				break;
+			}
+		}
+	}
+
+	std::vector<std::vector<uint8_t>> mipChain;
+	buildMipChain(pPixels, static_cast<uint32_t>(width), static_cast<uint32_t>(height), TARGET_FORMAT_BC5 != format, &threadPool, mipChain);
+	stbi_image_free(pPixels);
+
+	VkFormat vkFormat;
+	switch (format)
+	{
+	case TARGET_FORMAT_BC1:
+		vkFormat = fSrgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK : VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		break;
+	case TARGET_FORMAT_BC3:
+		vkFormat = fSrgb ? VK_FORMAT_BC3_SRGB_BLOCK : VK_FORMAT_BC3_UNORM_BLOCK;
+		break;
+	case TARGET_FORMAT_BC5:
+		vkFormat = VK_FORMAT_BC5_UNORM_BLOCK;
+		break;
+	default:
+		vkFormat = fSrgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+		break;
+	}
+
+	std::vector<std::vector<uint8_t>> levels;
+	size_t encodedBytes = 0;
+	for (uint32_t level = 0; level < mipChain.size(); ++level)
+	{
+		uint32_t levelWidth = std::max(static_cast<uint32_t>(width) >> level, 1u);
+		uint32_t levelHeight = std::max(static_cast<uint32_t>(height) >> level, 1u);
+		levels.push_back(encodeLevel(mipChain[level], levelWidth, levelHeight, format));
+		encodedBytes += levels.back().size();
+	}
+
+	std::string outputPath = path.substr(0, path.find_last_of('.')) + ".ktx2";
+	if (!writeKtx2(outputPath, vkFormat, static_cast<uint32_t>(width), static_cast<uint32_t>(height), levels))
+	{
+		std::cerr << outputPath << ": could not write the file" << std::endl;
+		return false;
+	}
+
+	std::cout << path << " -> " << outputPath << ": " << width << "x" << height << ", " << levels.size()
+		<< " levels, format " << vkFormat << ", " << encodedBytes / 1024 << " KB" << std::endl;
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Converts the JPG and PNG files given on the command
+*		line, or the textures of the application, into block
+*		compressed KTX2 files the texture manager loads instead.
+*
+*		texconvert [--bc1 | --bc3 | --bc5 | --rgba] [--srgb] [files]
+* Returns
+*		EXIT_SUCCESS if every file was converted.
+* Notes
+*		BC7 and ETC2 files are loaded by the application but
+*		not encoded here, those need an external encoder.
+*
+**************************************************************/
+int main(int argc, char *argv[])
+{
+	TargetFormat format = TARGET_FORMAT_AUTO;
+	bool fSrgb = false;
+	std::vector<std::string> paths;
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument = argv[i];
+		if ("--bc1" == argument)
+		{
+			format = TARGET_FORMAT_BC1;
+		}
+		else if ("--bc3" == argument)
+		{
+			format = TARGET_FORMAT_BC3;
+		}
+		else if ("--bc5" == argument)
+		{
+			format = TARGET_FORMAT_BC5;
+		}
+		else if ("--rgba" == argument)
+		{
+			format = TARGET_FORMAT_RGBA;
+		}
+		else if ("--srgb" == argument)
+		{
+			fSrgb = true;
+		}
+		else
+		{
+			paths.push_back(argument);
+		}
+	}
+	if (paths.empty())
+	{
+		paths.assign(std::begin(DEFAULT_SOURCES), std::end(DEFAULT_SOURCES));
+	}
+
+	ThreadPool threadPool;
+	bool fSuccess = true;
+	for (const auto &path : paths)
+	{
+		fSuccess = convert(path, format, fSrgb, threadPool) && fSuccess;
+	}
+	return fSuccess ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,391 @@
+#include "textureatlas.h"
+#include "imagedecoder.h"
+#include "mipbuilder.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+// Files larger than this cannot hold an image small enough for the
+// atlas, unless most of the file is metadata, and are not read at all.
+//
+const size_t ATLAS_MAX_FILE_SIZE = ATLAS_MAX_TEXTURE_SIZE * ATLAS_MAX_TEXTURE_SIZE * 4 + 64 * 1024;
+
+// An image considered for the atlas and where it was placed.
+//
+struct AtlasImage
+{
+	std::string m_path;
+	uint32_t m_width;
+	uint32_t m_height;
+	std::vector<uint8_t> m_pixels; // RGBA8, empty if the image is not packed.
+	uint32_t m_page;
+	uint32_t m_x; // Of the padded rectangle in the page.
+	uint32_t m_y;
+};
+
+/**************************************************************
+* Description
+*		Rounds a size up to a multiple of the atlas padding.
+* Returns
+*		The rounded size.
+* Notes
+*
+**************************************************************/
+static uint32_t alignToPadding(uint32_t size)
+{
+	return (size + ATLAS_PADDING - 1) / ATLAS_PADDING * ATLAS_PADDING;
+}
+
+/**************************************************************
+* Description
+*		Reads and decodes an image file if it is small enough
+*		for the atlas.
+* Returns
+*		void
+* Notes
+*		The pixels are left empty for anything else, including
+*		files that cannot be read.
+*
+**************************************************************/
+static void loadAtlasImage(AtlasImage &image)
+{
+	std::ifstream file(image.m_path, std::ios::ate | std::ios::binary);
+	if (!file.is_open() || static_cast<size_t>(file.tellg()) > ATLAS_MAX_FILE_SIZE)
+	{
+		return;
+	}
+	std::vector<char> content(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(content.data(), content.size());
+
+	std::string error;
+	if (!readImageHeader(content.data(), content.size(), image.m_width, image.m_height, error) ||
+		0 == image.m_width ||
+		0 == image.m_height ||
+		image.m_width > ATLAS_MAX_TEXTURE_SIZE ||
+		image.m_height > ATLAS_MAX_TEXTURE_SIZE)
+	{
+		return;
+	}
+
+	image.m_pixels.resize(static_cast<size_t>(image.m_width) * image.m_height * 4);
+	if (!decodeImage(content.data(), content.size(), selectImageCodec(content.data(), content.size()), image.m_pixels.data(), error))
+	{
+		image.m_pixels.clear();
+	}
+}
+
+/**************************************************************
+* Description
+*		Copies an image into its padded rectangle of a page,
+*		filling the padding and the alignment around it with
+*		the image wrapped around.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+static void copyAtlasImage(const AtlasImage &image, uint8_t *pPage, uint32_t pageWidth)
+{
+	uint32_t paddedWidth = alignToPadding(image.m_width + 2 * ATLAS_PADDING);
+	uint32_t paddedHeight = alignToPadding(image.m_height + 2 * ATLAS_PADDING);
+	for (uint32_t y = 0; y < paddedHeight; ++y)
+	{
+		uint32_t sourceY = (y + image.m_height - ATLAS_PADDING % image.m_height) % image.m_height;
+		const uint8_t *pSourceRow = image.m_pixels.data() + static_cast<size_t>(sourceY) * image.m_width * 4;
+		uint8_t *pRow = pPage + (static_cast<size_t>(image.m_y + y) * pageWidth + image.m_x) * 4;
+		for (uint32_t x = 0; x < paddedWidth; ++x)
+		{
+			uint32_t sourceX = (x + image.m_width - ATLAS_PADDING % image.m_width) % image.m_width;
+			memcpy(pRow + x * 4, pSourceRow + sourceX * 4, 4);
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Constructor.
+* Returns
+*
+* Notes
+*
+**************************************************************/
+SkylinePacker::SkylinePacker() :
+	m_width(0),
+	m_height(0),
+	m_usedWidth(0),
+	m_usedHeight(0)
+{
+}
+
+/**************************************************************
+* Description
+*		Empties the packer and sets the size of its area.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void SkylinePacker::reset(uint32_t width, uint32_t height)
+{
+	m_width = width;
+	m_height = height;
+	m_usedWidth = 0;
+	m_usedHeight = 0;
+	m_segments.clear();
+	m_segments.push_back({ 0, 0, width });
+}
+
+/**************************************************************
+* Description
+*		Checks if a rectangle fits with its left edge at the
+*		start of a segment, resting on the highest segment
+*		below it.
+* Returns
+*		true/false, with the top of the skyline below the
+*		rectangle.
+* Notes
+*
+**************************************************************/
+bool SkylinePacker::fFits(size_t segmentIndex, uint32_t width, uint32_t height, uint32_t &y) const
+{
+	uint32_t x = m_segments[segmentIndex].m_x;
+	if (x + width > m_width)
+	{
+		return false;
+	}
+
+	y = 0;
+	for (size_t i = segmentIndex; i < m_segments.size() && m_segments[i].m_x < x + width; ++i)
+	{
+		y = std::max(y, m_segments[i].m_y);
+		if (y + height > m_height)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Places a rectangle where its top is lowest, preferring
+*		the narrowest segment on a tie.
+* Returns
+*		true/false, with the position of the rectangle.
+* Notes
+*		Fails if the rectangle does not fit anywhere.
+*
+**************************************************************/
+bool SkylinePacker::insert(uint32_t width, uint32_t height, uint32_t &x, uint32_t &y)
+{
+	size_t bestIndex = m_segments.size();
+	uint32_t bestY = 0;
+	for (size_t i = 0; i < m_segments.size(); ++i)
+	{
+		uint32_t segmentY;
+		if (!fFits(i, width, height, segmentY))
+		{
+			continue;
+		}
+		if (m_segments.size() == bestIndex ||
+			segmentY < bestY ||
+			(segmentY == bestY && m_segments[i].m_width < m_segments[bestIndex].m_width))
+		{
+			bestIndex = i;
+			bestY = segmentY;
+		}
+	}
+	if (m_segments.size() == bestIndex)
+	{
+		return false;
+	}
+
+	x = m_segments[bestIndex].m_x;
+	y = bestY;
+	SkylineSegment segment = { x, y + height, width };
+	m_segments.insert(m_segments.begin() + bestIndex, segment);
+
+	// The segments now covered by the rectangle are removed, the last
+	// one is cut at its right edge.
+	//
+	for (size_t i = bestIndex + 1; i < m_segments.size();)
+	{
+		SkylineSegment &next = m_segments[i];
+		if (next.m_x >= x + width)
+		{
+			break;
+		}
+		uint32_t overlap = x + width - next.m_x;
+		if (overlap < next.m_width)
+		{
+			next.m_x += overlap;
+			next.m_width -= overlap;
+			break;
+		}
+		m_segments.erase(m_segments.begin() + i);
+	}
+
+	for (size_t i = 0; i + 1 < m_segments.size();)
+	{
+		if (m_segments[i].m_y == m_segments[i + 1].m_y)
+		{
+			m_segments[i].m_width += m_segments[i + 1].m_width;
+			m_segments.erase(m_segments.begin() + i + 1);
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	m_usedWidth = std::max(m_usedWidth, x + width);
+	m_usedHeight = std::max(m_usedHeight, y + height);
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Packs the images no larger than ATLAS_MAX_TEXTURE_SIZE
+*		among the files into pages, tallest first, and adds the
+*		pages to the texture manager.
+* Returns
+*		void
+* Notes
+*		The files are read and decoded on the thread pool if
+*		there is one. Files that are too large or cannot be
+*		decoded get no entry, and are left to be loaded on
+*		their own. Call once, before the materials are made.
+*
+**************************************************************/
+void TextureAtlas::build(const std::vector<std::string> &paths, TextureManager &textureManager, ThreadPool *pThreadPool)
+{
+	std::vector<AtlasImage> images;
+	for (const auto &path : paths)
+	{
+		if (m_entries.end() != m_entries.find(path) ||
+			images.end() != std::find_if(images.begin(), images.end(), [&path](const AtlasImage &image) { return path == image.m_path; }))
+		{
+			continue;
+		}
+		AtlasImage image = {};
+		image.m_path = path;
+		images.push_back(image);
+	}
+
+	auto loadImages = [&images](size_t, size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			loadAtlasImage(images[i]);
+		}
+	};
+	if (nullptr != pThreadPool)
+	{
+		pThreadPool->parallelFor(images.size(), 1, loadImages);
+	}
+	else
+	{
+		loadImages(0, 0, images.size());
+	}
+
+	std::vector<size_t> order;
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		if (!images[i].m_pixels.empty())
+		{
+			order.push_back(i);
+		}
+	}
+	std::sort(order.begin(), order.end(), [&images](size_t a, size_t b)
+	{
+		if (images[a].m_height != images[b].m_height)
+		{
+			return images[a].m_height > images[b].m_height;
+		}
+		return images[a].m_width > images[b].m_width;
+	});
+
+	// Every image is tried in every open page before a new one is
+	// started, small images fill the gaps the tall ones left.
+	//
+	std::vector<SkylinePacker> packers;
+	for (size_t index : order)
+	{
+		AtlasImage &image = images[index];
+		uint32_t paddedWidth = alignToPadding(image.m_width + 2 * ATLAS_PADDING);
+		uint32_t paddedHeight = alignToPadding(image.m_height + 2 * ATLAS_PADDING);
+		image.m_page = static_cast<uint32_t>(packers.size());
+		for (uint32_t page = 0; page < packers.size(); ++page)
+		{
+			if (packers[page].insert(paddedWidth, paddedHeight, image.m_x, image.m_y))
+			{
+				image.m_page = page;
+				break;
+			}
+		}
+		if (packers.size() == image.m_page)
+		{
+			packers.emplace_back();
+			packers.back().reset(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE);
+			packers.back().insert(paddedWidth, paddedHeight, image.m_x, image.m_y);
+		}
+	}
+
+	for (uint32_t page = 0; page < packers.size(); ++page)
+	{
+		uint32_t pageWidth = packers[page].getUsedWidth();
+		uint32_t pageHeight = packers[page].getUsedHeight();
+		std::vector<uint8_t> pixels(static_cast<size_t>(pageWidth) * pageHeight * 4, 0);
+		for (size_t index : order)
+		{
+			if (page == images[index].m_page)
+			{
+				copyAtlasImage(images[index], pixels.data(), pageWidth);
+			}
+		}
+
+		std::vector<std::vector<uint8_t>> levels;
+		buildMipChain(pixels.data(), pageWidth, pageHeight, true, pThreadPool, levels);
+		levels.resize(std::min<size_t>(levels.size(), ATLAS_MIP_LEVELS));
+		TextureHandle handle = textureManager.addTexture("atlas page " + std::to_string(m_pages.size()), pageWidth, pageHeight, levels);
+		m_pages.push_back(handle);
+
+		for (size_t index : order)
+		{
+			const AtlasImage &image = images[index];
+			if (page != image.m_page)
+			{
+				continue;
+			}
+			AtlasEntry entry;
+			entry.m_page = handle;
+			entry.m_uvRect = glm::vec4(
+				static_cast<float>(image.m_x + ATLAS_PADDING) / pageWidth,
+				static_cast<float>(image.m_y + ATLAS_PADDING) / pageHeight,
+				static_cast<float>(image.m_width) / pageWidth,
+				static_cast<float>(image.m_height) / pageHeight);
+			m_entries[image.m_path] = entry;
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Gets the page and rectangle of a packed texture.
+* Returns
+*		true/false
+* Notes
+*		Fails for a file that was not packed.
+*
+**************************************************************/
+bool TextureAtlas::getEntry(const std::string &path, AtlasEntry &entry) const
+{
+	auto found = m_entries.find(path);
+	if (m_entries.end() == found)
+	{
+		return false;
+	}
+	entry = found->second;
+	return true;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "texturemanager.h"
+#include "threadpool.h"
+#include<string>
+#include<unordered_map>
+#include<vector>
+
+// Images no larger than this along either side are packed into atlas
+// pages instead of getting an image of their own.
+//
+const uint32_t ATLAS_MAX_TEXTURE_SIZE = 256;
+
+// The largest side of an atlas page. Pages are cropped to the area
+// their textures cover.
+//
+const uint32_t ATLAS_PAGE_SIZE = 2048;
+
+// Texels of the wrapped texture copied around each texture in a page,
+// so filtering never reads a neighbour. Textures are also placed at
+// multiples of it, so each covers whole texels down to the last level.
+//
+const uint32_t ATLAS_PADDING = 8;
+
+// Levels of a page. The padding is a single texel in the last one, the
+// levels below would blend neighbouring textures.
+//
+const uint32_t ATLAS_MIP_LEVELS = 4;
+
+// Where a texture was packed: the page holding it and the rectangle it
+// covers in texture coordinates of the page, offset in xy and size in zw.
+//
+struct AtlasEntry
+{
+	TextureHandle m_page;
+	glm::vec4 m_uvRect;
+};
+
+// A run of the skyline, the top of the rectangles placed below it.
+//
+struct SkylineSegment
+{
+	uint32_t m_x;
+	uint32_t m_y;
+	uint32_t m_width;
+};
+
+// Places rectangles in an area bottom left first, tracking only the
+// skyline of the rectangles placed so far. Space below an overhang is
+// not reused, which costs little with rectangles inserted tallest first.
+//
+class SkylinePacker
+{
+public:
+	SkylinePacker();
+	void reset(uint32_t width, uint32_t height);
+	bool insert(uint32_t width, uint32_t height, uint32_t &x, uint32_t &y);
+	uint32_t getUsedWidth() const { return m_usedWidth; }
+	uint32_t getUsedHeight() const { return m_usedHeight; }
+private:
+	bool fFits(size_t segmentIndex, uint32_t width, uint32_t height, uint32_t &y) const;
+
+	std::vector<SkylineSegment> m_segments; // Left to right, covering the whole width.
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_usedWidth;
+	uint32_t m_usedHeight;
+};
+
+// Packs small textures into shared pages, so a scene with many small
+// materials uses a few images, views and bindless slots instead of one
+// of each per texture. Each texture is surrounded by copies of its
+// opposite edges, which keeps repeated texture coordinates seamless
+// when the shader wraps them into the rectangle of the texture. Pages
+// are added to the texture manager with a short mip chain.
+//
+class TextureAtlas
+{
+public:
+	void build(const std::vector<std::string> &paths, TextureManager &textureManager, ThreadPool *pThreadPool);
+	bool getEntry(const std::string &path, AtlasEntry &entry) const;
+	size_t getPageCount() const { return m_pages.size(); }
+	size_t getTextureCount() const { return m_entries.size(); }
+private:
+	std::unordered_map<std::string, AtlasEntry> m_entries; // By path.
+	std::vector<TextureHandle> m_pages;
+};
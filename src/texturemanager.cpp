@@ -0,0 +1,1677 @@
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#endif
+
+#include "texturemanager.h"
+#include "imagedecoder.h"
+#include "ktx2.h"
+#include "mipbuilder.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+const std::string KTX2_EXTENSION = ".ktx2";
+
+// Offsets of the levels in a staging buffer are aligned to a block.
+//
+const VkDeviceSize STAGING_LEVEL_ALIGNMENT = 16;
+
+// Levels of a streamed texture no larger than this are copied with its
+// first upload, whatever the budget, so it is shown straight away.
+//
+const uint32_t STREAMING_TAIL_SIZE = 128;
+
+/**************************************************************
+* Description
+*		Reads a whole file.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+static bool readFile(const std::string &path, std::vector<char> &content)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	content.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(content.data(), content.size());
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Checks if the path names a KTX2 file.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+static bool fKtx2Path(const std::string &path)
+{
+	return path.size() >= KTX2_EXTENSION.size() &&
+		0 == path.compare(path.size() - KTX2_EXTENSION.size(), KTX2_EXTENSION.size(), KTX2_EXTENSION);
+}
+
+/**************************************************************
+* Description
+*		Creates a directory unless it exists.
+* Returns
+*		true if the directory exists afterwards.
+* Notes
+*		Only the last directory of the path is created.
+*
+**************************************************************/
+static bool createDirectory(const std::string &path)
+{
+#ifdef _WIN32
+	return 0 != CreateDirectoryA(path.c_str(), nullptr) || ERROR_ALREADY_EXISTS == GetLastError();
+#else
+	return 0 == mkdir(path.c_str(), 0755) || EEXIST == errno;
+#endif
+}
+
+/**************************************************************
+* Description
+*		Creates a device local image for a texture with all its
+*		mip levels, and binds memory to it.
+* Returns
+*		The size of the memory.
+* Notes
+*		Images whose levels are written by the compute
+*		downsampler also need the storage usage.
+*
+**************************************************************/
+static VkDeviceSize createTextureImage(
+	VkDevice vkDevice,
+	VkPhysicalDevice vkPhysicalDevice,
+	VkFormat vkFormat,
+	uint32_t width,
+	uint32_t height,
+	uint32_t mipLevels,
+	bool fStorage,
+	VkImage &vkImage,
+	VkDeviceMemory &imageMemory)
+{
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent.width = width;
+	imageCreateInfo.extent.height = height;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.mipLevels = mipLevels;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = vkFormat;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (fStorage)
+	{
+		imageCreateInfo.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+	}
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	if (VK_SUCCESS != vkCreateImage(vkDevice, &imageCreateInfo, nullptr, &vkImage))
+	{
+		throw std::runtime_error("Could not create texture image.");
+	}
+
+	VkMemoryRequirements memRequirements = {};
+	vkGetImageMemoryRequirements(vkDevice, vkImage, &memRequirements);
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(vkPhysicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (VK_SUCCESS != vkAllocateMemory(vkDevice, &allocInfo, nullptr, &imageMemory))
+	{
+		throw std::runtime_error("Could not allocate memory for texture image.");
+	}
+	vkBindImageMemory(vkDevice, vkImage, imageMemory, 0);
+	return memRequirements.size;
+}
+
+/**************************************************************
+* Description
+*		Records the copy of the levels in the staging buffer,
+*		the blits or the dispatch generating the levels below
+*		them and the layout transitions leaving every level
+*		shader readable.
+* Returns
+*		void
+* Notes
+*		The regions hold the first levels, in order. All of them
+*		are copied at once. Without a downsampler each remaining
+*		level is blitted from the one above it once that one has
+*		been written. With one, only level 0 may be copied.
+*
+**************************************************************/
+static void recordTextureUpload(
+	VkCommandBuffer commandBuffer,
+	VkBuffer stagingBuffer,
+	VkImage image,
+	int32_t width,
+	int32_t height,
+	uint32_t mipLevels,
+	const std::vector<VkBufferImageCopy> &regions,
+	ComputeDownsampler *pDownsampler)
+{
+	uint32_t copiedLevels = static_cast<uint32_t>(regions.size());
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = image;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0,
+		nullptr,
+		0,
+		nullptr,
+		1,
+		&barrier);
+
+	vkCmdCopyBufferToImage(
+		commandBuffer,
+		stagingBuffer,
+		image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		copiedLevels,
+		regions.data());
+
+	// The copied levels above the one the blits start from are done.
+	//
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = (copiedLevels < mipLevels) ? copiedLevels - 1 : mipLevels;
+	if (barrier.subresourceRange.levelCount > 0)
+	{
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0,
+			0,
+			nullptr,
+			0,
+			nullptr,
+			1,
+			&barrier);
+	}
+	if (copiedLevels >= mipLevels)
+	{
+		return;
+	}
+	if (nullptr != pDownsampler)
+	{
+		pDownsampler->record(commandBuffer, image, static_cast<uint32_t>(width), static_cast<uint32_t>(height), mipLevels);
+		return;
+	}
+
+	barrier.subresourceRange.levelCount = 1;
+	int32_t mipWidth = std::max(width >> (copiedLevels - 1), 1);
+	int32_t mipHeight = std::max(height >> (copiedLevels - 1), 1);
+	for (uint32_t i = copiedLevels; i < mipLevels; ++i)
+	{
+		barrier.subresourceRange.baseMipLevel = i - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			0,
+			0,
+			nullptr,
+			0,
+			nullptr,
+			1,
+			&barrier);
+
+		int32_t nextWidth = std::max(mipWidth / 2, 1);
+		int32_t nextHeight = std::max(mipHeight / 2, 1);
+		VkImageBlit blit = {};
+		blit.srcOffsets[0] = { 0, 0, 0 };
+		blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = i - 1;
+		blit.srcSubresource.baseArrayLayer = 0;
+		blit.srcSubresource.layerCount = 1;
+		blit.dstOffsets[0] = { 0, 0, 0 };
+		blit.dstOffsets[1] = { nextWidth, nextHeight, 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = i;
+		blit.dstSubresource.baseArrayLayer = 0;
+		blit.dstSubresource.layerCount = 1;
+		vkCmdBlitImage(
+			commandBuffer,
+			image,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1,
+			&blit,
+			VK_FILTER_LINEAR);
+
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0,
+			0,
+			nullptr,
+			0,
+			nullptr,
+			1,
+			&barrier);
+
+		mipWidth = nextWidth;
+		mipHeight = nextHeight;
+	}
+
+	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0,
+		0,
+		nullptr,
+		0,
+		nullptr,
+		1,
+		&barrier);
+}
+
+/**************************************************************
+* Description
+*		Gets how a level of the format is laid out in the
+*		staging buffer, in rows of blocks.
+* Returns
+*		true/false
+* Notes
+*		Fails for formats whose blocks are not known.
+*
+**************************************************************/
+static bool getLevelRows(VkFormat vkFormat, const VkExtent3D &extent, VkDeviceSize &rowBytes, uint32_t &rowCount, uint32_t &rowHeight)
+{
+	uint32_t blockBytes, blockWidth, blockHeight;
+	if (!getFormatBlock(vkFormat, blockBytes, blockWidth, blockHeight))
+	{
+		return false;
+	}
+	rowBytes = static_cast<VkDeviceSize>((extent.width + blockWidth - 1) / blockWidth) * blockBytes;
+	rowCount = (extent.height + blockHeight - 1) / blockHeight;
+	rowHeight = blockHeight;
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Records the copy of a band of rows of one level, with
+*		the level out of the shader readable layout only while
+*		it is written.
+* Returns
+*		void
+* Notes
+*		The level is not sampled until all its rows have been
+*		copied, the layout transitions keep the rows copied by
+*		earlier uploads.
+*
+**************************************************************/
+static void recordBandCopy(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, VkImage image, const VkBufferImageCopy &band)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = image;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = band.imageSubresource.mipLevel;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0,
+		nullptr,
+		0,
+		nullptr,
+		1,
+		&barrier);
+
+	vkCmdCopyBufferToImage(
+		commandBuffer,
+		stagingBuffer,
+		image,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		1,
+		&band);
+
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+		0,
+		0,
+		nullptr,
+		0,
+		nullptr,
+		1,
+		&barrier);
+}
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+TextureManager::TextureManager()
+	:m_vkDevice(VK_NULL_HANDLE),
+	m_vkPhysicalDevice(VK_NULL_HANDLE),
+	m_vkCommandPool(VK_NULL_HANDLE),
+	m_pTimeline(nullptr),
+	m_pDeletionQueue(nullptr),
+	m_pMaterialTable(nullptr),
+	m_pThreadPool(nullptr),
+	m_vkSampler(VK_NULL_HANDLE),
+	m_streamingBudget(0),
+	m_fallbackTexture(INVALID_TEXTURE_HANDLE),
+	m_lastUploadValue(0),
+	m_imageCount(0),
+	m_imageBytes(0),
+	m_uploadedBytes(0),
+	m_fDeduplicate(true),
+	m_fPreferCompressed(true),
+	m_mipGeneration(MIP_GENERATION_BLIT),
+	m_fBlitMipmaps(true),
+	m_fTextureCompressionBC(false),
+	m_fTextureCompressionETC2(false),
+	m_timestampValidBits(0),
+	m_vkTimestampQueryPool(VK_NULL_HANDLE),
+	m_timestampPeriod(0.0f)
+{
+}
+
+/**************************************************************
+* Description
+*		Creates the sampler shared by the textures and, with a
+*		material table, the fallback texture in its first slot.
+* Returns
+*		void
+* Notes
+*		Without a thread pool every texture is decoded by load,
+*		on the calling thread.
+*		The command pool is only used by update, on the main
+*		thread.
+*		Block compressed formats are used when the physical
+*		device supports them, so the logical device has to be
+*		created with the features enabled.
+*		The compute downsampler records on the queue of the
+*		command pool, which has to support compute. If its
+*		shader cannot be loaded the images are blitted.
+*
+**************************************************************/
+void TextureManager::create(
+	VkDevice vkDevice,
+	VkPhysicalDevice vkPhysicalDevice,
+	VkCommandPool vkCommandPool,
+	Timeline *pTimeline,
+	DeletionQueue *pDeletionQueue,
+	MaterialTable *pMaterialTable,
+	ThreadPool *pThreadPool)
+{
+	m_vkDevice = vkDevice;
+	m_vkPhysicalDevice = vkPhysicalDevice;
+	m_vkCommandPool = vkCommandPool;
+	m_pTimeline = pTimeline;
+	m_pDeletionQueue = pDeletionQueue;
+	m_pMaterialTable = pMaterialTable;
+	m_pThreadPool = pThreadPool;
+
+	VkPhysicalDeviceFeatures deviceFeatures;
+	vkGetPhysicalDeviceFeatures(m_vkPhysicalDevice, &deviceFeatures);
+	m_fTextureCompressionBC = (VK_TRUE == deviceFeatures.textureCompressionBC);
+	m_fTextureCompressionETC2 = (VK_TRUE == deviceFeatures.textureCompressionETC2);
+
+	// Images the GPU cannot blit with linear filtering get their mip
+	// levels built on the CPU.
+	//
+	const VkFormatFeatureFlags blitFeatures =
+		VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+		VK_FORMAT_FEATURE_BLIT_DST_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(m_vkPhysicalDevice, VK_FORMAT_R8G8B8A8_UNORM, &formatProperties);
+	m_fBlitMipmaps = (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+
+	if (MIP_GENERATION_CPU != m_mipGeneration &&
+		(MIP_GENERATION_COMPUTE == m_mipGeneration || !m_fBlitMipmaps) &&
+		ComputeDownsampler::fDeviceSupported(m_vkPhysicalDevice))
+	{
+		std::vector<char> shaderCode;
+		if (readFile(DOWNSAMPLE_SHADER_PATH, shaderCode))
+		{
+			m_downsampler.create(m_vkDevice, m_vkPhysicalDevice, shaderCode);
+		}
+		else
+		{
+			std::cerr << "Could not open " << DOWNSAMPLE_SHADER_PATH << ", the compute downsampler is disabled." << std::endl;
+		}
+	}
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &deviceProperties);
+	if (0 != m_timestampValidBits && deviceProperties.limits.timestampComputeAndGraphics)
+	{
+		m_timestampPeriod = deviceProperties.limits.timestampPeriod;
+		VkQueryPoolCreateInfo queryPoolInfo = {};
+		queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		queryPoolInfo.queryCount = 2;
+		if (VK_SUCCESS != vkCreateQueryPool(m_vkDevice, &queryPoolInfo, nullptr, &m_vkTimestampQueryPool))
+		{
+			throw std::runtime_error("Could not create timestamp query pool.");
+		}
+	}
+
+	m_vkSampler = createSampler(0.0f);
+
+	if (nullptr != m_pMaterialTable)
+	{
+		createFallbackTexture();
+	}
+}
+
+/**************************************************************
+* Description
+*		Destroys the textures and the samplers.
+* Returns
+*		void
+* Notes
+*		Waits for the decodes still running. The uploads have to
+*		have completed and no draw may use the textures.
+*
+**************************************************************/
+void TextureManager::destroy()
+{
+	for (auto &decode : m_pendingDecodes)
+	{
+		m_decodedTextures.push_back(decode.get());
+	}
+	m_pendingDecodes.clear();
+
+	// These were never uploaded, so the GPU has not seen them.
+	//
+	for (const auto &decoded : m_decodedTextures)
+	{
+		vkDestroyBuffer(m_vkDevice, decoded.m_vkStagingBuffer, nullptr);
+		vkFreeMemory(m_vkDevice, decoded.m_vkStagingMemory, nullptr);
+	}
+	m_decodedTextures.clear();
+	m_pendingDuplicates.clear();
+	for (const auto &streaming : m_streamingTextures)
+	{
+		vkDestroyBuffer(m_vkDevice, streaming.m_decoded.m_vkStagingBuffer, nullptr);
+		vkFreeMemory(m_vkDevice, streaming.m_decoded.m_vkStagingMemory, nullptr);
+	}
+	m_streamingTextures.clear();
+
+	for (size_t i = 0; i < m_textures.size(); ++i)
+	{
+		const ManagedTexture &texture = m_textures[i];
+		if (texture.m_source == i)
+		{
+			vkDestroyImageView(m_vkDevice, texture.m_vkImageView, nullptr);
+			vkDestroyImage(m_vkDevice, texture.m_vkImage, nullptr);
+			vkFreeMemory(m_vkDevice, texture.m_vkMemory, nullptr);
+		}
+	}
+	m_textures.clear();
+	m_pathHandles.clear();
+	m_contentHandles.clear();
+	m_imageCount = 0;
+	m_imageBytes = 0;
+	m_uploadedBytes = 0;
+	m_fallbackTexture = INVALID_TEXTURE_HANDLE;
+
+	vkDestroySampler(m_vkDevice, m_vkSampler, nullptr);
+	m_vkSampler = VK_NULL_HANDLE;
+	for (auto sampler : m_vkLodSamplers)
+	{
+		vkDestroySampler(m_vkDevice, sampler, nullptr);
+	}
+	m_vkLodSamplers.clear();
+
+	if (m_downsampler.fCreated())
+	{
+		m_downsampler.destroy();
+	}
+	if (VK_NULL_HANDLE != m_vkTimestampQueryPool)
+	{
+		vkDestroyQueryPool(m_vkDevice, m_vkTimestampQueryPool, nullptr);
+		m_vkTimestampQueryPool = VK_NULL_HANDLE;
+	}
+}
+
+/**************************************************************
+* Description
+*		Requests the texture in the file. Requesting the same
+*		path again returns the same handle, unless
+*		deduplication is disabled.
+* Returns
+*		Handle of the texture.
+* Notes
+*		The bindless slot of the texture can be used right away,
+*		it shows the fallback texture until the upload has been
+*		submitted by update.
+*		Call between frames, the slot is written here.
+*
+**************************************************************/
+TextureHandle TextureManager::load(const std::string &path)
+{
+	auto existing = m_pathHandles.find(path);
+	if (m_fDeduplicate && m_pathHandles.end() != existing)
+	{
+		return existing->second;
+	}
+
+	TextureHandle handle = reserveTexture(path);
+	m_pathHandles[path] = handle;
+
+	if (nullptr != m_pThreadPool)
+	{
+		m_pendingDecodes.push_back(m_pThreadPool->submit([this, handle, path]()
+		{
+			return decode(handle, path);
+		}));
+	}
+	else
+	{
+		m_decodedTextures.push_back(decode(handle, path));
+	}
+	return handle;
+}
+
+/**************************************************************
+* Description
+*		Adds a texture from RGBA8 mip levels in memory, level 0
+*		first, holding sRGB encoded color like decoded images.
+*		The levels are staged straight away and uploaded by the
+*		next update.
+* Returns
+*		Handle of the texture.
+* Notes
+*		The texture gets a bindless slot showing the fallback
+*		texture until its upload has been submitted, like a
+*		loaded one. Only the levels given are created.
+*
+**************************************************************/
+TextureHandle TextureManager::addTexture(
+	const std::string &name,
+	uint32_t width,
+	uint32_t height,
+	const std::vector<std::vector<uint8_t>> &levels)
+{
+	TextureHandle handle = reserveTexture(name);
+
+	DecodedTexture decoded = {};
+	decoded.m_handle = handle;
+	decoded.m_duplicateOf = INVALID_TEXTURE_HANDLE;
+	decoded.m_width = width;
+	decoded.m_height = height;
+	decoded.m_vkFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	decoded.m_mipLevels = static_cast<uint32_t>(levels.size());
+
+	std::vector<const void*> levelData;
+	std::vector<VkDeviceSize> levelSizes;
+	for (const auto &level : levels)
+	{
+		levelData.push_back(level.data());
+		levelSizes.push_back(level.size());
+	}
+	stageLevels(levelData, levelSizes, decoded);
+	m_decodedTextures.push_back(decoded);
+	return handle;
+}
+
+/**************************************************************
+* Description
+*		Adds a texture still to be uploaded, with a bindless
+*		slot showing the fallback texture.
+* Returns
+*		Handle of the texture.
+* Notes
+*
+**************************************************************/
+TextureHandle TextureManager::reserveTexture(const std::string &path)
+{
+	TextureHandle handle = static_cast<TextureHandle>(m_textures.size());
+	ManagedTexture texture = {};
+	texture.m_path = path;
+	texture.m_textureIndex = NO_TEXTURE;
+	texture.m_source = handle;
+	if (nullptr != m_pMaterialTable)
+	{
+		const ManagedTexture &fallback = m_textures[m_fallbackTexture];
+		texture.m_textureIndex = m_pMaterialTable->addTexture(fallback.m_vkImageView, m_vkSampler);
+	}
+	m_textures.push_back(texture);
+	return handle;
+}
+
+/**************************************************************
+* Description
+*		Uploads the textures whose decodes have finished, in one
+*		command buffer with the levels streamed this update, and
+*		points their bindless slots at them.
+* Returns
+*		void
+* Notes
+*		Call once per frame, after the previous frame has
+*		completed and before recording the next one. Slots can
+*		be rewritten straight after the upload is submitted,
+*		since later submissions to the queue see its writes.
+*
+**************************************************************/
+void TextureManager::update()
+{
+	for (size_t i = 0; i < m_pendingDecodes.size();)
+	{
+		if (std::future_status::ready == m_pendingDecodes[i].wait_for(std::chrono::seconds(0)))
+		{
+			m_decodedTextures.push_back(m_pendingDecodes[i].get());
+			std::swap(m_pendingDecodes[i], m_pendingDecodes.back());
+			m_pendingDecodes.pop_back();
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	std::vector<DecodedTexture> uploads;
+	for (auto &decoded : m_decodedTextures)
+	{
+		ManagedTexture &texture = m_textures[decoded.m_handle];
+		if (!decoded.m_error.empty())
+		{
+			std::cerr << "Could not load texture " << texture.m_path << ": " << decoded.m_error << std::endl;
+			texture.m_fFailed = true;
+			texture.m_fDecoded = true;
+		}
+		else if (INVALID_TEXTURE_HANDLE != decoded.m_duplicateOf)
+		{
+			m_pendingDuplicates.push_back(decoded);
+		}
+		else
+		{
+			uploads.push_back(decoded);
+		}
+	}
+	m_decodedTextures.clear();
+
+	if (!uploads.empty() || !m_streamingTextures.empty())
+	{
+		upload(uploads);
+	}
+
+	// A duplicate shares the image once the texture it duplicates has
+	// been uploaded.
+	//
+	for (size_t i = 0; i < m_pendingDuplicates.size();)
+	{
+		const DecodedTexture &duplicate = m_pendingDuplicates[i];
+		const ManagedTexture &original = m_textures[duplicate.m_duplicateOf];
+		if (!original.m_fDecoded)
+		{
+			++i;
+			continue;
+		}
+
+		ManagedTexture &texture = m_textures[duplicate.m_handle];
+		texture.m_source = original.m_source;
+		texture.m_vkImage = original.m_vkImage;
+		texture.m_vkMemory = original.m_vkMemory;
+		texture.m_vkImageView = original.m_vkImageView;
+		texture.m_mipLevels = original.m_mipLevels;
+		texture.m_uploadValue = original.m_uploadValue;
+		texture.m_fFailed = original.m_fFailed;
+		texture.m_fDecoded = true;
+		if (nullptr != m_pMaterialTable && !texture.m_fFailed)
+		{
+			m_pMaterialTable->setTexture(
+				texture.m_textureIndex,
+				texture.m_vkImageView,
+				getSampler(m_textures[texture.m_source].m_residentLevel));
+		}
+
+		m_pendingDuplicates[i] = m_pendingDuplicates.back();
+		m_pendingDuplicates.pop_back();
+	}
+}
+
+/**************************************************************
+* Description
+*		Waits for every decode and uploads the textures.
+* Returns
+*		void
+* Notes
+*		The uploads are submitted, not waited for.
+*
+**************************************************************/
+void TextureManager::waitForAll()
+{
+	for (auto &decode : m_pendingDecodes)
+	{
+		decode.wait();
+	}
+	update();
+}
+
+/**************************************************************
+* Description
+*		Checks if the upload of the texture has completed.
+* Returns
+*		true/false
+* Notes
+*		A texture that failed to load never becomes ready, a
+*		streamed one only once its every level has been copied.
+*
+**************************************************************/
+bool TextureManager::fReady(TextureHandle handle)
+{
+	const ManagedTexture &texture = m_textures[handle];
+	const ManagedTexture &source = m_textures[texture.m_source];
+	return texture.m_fDecoded &&
+		!texture.m_fFailed &&
+		0 == source.m_residentLevel &&
+		source.m_uploadValue <= m_pTimeline->getCompletedValue();
+}
+
+/**************************************************************
+* Description
+*		Reads the file and decodes it into a new staging buffer.
+*		Runs on the thread pool.
+* Returns
+*		The decoded texture, or the error.
+* Notes
+*		The content is compared before it is decoded, so a file
+*		with the same content as an earlier one is not decoded
+*		at all. A KTX2 file next to an image is read instead of
+*		it, falling back to the image if its format cannot be
+*		sampled.
+*
+**************************************************************/
+DecodedTexture TextureManager::decode(TextureHandle handle, const std::string &path)
+{
+	DecodedTexture decoded = {};
+	decoded.m_handle = handle;
+	decoded.m_duplicateOf = INVALID_TEXTURE_HANDLE;
+
+	std::vector<char> content;
+	std::string contentPath = path;
+	bool fKtx2 = fKtx2Path(path);
+	bool fRead = false;
+	if (!fKtx2 && m_fPreferCompressed)
+	{
+		std::string ktx2Path = path.substr(0, path.find_last_of('.')) + KTX2_EXTENSION;
+		fKtx2 = fRead = readFile(ktx2Path, content);
+		if (fRead)
+		{
+			contentPath = ktx2Path;
+		}
+	}
+	if (!fRead && !readFile(path, content))
+	{
+		decoded.m_error = "could not open the file";
+		return decoded;
+	}
+
+	if (m_fDeduplicate)
+	{
+		decoded.m_duplicateOf = findContent(handle, contentPath, content);
+		if (INVALID_TEXTURE_HANDLE != decoded.m_duplicateOf)
+		{
+			return decoded;
+		}
+	}
+
+	if (fKtx2)
+	{
+		if (decodeKtx2(content, decoded) || fKtx2Path(path))
+		{
+			return decoded;
+		}
+
+		// The compressed file next to the image cannot be used.
+		//
+		decoded.m_error.clear();
+		if (!readFile(path, content))
+		{
+			decoded.m_error = "could not open the file";
+			return decoded;
+		}
+	}
+
+	decodeImage(content, decoded);
+	return decoded;
+}
+
+/**************************************************************
+* Description
+*		Looks for a texture read earlier with the same content,
+*		adding the content of this one if there is none.
+*		Runs on the thread pool.
+* Returns
+*		The texture with the same content, or
+*		INVALID_TEXTURE_HANDLE.
+* Notes
+*		The files with the same hash and size are read again
+*		and compared outside the lock. Two jobs reading the same
+*		content at once may then both decode it, which only
+*		costs the memory deduplication would have saved.
+*
+**************************************************************/
+TextureHandle TextureManager::findContent(TextureHandle handle, const std::string &path, const std::vector<char> &content)
+{
+	uint64_t hash = hashBytes(content.data(), content.size());
+	std::vector<TextureContent> candidates;
+	{
+		std::lock_guard<std::mutex> lock(m_contentMutex);
+		auto bucket = m_contentHandles.find(hash);
+		if (m_contentHandles.end() != bucket)
+		{
+			candidates = bucket->second;
+		}
+	}
+
+	std::vector<char> other;
+	for (const TextureContent &candidate : candidates)
+	{
+		if (candidate.m_size == content.size() &&
+			readFile(candidate.m_path, other) &&
+			other.size() == content.size() &&
+			0 == memcmp(other.data(), content.data(), content.size()))
+		{
+			return candidate.m_handle;
+		}
+	}
+
+	TextureContent entry = {};
+	entry.m_path = path;
+	entry.m_size = content.size();
+	entry.m_handle = handle;
+	std::lock_guard<std::mutex> lock(m_contentMutex);
+	m_contentHandles[hash].push_back(entry);
+	return INVALID_TEXTURE_HANDLE;
+}
+
+/**************************************************************
+* Description
+*		Copies the levels of a KTX2 file into a new staging
+*		buffer, ready to be copied to the image as they are.
+* Returns
+*		true/false
+* Notes
+*		Fails with the error set if the file is invalid or the
+*		device cannot sample its format.
+*
+**************************************************************/
+bool TextureManager::decodeKtx2(const std::vector<char> &content, DecodedTexture &decoded)
+{
+	Ktx2Texture ktx2;
+	if (!parseKtx2(content.data(), content.size(), ktx2, decoded.m_error))
+	{
+		return false;
+	}
+	if (!fFormatSupported(ktx2.m_vkFormat))
+	{
+		decoded.m_error = "the device cannot sample format " + std::to_string(ktx2.m_vkFormat);
+		return false;
+	}
+
+	decoded.m_width = ktx2.m_width;
+	decoded.m_height = ktx2.m_height;
+	decoded.m_vkFormat = ktx2.m_vkFormat;
+	decoded.m_mipLevels = static_cast<uint32_t>(ktx2.m_levels.size());
+	std::vector<const void*> levelData;
+	std::vector<VkDeviceSize> levelSizes;
+	for (const auto &level : ktx2.m_levels)
+	{
+		levelData.push_back(content.data() + level.m_byteOffset);
+		levelSizes.push_back(level.m_byteLength);
+	}
+	stageLevels(levelData, levelSizes, decoded);
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Decodes a JPG or PNG file into a new staging buffer.
+*		Either the first level is decoded straight into the
+*		staging buffer and the others are blitted when it is
+*		uploaded, or the whole chain is built on the CPU and
+*		staged.
+* Returns
+*		true/false
+* Notes
+*		The CPU builds the levels when asked to, or when neither
+*		a blit nor the compute downsampler can build them. Only
+*		then is the mip cache used: a chain built before is read
+*		from it, a new one is written to it.
+*		Image files hold sRGB encoded color, which the CPU
+*		averages in linear space.
+*
+**************************************************************/
+bool TextureManager::decodeImage(const std::vector<char> &content, DecodedTexture &decoded)
+{
+	uint32_t width, height;
+	if (!readImageHeader(content.data(), content.size(), width, height, decoded.m_error))
+	{
+		return false;
+	}
+
+	ImageCodec codec = selectImageCodec(content.data(), content.size());
+	decoded.m_width = width;
+	decoded.m_height = height;
+	decoded.m_vkFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	decoded.m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+	VkDeviceSize imageSize = static_cast<VkDeviceSize>(width) * height * 4;
+	if (!fCpuMipmaps(decoded.m_width, decoded.m_height))
+	{
+		uint8_t *pStaging = static_cast<uint8_t*>(allocateStaging(std::vector<VkDeviceSize>(1, imageSize), decoded));
+		bool fDecoded = ::decodeImage(content.data(), content.size(), codec, pStaging, decoded.m_error);
+		vkUnmapMemory(m_vkDevice, decoded.m_vkStagingMemory);
+		if (!fDecoded)
+		{
+			// Never used by the device, so released straight away.
+			//
+			vkDestroyBuffer(m_vkDevice, decoded.m_vkStagingBuffer, nullptr);
+			vkFreeMemory(m_vkDevice, decoded.m_vkStagingMemory, nullptr);
+			decoded.m_vkStagingBuffer = VK_NULL_HANDLE;
+			decoded.m_vkStagingMemory = VK_NULL_HANDLE;
+			decoded.m_regions.clear();
+		}
+		return fDecoded;
+	}
+
+	std::string cachePath;
+	if (!m_mipCacheDirectory.empty())
+	{
+		std::ostringstream cacheName;
+		cacheName << m_mipCacheDirectory << "/" << std::hex << std::setw(16) << std::setfill('0')
+			<< hashBytes(content.data(), content.size()) << KTX2_EXTENSION;
+		cachePath = cacheName.str();
+
+		std::vector<char> cached;
+		if (readFile(cachePath, cached) && decodeKtx2(cached, decoded))
+		{
+			return true;
+		}
+		decoded.m_error.clear();
+	}
+
+	std::vector<uint8_t> pixels(static_cast<size_t>(imageSize));
+	if (!::decodeImage(content.data(), content.size(), codec, pixels.data(), decoded.m_error))
+	{
+		return false;
+	}
+
+	std::vector<std::vector<uint8_t>> levels;
+	buildMipChain(pixels.data(), decoded.m_width, decoded.m_height, true, nullptr, levels);
+	pixels.clear();
+	pixels.shrink_to_fit();
+
+	std::vector<const void*> levelData;
+	std::vector<VkDeviceSize> levelSizes;
+	for (const auto &level : levels)
+	{
+		levelData.push_back(level.data());
+		levelSizes.push_back(level.size());
+	}
+	stageLevels(levelData, levelSizes, decoded);
+
+	// Written under a name of its own first, so a texture with the same
+	// content loading at the same time never reads half a file.
+	//
+	if (!cachePath.empty() && createDirectory(m_mipCacheDirectory))
+	{
+		std::string writePath = cachePath + "." + std::to_string(decoded.m_handle) + ".tmp";
+		if (!writeKtx2(writePath, decoded.m_vkFormat, decoded.m_width, decoded.m_height, levels) ||
+			0 != std::rename(writePath.c_str(), cachePath.c_str()))
+		{
+			std::remove(writePath.c_str());
+		}
+	}
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Copies mip levels, level 0 first, into a new staging
+*		buffer and sets up the regions copying them to the
+*		image.
+* Returns
+*		void
+* Notes
+*		The width and height of the decoded texture have to be
+*		set.
+*
+**************************************************************/
+void TextureManager::stageLevels(
+	const std::vector<const void*> &levelData,
+	const std::vector<VkDeviceSize> &levelSizes,
+	DecodedTexture &decoded)
+{
+	char *data = static_cast<char*>(allocateStaging(levelSizes, decoded));
+	for (size_t level = 0; level < levelData.size(); ++level)
+	{
+		memcpy(data + decoded.m_regions[level].bufferOffset, levelData[level], static_cast<size_t>(levelSizes[level]));
+	}
+	vkUnmapMemory(m_vkDevice, decoded.m_vkStagingMemory);
+}
+
+/**************************************************************
+* Description
+*		Creates a staging buffer holding mip levels of the
+*		sizes given, level 0 first, and sets up the regions
+*		copying them to the image.
+* Returns
+*		The mapped staging buffer.
+* Notes
+*		The width and height of the decoded texture have to be
+*		set. The caller writes each level at the offset of its
+*		region and unmaps the memory.
+*
+**************************************************************/
+void *TextureManager::allocateStaging(const std::vector<VkDeviceSize> &levelSizes, DecodedTexture &decoded)
+{
+	decoded.m_regions.clear();
+	decoded.m_stagingSize = 0;
+	for (uint32_t level = 0; level < levelSizes.size(); ++level)
+	{
+		VkBufferImageCopy region = {};
+		region.bufferOffset = (decoded.m_stagingSize + STAGING_LEVEL_ALIGNMENT - 1) / STAGING_LEVEL_ALIGNMENT * STAGING_LEVEL_ALIGNMENT;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = level;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = { 0, 0, 0 };
+		region.imageExtent = { std::max(decoded.m_width >> level, 1u), std::max(decoded.m_height >> level, 1u), 1 };
+		decoded.m_regions.push_back(region);
+		decoded.m_stagingSize = region.bufferOffset + levelSizes[level];
+	}
+
+	createBuffer(m_vkDevice,
+		m_vkPhysicalDevice,
+		decoded.m_stagingSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		decoded.m_vkStagingBuffer,
+		decoded.m_vkStagingMemory);
+
+	void *data = nullptr;
+	vkMapMemory(m_vkDevice, decoded.m_vkStagingMemory, 0, decoded.m_stagingSize, 0, &data);
+	return data;
+}
+
+/**************************************************************
+* Description
+*		Checks if textures of the format can be uploaded and
+*		sampled with linear filtering.
+* Returns
+*		true/false
+* Notes
+*		Block compressed formats also need the feature of their
+*		family.
+*
+**************************************************************/
+bool TextureManager::fFormatSupported(VkFormat vkFormat) const
+{
+	if (vkFormat >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && vkFormat <= VK_FORMAT_BC7_SRGB_BLOCK && !m_fTextureCompressionBC)
+	{
+		return false;
+	}
+	if (vkFormat >= VK_FORMAT_ETC2_R8G8B8_UNORM_BLOCK && vkFormat <= VK_FORMAT_EAC_R11G11_SNORM_BLOCK && !m_fTextureCompressionETC2)
+	{
+		return false;
+	}
+
+	const VkFormatFeatureFlags requiredFeatures =
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+		VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(m_vkPhysicalDevice, vkFormat, &props);
+	return (props.optimalTilingFeatures & requiredFeatures) == requiredFeatures;
+}
+
+/**************************************************************
+* Description
+*		Checks if the mip chain of an image of the size is built
+*		by the compute downsampler.
+* Returns
+*		true/false
+* Notes
+*		It stands in for the blits when the device cannot blit
+*		the format.
+*
+**************************************************************/
+bool TextureManager::fComputeMipmaps(uint32_t width, uint32_t height) const
+{
+	return m_downsampler.fSupported(width, height) && (MIP_GENERATION_COMPUTE == m_mipGeneration || !m_fBlitMipmaps);
+}
+
+/**************************************************************
+* Description
+*		Checks if the mip chain of an image of the size is built
+*		on the CPU.
+* Returns
+*		true/false
+* Notes
+*		Only when asked to, or when the device can neither blit
+*		the format with linear filtering nor run the compute
+*		downsampler on the image.
+*
+**************************************************************/
+bool TextureManager::fCpuMipmaps(uint32_t width, uint32_t height) const
+{
+	return MIP_GENERATION_CPU == m_mipGeneration || (!m_fBlitMipmaps && !fComputeMipmaps(width, height));
+}
+
+/**************************************************************
+* Description
+*		Checks if the decoded texture is copied to its image a
+*		band at a time, smallest level first.
+* Returns
+*		true/false
+* Notes
+*		Only textures staged with every level are streamed, the
+*		others need level 0 to build the rest.
+*
+**************************************************************/
+bool TextureManager::fStreamed(const DecodedTexture &decoded) const
+{
+	VkDeviceSize rowBytes;
+	uint32_t rowCount, rowHeight;
+	return 0 != m_streamingBudget &&
+		decoded.m_mipLevels > 1 &&
+		decoded.m_regions.size() == decoded.m_mipLevels &&
+		getLevelRows(decoded.m_vkFormat, decoded.m_regions[0].imageExtent, rowBytes, rowCount, rowHeight);
+}
+
+/**************************************************************
+* Description
+*		Creates a texture sampler never sampling the levels
+*		above the minimum level of detail.
+* Returns
+*		The sampler.
+* Notes
+*
+**************************************************************/
+VkSampler TextureManager::createSampler(float minLod) const
+{
+	// The textures have different numbers of mip levels, so the level
+	// of detail is not clamped from above.
+	//
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.anisotropyEnable = VK_TRUE;
+	samplerInfo.maxAnisotropy = 16;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.minLod = minLod;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	VkSampler sampler;
+	if (VK_SUCCESS != vkCreateSampler(m_vkDevice, &samplerInfo, nullptr, &sampler))
+	{
+		throw std::runtime_error("Could not create texture sampler.");
+	}
+	return sampler;
+}
+
+/**************************************************************
+* Description
+*		Gets the sampler for a texture whose levels from the
+*		minimum level down have been copied, creating it the
+*		first time.
+* Returns
+*		The sampler.
+* Notes
+*
+**************************************************************/
+VkSampler TextureManager::getSampler(uint32_t minLevel)
+{
+	if (0 == minLevel)
+	{
+		return m_vkSampler;
+	}
+	if (m_vkLodSamplers.size() < minLevel)
+	{
+		m_vkLodSamplers.resize(minLevel, VK_NULL_HANDLE);
+	}
+	if (VK_NULL_HANDLE == m_vkLodSamplers[minLevel - 1])
+	{
+		m_vkLodSamplers[minLevel - 1] = createSampler(static_cast<float>(minLevel));
+	}
+	return m_vkLodSamplers[minLevel - 1];
+}
+
+/**************************************************************
+* Description
+*		Reads back how long the last upload took on the GPU.
+* Returns
+*		The duration, or 0 if it is not known.
+* Notes
+*		Needs GPU timestamps to be enabled and the upload to
+*		have completed.
+*
+**************************************************************/
+double TextureManager::getLastUploadGpuMilliseconds() const
+{
+	if (VK_NULL_HANDLE == m_vkTimestampQueryPool)
+	{
+		return 0.0;
+	}
+
+	uint64_t timestamps[2] = {};
+	VkResult result = vkGetQueryPoolResults(
+		m_vkDevice,
+		m_vkTimestampQueryPool,
+		0,
+		2,
+		sizeof(timestamps),
+		timestamps,
+		sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT);
+	if (VK_SUCCESS != result)
+	{
+		return 0.0;
+	}
+	uint64_t ticks = (timestamps[1] - timestamps[0]) & getTimestampMask(m_timestampValidBits);
+	return static_cast<double>(ticks) * m_timestampPeriod / 1000000.0;
+}
+
+/**************************************************************
+* Description
+*		Creates the images of the decoded textures and uploads
+*		them, and the next levels of the textures streaming, in
+*		a single submission.
+* Returns
+*		void
+* Notes
+*		The staging buffers are released once the upload has
+*		completed, those of streamed textures once their last
+*		level has been copied.
+*
+**************************************************************/
+void TextureManager::upload(std::vector<DecodedTexture> &decodedTextures)
+{
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(m_vkDevice, m_vkCommandPool);
+	if (VK_NULL_HANDLE != m_vkTimestampQueryPool)
+	{
+		vkCmdResetQueryPool(commandBuffer, m_vkTimestampQueryPool, 0, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_vkTimestampQueryPool, 0);
+	}
+	if (m_downsampler.fCreated())
+	{
+		m_downsampler.beginBatch(m_pTimeline->getCompletedValue());
+	}
+	for (const auto &decoded : decodedTextures)
+	{
+		ManagedTexture &texture = m_textures[decoded.m_handle];
+		texture.m_mipLevels = decoded.m_mipLevels;
+		bool fCompute = (1 == decoded.m_regions.size()) &&
+			(decoded.m_mipLevels > 1) &&
+			fComputeMipmaps(decoded.m_width, decoded.m_height);
+		texture.m_imageBytes = createTextureImage(
+			m_vkDevice,
+			m_vkPhysicalDevice,
+			decoded.m_vkFormat,
+			decoded.m_width,
+			decoded.m_height,
+			texture.m_mipLevels,
+			fCompute,
+			texture.m_vkImage,
+			texture.m_vkMemory);
+		++m_imageCount;
+		m_imageBytes += texture.m_imageBytes;
+
+		VkImageViewCreateInfo imageViewInfo = {};
+		imageViewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+		imageViewInfo.image = texture.m_vkImage;
+		imageViewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+		imageViewInfo.format = decoded.m_vkFormat;
+		imageViewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		imageViewInfo.subresourceRange.baseMipLevel = 0;
+		imageViewInfo.subresourceRange.levelCount = texture.m_mipLevels;
+		imageViewInfo.subresourceRange.baseArrayLayer = 0;
+		imageViewInfo.subresourceRange.layerCount = 1;
+		if (VK_SUCCESS != vkCreateImageView(m_vkDevice, &imageViewInfo, nullptr, &texture.m_vkImageView))
+		{
+			throw std::runtime_error("Could not create image view.");
+		}
+
+		if (!fStreamed(decoded))
+		{
+			texture.m_residentLevel = 0;
+			m_uploadedBytes += decoded.m_stagingSize;
+			recordTextureUpload(
+				commandBuffer,
+				decoded.m_vkStagingBuffer,
+				texture.m_vkImage,
+				static_cast<int32_t>(decoded.m_width),
+				static_cast<int32_t>(decoded.m_height),
+				texture.m_mipLevels,
+				decoded.m_regions,
+				fCompute ? &m_downsampler : nullptr);
+			continue;
+		}
+
+		// Every level is made shader readable at once, the clamp of the
+		// sampler keeps the ones not copied yet from being sampled.
+		//
+		VkImageMemoryBarrier barrier = {};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.image = texture.m_vkImage;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.baseMipLevel = 0;
+		barrier.subresourceRange.levelCount = texture.m_mipLevels;
+		barrier.subresourceRange.baseArrayLayer = 0;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		vkCmdPipelineBarrier(
+			commandBuffer,
+			VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			0,
+			0,
+			nullptr,
+			0,
+			nullptr,
+			1,
+			&barrier);
+
+		StreamingTexture streaming = {};
+		streaming.m_handle = decoded.m_handle;
+		streaming.m_decoded = decoded;
+		texture.m_residentLevel = texture.m_mipLevels;
+
+		VkDeviceSize tailBytes = 0;
+		for (const auto &region : decoded.m_regions)
+		{
+			if (std::max(region.imageExtent.width, region.imageExtent.height) <= STREAMING_TAIL_SIZE)
+			{
+				VkDeviceSize rowBytes;
+				uint32_t rowCount, rowHeight;
+				getLevelRows(decoded.m_vkFormat, region.imageExtent, rowBytes, rowCount, rowHeight);
+				tailBytes += rowBytes * rowCount;
+			}
+		}
+		streamTexture(commandBuffer, streaming, tailBytes);
+		m_streamingTextures.push_back(streaming);
+	}
+
+	// The levels of the textures streaming since earlier uploads, the
+	// oldest first, as far as the budget goes.
+	//
+	VkDeviceSize budget = m_streamingBudget;
+	std::vector<TextureHandle> streamedTextures;
+	for (auto &streaming : m_streamingTextures)
+	{
+		const ManagedTexture &texture = m_textures[streaming.m_handle];
+		if (texture.m_fDecoded && 0 != budget && streamTexture(commandBuffer, streaming, budget))
+		{
+			streamedTextures.push_back(streaming.m_handle);
+		}
+	}
+	if (VK_NULL_HANDLE != m_vkTimestampQueryPool)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_vkTimestampQueryPool, 1);
+	}
+
+	uint64_t value = endSingleTimeCommands(m_vkCommandPool, *m_pTimeline, commandBuffer, *m_pDeletionQueue);
+	m_lastUploadValue = value;
+	if (m_downsampler.fCreated())
+	{
+		m_downsampler.endBatch(value, *m_pDeletionQueue);
+	}
+	for (const auto &decoded : decodedTextures)
+	{
+		if (!fStreamed(decoded))
+		{
+			m_pDeletionQueue->enqueueBuffer(value, decoded.m_vkStagingBuffer);
+			m_pDeletionQueue->enqueueMemory(value, decoded.m_vkStagingMemory);
+		}
+
+		ManagedTexture &texture = m_textures[decoded.m_handle];
+		texture.m_uploadValue = value;
+		texture.m_fDecoded = true;
+		if (nullptr != m_pMaterialTable)
+		{
+			VkSampler sampler = getSampler(texture.m_residentLevel);
+			if (NO_TEXTURE == texture.m_textureIndex)
+			{
+				texture.m_textureIndex = m_pMaterialTable->addTexture(texture.m_vkImageView, sampler);
+			}
+			else
+			{
+				m_pMaterialTable->setTexture(texture.m_textureIndex, texture.m_vkImageView, sampler);
+			}
+		}
+	}
+
+	for (auto handle : streamedTextures)
+	{
+		m_textures[handle].m_uploadValue = value;
+		setTextureSlots(handle);
+	}
+
+	// The staging buffers of the textures now complete are released
+	// once their last levels have been copied.
+	//
+	for (size_t i = 0; i < m_streamingTextures.size();)
+	{
+		const StreamingTexture &streaming = m_streamingTextures[i];
+		if (0 != m_textures[streaming.m_handle].m_residentLevel)
+		{
+			++i;
+			continue;
+		}
+		m_pDeletionQueue->enqueueBuffer(value, streaming.m_decoded.m_vkStagingBuffer);
+		m_pDeletionQueue->enqueueMemory(value, streaming.m_decoded.m_vkStagingMemory);
+		m_streamingTextures.erase(m_streamingTextures.begin() + i);
+	}
+}
+
+/**************************************************************
+* Description
+*		Records the copy of the next rows of a streamed texture,
+*		the level below the resident one first, until the budget
+*		is used up or every level has been copied. The budget is
+*		reduced by the bytes copied.
+* Returns
+*		true if anything was copied.
+* Notes
+*		At least one row of blocks is copied, even over the
+*		budget. A level becomes resident, and the texture is
+*		sampled down to it, once all its rows have been copied.
+*
+**************************************************************/
+bool TextureManager::streamTexture(VkCommandBuffer commandBuffer, StreamingTexture &streaming, VkDeviceSize &budget)
+{
+	ManagedTexture &texture = m_textures[streaming.m_handle];
+	const DecodedTexture &decoded = streaming.m_decoded;
+	bool fCopied = false;
+	while (0 != texture.m_residentLevel && 0 != budget)
+	{
+		const VkBufferImageCopy &region = decoded.m_regions[texture.m_residentLevel - 1];
+		VkDeviceSize rowBytes;
+		uint32_t rowCount, rowHeight;
+		getLevelRows(decoded.m_vkFormat, region.imageExtent, rowBytes, rowCount, rowHeight);
+		uint32_t rows = static_cast<uint32_t>(std::min<VkDeviceSize>(rowCount - streaming.m_rowsCopied, std::max<VkDeviceSize>(budget / rowBytes, 1)));
+
+		VkBufferImageCopy band = region;
+		band.bufferOffset += streaming.m_rowsCopied * rowBytes;
+		band.imageOffset.y = static_cast<int32_t>(streaming.m_rowsCopied * rowHeight);
+		band.imageExtent.height = std::min(rows * rowHeight, region.imageExtent.height - streaming.m_rowsCopied * rowHeight);
+		recordBandCopy(commandBuffer, decoded.m_vkStagingBuffer, texture.m_vkImage, band);
+
+		VkDeviceSize bandBytes = rows * rowBytes;
+		budget -= std::min(budget, bandBytes);
+		m_uploadedBytes += bandBytes;
+		fCopied = true;
+
+		streaming.m_rowsCopied += rows;
+		if (rowCount == streaming.m_rowsCopied)
+		{
+			streaming.m_rowsCopied = 0;
+			--texture.m_residentLevel;
+		}
+	}
+	return fCopied;
+}
+
+/**************************************************************
+* Description
+*		Points the bindless slots of a texture and of its
+*		duplicates at its image, with the sampler clamped to its
+*		resident levels.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void TextureManager::setTextureSlots(TextureHandle source)
+{
+	if (nullptr == m_pMaterialTable)
+	{
+		return;
+	}
+
+	VkSampler sampler = getSampler(m_textures[source].m_residentLevel);
+	for (const auto &texture : m_textures)
+	{
+		if (source == texture.m_source && texture.m_fDecoded && !texture.m_fFailed && NO_TEXTURE != texture.m_textureIndex)
+		{
+			m_pMaterialTable->setTexture(texture.m_textureIndex, texture.m_vkImageView, sampler);
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Creates and uploads a single white texel, shown in the
+*		slots of the textures that are still loading.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void TextureManager::createFallbackTexture()
+{
+	DecodedTexture decoded = {};
+	decoded.m_handle = static_cast<TextureHandle>(m_textures.size());
+	decoded.m_duplicateOf = INVALID_TEXTURE_HANDLE;
+	decoded.m_width = 1;
+	decoded.m_height = 1;
+	decoded.m_vkFormat = VK_FORMAT_R8G8B8A8_UNORM;
+	decoded.m_mipLevels = 1;
+	decoded.m_stagingSize = 4;
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { 1, 1, 1 };
+	decoded.m_regions.push_back(region);
+
+	createBuffer(m_vkDevice,
+		m_vkPhysicalDevice,
+		decoded.m_stagingSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		decoded.m_vkStagingBuffer,
+		decoded.m_vkStagingMemory);
+
+	void *data = nullptr;
+	vkMapMemory(m_vkDevice, decoded.m_vkStagingMemory, 0, 4, 0, &data);
+	memset(data, 0xFF, 4);
+	vkUnmapMemory(m_vkDevice, decoded.m_vkStagingMemory);
+
+	ManagedTexture texture = {};
+	texture.m_textureIndex = NO_TEXTURE;
+	texture.m_source = decoded.m_handle;
+	m_textures.push_back(texture);
+	m_fallbackTexture = decoded.m_handle;
+
+	std::vector<DecodedTexture> uploads(1, decoded);
+	upload(uploads);
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+#include "downsampler.h"
+#include "materialtable.h"
+#include "threadpool.h"
+#include<future>
+#include<mutex>
+#include<string>
+#include<unordered_map>
+#include<vector>
+
+// Identifies a texture requested from the texture manager. Valid as soon
+// as the request is made, the texture it names is uploaded later.
+//
+typedef uint32_t TextureHandle;
+
+const TextureHandle INVALID_TEXTURE_HANDLE = 0xFFFFFFFF;
+
+// How the mip chains of JPG and PNG textures are generated.
+//
+enum MipGeneration
+{
+	MIP_GENERATION_BLIT, // One blit per level on the GPU.
+	MIP_GENERATION_COMPUTE, // One dispatch for every level, blitting the images it cannot take.
+	MIP_GENERATION_CPU // Built on the CPU and copied with level 0.
+};
+
+// A texture decoded on a worker thread into its own staging buffer,
+// waiting for the main thread to upload it.
+//
+struct DecodedTexture
+{
+	TextureHandle m_handle;
+	TextureHandle m_duplicateOf; // A texture with the same content, or INVALID_TEXTURE_HANDLE.
+	uint32_t m_width;
+	uint32_t m_height;
+	VkFormat m_vkFormat;
+	uint32_t m_mipLevels;
+	std::vector<VkBufferImageCopy> m_regions; // Levels in the staging buffer, the rest are blitted.
+	VkDeviceSize m_stagingSize;
+	VkBuffer m_vkStagingBuffer;
+	VkDeviceMemory m_vkStagingMemory;
+	std::string m_error; // Set if the file could not be read or decoded.
+};
+
+// A texture and the upload filling it. Duplicates share the image of
+// the texture they duplicate and own no Vulkan objects.
+//
+struct ManagedTexture
+{
+	std::string m_path;
+	VkImage m_vkImage;
+	VkDeviceMemory m_vkMemory;
+	VkImageView m_vkImageView;
+	uint32_t m_mipLevels;
+	uint32_t m_residentLevel; // Most detailed level copied, 0 once the texture is complete.
+	VkDeviceSize m_imageBytes;
+	uint32_t m_textureIndex; // Slot in the bindless array, or NO_TEXTURE.
+	TextureHandle m_source; // The texture owning the image, itself unless a duplicate.
+	uint64_t m_uploadValue; // Graphics timeline value the upload completes with.
+	bool m_fDecoded; // The decode has finished and the upload was submitted.
+	bool m_fFailed;
+};
+
+// A file read by a decode job, kept by the hash of its content. Hashes
+// can collide, so the file is read again and compared before another
+// texture is made a duplicate of it.
+//
+struct TextureContent
+{
+	std::string m_path; // The file that was read, the KTX2 file if one was preferred.
+	size_t m_size;
+	TextureHandle m_handle;
+};
+
+// A texture copied to its image one level at a time, smallest first,
+// from the staging buffer it was decoded into.
+//
+struct StreamingTexture
+{
+	TextureHandle m_handle;
+	DecodedTexture m_decoded; // Owns the staging buffer until the last level is copied.
+	uint32_t m_rowsCopied; // Rows of blocks of the level below the resident one.
+};
+
+// Loads textures from image files. The files are read and decoded on
+// the thread pool, each straight into a staging buffer, and uploaded by
+// the main thread in one command buffer per update. Textures with the
+// same file content share one image. Every texture gets a slot in the
+// bindless array of the material table at once, showing a white
+// fallback texture until its upload has been submitted.
+// KTX2 files are uploaded as stored, block compressed with all their
+// mip levels. A JPG or PNG with a KTX2 file of the same name next to it
+// is loaded from that file when the device can sample its format.
+// Otherwise the mip chain of an image is blitted on the GPU, built by a
+// compute shader or built on the CPU, which can cache it on disk so
+// later loads copy every level.
+// Textures built in memory, like the pages of a texture atlas, are
+// added with their levels and uploaded the same way.
+// With a streaming budget, textures staged with every level are shown
+// as soon as their smallest levels are copied. The larger ones follow
+// over the next updates, each update copying no more than the budget,
+// and the sampler of a texture clamps its level of detail to the levels
+// already copied.
+//
+class TextureManager
+{
+public:
+	TextureManager();
+	void create(
+		VkDevice vkDevice,
+		VkPhysicalDevice vkPhysicalDevice,
+		VkCommandPool vkCommandPool,
+		Timeline *pTimeline,
+		DeletionQueue *pDeletionQueue,
+		MaterialTable *pMaterialTable,
+		ThreadPool *pThreadPool);
+	void destroy();
+	TextureHandle load(const std::string &path);
+	TextureHandle addTexture(
+		const std::string &name,
+		uint32_t width,
+		uint32_t height,
+		const std::vector<std::vector<uint8_t>> &levels);
+	void update();
+	void waitForAll();
+	bool fReady(TextureHandle handle);
+	uint32_t getTextureIndex(TextureHandle handle) const { return m_textures[handle].m_textureIndex; }
+	uint64_t getLastUploadValue() const { return m_lastUploadValue; }
+	size_t getTextureCount() const { return m_textures.size(); }
+	size_t getImageCount() const { return m_imageCount; }
+	VkDeviceSize getImageBytes() const { return m_imageBytes; }
+	VkDeviceSize getUploadedBytes() const { return m_uploadedBytes; }
+	void setDeduplicate(bool fDeduplicate) { m_fDeduplicate = fDeduplicate; }
+	void setPreferCompressed(bool fPreferCompressed) { m_fPreferCompressed = fPreferCompressed; }
+	void setMipGeneration(MipGeneration mipGeneration) { m_mipGeneration = mipGeneration; }
+	void setMipCacheDirectory(const std::string &directory) { m_mipCacheDirectory = directory; }
+	void setGpuTimestamps(uint32_t timestampValidBits) { m_timestampValidBits = timestampValidBits; }
+	void setStreamingBudget(VkDeviceSize bytesPerUpdate) { m_streamingBudget = bytesPerUpdate; }
+	uint32_t getResidentLevel(TextureHandle handle) const { return m_textures[m_textures[handle].m_source].m_residentLevel; }
+	size_t getStreamingCount() const { return m_streamingTextures.size(); }
+	double getLastUploadGpuMilliseconds() const;
+private:
+	TextureHandle reserveTexture(const std::string &path);
+	DecodedTexture decode(TextureHandle handle, const std::string &path);
+	TextureHandle findContent(TextureHandle handle, const std::string &path, const std::vector<char> &content);
+	bool decodeKtx2(const std::vector<char> &content, DecodedTexture &decoded);
+	bool decodeImage(const std::vector<char> &content, DecodedTexture &decoded);
+	void stageLevels(
+		const std::vector<const void*> &levelData,
+		const std::vector<VkDeviceSize> &levelSizes,
+		DecodedTexture &decoded);
+	void *allocateStaging(const std::vector<VkDeviceSize> &levelSizes, DecodedTexture &decoded);
+	bool fFormatSupported(VkFormat vkFormat) const;
+	bool fComputeMipmaps(uint32_t width, uint32_t height) const;
+	bool fCpuMipmaps(uint32_t width, uint32_t height) const;
+	bool fStreamed(const DecodedTexture &decoded) const;
+	VkSampler createSampler(float minLod) const;
+	VkSampler getSampler(uint32_t minLevel);
+	void upload(std::vector<DecodedTexture> &decodedTextures);
+	bool streamTexture(VkCommandBuffer commandBuffer, StreamingTexture &streaming, VkDeviceSize &budget);
+	void setTextureSlots(TextureHandle source);
+	void createFallbackTexture();
+
+	VkDevice m_vkDevice;
+	VkPhysicalDevice m_vkPhysicalDevice;
+	VkCommandPool m_vkCommandPool;
+	Timeline *m_pTimeline;
+	DeletionQueue *m_pDeletionQueue;
+	MaterialTable *m_pMaterialTable; // Optional, no slots are written without it.
+	ThreadPool *m_pThreadPool; // Optional, textures are decoded by load without it.
+	VkSampler m_vkSampler; // Shared by every complete texture.
+	std::vector<VkSampler> m_vkLodSamplers; // By minimum level, for the textures still streaming. Created when needed.
+	std::vector<ManagedTexture> m_textures; // Indexed by handle.
+	std::unordered_map<std::string, TextureHandle> m_pathHandles;
+	std::mutex m_contentMutex; // Guards m_contentHandles, used by the decode jobs.
+	std::unordered_map<uint64_t, std::vector<TextureContent>> m_contentHandles; // By hash of the file content.
+	std::vector<std::future<DecodedTexture>> m_pendingDecodes;
+	std::vector<DecodedTexture> m_decodedTextures; // Finished, waiting to be uploaded.
+	std::vector<DecodedTexture> m_pendingDuplicates; // Waiting for the texture they duplicate.
+	std::vector<StreamingTexture> m_streamingTextures; // Oldest first.
+	VkDeviceSize m_streamingBudget; // Bytes streamed per update, or 0 to copy every level at once.
+	TextureHandle m_fallbackTexture;
+	uint64_t m_lastUploadValue;
+	size_t m_imageCount;
+	VkDeviceSize m_imageBytes; // Device memory of the images.
+	VkDeviceSize m_uploadedBytes; // Copied from staging buffers.
+	bool m_fDeduplicate;
+	bool m_fPreferCompressed;
+	MipGeneration m_mipGeneration; // Set before create.
+	bool m_fBlitMipmaps; // The device can blit the image format with linear filtering.
+	ComputeDownsampler m_downsampler; // Created for MIP_GENERATION_COMPUTE, or when blits cannot be used.
+	std::string m_mipCacheDirectory; // Chains built on the CPU are cached in it, unless empty. Created when first written.
+	bool m_fTextureCompressionBC; // The device supports, and is expected to enable, the feature.
+	bool m_fTextureCompressionETC2;
+	uint32_t m_timestampValidBits; // Of the queue uploads run on, to time each upload on the GPU. Set before create, 0 disables.
+	VkQueryPool m_vkTimestampQueryPool; // Written by the last upload, if timestamps are supported.
+	float m_timestampPeriod; // Nanoseconds per timestamp tick.
+};
@@ -0,0 +1,152 @@
+#include "threadpool.h"
+#include <algorithm>
+#include <exception>
+
+/**************************************************************
+* Description
+*		Constructor for the class. Starts the worker threads.
+* Returns
+*		void
+* Notes
+*		A thread count of zero uses one thread per hardware
+*		thread, leaving one for the main thread.
+*
+**************************************************************/
+ThreadPool::ThreadPool(uint32_t threadCount)
+	:m_fStopping(false)
+{
+	if (0 == threadCount)
+	{
+		uint32_t hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	for (uint32_t i = 0; i < threadCount; ++i)
+	{
+		m_threads.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+/**************************************************************
+* Description
+*		Destructor for the class. Finishes the queued jobs and
+*		joins the worker threads.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_fStopping = true;
+	}
+	m_condition.notify_all();
+
+	for (auto &thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+/**************************************************************
+* Description
+*		Splits the range [0, count) into batches and runs the
+*		function on each of them in parallel. The calling thread
+*		runs the last batch itself and then waits for the rest.
+* Returns
+*		void
+* Notes
+*		Must not be called from a worker thread, since it blocks
+*		until the batches it queued have finished.
+*		If maxBatchCount is zero, there is at most one batch per
+*		worker thread plus one for the calling thread.
+*
+**************************************************************/
+void ThreadPool::parallelFor(
+	size_t count,
+	size_t minBatchSize,
+	const std::function<void(size_t batchIndex, size_t begin, size_t end)> &function,
+	uint32_t maxBatchCount)
+{
+	if (0 == count)
+	{
+		return;
+	}
+
+	size_t batchCount = 0 != maxBatchCount ? maxBatchCount : getThreadCount() + 1;
+	batchCount = std::min(batchCount, (count + std::max<size_t>(minBatchSize, 1) - 1) / std::max<size_t>(minBatchSize, 1));
+	batchCount = std::max<size_t>(batchCount, 1);
+	size_t batchSize = (count + batchCount - 1) / batchCount;
+
+	std::vector<std::future<void>> pending;
+	pending.reserve(batchCount);
+	size_t begin = 0;
+	size_t batchIndex = 0;
+	for (; batchIndex + 1 < batchCount && begin + batchSize < count; ++batchIndex)
+	{
+		size_t end = begin + batchSize;
+		pending.push_back(submit([&function, batchIndex, begin, end]() { function(batchIndex, begin, end); }));
+		begin = end;
+	}
+
+	// The queued batches reference the function, so they have to finish
+	// before we leave, even if the batch on this thread throws.
+	//
+	std::exception_ptr callerException;
+	try
+	{
+		function(batchIndex, begin, count);
+	}
+	catch (...)
+	{
+		callerException = std::current_exception();
+	}
+
+	for (auto &batch : pending)
+	{
+		batch.wait();
+	}
+
+	if (callerException)
+	{
+		std::rethrow_exception(callerException);
+	}
+
+	// get() rethrows any exception thrown by a batch.
+	//
+	for (auto &batch : pending)
+	{
+		batch.get();
+	}
+}
+
+/**************************************************************
+* Description
+*		The loop run by every worker thread. Waits for jobs and
+*		executes them until the pool is destroyed.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void ThreadPool::workerLoop()
+{
+	for (;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_condition.wait(lock, [this]() { return m_fStopping || !m_jobs.empty(); });
+			if (m_jobs.empty())
+			{
+				return;
+			}
+
+			job = std::move(m_jobs.front());
+			m_jobs.pop();
+		}
+		job();
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include<condition_variable>
+#include<cstdint>
+#include<functional>
+#include<future>
+#include<memory>
+#include<mutex>
+#include<queue>
+#include<thread>
+#include<vector>
+
+// A fixed set of worker threads executing submitted jobs in FIFO order.
+//
+class ThreadPool
+{
+public:
+	explicit ThreadPool(uint32_t threadCount = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	uint32_t getThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+
+	template<typename Function>
+	auto submit(Function &&function) -> std::future<decltype(function())>
+	{
+		typedef decltype(function()) ResultType;
+		auto task = std::make_shared<std::packaged_task<ResultType()>>(std::forward<Function>(function));
+		std::future<ResultType> result = task->get_future();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_jobs.push([task]() { (*task)(); });
+		}
+		m_condition.notify_one();
+		return result;
+	}
+
+	void parallelFor(
+		size_t count,
+		size_t minBatchSize,
+		const std::function<void(size_t batchIndex, size_t begin, size_t end)> &function,
+		uint32_t maxBatchCount = 0);
+
+private:
+	void workerLoop();
+
+	std::vector<std::thread> m_threads;
+	std::queue<std::function<void()>> m_jobs;
+	std::mutex m_mutex;
+	std::condition_variable m_condition;
+	bool m_fStopping;
+};
@@ -0,0 +1,173 @@
+#include "timeline.h"
+#include <limits>
+#include <stdexcept>
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+Timeline::Timeline()
+	:m_vkDevice(VK_NULL_HANDLE),
+	m_vkQueue(VK_NULL_HANDLE),
+	m_vkSemaphore(VK_NULL_HANDLE),
+	m_submittedValue(0),
+	m_completedValue(0)
+{
+}
+
+/**************************************************************
+* Description
+*		Creates the timeline semaphore for the queue, starting
+*		at zero.
+* Returns
+*		void
+* Notes
+*		The timelineSemaphore feature has to be enabled on the
+*		device.
+*
+**************************************************************/
+void Timeline::create(VkDevice vkDevice, VkQueue vkQueue)
+{
+	m_vkDevice = vkDevice;
+	m_vkQueue = vkQueue;
+
+	VkSemaphoreTypeCreateInfo typeInfo = {};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+	if (VK_SUCCESS != vkCreateSemaphore(m_vkDevice, &semaphoreInfo, nullptr, &m_vkSemaphore))
+	{
+		throw std::runtime_error("Timeline semaphore could not be created.");
+	}
+}
+
+/**************************************************************
+* Description
+*		Destroys the semaphore.
+* Returns
+*		void
+* Notes
+*		Nothing may be waiting on the semaphore.
+*
+**************************************************************/
+void Timeline::destroy()
+{
+	vkDestroySemaphore(m_vkDevice, m_vkSemaphore, nullptr);
+	m_vkSemaphore = VK_NULL_HANDLE;
+}
+
+/**************************************************************
+* Description
+*		Submits the batch to the queue, adding a signal of the
+*		next value of the timeline. The batch can also wait for
+*		a value of another timeline.
+* Returns
+*		The value signalled once the batch has completed.
+* Notes
+*		The semaphores of the submit info are binary.
+*		Submissions to a queue must come from one thread at a
+*		time.
+*
+**************************************************************/
+uint64_t Timeline::submit(
+	const VkSubmitInfo &submitInfo,
+	const Timeline *pWaitTimeline,
+	uint64_t waitValue,
+	VkPipelineStageFlags waitStage)
+{
+	m_waitSemaphores.assign(submitInfo.pWaitSemaphores, submitInfo.pWaitSemaphores + submitInfo.waitSemaphoreCount);
+	m_waitStages.assign(submitInfo.pWaitDstStageMask, submitInfo.pWaitDstStageMask + submitInfo.waitSemaphoreCount);
+	m_waitValues.assign(submitInfo.waitSemaphoreCount, 0);
+	if (nullptr != pWaitTimeline)
+	{
+		m_waitSemaphores.push_back(pWaitTimeline->get());
+		m_waitStages.push_back(waitStage);
+		m_waitValues.push_back(waitValue);
+	}
+
+	uint64_t value = m_submittedValue + 1;
+	m_signalSemaphores.assign(submitInfo.pSignalSemaphores, submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+	m_signalValues.assign(submitInfo.signalSemaphoreCount, 0);
+	m_signalSemaphores.push_back(m_vkSemaphore);
+	m_signalValues.push_back(value);
+
+	// The values of binary semaphores are ignored.
+	//
+	VkTimelineSemaphoreSubmitInfo timelineInfo = {};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = static_cast<uint32_t>(m_waitValues.size());
+	timelineInfo.pWaitSemaphoreValues = m_waitValues.data();
+	timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(m_signalValues.size());
+	timelineInfo.pSignalSemaphoreValues = m_signalValues.data();
+
+	VkSubmitInfo timelineSubmitInfo = submitInfo;
+	timelineSubmitInfo.pNext = &timelineInfo;
+	timelineSubmitInfo.waitSemaphoreCount = static_cast<uint32_t>(m_waitSemaphores.size());
+	timelineSubmitInfo.pWaitSemaphores = m_waitSemaphores.data();
+	timelineSubmitInfo.pWaitDstStageMask = m_waitStages.data();
+	timelineSubmitInfo.signalSemaphoreCount = static_cast<uint32_t>(m_signalSemaphores.size());
+	timelineSubmitInfo.pSignalSemaphores = m_signalSemaphores.data();
+
+	if (VK_SUCCESS != vkQueueSubmit(m_vkQueue, 1, &timelineSubmitInfo, VK_NULL_HANDLE))
+	{
+		throw std::runtime_error("Failed to submit to the queue.");
+	}
+	m_submittedValue = value;
+	return value;
+}
+
+/**************************************************************
+* Description
+*		Blocks until the timeline has reached the value.
+* Returns
+*		void
+* Notes
+*		Returns at once if the value is already known to have
+*		completed.
+*
+**************************************************************/
+void Timeline::wait(uint64_t value)
+{
+	if (value <= m_completedValue)
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo = {};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_vkSemaphore;
+	waitInfo.pValues = &value;
+	if (VK_SUCCESS != vkWaitSemaphores(m_vkDevice, &waitInfo, std::numeric_limits<uint64_t>::max()))
+	{
+		throw std::runtime_error("Failed to wait for the timeline semaphore.");
+	}
+	m_completedValue = value;
+}
+
+/**************************************************************
+* Description
+*		Reads the current value of the timeline.
+* Returns
+*		The highest value whose work has completed.
+* Notes
+*		Does not block.
+*
+**************************************************************/
+uint64_t Timeline::getCompletedValue()
+{
+	uint64_t value = 0;
+	if (VK_SUCCESS == vkGetSemaphoreCounterValue(m_vkDevice, m_vkSemaphore, &value) && value > m_completedValue)
+	{
+		m_completedValue = value;
+	}
+	return m_completedValue;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include<vector>
+
+// A timeline semaphore signalled by every submission to one queue, with
+// values increasing by one per submission. Work submitted up to a value
+// has completed once the semaphore reaches it, so the CPU waits for a
+// value instead of for the queue to go idle, and other queues wait for
+// it on the GPU.
+//
+class Timeline
+{
+public:
+	Timeline();
+	void create(VkDevice vkDevice, VkQueue vkQueue);
+	void destroy();
+	uint64_t submit(
+		const VkSubmitInfo &submitInfo,
+		const Timeline *pWaitTimeline = nullptr,
+		uint64_t waitValue = 0,
+		VkPipelineStageFlags waitStage = 0);
+	void wait(uint64_t value);
+	uint64_t getCompletedValue();
+	uint64_t getSubmittedValue() const { return m_submittedValue; }
+	VkSemaphore get() const { return m_vkSemaphore; }
+private:
+	VkDevice m_vkDevice;
+	VkQueue m_vkQueue;
+	VkSemaphore m_vkSemaphore;
+	uint64_t m_submittedValue; // Signalled by the last submission.
+	uint64_t m_completedValue; // Known to have been reached.
+
+	// Reused by every submission.
+	std::vector<VkSemaphore> m_waitSemaphores;
+	std::vector<VkPipelineStageFlags> m_waitStages;
+	std::vector<uint64_t> m_waitValues;
+	std::vector<VkSemaphore> m_signalSemaphores;
+	std::vector<uint64_t> m_signalValues;
+};
@@ -0,0 +1,336 @@
+#include "transform.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define TRANSFORM_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+#ifdef TRANSFORM_USE_SSE
+/**************************************************************
+* Description
+*		Computes cross product of the xyz components of two
+*		vectors. The w component of the result is zero.
+* Returns
+*		cross product
+* Notes
+*
+**************************************************************/
+static inline __m128 cross(__m128 u, __m128 v)
+{
+	__m128 uYZX = _mm_shuffle_ps(u, u, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 vYZX = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 result = _mm_sub_ps(_mm_mul_ps(u, vYZX), _mm_mul_ps(uYZX, v));
+	return _mm_shuffle_ps(result, result, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+/**************************************************************
+* Description
+*		Computes dot product of two vectors and broadcasts it
+*		to all the components.
+* Returns
+*		dot product
+* Notes
+*
+**************************************************************/
+static inline __m128 dot(__m128 u, __m128 v)
+{
+	__m128 product = _mm_mul_ps(u, v);
+	__m128 shuffled = _mm_shuffle_ps(product, product, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sum = _mm_add_ps(product, shuffled);
+	shuffled = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 0, 3, 2));
+	return _mm_add_ps(sum, shuffled);
+}
+#endif
+
+/**************************************************************
+* Description
+*		Computes the model-view-projection and normal matrices
+*		for a batch of model matrices.
+* Returns
+*		void
+* Notes
+*		The columns of the inverse transpose of a 3x3 matrix
+*		[a b c] are (b x c, c x a, a x b) / det, which saves us
+*		a general matrix inverse per object.
+*
+**************************************************************/
+void computeDrawTransforms(
+	const glm::mat4 &viewProj,
+	const glm::mat4 *pModelMatrices,
+	size_t count,
+	PushConstantObject *pDrawTransforms)
+{
+#ifdef TRANSFORM_USE_SSE
+	const __m128 viewProjColumns[4] = {
+		_mm_loadu_ps(&viewProj[0][0]),
+		_mm_loadu_ps(&viewProj[1][0]),
+		_mm_loadu_ps(&viewProj[2][0]),
+		_mm_loadu_ps(&viewProj[3][0]) };
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const glm::mat4 &model = pModelMatrices[i];
+		PushConstantObject &output = pDrawTransforms[i];
+
+		__m128 modelColumns[4];
+		for (int column = 0; column < 4; ++column)
+		{
+			modelColumns[column] = _mm_loadu_ps(&model[column][0]);
+			const float *pColumn = &model[column][0];
+			__m128 result = _mm_mul_ps(viewProjColumns[0], _mm_set1_ps(pColumn[0]));
+			result = _mm_add_ps(result, _mm_mul_ps(viewProjColumns[1], _mm_set1_ps(pColumn[1])));
+			result = _mm_add_ps(result, _mm_mul_ps(viewProjColumns[2], _mm_set1_ps(pColumn[2])));
+			result = _mm_add_ps(result, _mm_mul_ps(viewProjColumns[3], _mm_set1_ps(pColumn[3])));
+			_mm_storeu_ps(&output.m_mvp[column][0], result);
+		}
+
+		// The w components of the first three columns are zero for the
+		// affine matrices we build, so they do not disturb the products.
+		//
+		__m128 bc = cross(modelColumns[1], modelColumns[2]);
+		__m128 ca = cross(modelColumns[2], modelColumns[0]);
+		__m128 ab = cross(modelColumns[0], modelColumns[1]);
+		float det = _mm_cvtss_f32(dot(modelColumns[0], bc));
+		__m128 invDet = _mm_set1_ps(0.0f != det ? 1.0f / det : 0.0f);
+		_mm_storeu_ps(&output.m_normalMatrix[0][0], _mm_mul_ps(bc, invDet));
+		_mm_storeu_ps(&output.m_normalMatrix[1][0], _mm_mul_ps(ca, invDet));
+		_mm_storeu_ps(&output.m_normalMatrix[2][0], _mm_mul_ps(ab, invDet));
+	}
+#else
+	for (size_t i = 0; i < count; ++i)
+	{
+		const glm::mat4 &model = pModelMatrices[i];
+		pDrawTransforms[i].m_mvp = viewProj * model;
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+		for (int column = 0; column < 3; ++column)
+		{
+			pDrawTransforms[i].m_normalMatrix[column] = glm::vec4(normalMatrix[column], 0.0f);
+		}
+	}
+#endif
+}
+
+/**************************************************************
+* Description
+*		Multiplies two matrices.
+* Returns
+*		void
+* Notes
+*		result may not alias a or b.
+*
+**************************************************************/
+void multiplyMatrices(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &result)
+{
+#ifdef TRANSFORM_USE_SSE
+	const __m128 aColumns[4] = {
+		_mm_loadu_ps(&a[0][0]),
+		_mm_loadu_ps(&a[1][0]),
+		_mm_loadu_ps(&a[2][0]),
+		_mm_loadu_ps(&a[3][0]) };
+
+	for (int column = 0; column < 4; ++column)
+	{
+		const float *pColumn = &b[column][0];
+		__m128 product = _mm_mul_ps(aColumns[0], _mm_set1_ps(pColumn[0]));
+		product = _mm_add_ps(product, _mm_mul_ps(aColumns[1], _mm_set1_ps(pColumn[1])));
+		product = _mm_add_ps(product, _mm_mul_ps(aColumns[2], _mm_set1_ps(pColumn[2])));
+		product = _mm_add_ps(product, _mm_mul_ps(aColumns[3], _mm_set1_ps(pColumn[3])));
+		_mm_storeu_ps(&result[column][0], product);
+	}
+#else
+	result = a * b;
+#endif
+}
+
+/**************************************************************
+* Description
+*		Builds the local matrix of a single object.
+* Returns
+*		void
+* Notes
+*		Used for the objects left over after the batches of
+*		four, and when SSE is not available.
+*
+**************************************************************/
+static void composeLocalMatrix(
+	const glm::vec3 &position,
+	const glm::vec3 &center,
+	const glm::quat &orientation,
+	const glm::vec3 &scale,
+	glm::mat4 &localMatrix)
+{
+	glm::mat3 rotationScale = glm::mat3_cast(orientation);
+	rotationScale[0] *= scale.x;
+	rotationScale[1] *= scale.y;
+	rotationScale[2] *= scale.z;
+	localMatrix = glm::mat4(rotationScale);
+	localMatrix[3] = glm::vec4(position - center + rotationScale * center, 1.0f);
+}
+
+/**************************************************************
+* Description
+*		Builds the local matrices of a batch of objects.
+* Returns
+*		void
+* Notes
+*		The objects are processed four at a time with their
+*		components spread across the SSE lanes. With R the
+*		rotation and S the scale, the matrix is
+*		[ R * S | position - center + R * S * center ].
+*
+**************************************************************/
+void composeLocalMatrices(
+	const glm::vec3 *pPositions,
+	const glm::vec3 *pCenters,
+	const glm::quat *pOrientations,
+	const glm::vec3 *pScales,
+	const uint32_t *pIndices,
+	size_t count,
+	glm::mat4 *pLocalMatrices)
+{
+	size_t i = 0;
+#ifdef TRANSFORM_USE_SSE
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	for (; i + 4 <= count; i += 4)
+	{
+		const uint32_t i0 = pIndices[i];
+		const uint32_t i1 = pIndices[i + 1];
+		const uint32_t i2 = pIndices[i + 2];
+		const uint32_t i3 = pIndices[i + 3];
+
+#define GATHER(array, component) _mm_set_ps(array[i3].component, array[i2].component, array[i1].component, array[i0].component)
+		__m128 qx = GATHER(pOrientations, x);
+		__m128 qy = GATHER(pOrientations, y);
+		__m128 qz = GATHER(pOrientations, z);
+		__m128 qw = GATHER(pOrientations, w);
+		__m128 sx = GATHER(pScales, x);
+		__m128 sy = GATHER(pScales, y);
+		__m128 sz = GATHER(pScales, z);
+		__m128 cx = GATHER(pCenters, x);
+		__m128 cy = GATHER(pCenters, y);
+		__m128 cz = GATHER(pCenters, z);
+		__m128 px = GATHER(pPositions, x);
+		__m128 py = GATHER(pPositions, y);
+		__m128 pz = GATHER(pPositions, z);
+#undef GATHER
+
+		__m128 xx = _mm_mul_ps(qx, qx);
+		__m128 yy = _mm_mul_ps(qy, qy);
+		__m128 zz = _mm_mul_ps(qz, qz);
+		__m128 xy = _mm_mul_ps(qx, qy);
+		__m128 xz = _mm_mul_ps(qx, qz);
+		__m128 yz = _mm_mul_ps(qy, qz);
+		__m128 wx = _mm_mul_ps(qw, qx);
+		__m128 wy = _mm_mul_ps(qw, qy);
+		__m128 wz = _mm_mul_ps(qw, qz);
+
+		// Columns of R * S, one component per register.
+		//
+		__m128 c0x = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz))), sx);
+		__m128 c0y = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xy, wz)), sx);
+		__m128 c0z = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xz, wy)), sx);
+		__m128 c1x = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(xy, wz)), sy);
+		__m128 c1y = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz))), sy);
+		__m128 c1z = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(yz, wx)), sy);
+		__m128 c2x = _mm_mul_ps(_mm_mul_ps(two, _mm_add_ps(xz, wy)), sz);
+		__m128 c2y = _mm_mul_ps(_mm_mul_ps(two, _mm_sub_ps(yz, wx)), sz);
+		__m128 c2z = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy))), sz);
+
+		__m128 tx = _mm_add_ps(_mm_sub_ps(px, cx), _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0x, cx), _mm_mul_ps(c1x, cy)), _mm_mul_ps(c2x, cz)));
+		__m128 ty = _mm_add_ps(_mm_sub_ps(py, cy), _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0y, cx), _mm_mul_ps(c1y, cy)), _mm_mul_ps(c2y, cz)));
+		__m128 tz = _mm_add_ps(_mm_sub_ps(pz, cz), _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0z, cx), _mm_mul_ps(c1z, cy)), _mm_mul_ps(c2z, cz)));
+
+		// Transposing turns the component registers into one column
+		// per object.
+		//
+		__m128 c0w = _mm_setzero_ps();
+		__m128 c1w = _mm_setzero_ps();
+		__m128 c2w = _mm_setzero_ps();
+		__m128 tw = one;
+		_MM_TRANSPOSE4_PS(c0x, c0y, c0z, c0w);
+		_MM_TRANSPOSE4_PS(c1x, c1y, c1z, c1w);
+		_MM_TRANSPOSE4_PS(c2x, c2y, c2z, c2w);
+		_MM_TRANSPOSE4_PS(tx, ty, tz, tw);
+
+		const __m128 columns[4][4] = {
+			{ c0x, c1x, c2x, tx },
+			{ c0y, c1y, c2y, ty },
+			{ c0z, c1z, c2z, tz },
+			{ c0w, c1w, c2w, tw } };
+		const uint32_t indices[4] = { i0, i1, i2, i3 };
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			glm::mat4 &localMatrix = pLocalMatrices[indices[lane]];
+			for (int column = 0; column < 4; ++column)
+			{
+				_mm_storeu_ps(&localMatrix[column][0], columns[lane][column]);
+			}
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		const uint32_t index = pIndices[i];
+		composeLocalMatrix(pPositions[index], pCenters[index], pOrientations[index], pScales[index], pLocalMatrices[index]);
+	}
+}
+
+/**************************************************************
+* Description
+*		Extracts the clip planes of the view-projection matrix.
+* Returns
+*		void
+* Notes
+*		Uses the Vulkan clip volume, with depth from zero to one.
+*		The planes are normalized so distances are in world units.
+*
+**************************************************************/
+void extractFrustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6])
+{
+	glm::vec4 rows[4];
+	for (int row = 0; row < 4; ++row)
+	{
+		rows[row] = glm::vec4(viewProj[0][row], viewProj[1][row], viewProj[2][row], viewProj[3][row]);
+	}
+
+	planes[0] = rows[3] + rows[0]; // Left
+	planes[1] = rows[3] - rows[0]; // Right
+	planes[2] = rows[3] + rows[1]; // Top and bottom, y points down in
+	planes[3] = rows[3] - rows[1]; // Vulkan clip space.
+	planes[4] = rows[2];           // Near
+	planes[5] = rows[3] - rows[2]; // Far
+
+	for (int plane = 0; plane < 6; ++plane)
+	{
+		planes[plane] /= glm::length(glm::vec3(planes[plane]));
+	}
+}
+
+/**************************************************************
+* Description
+*		Tests the box against the frustum planes.
+* Returns
+*		false if the box is entirely outside one of the planes.
+* Notes
+*		Only the corner furthest along each plane normal is
+*		tested.
+*
+**************************************************************/
+bool isBoxInFrustum(const glm::vec4 planes[6], const glm::vec3 &boxMin, const glm::vec3 &boxMax)
+{
+	for (int plane = 0; plane < 6; ++plane)
+	{
+		glm::vec3 normal = glm::vec3(planes[plane]);
+		glm::vec3 corner(
+			normal.x >= 0.0f ? boxMax.x : boxMin.x,
+			normal.y >= 0.0f ? boxMax.y : boxMin.y,
+			normal.z >= 0.0f ? boxMax.z : boxMin.z);
+		if (glm::dot(normal, corner) + planes[plane].w < 0.0f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
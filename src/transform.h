@@ -0,0 +1,41 @@
+#pragma once
+
+#include "model.h"
+
+// Computes the per-draw transforms for a batch of objects. For every
+// model matrix it writes the combined model-view-projection matrix and
+// the normal matrix, the inverse transpose of the upper 3x3 of the model
+// matrix, so the vertex shader only has to do a single matrix multiply.
+//
+void computeDrawTransforms(
+	const glm::mat4 &viewProj,
+	const glm::mat4 *pModelMatrices,
+	size_t count,
+	PushConstantObject *pDrawTransforms);
+
+// Multiplies two matrices, result = a * b.
+//
+void multiplyMatrices(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &result);
+
+// Builds the local matrices T(position - center) * R(orientation) * S(scale) * T(center)
+// of the objects in pIndices. The inputs are parallel arrays indexed by object,
+// and the matrix of object pIndices[i] is written to pLocalMatrices[pIndices[i]].
+//
+void composeLocalMatrices(
+	const glm::vec3 *pPositions,
+	const glm::vec3 *pCenters,
+	const glm::quat *pOrientations,
+	const glm::vec3 *pScales,
+	const uint32_t *pIndices,
+	size_t count,
+	glm::mat4 *pLocalMatrices);
+
+// Extracts the six clip planes of a view-projection matrix, as (normal, distance)
+// with the normals pointing into the frustum.
+//
+void extractFrustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6]);
+
+// Tests an axis aligned box against the frustum planes. Conservative, a box
+// near a frustum corner may be reported visible when it is not.
+//
+bool isBoxInFrustum(const glm::vec4 planes[6], const glm::vec3 &boxMin, const glm::vec3 &boxMax);
@@ -47,17 +47,20 @@ void createBuffer(
 * Description
 *		Copies buffers
 * Returns
-*		void
+*		The timeline value the copy completes with.
 * Notes
+*		The source buffer is in use until the value has
+*		completed.
 *
 **************************************************************/
-void copyBuffer(
+uint64_t copyBuffer(
 	VkDevice vkDevice,
 	VkCommandPool vkCommandPool,
-	VkQueue vkQueue,
+	Timeline &timeline,
 	VkBuffer srcBuffer,
 	VkBuffer dstBuffer,
-	VkDeviceSize size)
+	VkDeviceSize size,
+	DeletionQueue &deletionQueue)
 {
 	VkCommandBuffer commandBuffer = beginSingleTimeCommands(vkDevice, vkCommandPool);
 	VkBufferCopy copyRegion = {};
@@ -65,7 +68,7 @@ void copyBuffer(
 	copyRegion.dstOffset = 0;
 	copyRegion.size = size;
 	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-	endSingleTimeCommands(vkDevice, vkCommandPool, vkQueue, commandBuffer);
+	return endSingleTimeCommands(vkCommandPool, timeline, commandBuffer, deletionQueue);
 }
 
 uint32_t findMemoryType(
@@ -120,18 +123,38 @@ VkCommandBuffer beginSingleTimeCommands(
 
 /**************************************************************
 * Description
-*		Ends commands?
+*		Ends the command buffer and submits it to the queue of
+*		the timeline.
 * Returns
-*		void
+*		The timeline value the commands complete with.
 * Notes
+*		The queue is not waited on. A barrier at the end makes
+*		the transfer writes visible to everything submitted to
+*		the queue afterwards, and the command buffer is handed
+*		to the deletion queue.
 *
 **************************************************************/
-void endSingleTimeCommands(
-	VkDevice vkDevice,
+uint64_t endSingleTimeCommands(
 	VkCommandPool vkCommandPool,
-	VkQueue vkQueue,
-	VkCommandBuffer commandBuffer)
+	Timeline &timeline,
+	VkCommandBuffer commandBuffer,
+	DeletionQueue &deletionQueue)
 {
+	VkMemoryBarrier memoryBarrier = {};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	memoryBarrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+		0,
+		1,
+		&memoryBarrier,
+		0,
+		nullptr,
+		0,
+		nullptr);
 	vkEndCommandBuffer(commandBuffer);
 
 	VkSubmitInfo submitInfo = {};
@@ -139,7 +162,41 @@ void endSingleTimeCommands(
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	vkQueueSubmit(vkQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(vkQueue);
-	vkFreeCommandBuffers(vkDevice, vkCommandPool, 1, &commandBuffer);
-}
\ No newline at end of file
+	uint64_t value = timeline.submit(submitInfo);
+	deletionQueue.enqueueCommandBuffer(value, vkCommandPool, commandBuffer);
+	return value;
+}
+
+/**************************************************************
+* Description
+*		Hashes the bytes with FNV-1a.
+* Returns
+*		The 64 bit hash.
+* Notes
+*		Pass the result back in to hash several ranges as one.
+*
+**************************************************************/
+uint64_t hashBytes(const void *pData, size_t size, uint64_t hash)
+{
+	const uint8_t *pBytes = static_cast<const uint8_t*>(pData);
+	for (size_t i = 0; i < size; ++i)
+	{
+		hash = (hash ^ pBytes[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/**************************************************************
+* Description
+*		Gets the mask of the valid bits of a timestamp.
+* Returns
+*		The mask, 0 if no bits are valid.
+* Notes
+*		timestampValidBits is the value from the properties of
+*		the queue family, 36 to 64 when it writes timestamps.
+*
+**************************************************************/
+uint64_t getTimestampMask(uint32_t timestampValidBits)
+{
+	return (timestampValidBits >= 64) ? ~0ull : ((1ull << timestampValidBits) - 1);
+}
@@ -1,8 +1,9 @@
 #pragma once
-#define GLFW_INCLUDE_VULKAN
-#include <GLFW/glfw3.h>
+#include <vulkan/vulkan.h>
 
 #include<iostream>
+#include "deletionqueue.h"
+#include "timeline.h"
 
 // Create buffer and its associated memory
 // based on input parameters.
@@ -16,15 +17,18 @@ void createBuffer(
 	VkBuffer &buffer,
 	VkDeviceMemory &bufferMemory);
 
-// Copies buffer content.
+// Copies buffer content. The copy is not waited for, the source
+// buffer has to stay alive until the returned timeline value
+// has completed.
 //
-void copyBuffer(
+uint64_t copyBuffer(
 	VkDevice vkDevice,
 	VkCommandPool vkCommandPool,
-	VkQueue vkQueue,
+	Timeline &timeline,
 	VkBuffer srcBuffer,
 	VkBuffer dstBuffer,
-	VkDeviceSize size);
+	VkDeviceSize size,
+	DeletionQueue &deletionQueue);
 
 // Begins a command buffer in the provided
 // command pool.
@@ -33,18 +37,33 @@ VkCommandBuffer beginSingleTimeCommands(
 	VkDevice vkDevice,
 	VkCommandPool vkCommandPool);
 
-// Submits the command buffer to the queue
-// and deletes it.
+// Submits the command buffer to the queue of the
+// timeline without waiting for it. The command buffer
+// is freed once the returned value has completed.
 //
-void endSingleTimeCommands(
-	VkDevice vkDevice,
+uint64_t endSingleTimeCommands(
 	VkCommandPool vkCommandPool,
-	VkQueue vkQueue,
-	VkCommandBuffer commandBuffer);
+	Timeline &timeline,
+	VkCommandBuffer commandBuffer,
+	DeletionQueue &deletionQueue);
 
 // Get the memory type based on the input properties.
 //
 uint32_t findMemoryType(
 	VkPhysicalDevice vkPhysicalDevice,
 	int32_t typeFilter,
-	VkMemoryPropertyFlags properties);
\ No newline at end of file
+	VkMemoryPropertyFlags properties);
+
+// Hashes the bytes with 64 bit FNV-1a, continuing from the given hash
+// so several ranges can be hashed together.
+//
+uint64_t hashBytes(
+	const void *pData,
+	size_t size,
+	uint64_t hash = 14695981039346656037ull);
+
+// Gets the mask of the bits a queue writes in its timestamps. The
+// difference of two timestamps is masked with it, which also handles
+// the counter wrapping between them.
+//
+uint64_t getTimestampMask(uint32_t timestampValidBits);
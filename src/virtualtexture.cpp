@@ -0,0 +1,1358 @@
+#include "virtualtexture.h"
+#include "imagedecoder.h"
+#include "mipbuilder.h"
+#include "utilities.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+const VkFormat VIRTUAL_CACHE_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+const VkFormat VIRTUAL_INDIRECTION_FORMAT = VK_FORMAT_R8G8B8A8_UINT;
+const VkFormat VIRTUAL_FEEDBACK_FORMAT = VK_FORMAT_R32_UINT;
+
+// Returned by allocateSlot when every slot is pinned or in use.
+//
+const uint32_t NO_CACHE_SLOT = 0xFFFFFFFF;
+
+// Page requests pack the texture, the level and the page coordinates
+// into 32 bits, as the feedback shader writes them. NO_PAGE_REQUEST has
+// every level bit set, which no texture has that many levels for.
+//
+const uint32_t MAX_VIRTUAL_LEVELS = 15;
+const uint32_t MAX_VIRTUAL_PAGES = 4096;
+
+/**************************************************************
+* Description
+*		Packs a page of a level of a texture into a request.
+* Returns
+*		The request.
+* Notes
+*
+**************************************************************/
+static uint32_t makeRequest(uint32_t textureIndex, uint32_t level, uint32_t pageX, uint32_t pageY)
+{
+	return (textureIndex << 28) | (level << 24) | (pageY << 12) | pageX;
+}
+
+/**************************************************************
+* Description
+*		Gets the texture a request is for.
+* Returns
+*		uint32_t
+* Notes
+*
+**************************************************************/
+static uint32_t getRequestTexture(uint32_t request)
+{
+	return request >> 28;
+}
+
+/**************************************************************
+* Description
+*		Gets the level a request is for.
+* Returns
+*		uint32_t
+* Notes
+*
+**************************************************************/
+static uint32_t getRequestLevel(uint32_t request)
+{
+	return (request >> 24) & 0xF;
+}
+
+/**************************************************************
+* Description
+*		Gets the column of the requested page in its level.
+* Returns
+*		uint32_t
+* Notes
+*
+**************************************************************/
+static uint32_t getRequestX(uint32_t request)
+{
+	return request & 0xFFF;
+}
+
+/**************************************************************
+* Description
+*		Gets the row of the requested page in its level.
+* Returns
+*		uint32_t
+* Notes
+*
+**************************************************************/
+static uint32_t getRequestY(uint32_t request)
+{
+	return (request >> 12) & 0xFFF;
+}
+
+/**************************************************************
+* Description
+*		Reads a whole file.
+* Returns
+*		true/false
+* Notes
+*
+**************************************************************/
+static bool readFile(const std::string &path, std::vector<char> &content)
+{
+	std::ifstream file(path, std::ios::ate | std::ios::binary);
+	if (!file.is_open())
+	{
+		return false;
+	}
+	content.resize(static_cast<size_t>(file.tellg()));
+	file.seekg(0);
+	file.read(content.data(), content.size());
+	return true;
+}
+
+/**************************************************************
+* Description
+*		Records a layout transition of every level of a color
+*		image.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+static void transitionImage(
+	VkCommandBuffer commandBuffer,
+	VkImage vkImage,
+	uint32_t mipLevels,
+	VkImageLayout oldLayout,
+	VkImageLayout newLayout,
+	VkAccessFlags srcAccessMask,
+	VkAccessFlags dstAccessMask,
+	VkPipelineStageFlags srcStageMask,
+	VkPipelineStageFlags dstStageMask)
+{
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = vkImage;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.levelCount = mipLevels;
+	barrier.subresourceRange.baseArrayLayer = 0;
+	barrier.subresourceRange.layerCount = 1;
+	barrier.oldLayout = oldLayout;
+	barrier.newLayout = newLayout;
+	barrier.srcAccessMask = srcAccessMask;
+	barrier.dstAccessMask = dstAccessMask;
+	vkCmdPipelineBarrier(commandBuffer, srcStageMask, dstStageMask, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+/**************************************************************
+* Description
+*		Constructor for the class.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+VirtualTextureSystem::VirtualTextureSystem()
+	:m_vkDevice(VK_NULL_HANDLE),
+	m_vkPhysicalDevice(VK_NULL_HANDLE),
+	m_vkCommandPool(VK_NULL_HANDLE),
+	m_pTimeline(nullptr),
+	m_pDeletionQueue(nullptr),
+	m_vkLayout(VK_NULL_HANDLE),
+	m_vkPool(VK_NULL_HANDLE),
+	m_vkDescriptorSet(VK_NULL_HANDLE),
+	m_vkParameterBuffer(VK_NULL_HANDLE),
+	m_vkParameterMemory(VK_NULL_HANDLE),
+	m_pParameters(nullptr),
+	m_vkCacheSampler(VK_NULL_HANDLE),
+	m_vkIndirectionSampler(VK_NULL_HANDLE),
+	m_vkCacheImage(VK_NULL_HANDLE),
+	m_vkCacheMemory(VK_NULL_HANDLE),
+	m_vkCacheView(VK_NULL_HANDLE),
+	m_updateIndex(0),
+	m_pageBudget(VIRTUAL_PAGE_BUDGET),
+	m_lastStreamedPages(0),
+	m_vkFeedbackRenderPass(VK_NULL_HANDLE),
+	m_vkDepthFormat(VK_FORMAT_UNDEFINED),
+	m_feedbackExtent({ 0, 0 }),
+	m_vkFeedbackImage(VK_NULL_HANDLE),
+	m_vkFeedbackMemory(VK_NULL_HANDLE),
+	m_vkFeedbackView(VK_NULL_HANDLE),
+	m_vkFeedbackDepthImage(VK_NULL_HANDLE),
+	m_vkFeedbackDepthMemory(VK_NULL_HANDLE),
+	m_vkFeedbackDepthView(VK_NULL_HANDLE),
+	m_vkFeedbackFramebuffer(VK_NULL_HANDLE),
+	m_vkReadbackBuffer(VK_NULL_HANDLE),
+	m_vkReadbackMemory(VK_NULL_HANDLE),
+	m_pReadback(nullptr),
+	m_fFeedbackPending(false)
+{
+}
+
+/**************************************************************
+* Description
+*		Creates the set with the parameter buffer, the page
+*		cache and its samplers, and the feedback render pass.
+*		The cache is left shader readable.
+* Returns
+*		void
+* Notes
+*		The indirection array is partially bound and update
+*		after bind, like the texture array of the material
+*		table, so textures can be added while command buffers
+*		binding the set are pending. The feedback target is
+*		created separately, it follows the swapchain extent.
+*
+**************************************************************/
+void VirtualTextureSystem::create(
+	VkDevice vkDevice,
+	VkPhysicalDevice vkPhysicalDevice,
+	VkCommandPool vkCommandPool,
+	Timeline *pTimeline,
+	DeletionQueue *pDeletionQueue,
+	VkFormat vkDepthFormat)
+{
+	m_vkDevice = vkDevice;
+	m_vkPhysicalDevice = vkPhysicalDevice;
+	m_vkCommandPool = vkCommandPool;
+	m_pTimeline = pTimeline;
+	m_pDeletionQueue = pDeletionQueue;
+
+	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[2].binding = 2;
+	bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[2].descriptorCount = MAX_VIRTUAL_TEXTURES;
+	bindings[2].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	std::array<VkDescriptorBindingFlags, 3> bindingFlags = {
+		0,
+		0,
+		VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT };
+	VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+	bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	bindingFlagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+	bindingFlagsInfo.pBindingFlags = bindingFlags.data();
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &bindingFlagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+	if (VK_SUCCESS != vkCreateDescriptorSetLayout(m_vkDevice, &layoutInfo, nullptr, &m_vkLayout))
+	{
+		throw std::runtime_error("Could not create virtual texture set layout.");
+	}
+
+	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount = 1;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = 1 + MAX_VIRTUAL_TEXTURES;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes = poolSizes.data();
+	poolInfo.maxSets = 1;
+	if (VK_SUCCESS != vkCreateDescriptorPool(m_vkDevice, &poolInfo, nullptr, &m_vkPool))
+	{
+		throw std::runtime_error("Could not create virtual texture descriptor pool.");
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_vkPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_vkLayout;
+	if (VK_SUCCESS != vkAllocateDescriptorSets(m_vkDevice, &allocInfo, &m_vkDescriptorSet))
+	{
+		throw std::runtime_error("Could not create virtual texture descriptor set.");
+	}
+
+	createBuffer(m_vkDevice,
+		m_vkPhysicalDevice,
+		sizeof(VirtualTextureParameters),
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_vkParameterBuffer,
+		m_vkParameterMemory);
+	if (VK_SUCCESS != vkMapMemory(
+		m_vkDevice,
+		m_vkParameterMemory,
+		0,
+		sizeof(VirtualTextureParameters),
+		0,
+		reinterpret_cast<void**>(&m_pParameters)))
+	{
+		throw std::runtime_error("Could not map virtual texture parameter memory.");
+	}
+	memset(m_pParameters, 0, sizeof(VirtualTextureParameters));
+	m_pParameters->m_feedbackLodBias = -std::log2(static_cast<float>(VIRTUAL_FEEDBACK_SCALE));
+
+	// Pages are filtered within their borders and never mipmapped, the
+	// indirection is only fetched.
+	//
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.anisotropyEnable = VK_FALSE;
+	samplerInfo.maxAnisotropy = 1.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = 0.0f;
+	if (VK_SUCCESS != vkCreateSampler(m_vkDevice, &samplerInfo, nullptr, &m_vkCacheSampler))
+	{
+		throw std::runtime_error("Could not create page cache sampler.");
+	}
+
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+	if (VK_SUCCESS != vkCreateSampler(m_vkDevice, &samplerInfo, nullptr, &m_vkIndirectionSampler))
+	{
+		throw std::runtime_error("Could not create indirection sampler.");
+	}
+
+	uint32_t cacheSize = VIRTUAL_CACHE_PAGES * VIRTUAL_PAGE_STRIDE;
+	createImage(
+		cacheSize,
+		cacheSize,
+		1 /*mipLevels*/,
+		VIRTUAL_CACHE_FORMAT,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		m_vkCacheImage,
+		m_vkCacheMemory,
+		m_vkCacheView);
+	m_cachePages.assign(VIRTUAL_CACHE_PAGES * VIRTUAL_CACHE_PAGES, CachePage{ NO_PAGE_REQUEST, 0, false });
+
+	// Slots holding no page are never sampled, the cache only has to be
+	// in the layout the set expects.
+	//
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(m_vkDevice, m_vkCommandPool);
+	transitionImage(
+		commandBuffer,
+		m_vkCacheImage,
+		1,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		0,
+		VK_ACCESS_SHADER_READ_BIT,
+		VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	endSingleTimeCommands(m_vkCommandPool, *m_pTimeline, commandBuffer, *m_pDeletionQueue);
+
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = m_vkParameterBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = sizeof(VirtualTextureParameters);
+
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = m_vkCacheSampler;
+	imageInfo.imageView = m_vkCacheView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[0].dstSet = m_vkDescriptorSet;
+	descriptorWrites[0].dstBinding = 0;
+	descriptorWrites[0].dstArrayElement = 0;
+	descriptorWrites[0].descriptorCount = 1;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrites[0].pBufferInfo = &bufferInfo;
+	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[1].dstSet = m_vkDescriptorSet;
+	descriptorWrites[1].dstBinding = 1;
+	descriptorWrites[1].dstArrayElement = 0;
+	descriptorWrites[1].descriptorCount = 1;
+	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[1].pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_vkDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+	createFeedbackRenderPass(vkDepthFormat);
+}
+
+/**************************************************************
+* Description
+*		Destroys the textures, the cache, the feedback target
+*		and render pass, and the set.
+* Returns
+*		void
+* Notes
+*		None of them may be in use on the GPU. Resources retired
+*		by a resize are owned by the deletion queue.
+*
+**************************************************************/
+void VirtualTextureSystem::destroy()
+{
+	for (auto &texture : m_textures)
+	{
+		vkDestroyImageView(m_vkDevice, texture.m_vkIndirectionView, nullptr);
+		vkDestroyImage(m_vkDevice, texture.m_vkIndirectionImage, nullptr);
+		vkFreeMemory(m_vkDevice, texture.m_vkIndirectionMemory, nullptr);
+	}
+	m_textures.clear();
+	m_pageSlots.clear();
+	m_cachePages.clear();
+
+	vkDestroyFramebuffer(m_vkDevice, m_vkFeedbackFramebuffer, nullptr);
+	vkDestroyImageView(m_vkDevice, m_vkFeedbackView, nullptr);
+	vkDestroyImage(m_vkDevice, m_vkFeedbackImage, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkFeedbackMemory, nullptr);
+	vkDestroyImageView(m_vkDevice, m_vkFeedbackDepthView, nullptr);
+	vkDestroyImage(m_vkDevice, m_vkFeedbackDepthImage, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkFeedbackDepthMemory, nullptr);
+	vkDestroyBuffer(m_vkDevice, m_vkReadbackBuffer, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkReadbackMemory, nullptr);
+	vkDestroyRenderPass(m_vkDevice, m_vkFeedbackRenderPass, nullptr);
+	m_vkFeedbackFramebuffer = VK_NULL_HANDLE;
+	m_vkFeedbackView = VK_NULL_HANDLE;
+	m_vkFeedbackImage = VK_NULL_HANDLE;
+	m_vkFeedbackMemory = VK_NULL_HANDLE;
+	m_vkFeedbackDepthView = VK_NULL_HANDLE;
+	m_vkFeedbackDepthImage = VK_NULL_HANDLE;
+	m_vkFeedbackDepthMemory = VK_NULL_HANDLE;
+	m_vkReadbackBuffer = VK_NULL_HANDLE;
+	m_vkReadbackMemory = VK_NULL_HANDLE;
+	m_pReadback = nullptr;
+	m_vkFeedbackRenderPass = VK_NULL_HANDLE;
+	m_fFeedbackPending = false;
+
+	vkDestroyImageView(m_vkDevice, m_vkCacheView, nullptr);
+	vkDestroyImage(m_vkDevice, m_vkCacheImage, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkCacheMemory, nullptr);
+	vkDestroySampler(m_vkDevice, m_vkCacheSampler, nullptr);
+	vkDestroySampler(m_vkDevice, m_vkIndirectionSampler, nullptr);
+	if (VK_NULL_HANDLE != m_vkParameterMemory)
+	{
+		vkUnmapMemory(m_vkDevice, m_vkParameterMemory);
+	}
+	vkDestroyBuffer(m_vkDevice, m_vkParameterBuffer, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkParameterMemory, nullptr);
+	vkDestroyDescriptorPool(m_vkDevice, m_vkPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_vkDevice, m_vkLayout, nullptr);
+	m_vkCacheView = VK_NULL_HANDLE;
+	m_vkCacheImage = VK_NULL_HANDLE;
+	m_vkCacheMemory = VK_NULL_HANDLE;
+	m_vkCacheSampler = VK_NULL_HANDLE;
+	m_vkIndirectionSampler = VK_NULL_HANDLE;
+	m_pParameters = nullptr;
+	m_vkParameterBuffer = VK_NULL_HANDLE;
+	m_vkParameterMemory = VK_NULL_HANDLE;
+	m_vkPool = VK_NULL_HANDLE;
+	m_vkLayout = VK_NULL_HANDLE;
+	m_vkDescriptorSet = VK_NULL_HANDLE;
+}
+
+/**************************************************************
+* Description
+*		Loads an image file as a virtual texture. Its mip chain
+*		is built and kept in system memory, and the page of its
+*		coarsest level is copied to the cache and pinned there,
+*		so the texture can be sampled straight away.
+* Returns
+*		The index of the texture, or NO_VIRTUAL_TEXTURE if the
+*		file could not be loaded or there is no room for it.
+* Notes
+*		The file is decoded on the calling thread. Levels stop
+*		at the first one that fits in a single page.
+*
+**************************************************************/
+uint32_t VirtualTextureSystem::addTexture(const std::string &path)
+{
+	if (m_textures.size() >= MAX_VIRTUAL_TEXTURES)
+	{
+		std::cerr << "Too many virtual textures, " << path << " is not loaded." << std::endl;
+		return NO_VIRTUAL_TEXTURE;
+	}
+
+	std::vector<char> content;
+	std::string error = "could not open the file";
+	uint32_t width, height;
+	if (!readFile(path, content) || !readImageHeader(content.data(), content.size(), width, height, error))
+	{
+		std::cerr << "Could not load virtual texture " << path << ": " << error << std::endl;
+		return NO_VIRTUAL_TEXTURE;
+	}
+
+	uint32_t textureIndex = static_cast<uint32_t>(m_textures.size());
+	VirtualTexture texture = {};
+	texture.m_path = path;
+	texture.m_width = width;
+	texture.m_height = height;
+	texture.m_levelCount = 1;
+	while (std::max(texture.m_width >> (texture.m_levelCount - 1), 1u) > VIRTUAL_PAGE_SIZE ||
+		std::max(texture.m_height >> (texture.m_levelCount - 1), 1u) > VIRTUAL_PAGE_SIZE)
+	{
+		++texture.m_levelCount;
+	}
+	for (uint32_t level = 0; level < texture.m_levelCount; ++level)
+	{
+		uint32_t levelWidth = std::max(texture.m_width >> level, 1u);
+		uint32_t levelHeight = std::max(texture.m_height >> level, 1u);
+		texture.m_pagesX.push_back((levelWidth + VIRTUAL_PAGE_SIZE - 1) / VIRTUAL_PAGE_SIZE);
+		texture.m_pagesY.push_back((levelHeight + VIRTUAL_PAGE_SIZE - 1) / VIRTUAL_PAGE_SIZE);
+	}
+	if (texture.m_levelCount > MAX_VIRTUAL_LEVELS ||
+		texture.m_pagesX[0] > MAX_VIRTUAL_PAGES ||
+		texture.m_pagesY[0] > MAX_VIRTUAL_PAGES)
+	{
+		std::cerr << "Virtual texture " << path << " is too large." << std::endl;
+		return NO_VIRTUAL_TEXTURE;
+	}
+
+	std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+	if (!decodeImage(content.data(), content.size(), selectImageCodec(content.data(), content.size()), pixels.data(), error))
+	{
+		std::cerr << "Could not load virtual texture " << path << ": " << error << std::endl;
+		return NO_VIRTUAL_TEXTURE;
+	}
+	buildMipChain(pixels.data(), texture.m_width, texture.m_height, true, nullptr, texture.m_levels);
+	texture.m_levels.resize(texture.m_levelCount);
+
+	// Power of two sides keep every level of the indirection image at
+	// least as large as the pages of the level, whatever the size of
+	// the texture.
+	//
+	texture.m_indirectionWidth = 1;
+	while (texture.m_indirectionWidth < texture.m_pagesX[0])
+	{
+		texture.m_indirectionWidth *= 2;
+	}
+	texture.m_indirectionHeight = 1;
+	while (texture.m_indirectionHeight < texture.m_pagesY[0])
+	{
+		texture.m_indirectionHeight *= 2;
+	}
+	texture.m_indirection.resize(texture.m_levelCount);
+	for (uint32_t level = 0; level < texture.m_levelCount; ++level)
+	{
+		uint32_t levelWidth = std::max(texture.m_indirectionWidth >> level, 1u);
+		uint32_t levelHeight = std::max(texture.m_indirectionHeight >> level, 1u);
+		texture.m_indirection[level].assign(levelWidth * levelHeight, 0);
+	}
+	texture.m_fIndirectionDirty = true;
+	texture.m_fIndirectionInitialized = false;
+	createImage(
+		texture.m_indirectionWidth,
+		texture.m_indirectionHeight,
+		texture.m_levelCount,
+		VIRTUAL_INDIRECTION_FORMAT,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		texture.m_vkIndirectionImage,
+		texture.m_vkIndirectionMemory,
+		texture.m_vkIndirectionView);
+
+	m_pParameters->m_textures[textureIndex][0] = texture.m_width;
+	m_pParameters->m_textures[textureIndex][1] = texture.m_height;
+	m_pParameters->m_textures[textureIndex][2] = texture.m_levelCount;
+	writeIndirectionDescriptor(textureIndex, texture.m_vkIndirectionView);
+	m_textures.push_back(std::move(texture));
+
+	uint32_t coarsestPage = makeRequest(textureIndex, m_textures.back().m_levelCount - 1, 0, 0);
+	uploadPages(std::vector<uint32_t>(1, coarsestPage));
+	m_cachePages[m_pageSlots[coarsestPage]].m_fPinned = true;
+	return textureIndex;
+}
+
+/**************************************************************
+* Description
+*		Creates the render target of the feedback pass at a
+*		fraction of the swapchain extent, and the buffer it is
+*		read back through. The previous target is retired.
+* Returns
+*		void
+* Notes
+*		Feedback written to the previous target is dropped.
+*
+**************************************************************/
+void VirtualTextureSystem::createFeedbackTarget(VkExtent2D swapchainExtent)
+{
+	retireFeedbackTarget();
+
+	m_feedbackExtent.width = std::max((swapchainExtent.width + VIRTUAL_FEEDBACK_SCALE - 1) / VIRTUAL_FEEDBACK_SCALE, 1u);
+	m_feedbackExtent.height = std::max((swapchainExtent.height + VIRTUAL_FEEDBACK_SCALE - 1) / VIRTUAL_FEEDBACK_SCALE, 1u);
+	createImage(
+		m_feedbackExtent.width,
+		m_feedbackExtent.height,
+		1 /*mipLevels*/,
+		VIRTUAL_FEEDBACK_FORMAT,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		VK_IMAGE_ASPECT_COLOR_BIT,
+		m_vkFeedbackImage,
+		m_vkFeedbackMemory,
+		m_vkFeedbackView);
+	createImage(
+		m_feedbackExtent.width,
+		m_feedbackExtent.height,
+		1 /*mipLevels*/,
+		m_vkDepthFormat,
+		VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+		VK_IMAGE_ASPECT_DEPTH_BIT,
+		m_vkFeedbackDepthImage,
+		m_vkFeedbackDepthMemory,
+		m_vkFeedbackDepthView);
+
+	std::array<VkImageView, 2> attachments = { m_vkFeedbackView, m_vkFeedbackDepthView };
+	VkFramebufferCreateInfo framebufferInfo = {};
+	framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	framebufferInfo.renderPass = m_vkFeedbackRenderPass;
+	framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	framebufferInfo.pAttachments = attachments.data();
+	framebufferInfo.width = m_feedbackExtent.width;
+	framebufferInfo.height = m_feedbackExtent.height;
+	framebufferInfo.layers = 1;
+	if (VK_SUCCESS != vkCreateFramebuffer(m_vkDevice, &framebufferInfo, nullptr, &m_vkFeedbackFramebuffer))
+	{
+		throw std::runtime_error("Could not create feedback framebuffer.");
+	}
+
+	VkDeviceSize readbackSize = static_cast<VkDeviceSize>(m_feedbackExtent.width) * m_feedbackExtent.height * sizeof(uint32_t);
+	createBuffer(m_vkDevice,
+		m_vkPhysicalDevice,
+		readbackSize,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_vkReadbackBuffer,
+		m_vkReadbackMemory);
+	if (VK_SUCCESS != vkMapMemory(
+		m_vkDevice,
+		m_vkReadbackMemory,
+		0,
+		readbackSize,
+		0,
+		reinterpret_cast<void**>(&m_pReadback)))
+	{
+		throw std::runtime_error("Could not map feedback readback memory.");
+	}
+	m_fFeedbackPending = false;
+}
+
+/**************************************************************
+* Description
+*		Begins the feedback render pass, cleared to no requests,
+*		and sets the viewport and scissor to the feedback
+*		extent.
+* Returns
+*		void
+* Notes
+*		The caller binds the feedback pipeline and the sets and
+*		records the draws, inline.
+*
+**************************************************************/
+void VirtualTextureSystem::beginFeedbackPass(VkCommandBuffer commandBuffer)
+{
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color.uint32[0] = NO_PAGE_REQUEST;
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = m_vkFeedbackRenderPass;
+	renderPassInfo.framebuffer = m_vkFeedbackFramebuffer;
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = m_feedbackExtent;
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(m_feedbackExtent.width);
+	viewport.height = static_cast<float>(m_feedbackExtent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissorRectangle = {};
+	scissorRectangle.extent = m_feedbackExtent;
+	scissorRectangle.offset = { 0, 0 };
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissorRectangle);
+}
+
+/**************************************************************
+* Description
+*		Ends the feedback render pass and copies the requests to
+*		the readback buffer, for update to read once the frame
+*		has completed.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void VirtualTextureSystem::endFeedbackPass(VkCommandBuffer commandBuffer)
+{
+	vkCmdEndRenderPass(commandBuffer);
+
+	VkBufferImageCopy region = {};
+	region.bufferOffset = 0;
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = { 0, 0, 0 };
+	region.imageExtent = { m_feedbackExtent.width, m_feedbackExtent.height, 1 };
+	vkCmdCopyImageToBuffer(
+		commandBuffer,
+		m_vkFeedbackImage,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		m_vkReadbackBuffer,
+		1,
+		&region);
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = m_vkReadbackBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		0,
+		nullptr,
+		1,
+		&barrier,
+		0,
+		nullptr);
+	m_fFeedbackPending = true;
+}
+
+/**************************************************************
+* Description
+*		Reads the requests of the last feedback pass and copies
+*		the pages missing from the cache, coarsest first and at
+*		most the page budget of them. Pages requested keep their
+*		slots, the least recently requested ones are evicted
+*		to make room.
+* Returns
+*		void
+* Notes
+*		Call once the frame writing the feedback has completed.
+*		Every coarser page a request falls back on is requested
+*		along with it, so detail appears level by level.
+*
+**************************************************************/
+void VirtualTextureSystem::update()
+{
+	m_lastStreamedPages = 0;
+	if (!m_fFeedbackPending || m_textures.empty())
+	{
+		return;
+	}
+	m_fFeedbackPending = false;
+	++m_updateIndex;
+
+	m_requests.assign(m_pReadback, m_pReadback + m_feedbackExtent.width * m_feedbackExtent.height);
+	std::sort(m_requests.begin(), m_requests.end());
+	m_requests.erase(std::unique(m_requests.begin(), m_requests.end()), m_requests.end());
+	m_requests.erase(
+		std::remove_if(m_requests.begin(), m_requests.end(), [this](uint32_t request) { return !fValidRequest(request); }),
+		m_requests.end());
+
+	size_t requestCount = m_requests.size();
+	for (size_t i = 0; i < requestCount; ++i)
+	{
+		uint32_t request = m_requests[i];
+		uint32_t textureIndex = getRequestTexture(request);
+		uint32_t levelCount = m_textures[textureIndex].m_levelCount;
+		for (uint32_t level = getRequestLevel(request) + 1, shift = 1; level < levelCount; ++level, ++shift)
+		{
+			m_requests.push_back(makeRequest(textureIndex, level, getRequestX(request) >> shift, getRequestY(request) >> shift));
+		}
+	}
+	std::sort(m_requests.begin(), m_requests.end());
+	m_requests.erase(std::unique(m_requests.begin(), m_requests.end()), m_requests.end());
+
+	std::vector<uint32_t> missingPages;
+	for (uint32_t request : m_requests)
+	{
+		auto resident = m_pageSlots.find(request);
+		if (m_pageSlots.end() != resident)
+		{
+			m_cachePages[resident->second].m_lastUsed = m_updateIndex;
+		}
+		else
+		{
+			missingPages.push_back(request);
+		}
+	}
+
+	std::stable_sort(missingPages.begin(), missingPages.end(), [](uint32_t a, uint32_t b)
+	{
+		return getRequestLevel(a) > getRequestLevel(b);
+	});
+	if (missingPages.size() > m_pageBudget)
+	{
+		missingPages.resize(m_pageBudget);
+	}
+	uploadPages(missingPages);
+}
+
+/**************************************************************
+* Description
+*		Creates a device local image, binds memory to it and
+*		creates a view of every level.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void VirtualTextureSystem::createImage(
+	uint32_t width,
+	uint32_t height,
+	uint32_t mipLevels,
+	VkFormat vkFormat,
+	VkImageUsageFlags usage,
+	VkImageAspectFlags aspectFlags,
+	VkImage &vkImage,
+	VkDeviceMemory &imageMemory,
+	VkImageView &imageView)
+{
+	VkImageCreateInfo imageCreateInfo = {};
+	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageCreateInfo.extent.width = width;
+	imageCreateInfo.extent.height = height;
+	imageCreateInfo.extent.depth = 1;
+	imageCreateInfo.mipLevels = mipLevels;
+	imageCreateInfo.arrayLayers = 1;
+	imageCreateInfo.format = vkFormat;
+	imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	imageCreateInfo.usage = usage;
+	imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	if (VK_SUCCESS != vkCreateImage(m_vkDevice, &imageCreateInfo, nullptr, &vkImage))
+	{
+		throw std::runtime_error("Could not create virtual texture image.");
+	}
+
+	VkMemoryRequirements memRequirements = {};
+	vkGetImageMemoryRequirements(m_vkDevice, vkImage, &memRequirements);
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(m_vkPhysicalDevice, memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	if (VK_SUCCESS != vkAllocateMemory(m_vkDevice, &allocInfo, nullptr, &imageMemory))
+	{
+		throw std::runtime_error("Could not allocate memory for virtual texture image.");
+	}
+	vkBindImageMemory(m_vkDevice, vkImage, imageMemory, 0);
+
+	VkImageViewCreateInfo viewInfo = {};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = vkImage;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = vkFormat;
+	viewInfo.subresourceRange.aspectMask = aspectFlags;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = mipLevels;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+	if (VK_SUCCESS != vkCreateImageView(m_vkDevice, &viewInfo, nullptr, &imageView))
+	{
+		throw std::runtime_error("Could not create virtual texture image view.");
+	}
+}
+
+/**************************************************************
+* Description
+*		Creates the render pass of the feedback pass, with a
+*		color attachment of page requests left ready to be
+*		copied and a depth attachment of its own.
+* Returns
+*		void
+* Notes
+*		The feedback pipeline is created by the caller against
+*		this render pass.
+*
+**************************************************************/
+void VirtualTextureSystem::createFeedbackRenderPass(VkFormat vkDepthFormat)
+{
+	m_vkDepthFormat = vkDepthFormat;
+
+	std::array<VkAttachmentDescription, 2> attachments = {};
+	attachments[0].format = VIRTUAL_FEEDBACK_FORMAT;
+	attachments[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[0].finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	attachments[1].format = m_vkDepthFormat;
+	attachments[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachments[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkAttachmentReference colorAttachmentRef = {};
+	colorAttachmentRef.attachment = 0;
+	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	VkAttachmentReference depthAttachmentRef = {};
+	depthAttachmentRef.attachment = 1;
+	depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+	VkSubpassDescription subpass = {};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorAttachmentRef;
+	subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+	// The copy of the previous feedback has to finish reading the image
+	// before it is cleared, and this pass has to finish writing it
+	// before it is copied.
+	//
+	std::array<VkSubpassDependency, 2> dependencies = {};
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+	renderPassInfo.pDependencies = dependencies.data();
+	if (VK_SUCCESS != vkCreateRenderPass(m_vkDevice, &renderPassInfo, nullptr, &m_vkFeedbackRenderPass))
+	{
+		throw std::runtime_error("Could not create feedback render pass.");
+	}
+}
+
+/**************************************************************
+* Description
+*		Hands the feedback target and readback buffer to the
+*		deletion queue.
+* Returns
+*		void
+* Notes
+*		They are destroyed once everything submitted so far has
+*		completed.
+*
+**************************************************************/
+void VirtualTextureSystem::retireFeedbackTarget()
+{
+	if (VK_NULL_HANDLE == m_vkFeedbackFramebuffer)
+	{
+		return;
+	}
+
+	uint64_t value = m_pTimeline->getSubmittedValue();
+	m_pDeletionQueue->enqueueFramebuffer(value, m_vkFeedbackFramebuffer);
+	m_pDeletionQueue->enqueueImageView(value, m_vkFeedbackView);
+	m_pDeletionQueue->enqueueImage(value, m_vkFeedbackImage);
+	m_pDeletionQueue->enqueueMemory(value, m_vkFeedbackMemory);
+	m_pDeletionQueue->enqueueImageView(value, m_vkFeedbackDepthView);
+	m_pDeletionQueue->enqueueImage(value, m_vkFeedbackDepthImage);
+	m_pDeletionQueue->enqueueMemory(value, m_vkFeedbackDepthMemory);
+	m_pDeletionQueue->enqueueBuffer(value, m_vkReadbackBuffer);
+	m_pDeletionQueue->enqueueMemory(value, m_vkReadbackMemory);
+	m_vkFeedbackFramebuffer = VK_NULL_HANDLE;
+	m_pReadback = nullptr;
+	m_fFeedbackPending = false;
+}
+
+/**************************************************************
+* Description
+*		Writes the indirection image of a texture into its slot
+*		of the indirection array.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void VirtualTextureSystem::writeIndirectionDescriptor(uint32_t textureIndex, VkImageView vkImageView)
+{
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.sampler = m_vkIndirectionSampler;
+	imageInfo.imageView = vkImageView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = m_vkDescriptorSet;
+	descriptorWrite.dstBinding = 2;
+	descriptorWrite.dstArrayElement = textureIndex;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.pImageInfo = &imageInfo;
+	vkUpdateDescriptorSets(m_vkDevice, 1, &descriptorWrite, 0, nullptr);
+}
+
+/**************************************************************
+* Description
+*		Checks that a request read back names a page of a level
+*		of a loaded texture.
+* Returns
+*		true/false
+* Notes
+*		Texels no virtual texture was drawn to hold
+*		NO_PAGE_REQUEST, which fails.
+*
+**************************************************************/
+bool VirtualTextureSystem::fValidRequest(uint32_t request) const
+{
+	uint32_t textureIndex = getRequestTexture(request);
+	if (textureIndex >= m_textures.size())
+	{
+		return false;
+	}
+	const VirtualTexture &texture = m_textures[textureIndex];
+	uint32_t level = getRequestLevel(request);
+	return level < texture.m_levelCount &&
+		getRequestX(request) < texture.m_pagesX[level] &&
+		getRequestY(request) < texture.m_pagesY[level];
+}
+
+/**************************************************************
+* Description
+*		Finds a cache slot for a new page: a free one if there
+*		is any, otherwise the one requested least recently.
+* Returns
+*		The slot, or NO_CACHE_SLOT if every page is pinned or
+*		was requested by this update.
+* Notes
+*		The page held by the slot is not evicted here.
+*
+**************************************************************/
+uint32_t VirtualTextureSystem::allocateSlot()
+{
+	uint32_t leastRecentSlot = NO_CACHE_SLOT;
+	for (uint32_t slot = 0; slot < m_cachePages.size(); ++slot)
+	{
+		const CachePage &page = m_cachePages[slot];
+		if (NO_PAGE_REQUEST == page.m_key)
+		{
+			return slot;
+		}
+		if (!page.m_fPinned &&
+			page.m_lastUsed < m_updateIndex &&
+			(NO_CACHE_SLOT == leastRecentSlot || page.m_lastUsed < m_cachePages[leastRecentSlot].m_lastUsed))
+		{
+			leastRecentSlot = slot;
+		}
+	}
+	return leastRecentSlot;
+}
+
+/**************************************************************
+* Description
+*		Copies the texels of a page and its border from the mip
+*		chain of the texture, row by row.
+* Returns
+*		void
+* Notes
+*		The border wraps around the edges of the level, as a
+*		repeating sampler would. Pages on the right and bottom
+*		edges repeat the level where they extend past it.
+*
+**************************************************************/
+void VirtualTextureSystem::fillPage(uint32_t request, uint8_t *pPage) const
+{
+	const VirtualTexture &texture = m_textures[getRequestTexture(request)];
+	uint32_t level = getRequestLevel(request);
+	const uint8_t *pLevel = texture.m_levels[level].data();
+	int32_t levelWidth = static_cast<int32_t>(std::max(texture.m_width >> level, 1u));
+	int32_t levelHeight = static_cast<int32_t>(std::max(texture.m_height >> level, 1u));
+	int32_t originX = static_cast<int32_t>(getRequestX(request) * VIRTUAL_PAGE_SIZE) - static_cast<int32_t>(VIRTUAL_PAGE_BORDER);
+	int32_t originY = static_cast<int32_t>(getRequestY(request) * VIRTUAL_PAGE_SIZE) - static_cast<int32_t>(VIRTUAL_PAGE_BORDER);
+
+	for (int32_t row = 0; row < static_cast<int32_t>(VIRTUAL_PAGE_STRIDE); ++row)
+	{
+		int32_t sourceY = ((originY + row) % levelHeight + levelHeight) % levelHeight;
+		const uint8_t *pSourceRow = pLevel + static_cast<size_t>(sourceY) * levelWidth * 4;
+		uint8_t *pRow = pPage + static_cast<size_t>(row) * VIRTUAL_PAGE_STRIDE * 4;
+		for (int32_t column = 0; column < static_cast<int32_t>(VIRTUAL_PAGE_STRIDE); ++column)
+		{
+			int32_t sourceX = ((originX + column) % levelWidth + levelWidth) % levelWidth;
+			memcpy(pRow + column * 4, pSourceRow + sourceX * 4, 4);
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Writes every level of the indirection of a texture from
+*		the pages in the cache, coarsest level first. A page
+*		that is not resident points where the page covering it
+*		one level up does.
+* Returns
+*		void
+* Notes
+*		An entry holds the cache slot in x and y, the level the
+*		slot holds in z and 255 in w once anything is mapped.
+*
+**************************************************************/
+void VirtualTextureSystem::rebuildIndirection(VirtualTexture &texture)
+{
+	uint32_t textureIndex = static_cast<uint32_t>(&texture - m_textures.data());
+	for (uint32_t level = texture.m_levelCount; level-- > 0;)
+	{
+		uint32_t width = std::max(texture.m_indirectionWidth >> level, 1u);
+		std::vector<uint32_t> &entries = texture.m_indirection[level];
+		for (uint32_t y = 0; y < texture.m_pagesY[level]; ++y)
+		{
+			for (uint32_t x = 0; x < texture.m_pagesX[level]; ++x)
+			{
+				uint32_t entry = 0;
+				auto resident = m_pageSlots.find(makeRequest(textureIndex, level, x, y));
+				if (m_pageSlots.end() != resident)
+				{
+					uint32_t slot = resident->second;
+					entry = (slot % VIRTUAL_CACHE_PAGES) |
+						((slot / VIRTUAL_CACHE_PAGES) << 8) |
+						(level << 16) |
+						(255u << 24);
+				}
+				else if (level + 1 < texture.m_levelCount)
+				{
+					uint32_t parentWidth = std::max(texture.m_indirectionWidth >> (level + 1), 1u);
+					uint32_t parentX = std::min(x / 2, texture.m_pagesX[level + 1] - 1);
+					uint32_t parentY = std::min(y / 2, texture.m_pagesY[level + 1] - 1);
+					entry = texture.m_indirection[level + 1][parentY * parentWidth + parentX];
+				}
+				entries[y * width + x] = entry;
+			}
+		}
+	}
+}
+
+/**************************************************************
+* Description
+*		Gives each page a cache slot, evicting the pages held
+*		there, and copies the pages and the indirection of the
+*		textures that changed in one command buffer.
+* Returns
+*		void
+* Notes
+*		Stops at the first page no slot can be found for. The
+*		staging buffer is released through the deletion queue.
+*
+**************************************************************/
+void VirtualTextureSystem::uploadPages(const std::vector<uint32_t> &requests)
+{
+	std::vector<std::pair<uint32_t, uint32_t>> uploads; // Request and slot.
+	for (uint32_t request : requests)
+	{
+		uint32_t slot = allocateSlot();
+		if (NO_CACHE_SLOT == slot)
+		{
+			break;
+		}
+
+		CachePage &page = m_cachePages[slot];
+		if (NO_PAGE_REQUEST != page.m_key)
+		{
+			m_pageSlots.erase(page.m_key);
+			m_textures[getRequestTexture(page.m_key)].m_fIndirectionDirty = true;
+		}
+		page.m_key = request;
+		page.m_lastUsed = m_updateIndex;
+		page.m_fPinned = false;
+		m_pageSlots[request] = slot;
+		m_textures[getRequestTexture(request)].m_fIndirectionDirty = true;
+		uploads.emplace_back(request, slot);
+	}
+
+	const VkDeviceSize pageBytes = VIRTUAL_PAGE_STRIDE * VIRTUAL_PAGE_STRIDE * 4;
+	VkDeviceSize stagingSize = uploads.size() * pageBytes;
+	for (auto &texture : m_textures)
+	{
+		if (texture.m_fIndirectionDirty)
+		{
+			rebuildIndirection(texture);
+			for (const auto &level : texture.m_indirection)
+			{
+				stagingSize += level.size() * sizeof(uint32_t);
+			}
+		}
+	}
+	if (0 == stagingSize)
+	{
+		return;
+	}
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingMemory;
+	createBuffer(m_vkDevice,
+		m_vkPhysicalDevice,
+		stagingSize,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		stagingBuffer,
+		stagingMemory);
+	uint8_t *pStaging = nullptr;
+	if (VK_SUCCESS != vkMapMemory(m_vkDevice, stagingMemory, 0, stagingSize, 0, reinterpret_cast<void**>(&pStaging)))
+	{
+		throw std::runtime_error("Could not map virtual texture staging memory.");
+	}
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(m_vkDevice, m_vkCommandPool);
+	VkDeviceSize offset = 0;
+	if (!uploads.empty())
+	{
+		std::vector<VkBufferImageCopy> regions;
+		for (const auto &upload : uploads)
+		{
+			fillPage(upload.first, pStaging + offset);
+
+			VkBufferImageCopy region = {};
+			region.bufferOffset = offset;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = 0;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset.x = static_cast<int32_t>((upload.second % VIRTUAL_CACHE_PAGES) * VIRTUAL_PAGE_STRIDE);
+			region.imageOffset.y = static_cast<int32_t>((upload.second / VIRTUAL_CACHE_PAGES) * VIRTUAL_PAGE_STRIDE);
+			region.imageOffset.z = 0;
+			region.imageExtent = { VIRTUAL_PAGE_STRIDE, VIRTUAL_PAGE_STRIDE, 1 };
+			regions.push_back(region);
+			offset += pageBytes;
+		}
+
+		// The frames sampling the evicted pages have completed.
+		//
+		transitionImage(
+			commandBuffer,
+			m_vkCacheImage,
+			1,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			0,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT);
+		vkCmdCopyBufferToImage(
+			commandBuffer,
+			stagingBuffer,
+			m_vkCacheImage,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()),
+			regions.data());
+		transitionImage(
+			commandBuffer,
+			m_vkCacheImage,
+			1,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+	}
+
+	for (auto &texture : m_textures)
+	{
+		if (!texture.m_fIndirectionDirty)
+		{
+			continue;
+		}
+
+		std::vector<VkBufferImageCopy> regions;
+		for (uint32_t level = 0; level < texture.m_levelCount; ++level)
+		{
+			const std::vector<uint32_t> &entries = texture.m_indirection[level];
+			memcpy(pStaging + offset, entries.data(), entries.size() * sizeof(uint32_t));
+
+			VkBufferImageCopy region = {};
+			region.bufferOffset = offset;
+			region.bufferRowLength = 0;
+			region.bufferImageHeight = 0;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = level;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageOffset = { 0, 0, 0 };
+			region.imageExtent.width = std::max(texture.m_indirectionWidth >> level, 1u);
+			region.imageExtent.height = std::max(texture.m_indirectionHeight >> level, 1u);
+			region.imageExtent.depth = 1;
+			regions.push_back(region);
+			offset += entries.size() * sizeof(uint32_t);
+		}
+
+		transitionImage(
+			commandBuffer,
+			texture.m_vkIndirectionImage,
+			texture.m_levelCount,
+			texture.m_fIndirectionInitialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			0,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT);
+		vkCmdCopyBufferToImage(
+			commandBuffer,
+			stagingBuffer,
+			texture.m_vkIndirectionImage,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			static_cast<uint32_t>(regions.size()),
+			regions.data());
+		transitionImage(
+			commandBuffer,
+			texture.m_vkIndirectionImage,
+			texture.m_levelCount,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_ACCESS_TRANSFER_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+		texture.m_fIndirectionDirty = false;
+		texture.m_fIndirectionInitialized = true;
+	}
+	vkUnmapMemory(m_vkDevice, stagingMemory);
+
+	uint64_t value = endSingleTimeCommands(m_vkCommandPool, *m_pTimeline, commandBuffer, *m_pDeletionQueue);
+	m_pDeletionQueue->enqueueBuffer(value, stagingBuffer);
+	m_pDeletionQueue->enqueueMemory(value, stagingMemory);
+	m_lastStreamedPages = static_cast<uint32_t>(uploads.size());
+}
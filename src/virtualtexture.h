@@ -0,0 +1,175 @@
+#pragma once
+
+#include "deletionqueue.h"
+#include "model.h"
+#include "timeline.h"
+#include<string>
+#include<unordered_map>
+#include<vector>
+
+// Texels along each side of a page, and the texels of its neighbours
+// copied around it so bilinear filtering never reads another page.
+//
+const uint32_t VIRTUAL_PAGE_SIZE = 128;
+const uint32_t VIRTUAL_PAGE_BORDER = 4;
+const uint32_t VIRTUAL_PAGE_STRIDE = VIRTUAL_PAGE_SIZE + 2 * VIRTUAL_PAGE_BORDER;
+
+// Pages along each side of the physical page cache. The cache texture
+// is VIRTUAL_CACHE_PAGES * VIRTUAL_PAGE_STRIDE texels wide and high.
+//
+const uint32_t VIRTUAL_CACHE_PAGES = 16;
+
+// Virtual textures the indirection array of the set holds.
+//
+const uint32_t MAX_VIRTUAL_TEXTURES = 16;
+
+// The feedback pass renders at the swapchain size divided by this.
+//
+const uint32_t VIRTUAL_FEEDBACK_SCALE = 8;
+
+// Pages copied to the cache per update unless set otherwise.
+//
+const uint32_t VIRTUAL_PAGE_BUDGET = 16;
+
+// Cleared into the feedback target, no page is requested by the texel.
+//
+const uint32_t NO_PAGE_REQUEST = 0xFFFFFFFF;
+
+// The uniform buffer of the set, laid out as the std140 block the
+// shaders read.
+//
+struct VirtualTextureParameters
+{
+	float m_feedbackLodBias; // Makes the low resolution feedback ask for the levels the frame samples.
+	float m_padding[3];
+	uint32_t m_textures[MAX_VIRTUAL_TEXTURES][4]; // Width, height and level count of each texture.
+};
+
+// A slot of the page cache and the page it holds.
+//
+struct CachePage
+{
+	uint32_t m_key; // The page request naming the page, or NO_PAGE_REQUEST if the slot is free.
+	uint64_t m_lastUsed; // The last update the page was requested in.
+	bool m_fPinned; // The coarsest page of a texture, never evicted.
+};
+
+// A texture split into pages, with its whole mip chain kept in system
+// memory and only the pages the feedback asks for on the GPU. The
+// indirection image has one texel per page of each level, naming the
+// cache slot showing it.
+//
+struct VirtualTexture
+{
+	std::string m_path;
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_levelCount; // Down to the level that fits one page.
+	std::vector<std::vector<uint8_t>> m_levels; // RGBA8, level 0 first.
+	std::vector<uint32_t> m_pagesX; // Pages of each level.
+	std::vector<uint32_t> m_pagesY;
+	uint32_t m_indirectionWidth; // Level 0 of the indirection image, in pages.
+	uint32_t m_indirectionHeight;
+	std::vector<std::vector<uint32_t>> m_indirection; // RGBA8 entries of each level.
+	bool m_fIndirectionDirty;
+	VkImage m_vkIndirectionImage;
+	VkDeviceMemory m_vkIndirectionMemory;
+	VkImageView m_vkIndirectionView;
+	bool m_fIndirectionInitialized; // The image has left the undefined layout.
+};
+
+// Software virtual texturing. Textures far larger than what is kept on
+// the device are sampled through a page table: an indirection texture
+// per virtual texture maps each page to a slot of one physical cache
+// texture. A low resolution pass writes the page every texel needs, and
+// the CPU reads it back once the frame has completed, keeps the pages
+// used recently and copies the missing ones, coarsest first, within a
+// budget. Pages not resident yet are shown from the closest coarser
+// level that is. Only core Vulkan is used, no sparse residency.
+//
+class VirtualTextureSystem
+{
+public:
+	VirtualTextureSystem();
+	void create(
+		VkDevice vkDevice,
+		VkPhysicalDevice vkPhysicalDevice,
+		VkCommandPool vkCommandPool,
+		Timeline *pTimeline,
+		DeletionQueue *pDeletionQueue,
+		VkFormat vkDepthFormat);
+	void destroy();
+	uint32_t addTexture(const std::string &path);
+	void setPageBudget(uint32_t pageBudget) { m_pageBudget = pageBudget; }
+	void createFeedbackTarget(VkExtent2D swapchainExtent);
+	void beginFeedbackPass(VkCommandBuffer commandBuffer);
+	void endFeedbackPass(VkCommandBuffer commandBuffer);
+	void update();
+	VkDescriptorSetLayout getLayout() const { return m_vkLayout; }
+	VkDescriptorSet getSet() const { return m_vkDescriptorSet; }
+	VkRenderPass getFeedbackRenderPass() const { return m_vkFeedbackRenderPass; }
+	VkExtent2D getFeedbackExtent() const { return m_feedbackExtent; }
+	uint32_t getTextureCount() const { return static_cast<uint32_t>(m_textures.size()); }
+	uint32_t getResidentPageCount() const { return static_cast<uint32_t>(m_pageSlots.size()); }
+	uint32_t getLastStreamedPageCount() const { return m_lastStreamedPages; }
+private:
+	void createImage(
+		uint32_t width,
+		uint32_t height,
+		uint32_t mipLevels,
+		VkFormat vkFormat,
+		VkImageUsageFlags usage,
+		VkImageAspectFlags aspectFlags,
+		VkImage &vkImage,
+		VkDeviceMemory &imageMemory,
+		VkImageView &imageView);
+	void createFeedbackRenderPass(VkFormat vkDepthFormat);
+	void retireFeedbackTarget();
+	void writeIndirectionDescriptor(uint32_t textureIndex, VkImageView vkImageView);
+	bool fValidRequest(uint32_t request) const;
+	uint32_t allocateSlot();
+	void fillPage(uint32_t request, uint8_t *pPage) const;
+	void rebuildIndirection(VirtualTexture &texture);
+	void uploadPages(const std::vector<uint32_t> &requests);
+
+	VkDevice m_vkDevice;
+	VkPhysicalDevice m_vkPhysicalDevice;
+	VkCommandPool m_vkCommandPool;
+	Timeline *m_pTimeline;
+	DeletionQueue *m_pDeletionQueue;
+	VkDescriptorSetLayout m_vkLayout;
+	VkDescriptorPool m_vkPool;
+	VkDescriptorSet m_vkDescriptorSet;
+	VkBuffer m_vkParameterBuffer; // Sizes and level counts of the textures.
+	VkDeviceMemory m_vkParameterMemory;
+	VirtualTextureParameters *m_pParameters; // Persistently mapped, the memory is host coherent.
+	VkSampler m_vkCacheSampler;
+	VkSampler m_vkIndirectionSampler;
+	VkImage m_vkCacheImage;
+	VkDeviceMemory m_vkCacheMemory;
+	VkImageView m_vkCacheView;
+	std::vector<VirtualTexture> m_textures;
+	std::vector<CachePage> m_cachePages; // One for each slot of the cache.
+	std::unordered_map<uint32_t, uint32_t> m_pageSlots; // Slot of each resident page, by request.
+	uint64_t m_updateIndex;
+	uint32_t m_pageBudget;
+	uint32_t m_lastStreamedPages;
+
+	// The feedback pass and the buffer it is read back through.
+	//
+	VkRenderPass m_vkFeedbackRenderPass;
+	VkFormat m_vkDepthFormat;
+	VkExtent2D m_feedbackExtent;
+	VkImage m_vkFeedbackImage;
+	VkDeviceMemory m_vkFeedbackMemory;
+	VkImageView m_vkFeedbackView;
+	VkImage m_vkFeedbackDepthImage;
+	VkDeviceMemory m_vkFeedbackDepthMemory;
+	VkImageView m_vkFeedbackDepthView;
+	VkFramebuffer m_vkFeedbackFramebuffer;
+	VkBuffer m_vkReadbackBuffer;
+	VkDeviceMemory m_vkReadbackMemory;
+	uint32_t *m_pReadback; // Persistently mapped, the memory is host coherent.
+	bool m_fFeedbackPending; // A submitted frame wrote the feedback, it was not read yet.
+	std::vector<uint32_t> m_requests;
+};
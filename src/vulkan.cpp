@@ -1,11 +1,44 @@
 #include "vulkan.h"
 #include <set>
 #include <algorithm>
+#include <cstdlib>
 #include <fstream>
 
-#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include<stb_image_write.h>
 #include<stb_image.h>
 
+// Draws recorded into each cached secondary command buffer. Smaller
+// segments are re-recorded more selectively, larger ones cost less to
+// schedule and execute.
+//
+const size_t DRAWS_PER_SEGMENT = 256;
+
+// Number of draws recorded by benchmarkCommandRecording.
+//
+const uint32_t BENCHMARK_DRAW_COUNT = 10000;
+
+// Number of textures loaded by benchmarkTextureLoading, cycling through
+// the files below.
+//
+const uint32_t BENCHMARK_TEXTURE_COUNT = 50;
+const char *BENCHMARK_TEXTURE_PATHS[] = {
+	"textures/chalet.jpg",
+	"textures/teapot.png",
+	"textures/texture.jpg" };
+
+// Uploads of BENCHMARK_TEXTURE_PATHS[0] timed by benchmarkMipGeneration
+// for each way of generating its mip chain.
+//
+const uint32_t BENCHMARK_MIP_GENERATION_REPEATS = 10;
+
+// A frame matches its reference image when no more than this fraction of
+// its pixels differ from it by more than COMPARE_CHANNEL_TOLERANCE in a
+// channel. Drivers round filtering and blending slightly differently.
+//
+const int COMPARE_CHANNEL_TOLERANCE = 8;
+const double COMPARE_MAX_DIFFERENT_PIXELS = 0.005;
+
 /**************************************************************
 * Description
 *		Reads the file in binary format and returns the data
@@ -87,67 +120,347 @@ void HelloTriangleApplication::initVulkan()
 {
 	createInstance();
 	setupDebugCallback();
-	createSurface();
+	if (!m_options.m_fHeadless)
+	{
+		createSurface();
+	}
 	pickPhysicalDevice();
 	createLogicalDevice();
-	createSwapChain();
+	m_pipelineCache.create(m_vkDevice, m_vkPhysicalDevice, PIPELINE_CACHE_PATH);
+	m_deletionQueue.create(m_vkDevice);
+	m_graphicsTimeline.create(m_vkDevice, m_vkGraphicsQueue);
+	m_descriptorAllocator.create(m_vkDevice);
+	if (m_options.m_fHeadless)
+	{
+		createOffscreenTarget();
+	}
+	else
+	{
+		createSwapChain();
+	}
 	createSwapchainImageViews();
+	createRenderFinishedSemaphores();
 	createRenderPass();
 	createDescriptorSetLayout();
-	createGraphicsPipelines();
 	createCommandPool();
+	m_materialTable.create(m_vkDevice, m_vkPhysicalDevice);
+	m_virtualTextures.setPageBudget(VIRTUAL_TEXTURE_PAGE_BUDGET);
+	m_virtualTextures.create(
+		m_vkDevice,
+		m_vkPhysicalDevice,
+		m_vkCommandPool,
+		&m_graphicsTimeline,
+		&m_deletionQueue,
+		findDepthFormat());
+	createPipelineLayout();
+	createGraphicsPipelines();
 	createDepthResources();
+	m_virtualTextures.createFeedbackTarget(m_vkSwapchainExtent);
 	createFrameBuffers();
-	createTextureImage();
-	createTextureImageView();
-	createTextureSampler();
+	m_textureManager.setMipGeneration(m_options.m_mipGeneration);
+	m_textureManager.setMipCacheDirectory(MIP_CACHE_DIRECTORY);
+	m_textureManager.setStreamingBudget(m_options.m_comparePath.empty() ? TEXTURE_STREAMING_BUDGET : 0);
+	m_textureManager.create(
+		m_vkDevice,
+		m_vkPhysicalDevice,
+		m_vkCommandPool,
+		&m_graphicsTimeline,
+		&m_deletionQueue,
+		&m_materialTable,
+		&m_threadPool);
 	loadModels();
+	createMaterials();
+	if (!m_options.m_comparePath.empty())
+	{
+		// Frames compared with a reference show every texture complete
+		// from the first one, however long it takes to decode.
+		//
+		m_textureManager.waitForAll();
+	}
 	createVertexBuffers();
 	createIndexBuffers();
 	createUniformBuffer();
-	createDescriptorPool();
 	createDescriptorSet();
-	createAndFillCommandBuffers();
+	createCommandBuffers();
+	createTimestampQueryPool();
 	createSemaphores();
 }
 
-void HelloTriangleApplication::mainLoop()
+/**************************************************************
+* Description
+*		Handles the pending window events.
+* Returns
+*		false when the window was closed, true otherwise.
+* Notes
+*		Headless runs have no window and always go on.
+*
+**************************************************************/
+bool HelloTriangleApplication::pollWindowEvents()
 {
-	while (!glfwWindowShouldClose(m_glfwWindow))
+#ifdef RENDERER_GLFW
+	if (!m_options.m_fHeadless)
 	{
 		glfwPollEvents();
-		updateUniformBuffer();
+		return !glfwWindowShouldClose(m_glfwWindow);
+	}
+#endif
+	return true;
+}
+
+void HelloTriangleApplication::mainLoop()
+{
+	bool fBenchmark = !m_options.m_benchmarkScriptPath.empty();
+	CpuTimer benchmarkTimer;
+	StdTime lastFrameTime = std::chrono::steady_clock::now();
+	for (;;)
+	{
+		if (0 != m_options.m_frameCount && m_frameIndex >= m_options.m_frameCount)
+		{
+			break;
+		}
+		if (!pollWindowEvents())
+		{
+			break;
+		}
+
+		// The clock is sampled once per frame and every model
+		// advances by the same frame time.
+		//
+		StdTime currentTime = std::chrono::steady_clock::now();
+		float deltaTime = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - lastFrameTime).count();
+		lastFrameTime = currentTime;
+
+		// Scripted runs advance by the fixed timestep of the script
+		// however long the frame took, so every run renders the same
+		// frames.
+		//
+		if (fBenchmark)
+		{
+			deltaTime = m_benchmarkScript.getTimestep();
+			applyBenchmarkScript(static_cast<float>(m_frameIndex) * deltaTime);
+		}
+
+		// Resize events are handled once per frame, before the
+		// projection of the frame is computed.
+		//
+		if (m_fSwapchainDirty)
+		{
+			recreateSwapchain();
+			if (m_fSwapchainDirty)
+			{
+				// The window is minimized, there is nothing to draw to.
+				// Sleep until an event, such as the window being restored,
+				// instead of spinning.
+				//
+#ifdef RENDERER_GLFW
+				glfwWaitEvents();
+#endif
+				continue;
+			}
+		}
+
+		CpuTimer frameTimer;
+		updateScene(deltaTime);
 		drawFrame();
+		double frameMilliseconds = frameTimer.elapsedMilliseconds();
+		m_frameStatistics.addSample("frame (ms)", frameMilliseconds);
+		m_frameStatistics.addSample("frame cpu (ms)", frameMilliseconds - m_frameWaitMilliseconds);
+		m_frameStatistics.endFrame();
+
+		// The warm up frames compile pipelines and stream textures and
+		// are left out of the results.
+		//
+		if (fBenchmark && m_frameIndex == m_benchmarkScript.getWarmupFrameCount())
+		{
+			m_frameStatistics.clearHistory();
+			benchmarkTimer.reset();
+		}
+
+		if (m_options.m_fHeadless)
+		{
+			bool fLastFrame = m_frameIndex == m_options.m_frameCount;
+			bool fInterval = 0 != m_options.m_readbackInterval && 0 == m_frameIndex % m_options.m_readbackInterval;
+			bool fWrite = !m_options.m_readbackPrefix.empty() && (fLastFrame || fInterval);
+			bool fCompare = !m_options.m_comparePath.empty() && fLastFrame;
+			if (fWrite || fCompare)
+			{
+				std::vector<uint8_t> pixels;
+				readbackFrame(pixels);
+				if (fWrite)
+				{
+					std::string path = m_options.m_readbackPrefix + std::to_string(m_frameIndex) + ".png";
+					uint32_t width = m_vkSwapchainExtent.width;
+					if (0 == stbi_write_png(path.c_str(), width, m_vkSwapchainExtent.height, 4, pixels.data(), width * 4))
+					{
+						std::cerr << "Could not write " << path << std::endl;
+					}
+				}
+				if (fCompare)
+				{
+					compareFrame(pixels);
+				}
+			}
+		}
 	}
 
 	vkDeviceWaitIdle(m_vkDevice);
+	if (fBenchmark)
+	{
+		// Timings are read back a frame late, the ones of the last
+		// frame are still pending.
+		//
+		double seconds = benchmarkTimer.elapsedMilliseconds() / 1000.0;
+		if (m_fGpuTimingsPending)
+		{
+			collectGpuTimings();
+			m_fGpuTimingsPending = false;
+		}
+		saveBenchmarkResults(seconds);
+	}
 }
 
 void HelloTriangleApplication::run()
 {
-	initWindow();
+	if (!m_options.m_benchmarkScriptPath.empty())
+	{
+		loadBenchmarkScene();
+	}
+#ifdef RENDERER_GLFW
+	if (!m_options.m_fHeadless)
+	{
+		initWindow();
+	}
+#endif
 	initVulkan();
+	if (m_options.m_fBenchmarkMipGeneration)
+	{
+		benchmarkMipGeneration();
+	}
 	mainLoop();
 	cleanup();
+
+	// Test runs fail on what the validation layers report, compared
+	// runs also on a frame that does not match.
+	//
+	bool fTest = m_options.m_fFailOnValidationErrors || !m_options.m_comparePath.empty();
+	uint32_t validationErrorCount = m_validationErrorCount.load();
+	if (fTest && 0 != validationErrorCount)
+	{
+		throw std::runtime_error("The validation layers reported " + std::to_string(validationErrorCount) + " errors.");
+	}
+	if (!m_options.m_comparePath.empty())
+	{
+		if (!m_compareError.empty())
+		{
+			throw std::runtime_error(m_compareError);
+		}
+		std::cout << "The last frame matches " << m_options.m_comparePath << std::endl;
+	}
 }
 
 /**************************************************************
 * Description
-*		Creates graphics pipelines needed for the application.
-*
+*		Starts compiling the graphics pipelines needed for the
+*		application on the thread pool.
 * Returns
 *		void
 * Notes
+*		The shader modules are loaded here, on the calling thread,
+*		and shared by the pipelines. The pipelines are picked up
+*		by getGraphicsPipeline when they are first needed.
+*		The cache is cold on the first run and warm when it was
+*		loaded from disk. Resizing the window does not create the
+*		pipelines again, only a change of the surface format does.
 *
 **************************************************************/
 void HelloTriangleApplication::createGraphicsPipelines()
 {
-	m_vkGraphicsPipelineWithColorShading = createGraphicsPipeline("shaders/colorshading.spv");
-	m_models[0].setGraphicsPipeline(m_vkGraphicsPipelineWithColorShading);
-	m_vkGraphicsPipelineWithTextureShading = createGraphicsPipeline("shaders/textureshading.spv");
-	m_models[1].setGraphicsPipeline(m_vkGraphicsPipelineWithTextureShading);
+	const char *fragShaderPaths[PIPELINE_COUNT] = {};
+	fragShaderPaths[PIPELINE_COLOR_SHADING] = "shaders/colorshading.spv";
+	fragShaderPaths[PIPELINE_TEXTURE_SHADING] = "shaders/textureshading.spv";
+	fragShaderPaths[PIPELINE_VIRTUAL_FEEDBACK] = "shaders/vtfeedback.spv";
+
+	m_fPipelineCacheWarm = m_pipelineCache.fLoadedFromDisk();
+	m_pipelineTimer.reset();
+	m_vkGraphicsPipelines.assign(PIPELINE_COUNT, VK_NULL_HANDLE);
+	m_pipelineFutures.resize(PIPELINE_COUNT);
+
+	VkShaderModule vertShaderModule = getShaderModule("shaders/vert.spv");
+	for (uint32_t i = 0; i < PIPELINE_COUNT; ++i)
+	{
+		VkShaderModule fragShaderModule = getShaderModule(fragShaderPaths[i]);
+		VkRenderPass renderPass = (PIPELINE_VIRTUAL_FEEDBACK == i) ? m_virtualTextures.getFeedbackRenderPass() : m_vkRenderPass;
+		m_pipelineFutures[i] = m_threadPool.submit([this, vertShaderModule, fragShaderModule, renderPass]()
+		{
+			return createGraphicsPipeline(vertShaderModule, fragShaderModule, renderPass);
+		});
+	}
+}
+
+/**************************************************************
+* Description
+*		Returns the graphics pipeline, waiting for it to finish
+*		compiling if this is the first time it is needed.
+* Returns
+*		Graphics pipeline
+* Notes
+*		Must be called on the main thread. Records how long after
+*		submission the pipeline became available, and how long
+*		the frame waited for it, in the frame statistics.
+*
+**************************************************************/
+VkPipeline HelloTriangleApplication::getGraphicsPipeline(uint32_t pipelineIndex)
+{
+	if (VK_NULL_HANDLE == m_vkGraphicsPipelines[pipelineIndex])
+	{
+		CpuTimer waitTimer;
+		m_vkGraphicsPipelines[pipelineIndex] = m_pipelineFutures[pipelineIndex].get();
+		std::string cache = m_fPipelineCacheWarm ? "warm" : "cold";
+		m_frameStatistics.addSample("pipeline ready, " + cache + " cache (ms)", m_pipelineTimer.elapsedMilliseconds());
+		m_frameStatistics.addSample("pipeline wait, " + cache + " cache (ms)", waitTimer.elapsedMilliseconds());
+	}
+	return m_vkGraphicsPipelines[pipelineIndex];
+}
+
+/**************************************************************
+* Description
+*		Waits for the pipelines that are still compiling.
+* Returns
+*		void
+* Notes
+*		Needed before the pipelines are destroyed, since the jobs
+*		still use the render pass and the pipeline layout.
+*
+**************************************************************/
+void HelloTriangleApplication::waitForGraphicsPipelines()
+{
+	for (uint32_t i = 0; i < m_pipelineFutures.size(); ++i)
+	{
+		if (m_pipelineFutures[i].valid())
+		{
+			m_vkGraphicsPipelines[i] = m_pipelineFutures[i].get();
+		}
+	}
 }
 
+/**************************************************************
+* Description
+*		Destroys the graphics pipelines once they have finished
+*		compiling.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void HelloTriangleApplication::destroyGraphicsPipelines()
+{
+	waitForGraphicsPipelines();
+	for (auto pipeline : m_vkGraphicsPipelines)
+	{
+		vkDestroyPipeline(m_vkDevice, pipeline, nullptr);
+	}
+	m_vkGraphicsPipelines.clear();
+}
 
 /**************************************************************
 * Description
@@ -159,47 +472,96 @@ void HelloTriangleApplication::createGraphicsPipelines()
 * Returns
 *		void
 * Notes
+*		A swapchain that is out of date is only marked here and
+*		recreated by the main loop before the next frame, together
+*		with any resize events received in between.
+*		There is one frame in flight. The CPU only waits for the
+*		previous frame right before reusing its resources, so the
+*		scene update of this frame overlaps with it on the GPU.
 *
 **************************************************************/
 void HelloTriangleApplication::drawFrame()
 {
-	uint32_t imageIndex;
-	VkResult result = vkAcquireNextImageKHR(
-								m_vkDevice,
-								m_vkSwapchain,
-								std::numeric_limits<uint64_t>::max(),
-								m_vkImageAvailableSemaphore,
-								VK_NULL_HANDLE,
-								&imageIndex);
-
-	if (VK_ERROR_OUT_OF_DATE_KHR == result)
-	{
-		recreateSwapchain();
-		return;
-	}
-	else if (VK_SUCCESS != result && VK_SUBOPTIMAL_KHR != result)
-	{
-		throw std::runtime_error("Failed to acquire swapchain image.");
+	// The previous frame has to complete before its semaphore, command
+	// buffers, queries and uniform data are reused.
+	//
+	CpuTimer waitTimer;
+	m_graphicsTimeline.wait(m_lastFrameValue);
+	m_frameWaitMilliseconds = waitTimer.elapsedMilliseconds();
+	m_frameStatistics.addSample("frame wait (ms)", m_frameWaitMilliseconds);
+	if (m_fGpuTimingsPending)
+	{
+		collectGpuTimings();
+		m_fGpuTimingsPending = false;
+	}
+	uint64_t completedValue = m_graphicsTimeline.getCompletedValue();
+	m_deletionQueue.release(completedValue);
+	m_descriptorAllocator.beginFrame(completedValue);
+	m_textureManager.update();
+	m_virtualTextures.update();
+	m_frameStatistics.addSample("virtual pages streamed", m_virtualTextures.getLastStreamedPageCount());
+	m_frameStatistics.addSample("virtual pages resident", m_virtualTextures.getResidentPageCount());
+	m_frameStatistics.addSample("texture images", static_cast<double>(m_textureManager.getImageCount()));
+	if (m_fUniformBufferDirty)
+	{
+		memcpy(m_pUniformBufferData, &m_uniformBufferObject, sizeof(m_uniformBufferObject));
+		m_fUniformBufferDirty = false;
+	}
+
+	// Headless frames all render to the single offscreen image, which
+	// is free once the previous frame has completed.
+	//
+	uint32_t imageIndex = 0;
+	VkResult result = VK_SUCCESS;
+	if (!m_options.m_fHeadless)
+	{
+		result = vkAcquireNextImageKHR(
+					m_vkDevice,
+					m_vkSwapchain,
+					std::numeric_limits<uint64_t>::max(),
+					m_vkImageAvailableSemaphore,
+					VK_NULL_HANDLE,
+					&imageIndex);
+
+		if (VK_ERROR_OUT_OF_DATE_KHR == result)
+		{
+			m_fSwapchainDirty = true;
+			return;
+		}
+		else if (VK_SUCCESS != result && VK_SUBOPTIMAL_KHR != result)
+		{
+			throw std::runtime_error("Failed to acquire swapchain image.");
+		}
 	}
 
+	recordFrameCommandBuffer(imageIndex);
+
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
 	VkSemaphore waitSemaphores[] = { m_vkImageAvailableSemaphore };
 	VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &m_vkCommandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &m_vkFrameCommandBuffer;
 
-	VkSemaphore signalSemaphores[] = { m_vkRenderFinishedSemaphore };
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	VkSemaphore signalSemaphores[] = { m_vkRenderFinishedSemaphores[imageIndex] };
+	if (!m_options.m_fHeadless)
+	{
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = waitSemaphores;
+		submitInfo.pWaitDstStageMask = waitStages;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = signalSemaphores;
+	}
 
-	if (VK_SUCCESS != vkQueueSubmit(m_vkGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE))
+	m_lastFrameValue = m_graphicsTimeline.submit(submitInfo);
+	m_descriptorAllocator.endFrame(m_lastFrameValue);
+	m_fGpuTimingsPending = true;
+
+	if (m_options.m_fHeadless)
 	{
-		throw std::runtime_error("Failed to submit draw command buffer.");
+		++m_frameIndex;
+		return;
 	}
 
 	VkPresentInfoKHR presentInfo = {};
@@ -215,39 +577,143 @@ void HelloTriangleApplication::drawFrame()
 	result = vkQueuePresentKHR(m_vkPresentQueue, &presentInfo);
 	if (VK_ERROR_OUT_OF_DATE_KHR == result || VK_SUBOPTIMAL_KHR == result)
 	{
-		recreateSwapchain();
-		return;
+		m_fSwapchainDirty = true;
 	}
 	else if (VK_SUCCESS != result)
 	{
 		throw std::runtime_error("Failed to present swapchain image.");
 	}
-	vkQueueWaitIdle(m_vkPresentQueue);
+	++m_frameIndex;
+}
+
+/**************************************************************
+* Description
+*		Creates the query pool used to time the render pass on
+*		the GPU. Two timestamps are written each frame, one
+*		before and one after the render pass.
+* Returns
+*		void
+* Notes
+*		If the device does not support timestamps on graphics
+*		queues, or the graphics queue family writes no valid
+*		bits in them, no pool is created and GPU timings are
+*		skipped.
+*
+**************************************************************/
+void HelloTriangleApplication::createTimestampQueryPool()
+{
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &deviceProperties);
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(m_vkPhysicalDevice, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(m_vkPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+	QueueFamilyIndices indices = findQueueFamilies(m_vkPhysicalDevice);
+	m_timestampValidBits = queueFamilies[indices.graphicsFamily].timestampValidBits;
+	if (!deviceProperties.limits.timestampComputeAndGraphics || 0 == m_timestampValidBits)
+	{
+		m_timestampValidBits = 0;
+		return;
+	}
+
+	m_timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+	VkQueryPoolCreateInfo queryPoolInfo = {};
+	queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	queryPoolInfo.queryCount = 2;
+	if (VK_SUCCESS != vkCreateQueryPool(m_vkDevice, &queryPoolInfo, nullptr, &m_vkTimestampQueryPool))
+	{
+		throw std::runtime_error("Could not create timestamp query pool.");
+	}
+}
+
+/**************************************************************
+* Description
+*		Reads back the timestamps written by the last frame and
+*		adds the render pass duration to the frame statistics.
+* Returns
+*		void
+* Notes
+*		Called once the frame has finished executing, so the
+*		results are available without waiting.
+*
+**************************************************************/
+void HelloTriangleApplication::collectGpuTimings()
+{
+	if (VK_NULL_HANDLE == m_vkTimestampQueryPool)
+	{
+		return;
+	}
+
+	uint64_t timestamps[2] = {};
+	VkResult result = vkGetQueryPoolResults(
+		m_vkDevice,
+		m_vkTimestampQueryPool,
+		0,
+		2,
+		sizeof(timestamps),
+		timestamps,
+		sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT);
+
+	if (VK_SUCCESS == result)
+	{
+		uint64_t ticks = (timestamps[1] - timestamps[0]) & getTimestampMask(m_timestampValidBits);
+		double durationNs = static_cast<double>(ticks) * m_timestampPeriod;
+		m_frameStatistics.addSample("render pass gpu (ms)", durationNs / 1000000.0);
+	}
 }
 
 /**************************************************************
 * Description
-*		Creates semaphores to be used for synchronizing operations
-*		on swapchain images. There are two semaphores we will use,
-*		1. Semaphore which indicates an image has been acquired for rendering
-*		2. Semaphore which indicates an image has been rendered to
-*			and is available for presentation.
+*		Creates the semaphore which indicates an image has been
+*		acquired for rendering.
 * Returns
 *		void
 * Notes
+*		Frames and uploads are ordered by the graphics timeline,
+*		the binary semaphores are only needed by the swapchain.
 *
 **************************************************************/
 void HelloTriangleApplication::createSemaphores()
 {
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-	if (VK_SUCCESS != vkCreateSemaphore(m_vkDevice, &semaphoreInfo, nullptr, &m_vkImageAvailableSemaphore) ||
-		VK_SUCCESS != vkCreateSemaphore(m_vkDevice, &semaphoreInfo, nullptr, &m_vkRenderFinishedSemaphore))
+	if (VK_SUCCESS != vkCreateSemaphore(m_vkDevice, &semaphoreInfo, nullptr, &m_vkImageAvailableSemaphore))
 	{
 		throw std::runtime_error("Semaphores could not be created.");
 	}
 }
 
+/**************************************************************
+* Description
+*		Creates the semaphores which indicate an image has been
+*		rendered to and is available for presentation, one for
+*		each swapchain image.
+* Returns
+*		void
+* Notes
+*		Presentation cannot signal a timeline. A semaphore is
+*		only signalled again once its image has been acquired
+*		again, which means the present waiting on it is done.
+*
+**************************************************************/
+void HelloTriangleApplication::createRenderFinishedSemaphores()
+{
+	VkSemaphoreCreateInfo semaphoreInfo = {};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	m_vkRenderFinishedSemaphores.resize(m_vkSwapchainImages.size());
+	for (auto &semaphore : m_vkRenderFinishedSemaphores)
+	{
+		if (VK_SUCCESS != vkCreateSemaphore(m_vkDevice, &semaphoreInfo, nullptr, &semaphore))
+		{
+			throw std::runtime_error("Semaphores could not be created.");
+		}
+	}
+}
+
 /**************************************************************
 * Description
 *		Creates uniform buffer and memory. We use this buffer to
@@ -258,13 +724,27 @@ void HelloTriangleApplication::createSemaphores()
 * Returns
 *		void
 * Notes
+*		There is a single buffer holding the per-frame data. The
+*		per-object model matrices are pushed as push constants.
 *
 **************************************************************/
 void HelloTriangleApplication::createUniformBuffer()
 {
-	for (auto &model : m_models)
+	VkDeviceSize size = sizeof(UniformBufferObject);
+	createBuffer(m_vkDevice,
+		m_vkPhysicalDevice,
+		size,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		m_vkUniformBuffer,
+		m_vkUniformBufferMemory);
+
+	// The memory is host coherent, so we keep it mapped instead of
+	// mapping and unmapping it every frame.
+	//
+	if (VK_SUCCESS != vkMapMemory(m_vkDevice, m_vkUniformBufferMemory, 0, size, 0, &m_pUniformBufferData))
 	{
-		model.createUniformBuffer(m_vkDevice, m_vkPhysicalDevice);
+		throw std::runtime_error("Could not map uniform buffer memory.");
 	}
 }
 
@@ -272,13 +752,13 @@ void HelloTriangleApplication::createUniformBuffer()
 * Description
 *		Creates descriptor set layout so that we can pass
 *		uniform objects to shaders. Used for supplying
-*		transformation matrices to vertex shader and texture
-*		image to fragment shader.
+*		the view and projection matrices to vertex shader.
 *		DescriptorSetLayout specifies the type of resources to
 *		bind to graphics pipeline.
 * Returns
 *		void
 * Notes
+*		The textures are in the set of the material table.
 *
 **************************************************************/
 void HelloTriangleApplication::createDescriptorSetLayout()
@@ -290,14 +770,7 @@ void HelloTriangleApplication::createDescriptorSetLayout()
 	uboBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	uboBinding.pImmutableSamplers = nullptr;
 
-	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
-	samplerLayoutBinding.binding = 1;
-	samplerLayoutBinding.descriptorCount = 1;
-	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	samplerLayoutBinding.pImmutableSamplers = nullptr;
-	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboBinding, samplerLayoutBinding };
+	std::array<VkDescriptorSetLayoutBinding, 1> bindings = { uboBinding };
 
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -320,9 +793,12 @@ void HelloTriangleApplication::createDescriptorSetLayout()
 **************************************************************/
 void HelloTriangleApplication::loadModels()
 {
-	for (auto &model : m_models)
+	for (uint32_t i = 0; i < m_models.size(); ++i)
 	{
+		Model &model = m_models[i];
 		model.loadModel();
+		m_scene.setLocalBounds(model.getSceneNode(), model.getBoundsMin(), model.getBoundsMax());
+		m_drawList.push_back(i);
 	}
 }
 
@@ -342,7 +818,8 @@ void HelloTriangleApplication::createVertexBuffers()
 			m_vkDevice,
 			m_vkPhysicalDevice,
 			m_vkCommandPool,
-			m_vkGraphicsQueue
+			m_graphicsTimeline,
+			m_deletionQueue
 		);
 	}
 }
@@ -364,7 +841,8 @@ void HelloTriangleApplication::createIndexBuffers()
 			m_vkDevice,
 			m_vkPhysicalDevice,
 			m_vkCommandPool,
-			m_vkGraphicsQueue
+			m_graphicsTimeline,
+			m_deletionQueue
 		);
 	}
 }
@@ -372,194 +850,269 @@ void HelloTriangleApplication::createIndexBuffers()
 
 /**************************************************************
 * Description
-*		Updates the uniform buffer to be fed to shader.
+*		Updates the camera and the models for the frame. The
+*		uniform buffer to be fed to shader is only written when
+*		the view or projection has changed, by drawFrame once the
+*		previous frame is done reading it.
 * Returns
 *		void
 * Notes
 *
 **************************************************************/
-void HelloTriangleApplication::updateUniformBuffer()
+void HelloTriangleApplication::updateScene(float deltaTime)
 {
-	for (int i = 0; i < m_models.size(); ++i)
+#ifdef RENDERER_GLFW
+	if (m_camera.fMouseButtonPressed())
 	{
-		UniformBufferObject ubo = {};
-
-		// TODO : create model matrix for each model.
-		ubo.m_model = m_models[i].getModelMatrix();
+		double xPos, yPos;
+		glfwGetCursorPos(m_glfwWindow, &xPos, &yPos);
+		m_camera.setCurrentMousePosition(xPos, yPos);
+	}
+#endif
 
+	bool fViewProjChanged = m_camera.fViewDirty() || m_fProjectionDirty;
+	if (fViewProjChanged)
+	{
+		UniformBufferObject ubo = {};
 		ubo.m_view = m_camera.getViewMatrix();
-		if (m_camera.fMouseButtonPressed())
-		{
-			double xPos, yPos;
-			glfwGetCursorPos(m_glfwWindow, &xPos, &yPos);
-			m_camera.setCurrentMousePosition(xPos, yPos);
-		}
 		// ubo.m_view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-		ubo.m_proj = glm::perspective(glm::radians(45.0f), m_vkSwapchainExtent.width / (float)m_vkSwapchainExtent.height, 0.1f, 10.0f);
+		ubo.m_proj = glm::perspective(glm::radians(45.0f), m_vkSwapchainExtent.width / (float)m_vkSwapchainExtent.height, Z_NEAR, Z_FAR);
 		ubo.m_proj[1][1] *= -1;
-		void *data = nullptr;
-		vkMapMemory(m_vkDevice, m_models[i].getUniformBufferMemory(), 0, sizeof(ubo), 0, &data);
-		memcpy(data, &ubo, sizeof(ubo));
-		vkUnmapMemory(m_vkDevice, m_models[i].getUniformBufferMemory());
+		ubo.m_viewProj = ubo.m_proj * ubo.m_view;
+		m_uniformBufferObject = ubo;
+		m_fUniformBufferDirty = true;
+		m_viewProj = ubo.m_viewProj;
+		m_fProjectionDirty = false;
 	}
+
+	updateDrawTransforms(fViewProjChanged, deltaTime);
+	updateVisibleDrawList();
 }
 
 /**************************************************************
 * Description
-*		Create descriptor pool for descriptor sets. We have
-*		two types of descriptors, unform buffer and image sampler.
+*		Advances the models by the frame time, updates the scene
+*		and computes the model-view-projection and normal
+*		matrices of the models that changed in one batch. These
+*		are pushed to the vertex shader while recording the draws.
 * Returns
 *		void
 * Notes
+*		If the view or projection changed, every model needs
+*		new transforms.
 *
 **************************************************************/
-void HelloTriangleApplication::createDescriptorPool()
+void HelloTriangleApplication::updateDrawTransforms(bool fViewProjChanged, float deltaTime)
 {
-	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-	poolSizes[0].descriptorCount = 2;
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[1].descriptorCount = 1;
-	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	
-	VkDescriptorPoolCreateInfo poolInfo = {};
-	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = 2;
-	if (VK_SUCCESS != vkCreateDescriptorPool(m_vkDevice, &poolInfo, nullptr, &m_vkDescriptorPool))
+	CpuTimer transformTimer;
+	if (m_drawTransforms.size() != m_models.size())
+	{
+		m_drawTransforms.resize(m_models.size());
+		m_drawTransformFrames.resize(m_models.size());
+		fViewProjChanged = true;
+	}
+
+	for (auto &model : m_models)
+	{
+		model.update(m_scene, deltaTime);
+	}
+	m_scene.update(&m_threadPool);
+
+	m_changedModelIndices.clear();
+	m_changedModelMatrices.clear();
+	for (size_t i = 0; i < m_models.size(); ++i)
+	{
+		uint32_t sceneNode = m_models[i].getSceneNode();
+		if (fViewProjChanged || m_scene.fWorldMatrixChanged(sceneNode))
+		{
+			m_changedModelIndices.push_back(i);
+			m_changedModelMatrices.push_back(m_scene.getWorldMatrix(sceneNode));
+		}
+	}
+
+	m_frameStatistics.addSample("changed objects", static_cast<double>(m_changedModelIndices.size()));
+	if (m_changedModelIndices.empty())
 	{
-		throw std::runtime_error("Could not create descriptor pool");
+		return;
+	}
+
+	m_changedDrawTransforms.resize(m_changedModelMatrices.size());
+	computeDrawTransforms(
+		m_viewProj,
+		m_changedModelMatrices.data(),
+		m_changedModelMatrices.size(),
+		m_changedDrawTransforms.data());
+
+	for (size_t i = 0; i < m_changedModelIndices.size(); ++i)
+	{
+		m_drawTransforms[m_changedModelIndices[i]] = m_changedDrawTransforms[i];
+		m_drawTransformFrames[m_changedModelIndices[i]] = m_frameIndex;
 	}
+
+	m_frameStatistics.addSample("transforms cpu (us)", transformTimer.elapsedMicroseconds());
 }
 
 /**************************************************************
 * Description
-*		Creates descriptor set and updates the descritors to point
-*		to uniform buffer and image sampler.
+*		Builds the list of draws whose world space bounds
+*		intersect the view frustum, sorted by their state so
+*		consecutive draws share as much of it as possible.
 * Returns
 *		void
 * Notes
+*		All the pipelines are opaque, so the draws within a
+*		pipeline go front to back. The depth of a draw is the
+*		view space depth of the center of its bounds.
+*		The descriptor sets are shared by every draw, so their
+*		field of the key groups the draws by material instead.
 *
 **************************************************************/
-void HelloTriangleApplication::createDescriptorSet()
+void HelloTriangleApplication::updateVisibleDrawList()
 {
-	VkDescriptorSetAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = m_vkDescriptorPool;
-	allocInfo.descriptorSetCount = m_models.size();
-	VkDescriptorSetLayout layout[2] = { m_vkDescriptorSetLayout , m_vkDescriptorSetLayout };
-	allocInfo.pSetLayouts = layout;
-	VkResult vkResult = vkAllocateDescriptorSets(m_vkDevice, &allocInfo, m_vkDescriptorSets.data());
-	if (VK_SUCCESS != vkResult)
+	glm::vec4 frustumPlanes[6];
+	extractFrustumPlanes(m_viewProj, frustumPlanes);
+
+	m_drawItems.clear();
+	for (uint32_t modelIndex : m_drawList)
 	{
-		throw std::runtime_error("Could not create descriptor set");
-	}
-
-	for (int i = 0; i < m_vkDescriptorSets.size(); ++i)
-	{
-		VkDescriptorBufferInfo bufferInfo = {};
-		bufferInfo.buffer = m_models[i].getUniformBuffer();
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(UniformBufferObject);
-
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = m_vkTextureImageView;
-		imageInfo.sampler = m_vkTextureSampler;
-
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
-		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[0].dstSet = m_vkDescriptorSets[i];
-		descriptorWrites[0].dstBinding = 0;
-		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorCount = 1;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[0].pBufferInfo = &bufferInfo;
-		descriptorWrites[0].pImageInfo = nullptr;
-		descriptorWrites[0].pTexelBufferView = nullptr;
-
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = m_vkDescriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pImageInfo = &imageInfo;
-
-		vkUpdateDescriptorSets(
-			m_vkDevice,
-			static_cast<uint32_t>(descriptorWrites.size()),
-			descriptorWrites.data(),
-			0,
-			nullptr);
+		const Model &model = m_models[modelIndex];
+		uint32_t sceneNode = model.getSceneNode();
+		const glm::vec3 &boundsMin = m_scene.getWorldBoundsMin(sceneNode);
+		const glm::vec3 &boundsMax = m_scene.getWorldBoundsMax(sceneNode);
+		if (!isBoxInFrustum(frustumPlanes, boundsMin, boundsMax))
+		{
+			continue;
+		}
+
+		// The segments are recorded on worker threads, so the pipeline
+		// has to be ready before then.
+		//
+		getGraphicsPipeline(model.getPipelineIndex());
+
+		glm::vec4 clipCenter = m_viewProj * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f);
+		DrawItem item;
+		item.m_sortKey = makeDrawSortKey(model.getPipelineIndex(), model.getMaterialIndex(), modelIndex, clipCenter.w / Z_FAR, true);
+		item.m_drawIndex = modelIndex;
+		m_drawItems.push_back(item);
 	}
+
+	sortDrawItems(m_drawItems, m_drawItemScratch);
+	m_visibleDrawList.resize(m_drawItems.size());
+	for (size_t i = 0; i < m_drawItems.size(); ++i)
+	{
+		m_visibleDrawList[i] = m_drawItems[i].m_drawIndex;
+	}
+	m_frameStatistics.addSample("visible draws", static_cast<double>(m_visibleDrawList.size()));
 }
 
 /**************************************************************
 * Description
-*		Creates a texture image.
+*		Creates the update template of the frame set and gets
+*		the set pointing to the uniform buffer from the
+*		descriptor allocator.
 * Returns
 *		void
 * Notes
+*		All the models share a single descriptor set.
+*		The descriptors are cleared first because the allocator
+*		finds cached sets by comparing their bytes.
 *
 **************************************************************/
-void HelloTriangleApplication::createTextureImage()
+void HelloTriangleApplication::createDescriptorSet()
 {
-	int texWidth, texHeight, texChannels;
-	stbi_uc *pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	if (!pixels)
-	{
-		throw std::runtime_error("Could not load texture image.");
-	}
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(m_vkDevice,
-		m_vkPhysicalDevice,
-		imageSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
-
-	void *data = nullptr;
-	vkMapMemory(m_vkDevice, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(m_vkDevice, stagingBufferMemory);
-	stbi_image_free(pixels);
-	createImage(static_cast<uint32_t>(texWidth),
-		static_cast<uint32_t>(texHeight),
-		m_mipLevels,
-		VK_FORMAT_R8G8B8A8_UNORM,
-		VK_IMAGE_TILING_OPTIMAL,
-		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		m_vkTextureImage,
-		m_vkTextureMemory);
-
-	transitionImageLayout(
-		m_vkTextureImage,
-		VK_FORMAT_R8G8B8A8_SNORM,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		m_mipLevels);
-
-	copyBufferToImage(
-		stagingBuffer,
-		m_vkTextureImage,
-		static_cast<uint32_t>(texWidth),
-		static_cast<uint32_t>(texHeight));
-
-	generateMipmaps(m_vkTextureImage, texWidth, texHeight, m_mipLevels);
-
-	vkDestroyBuffer(m_vkDevice, stagingBuffer, nullptr);
-	vkFreeMemory(m_vkDevice, stagingBufferMemory, nullptr);
+	std::vector<VkDescriptorUpdateTemplateEntry> entries(1);
+	entries[0].dstBinding = 0;
+	entries[0].dstArrayElement = 0;
+	entries[0].descriptorCount = 1;
+	entries[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	entries[0].offset = offsetof(FrameDescriptors, m_uniformBuffer);
+	entries[0].stride = sizeof(VkDescriptorBufferInfo);
+	m_vkFrameDescriptorTemplate = m_descriptorAllocator.createUpdateTemplate(m_vkDescriptorSetLayout, entries);
+
+	FrameDescriptors descriptors;
+	memset(&descriptors, 0, sizeof(descriptors));
+	descriptors.m_uniformBuffer.buffer = m_vkUniformBuffer;
+	descriptors.m_uniformBuffer.offset = 0;
+	descriptors.m_uniformBuffer.range = sizeof(UniformBufferObject);
+
+	m_vkDescriptorSet = m_descriptorAllocator.getCachedSet(
+		m_vkDescriptorSetLayout,
+		m_vkFrameDescriptorTemplate,
+		&descriptors,
+		sizeof(descriptors));
 }
 
 /**************************************************************
 * Description
-*		Creates an image, allocates memory for it and binds it.
+*		Gives every model a material from its obj file and
+*		requests the textures of the materials.
+* Returns
+*		void
+* Notes
+*		The color shaded models take their color from the
+*		vertices and do not sample a texture. Texture shaded
+*		models without a texture of their own use TEXTURE_PATH.
+*		A model with a virtual texture samples it instead, or
+*		loads it as an ordinary texture if it cannot be added.
+*		Textures no larger than ATLAS_MAX_TEXTURE_SIZE are
+*		decoded here and packed into atlas pages, the material
+*		giving the rectangle of its texture. The other textures
+*		are decoded in the background, so the models show the
+*		fallback texture for the first frames.
+*
+**************************************************************/
+void HelloTriangleApplication::createMaterials()
+{
+	// Textures small enough share atlas pages, the others are loaded
+	// on their own.
+	//
+	std::vector<std::string> texturePaths;
+	for (const auto &model : m_models)
+	{
+		if (PIPELINE_TEXTURE_SHADING == model.getPipelineIndex() && model.getVirtualTexturePath().empty())
+		{
+			texturePaths.push_back(model.getDiffuseTexturePath().empty() ? TEXTURE_PATH : model.getDiffuseTexturePath());
+		}
+	}
+	m_textureAtlas.build(texturePaths, m_textureManager, &m_threadPool);
+
+	for (auto &model : m_models)
+	{
+		Material material = {};
+		material.m_baseColor = glm::vec4(model.getDiffuseColor(), 1.0f);
+		material.m_uvRect = FULL_UV_RECT;
+		material.m_textureIndex = NO_TEXTURE;
+		material.m_virtualTextureIndex = NO_VIRTUAL_TEXTURE;
+		if (PIPELINE_TEXTURE_SHADING == model.getPipelineIndex())
+		{
+			std::string texturePath = model.getDiffuseTexturePath().empty() ? TEXTURE_PATH : model.getDiffuseTexturePath();
+			if (!model.getVirtualTexturePath().empty())
+			{
+				material.m_virtualTextureIndex = m_virtualTextures.addTexture(model.getVirtualTexturePath());
+				texturePath = model.getVirtualTexturePath();
+			}
+			if (NO_VIRTUAL_TEXTURE == material.m_virtualTextureIndex)
+			{
+				AtlasEntry atlasEntry;
+				if (m_textureAtlas.getEntry(texturePath, atlasEntry))
+				{
+					material.m_textureIndex = m_textureManager.getTextureIndex(atlasEntry.m_page);
+					material.m_uvRect = atlasEntry.m_uvRect;
+				}
+				else
+				{
+					TextureHandle texture = m_textureManager.load(texturePath);
+					material.m_textureIndex = m_textureManager.getTextureIndex(texture);
+				}
+			}
+		}
+		model.setMaterialIndex(m_materialTable.addMaterial(material));
+	}
+}
+
+/**************************************************************
+* Description
+*		Creates an image, allocates memory for it and binds it.
 * Returns
 *		void
 * Notes
@@ -693,34 +1246,7 @@ void HelloTriangleApplication::transitionImageLayout(
 		1,
 		&memoryBarrier);
 
-	endSingleTimeCommands(m_vkDevice, m_vkCommandPool, m_vkGraphicsQueue, commandBuffer);
-}
-
-/**************************************************************
-* Description
-*		Helper functoin to copy buffer data to an image.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void HelloTriangleApplication::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
-{
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands(m_vkDevice, m_vkCommandPool);
-
-	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
-	region.bufferImageHeight = 0;
-	region.bufferRowLength = 0;
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-
-	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = { width, height, 1 };
-	vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-	endSingleTimeCommands(m_vkDevice, m_vkCommandPool, m_vkGraphicsQueue, commandBuffer);
+	endSingleTimeCommands(m_vkCommandPool, m_graphicsTimeline, commandBuffer, m_deletionQueue);
 }
 
 /**************************************************************
@@ -768,7 +1294,7 @@ void HelloTriangleApplication::createInstance()
 	vkAppInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	vkAppInfo.pEngineName = "No Engine";
 	vkAppInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	vkAppInfo.apiVersion = VK_API_VERSION_1_0;
+	vkAppInfo.apiVersion = VK_API_VERSION_1_2;
 
 	VkInstanceCreateInfo vkCreateInfo = {};
 	vkCreateInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -864,20 +1390,27 @@ bool HelloTriangleApplication::checkValidationLayersSupport()
 * Returns
 *		The list of extensions.
 * Notes
+*		Headless runs have no surface and need no GLFW
+*		extensions.
 *
 **************************************************************/
 std::vector<const char*> HelloTriangleApplication::getRequiredExtensions()
 {
 	std::vector<const char*> extensions;
-	const char** glfwExtensions = nullptr;
-	unsigned int glfwExtensionCount = 0;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	assert(glfwExtensionCount);
-
-	for (unsigned int iExtension = 0; iExtension < glfwExtensionCount; ++iExtension)
+#ifdef RENDERER_GLFW
+	if (!m_options.m_fHeadless)
 	{
-		extensions.push_back(glfwExtensions[iExtension]);
+		const char** glfwExtensions = nullptr;
+		unsigned int glfwExtensionCount = 0;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		assert(glfwExtensionCount);
+
+		for (unsigned int iExtension = 0; iExtension < glfwExtensionCount; ++iExtension)
+		{
+			extensions.push_back(glfwExtensions[iExtension]);
+		}
 	}
+#endif
 
 	if (g_enableValidationLayers)
 	{
@@ -898,27 +1431,56 @@ std::vector<const char*> HelloTriangleApplication::getRequiredExtensions()
 void HelloTriangleApplication::cleanup()
 {
 	cleanupSwapchain();
-	vkDestroyDescriptorPool(m_vkDevice, m_vkDescriptorPool, nullptr);
+	m_deletionQueue.flush();
+	destroyGraphicsPipelines();
+	vkDestroyRenderPass(m_vkDevice, m_vkRenderPass, nullptr);
+	vkDestroyPipelineLayout(m_vkDevice, m_vkPipelineLayout, nullptr);
+	for (auto &shaderModule : m_vkShaderModules)
+	{
+		vkDestroyShaderModule(m_vkDevice, shaderModule.second, nullptr);
+	}
+	m_descriptorAllocator.destroy();
+	m_textureManager.destroy();
+	m_virtualTextures.destroy();
+	m_materialTable.destroy();
 	vkDestroyDescriptorSetLayout(m_vkDevice, m_vkDescriptorSetLayout, nullptr);
-	vkDestroySampler(m_vkDevice, m_vkTextureSampler, nullptr);
-	vkDestroyImageView(m_vkDevice, m_vkTextureImageView, nullptr);
-	vkDestroyImage(m_vkDevice, m_vkTextureImage, nullptr);
-	vkFreeMemory(m_vkDevice, m_vkTextureMemory, nullptr);
+	vkUnmapMemory(m_vkDevice, m_vkUniformBufferMemory);
+	if (VK_NULL_HANDLE != m_vkTimestampQueryPool)
+	{
+		vkDestroyQueryPool(m_vkDevice, m_vkTimestampQueryPool, nullptr);
+	}
+	vkDestroyBuffer(m_vkDevice, m_vkUniformBuffer, nullptr);
+	vkFreeMemory(m_vkDevice, m_vkUniformBufferMemory, nullptr);
 
 	for (auto model : m_models)
 	{
 		model.cleanup(m_vkDevice);
 	}
 	vkDestroySemaphore(m_vkDevice, m_vkImageAvailableSemaphore, nullptr);
-	vkDestroySemaphore(m_vkDevice, m_vkRenderFinishedSemaphore, nullptr);
 	vkDestroyCommandPool(m_vkDevice, m_vkCommandPool, nullptr);
+	vkDestroyCommandPool(m_vkDevice, m_vkFrameCommandPool, nullptr);
+	for (auto &slot : m_recordingSlots)
+	{
+		vkDestroyCommandPool(m_vkDevice, slot.m_vkCommandPool, nullptr);
+	}
 
+	m_pipelineCache.save();
+	m_pipelineCache.destroy();
+	m_graphicsTimeline.destroy();
 	vkDestroyDevice(m_vkDevice, nullptr);
-	vkDestroySurfaceKHR(m_vkInstance, m_vkSurface, nullptr);
+	if (!m_options.m_fHeadless)
+	{
+		vkDestroySurfaceKHR(m_vkInstance, m_vkSurface, nullptr);
+	}
 	DestroyDebugReportCallbackEXT(m_vkInstance, m_vkCallback, nullptr /*pAllocator*/);
 	vkDestroyInstance(m_vkInstance, nullptr);
-	glfwDestroyWindow(m_glfwWindow);
-	glfwTerminate();
+#ifdef RENDERER_GLFW
+	if (!m_options.m_fHeadless)
+	{
+		glfwDestroyWindow(m_glfwWindow);
+		glfwTerminate();
+	}
+#endif
 }
 
 /**************************************************************
@@ -927,6 +1489,8 @@ void HelloTriangleApplication::cleanup()
 * Returns
 *		void
 * Notes
+*		In headless mode the offscreen color image stands in
+*		for the swapchain.
 *
 **************************************************************/
 void HelloTriangleApplication::cleanupSwapchain()
@@ -940,21 +1504,31 @@ void HelloTriangleApplication::cleanupSwapchain()
 		vkDestroyFramebuffer(m_vkDevice, framebuffer, nullptr);
 	}
 
-	vkFreeCommandBuffers(m_vkDevice, m_vkCommandPool, m_vkCommandBuffers.size(), m_vkCommandBuffers.data());
-	vkDestroyPipeline(m_vkDevice, m_vkGraphicsPipelineWithColorShading, nullptr);
-	vkDestroyPipeline(m_vkDevice, m_vkGraphicsPipelineWithTextureShading, nullptr);
-
-	vkDestroyPipelineLayout(m_vkDevice, m_vkPipelineLayout, nullptr);
-	vkDestroyRenderPass(m_vkDevice, m_vkRenderPass, nullptr);
-
 	for (auto imageView : m_vkSwapchainImageViews)
 	{
 		vkDestroyImageView(m_vkDevice, imageView, nullptr);
 	}
 
-	vkDestroySwapchainKHR(m_vkDevice, m_vkSwapchain, nullptr /*pAllocator*/);
+	for (auto semaphore : m_vkRenderFinishedSemaphores)
+	{
+		vkDestroySemaphore(m_vkDevice, semaphore, nullptr);
+	}
+
+	if (m_options.m_fHeadless)
+	{
+		for (auto image : m_vkSwapchainImages)
+		{
+			vkDestroyImage(m_vkDevice, image, nullptr);
+		}
+		vkFreeMemory(m_vkDevice, m_vkOffscreenImageMemory, nullptr);
+	}
+	else
+	{
+		vkDestroySwapchainKHR(m_vkDevice, m_vkSwapchain, nullptr /*pAllocator*/);
+	}
 }
 
+#ifdef RENDERER_GLFW
 /**************************************************************
 * Description
 *		Initializes the GLFW window for Vulkan.
@@ -1001,12 +1575,15 @@ void HelloTriangleApplication::initWindow()
 * Returns
 *		void
 * Notes
+*		A drag resize sends many events per frame, so the
+*		swapchain is only marked here and recreated once by the
+*		next frame.
 *
 **************************************************************/
 void HelloTriangleApplication::onWindowResize(GLFWwindow * window, int width, int height)
 {
 	HelloTriangleApplication *thisApp = reinterpret_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window));
-	thisApp->recreateSwapchain();
+	thisApp->m_fSwapchainDirty = true;
 }
 
 /**************************************************************
@@ -1088,6 +1665,24 @@ void HelloTriangleApplication::onKeyPress(
 			app->m_models[0].setZKeyPressed(false);
 		}
 		break;
+	case GLFW_KEY_B:
+		if (GLFW_PRESS == action)
+		{
+			app->benchmarkCommandRecording();
+		}
+		break;
+	case GLFW_KEY_T:
+		if (GLFW_PRESS == action)
+		{
+			app->benchmarkTextureLoading();
+		}
+		break;
+	case GLFW_KEY_G:
+		if (GLFW_PRESS == action)
+		{
+			app->benchmarkMipGeneration();
+		}
+		break;
 	}
 }
 
@@ -1134,6 +1729,7 @@ void HelloTriangleApplication::onCursorMove(GLFWwindow * window, double xpos, do
 		app->m_camera.setCurrentMousePosition(xpos, ypos);
 	}
 }
+#endif
 
 /**************************************************************
 * Description
@@ -1141,6 +1737,8 @@ void HelloTriangleApplication::onCursorMove(GLFWwindow * window, double xpos, do
 * Returns
 *		void
 * Notes
+*		Called from any thread creating or using Vulkan objects,
+*		the thread pool included.
 *
 **************************************************************/
 VKAPI_ATTR VkBool32 VKAPI_CALL HelloTriangleApplication::debugCallback(
@@ -1154,26 +1752,13 @@ VKAPI_ATTR VkBool32 VKAPI_CALL HelloTriangleApplication::debugCallback(
 	void *userData)
 {
 	std::cerr << "validation layer: " << msg << std::endl;
+	if (0 != (flags & VK_DEBUG_REPORT_ERROR_BIT_EXT))
+	{
+		++reinterpret_cast<HelloTriangleApplication*>(userData)->m_validationErrorCount;
+	}
 	return VK_FALSE;
 }
 
-/**************************************************************
-* Description
-*		Creates the texture image view for the texture image.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void HelloTriangleApplication::createTextureImageView()
-{
-	m_vkTextureImageView = createImageView(
-							m_vkTextureImage,
-							VK_FORMAT_R8G8B8A8_UNORM,
-							VK_IMAGE_ASPECT_COLOR_BIT,
-							m_mipLevels);
-}
-
 /**************************************************************
 * Description
 *		Helper function to create image view based on image, format,
@@ -1208,40 +1793,6 @@ VkImageView HelloTriangleApplication::createImageView(
 	return imageView;
 }
 
-/**************************************************************
-* Description
-*		Creates texture sampler for texture access in shader.
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void HelloTriangleApplication::createTextureSampler()
-{
-	VkSamplerCreateInfo samplerInfo = {};
-	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-	samplerInfo.magFilter = VK_FILTER_LINEAR;
-	samplerInfo.minFilter = VK_FILTER_LINEAR;
-	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-	samplerInfo.anisotropyEnable = VK_TRUE;
-	samplerInfo.maxAnisotropy = 16;
-	samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
-	samplerInfo.unnormalizedCoordinates = VK_FALSE;
-	samplerInfo.compareEnable = VK_FALSE;
-	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
-	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-	samplerInfo.mipLodBias = 0.0f;
-	samplerInfo.minLod = 0.0f;
-	samplerInfo.maxLod = static_cast<float>(m_mipLevels);
-	if (VK_SUCCESS != vkCreateSampler(m_vkDevice, &samplerInfo, nullptr, &m_vkTextureSampler))
-	{
-		throw std::runtime_error("Could not create texture sampler.");
-	}
-
-}
-
 /**************************************************************
 * Description
 *		Creates the relevant resource for depth buffering.
@@ -1249,6 +1800,9 @@ void HelloTriangleApplication::createTextureSampler()
 * Returns
 *		void
 * Notes
+*		The image is not transitioned here. The render pass clears
+*		it from an undefined layout, and a transition would wait
+*		for the graphics queue on every resize.
 *
 **************************************************************/
 void HelloTriangleApplication::createDepthResources()
@@ -1265,15 +1819,6 @@ void HelloTriangleApplication::createDepthResources()
 		m_vkDepthImage,
 		m_vkDepthImageMemory);
 	m_vkDepthImageView = createImageView(m_vkDepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, 1 /*mipLevels*/);
-
-	// Transition the depth image to right layout.
-	//
-	transitionImageLayout(
-		m_vkDepthImage,
-		depthFormat,
-		VK_IMAGE_LAYOUT_UNDEFINED,
-		VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
-		1 /*mipLevels*/);
 }
 
 /**************************************************************
@@ -1335,119 +1880,6 @@ bool HelloTriangleApplication::hasStencilComponent(VkFormat format)
 	return VK_FORMAT_D32_SFLOAT_S8_UINT == format || VK_FORMAT_D24_UNORM_S8_UINT == format;
 }
 
-/**************************************************************
-* Description
-*		Generates mipmaps
-* Returns
-*		void
-* Notes
-*
-**************************************************************/
-void HelloTriangleApplication::generateMipmaps(
-	VkImage image,
-	int32_t texWidth,
-	int32_t texHeight,
-	uint32_t mipLevels)
-{
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands(m_vkDevice, m_vkCommandPool);
-	VkImageMemoryBarrier barrier = {};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.image = image;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.subresourceRange.levelCount = 1;
-	int32_t mipWidth = texWidth;
-	int32_t mipHeight = texHeight;
-	for (uint32_t i = 1; i < m_mipLevels; ++i)
-	{
-		barrier.subresourceRange.baseMipLevel = i - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		vkCmdPipelineBarrier(
-			commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			0,
-			0,
-			nullptr,
-			0,
-			nullptr,
-			1,
-			&barrier);
-		VkImageBlit blit = {};
-		blit.srcOffsets[0] = { 0,0,0 };
-		blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };
-		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.srcSubresource.mipLevel = i - 1;
-		blit.srcSubresource.baseArrayLayer = 0;
-		blit.srcSubresource.layerCount = 1;
-		blit.dstOffsets[0] = { 0,0,0 };
-		blit.dstOffsets[1] = { mipWidth / 2, mipHeight / 2, 1 };
-		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.dstSubresource.mipLevel = i;
-		blit.dstSubresource.baseArrayLayer = 0;
-		blit.dstSubresource.layerCount = 1;
-		vkCmdBlitImage(
-			commandBuffer,
-			image,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-			image,
-			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-			1,
-			&blit,
-			VK_FILTER_LINEAR);
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-		vkCmdPipelineBarrier(
-			commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-			0,
-			0,
-			nullptr,
-			0,
-			nullptr,
-			1,
-			&barrier);
-
-		if (mipWidth > 1)
-		{
-			mipWidth /= 2;
-		}
-		if (mipHeight > 1)
-		{
-			mipHeight /= 2;
-		}
-	}
-
-	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-	vkCmdPipelineBarrier(
-		commandBuffer,
-		VK_PIPELINE_STAGE_TRANSFER_BIT,
-		VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-		0,
-		0,
-		nullptr,
-		0,
-		nullptr,
-		1,
-		&barrier);
-
-	endSingleTimeCommands(m_vkDevice, m_vkCommandPool, m_vkGraphicsQueue, commandBuffer);
-}
-
 /**************************************************************
 * Description
 *		Sets up the debug callbacks for validation layers.
@@ -1469,6 +1901,7 @@ void HelloTriangleApplication::setupDebugCallback()
 	createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_REPORT_CALLBACK_CREATE_INFO_EXT;
 	createInfo.flags = VK_DEBUG_REPORT_ERROR_BIT_EXT | VK_DEBUG_REPORT_WARNING_BIT_EXT;
 	createInfo.pfnCallback = debugCallback;
+	createInfo.pUserData = this;
 	if (VK_SUCCESS != CreateDebugReportCallbackEXT(m_vkInstance, &createInfo, nullptr /* pAllocator */, &m_vkCallback))
 	{
 		throw std::runtime_error("failed to setup debug callback!");
@@ -1486,10 +1919,14 @@ void HelloTriangleApplication::setupDebugCallback()
 **************************************************************/
 void HelloTriangleApplication::createSurface()
 {
+#ifdef RENDERER_GLFW
 	if (VK_SUCCESS != glfwCreateWindowSurface(m_vkInstance, m_glfwWindow, nullptr /* allocation callback */, &m_vkSurface))
 	{
 		throw std::runtime_error("Could not create a window surface.");
 	}
+#else
+	throw std::runtime_error("Built without RENDERER_GLFW, only headless runs are supported.");
+#endif
 }
 
 /**************************************************************
@@ -1539,6 +1976,9 @@ void HelloTriangleApplication::pickPhysicalDevice()
 * Returns
 *		true/false
 * Notes
+*		Vulkan 1.2 with timeline semaphores and the descriptor
+*		indexing features of the material table is required.
+*		Headless runs need no swapchain support.
 *
 **************************************************************/
 bool HelloTriangleApplication::ifDeviceSuitable(VkPhysicalDevice device)
@@ -1547,13 +1987,24 @@ bool HelloTriangleApplication::ifDeviceSuitable(VkPhysicalDevice device)
 	VkPhysicalDeviceFeatures deviceFeatures;
 	vkGetPhysicalDeviceProperties(device, &deviceProperties);
 	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+	if (deviceProperties.apiVersion < VK_API_VERSION_1_2)
+	{
+		return false;
+	}
+
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	VkPhysicalDeviceFeatures2 deviceFeatures2 = {};
+	deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	deviceFeatures2.pNext = &timelineFeatures;
+	vkGetPhysicalDeviceFeatures2(device, &deviceFeatures2);
 
 	QueueFamilyIndices indices = findQueueFamilies(device);
 
 	bool fExtensionsSupported = checkDeviceExtensionsSupport(device);
-	bool fSwapChainSupportEnough = false;
+	bool fSwapChainSupportEnough = m_options.m_fHeadless;
 
-	if (fExtensionsSupported)
+	if (fExtensionsSupported && !m_options.m_fHeadless)
 	{
 		SwapChainSupportDetails swapChainSupportDetails = querySwapChainSupportDetails(device);
 		fSwapChainSupportEnough = !swapChainSupportDetails.m_surfaceFormats.empty()
@@ -1563,7 +2014,28 @@ bool HelloTriangleApplication::ifDeviceSuitable(VkPhysicalDevice device)
 	return indices.isComplete() &&
 		fExtensionsSupported &&
 		fSwapChainSupportEnough &&
-		deviceFeatures.samplerAnisotropy;
+		deviceFeatures.samplerAnisotropy &&
+		timelineFeatures.timelineSemaphore &&
+		MaterialTable::fDeviceSupported(device);
+}
+
+/**************************************************************
+* Description
+*		Gets the list of device extensions the application
+*		enables.
+* Returns
+*		The list of extensions.
+* Notes
+*		Headless runs render offscreen and need no swapchain.
+*
+**************************************************************/
+std::vector<const char*> HelloTriangleApplication::getDeviceExtensions() const
+{
+	if (m_options.m_fHeadless)
+	{
+		return {};
+	}
+	return { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 }
 
 /**************************************************************
@@ -1588,6 +2060,7 @@ bool HelloTriangleApplication::checkDeviceExtensionsSupport(VkPhysicalDevice dev
 	// Check if the required extensions are present in available extensions.
 	// Make a copy of the required extensions for in-place updates.
 	//
+	std::vector<const char*> deviceExtensions = getDeviceExtensions();
 	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
 	for (auto &availableExtension : availableExtensions)
@@ -1605,6 +2078,8 @@ bool HelloTriangleApplication::checkDeviceExtensionsSupport(VkPhysicalDevice dev
 *		indices of queueFamilies
 * Notes
 *		queues supporting graphics and presentation are required.
+*		Nothing is presented in headless mode, the graphics
+*		queue stands in for the present queue.
 *
 **************************************************************/
 QueueFamilyIndices HelloTriangleApplication::findQueueFamilies(VkPhysicalDevice device)
@@ -1630,7 +2105,14 @@ QueueFamilyIndices HelloTriangleApplication::findQueueFamilies(VkPhysicalDevice
 		}
 
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_vkSurface, &presentSupport);
+		if (m_options.m_fHeadless)
+		{
+			presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) ? VK_TRUE : VK_FALSE;
+		}
+		else
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_vkSurface, &presentSupport);
+		}
 		if (queueFamily.queueCount > 0 && presentSupport)
 		{
 			indices.presentFamily = i;
@@ -1845,7 +2327,12 @@ void HelloTriangleApplication::createSwapChain()
 	swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	swapChainCreateInfo.presentMode = presentMode;
 	swapChainCreateInfo.clipped = VK_TRUE;
-	swapChainCreateInfo.oldSwapchain = nullptr;
+
+	// Handing over the current swapchain lets the presentation engine
+	// reuse its resources and keeps the frames in flight valid. It is
+	// retired by this call and destroyed once those frames complete.
+	//
+	swapChainCreateInfo.oldSwapchain = m_vkSwapchain;
 
 	if (VK_SUCCESS != vkCreateSwapchainKHR(m_vkDevice, &swapChainCreateInfo, nullptr, &m_vkSwapchain))
 	{
@@ -1868,86 +2355,371 @@ void HelloTriangleApplication::createSwapChain()
 * Returns
 *		void
 * Notes
+*		The device is not waited on. The old swapchain, its views,
+*		framebuffers and depth buffer are retired and destroyed
+*		once the frames using them have completed.
+*		The viewport and scissor are dynamic state, so the
+*		pipelines do not depend on the extent. They and the render
+*		pass are only recreated if the surface format changes, and
+*		the old ones go through the deletion queue as well.
+*		The time taken is added to the frame statistics.
 *
 **************************************************************/
 void HelloTriangleApplication::recreateSwapchain()
 {
-	int width, height;
+	int width = 0, height = 0;
+#ifdef RENDERER_GLFW
 	glfwGetWindowSize(m_glfwWindow, &width, &height);
+#endif
 	if (0 == width || 0 == height)
 	{
 		return;
 	}
 
-	vkDeviceWaitIdle(m_vkDevice);
-	cleanupSwapchain();
+	CpuTimer resizeTimer;
+	m_fSwapchainDirty = false;
+	m_fProjectionDirty = true;
+
+	// The cached segments set the viewport and scissor to the old
+	// extent. Their command buffers are recorded again from scratch.
+	//
+	m_commandSegments.clear();
+
+	VkFormat previousImageFormat = m_vkSwapchainImageFormat;
+	retireSwapchain();
 	createSwapChain();
 	createSwapchainImageViews();
-	createRenderPass();
-	createGraphicsPipelines();
+	createRenderFinishedSemaphores();
+	if (previousImageFormat != m_vkSwapchainImageFormat)
+	{
+		waitForGraphicsPipelines();
+		for (auto pipeline : m_vkGraphicsPipelines)
+		{
+			m_deletionQueue.enqueuePipeline(m_graphicsTimeline.getSubmittedValue(), pipeline);
+		}
+		m_deletionQueue.enqueueRenderPass(m_graphicsTimeline.getSubmittedValue(), m_vkRenderPass);
+		createRenderPass();
+		createGraphicsPipelines();
+	}
 	createDepthResources();
+	m_virtualTextures.createFeedbackTarget(m_vkSwapchainExtent);
 	createFrameBuffers();
-	createAndFillCommandBuffers();
+	m_frameStatistics.addSample("swapchain recreation (ms)", resizeTimer.elapsedMilliseconds());
 }
 
 /**************************************************************
 * Description
-*		Create swapchain image views. There is one imageview
-*		for each swapchain image.
+*		Hands the swapchain resources to the deletion queue. The
+*		swapchain handle is left in place so the new swapchain
+*		can be created from it.
 * Returns
 *		void
 * Notes
+*		The resources are destroyed once everything submitted
+*		so far has completed.
 *
 **************************************************************/
-void HelloTriangleApplication::createSwapchainImageViews()
+void HelloTriangleApplication::retireSwapchain()
 {
-	m_vkSwapchainImageViews.resize(m_vkSwapchainImages.size());
-	for (size_t i = 0; i < m_vkSwapchainImages.size(); ++i)
+	uint64_t value = m_graphicsTimeline.getSubmittedValue();
+	for (auto framebuffer : m_vkSwapchainFrameBuffers)
 	{
-		m_vkSwapchainImageViews[i] = createImageView(
-										m_vkSwapchainImages[i],
-										m_vkSwapchainImageFormat,
-										VK_IMAGE_ASPECT_COLOR_BIT,
-										1 /*mipLevels*/);
+		m_deletionQueue.enqueueFramebuffer(value, framebuffer);
+	}
+	m_vkSwapchainFrameBuffers.clear();
+
+	for (auto imageView : m_vkSwapchainImageViews)
+	{
+		m_deletionQueue.enqueueImageView(value, imageView);
+	}
+	m_vkSwapchainImageViews.clear();
+
+	m_deletionQueue.enqueueImageView(value, m_vkDepthImageView);
+	m_deletionQueue.enqueueImage(value, m_vkDepthImage);
+	m_deletionQueue.enqueueMemory(value, m_vkDepthImageMemory);
+	for (auto semaphore : m_vkRenderFinishedSemaphores)
+	{
+		m_deletionQueue.enqueueSemaphore(value, semaphore);
 	}
+	m_vkRenderFinishedSemaphores.clear();
+	m_deletionQueue.enqueueSwapchain(value, m_vkSwapchain);
 }
 
 /**************************************************************
 * Description
-*		Creates the graphics pipeline. This involves setting up
-*		shaders and other nonprogramming pipeline stages. These
-*		include
-*		1. Vertex and Fragment Shader
-*		2. Input Assembler
-*		3. Viewport info
-*		4. Rasterization
-*		5. Multisampling
-*		6. Depth/Stencil Buffer
-*		7. Color/Alpha Blending
-*		8. Descriptor set layout for uniform object
+*		Creates the color image headless runs render to, in
+*		place of the swapchain images.
 * Returns
-*		Graphics pipeline
+*		void
 * Notes
+*		The image is kept in m_vkSwapchainImages, so the image
+*		views, framebuffers and frame recording are shared with
+*		windowed runs. One image is enough, a frame only starts
+*		once the previous one has completed.
 *
 **************************************************************/
-VkPipeline HelloTriangleApplication::createGraphicsPipeline(std::string fragShaderPath)
+void HelloTriangleApplication::createOffscreenTarget()
 {
-	auto vertShaderCode = readFile("shaders/vert.spv");
-	auto colorShadingCode = readFile(fragShaderPath.c_str());
-	auto vertShaderModule = createShaderModule(vertShaderCode);
-	auto fragShaderModule = createShaderModule(colorShadingCode);
-	
-	VkPipelineShaderStageCreateInfo  vertShaderStageCreateInfo = {};
-	vertShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageCreateInfo.module = vertShaderModule;
-	vertShaderStageCreateInfo.pName = "main";
+	m_vkSwapchainImageFormat = HEADLESS_COLOR_FORMAT;
+	m_vkSwapchainExtent = { m_options.m_width, m_options.m_height };
+	m_vkSwapchainImages.resize(1);
+	createImage(
+		m_vkSwapchainExtent.width,
+		m_vkSwapchainExtent.height,
+		1 /*mipLevels*/,
+		m_vkSwapchainImageFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		m_vkSwapchainImages[0],
+		m_vkOffscreenImageMemory);
+}
 
-	VkPipelineShaderStageCreateInfo  fragShaderStageCreateInfo = {};
-	fragShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageCreateInfo.module = fragShaderModule;
-	fragShaderStageCreateInfo.pName = "main";
+/**************************************************************
+* Description
+*		Copies the offscreen image of the last frame to the CPU,
+*		as RGBA rows.
+* Returns
+*		void
+* Notes
+*		Headless mode only. Waits for the copy, so frames read
+*		back are not representative of the frame time. Alpha
+*		is made opaque, as a window would show it.
+*
+**************************************************************/
+void HelloTriangleApplication::readbackFrame(std::vector<uint8_t> &pixels)
+{
+	assert(m_options.m_fHeadless);
+	uint32_t width = m_vkSwapchainExtent.width;
+	uint32_t height = m_vkSwapchainExtent.height;
+	VkDeviceSize size = static_cast<VkDeviceSize>(width) * height * 4;
+	VkBuffer readbackBuffer;
+	VkDeviceMemory readbackMemory;
+	createBuffer(
+		m_vkDevice,
+		m_vkPhysicalDevice,
+		size,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		readbackBuffer,
+		readbackMemory);
+
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands(m_vkDevice, m_vkCommandPool);
+
+	// The render pass left the image in the transfer source layout.
+	//
+	VkImageMemoryBarrier imageBarrier = {};
+	imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+	imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	imageBarrier.image = m_vkSwapchainImages[0];
+	imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	imageBarrier.subresourceRange.levelCount = 1;
+	imageBarrier.subresourceRange.layerCount = 1;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0,
+		0, nullptr,
+		0, nullptr,
+		1, &imageBarrier);
+
+	VkBufferImageCopy region = {};
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount = 1;
+	region.imageExtent = { width, height, 1 };
+	vkCmdCopyImageToBuffer(commandBuffer, m_vkSwapchainImages[0], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffer, 1, &region);
+
+	VkBufferMemoryBarrier bufferBarrier = {};
+	bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	bufferBarrier.buffer = readbackBuffer;
+	bufferBarrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		0, nullptr,
+		1, &bufferBarrier,
+		0, nullptr);
+
+	m_graphicsTimeline.wait(endSingleTimeCommands(m_vkCommandPool, m_graphicsTimeline, commandBuffer, m_deletionQueue));
+
+	uint8_t *pPixels = nullptr;
+	vkMapMemory(m_vkDevice, readbackMemory, 0, size, 0, reinterpret_cast<void**>(&pPixels));
+	pixels.assign(pPixels, pPixels + size);
+	for (VkDeviceSize i = 3; i < size; i += 4)
+	{
+		pixels[i] = 255;
+	}
+	vkUnmapMemory(m_vkDevice, readbackMemory);
+	vkDestroyBuffer(m_vkDevice, readbackBuffer, nullptr);
+	vkFreeMemory(m_vkDevice, readbackMemory, nullptr);
+}
+
+/**************************************************************
+* Description
+*		Compares a frame read back with the reference image
+*		given on the command line.
+* Returns
+*		void
+* Notes
+*		Sets the compare error when the reference cannot be
+*		read, has another size, or more than
+*		COMPARE_MAX_DIFFERENT_PIXELS of the pixels differ.
+*
+**************************************************************/
+void HelloTriangleApplication::compareFrame(const std::vector<uint8_t> &pixels)
+{
+	int width, height, channels;
+	stbi_uc *pReference = stbi_load(m_options.m_comparePath.c_str(), &width, &height, &channels, 4);
+	if (nullptr == pReference)
+	{
+		m_compareError = "Could not read the reference image " + m_options.m_comparePath;
+		return;
+	}
+	if (static_cast<uint32_t>(width) != m_vkSwapchainExtent.width || static_cast<uint32_t>(height) != m_vkSwapchainExtent.height)
+	{
+		m_compareError = "The reference image " + m_options.m_comparePath + " is " +
+			std::to_string(width) + "x" + std::to_string(height) + ", the frame " +
+			std::to_string(m_vkSwapchainExtent.width) + "x" + std::to_string(m_vkSwapchainExtent.height);
+		stbi_image_free(pReference);
+		return;
+	}
+
+	size_t pixelCount = static_cast<size_t>(width) * height;
+	size_t differentCount = 0;
+	for (size_t i = 0; i < pixelCount; ++i)
+	{
+		for (size_t channel = 0; channel < 3; ++channel)
+		{
+			if (std::abs(pixels[i * 4 + channel] - pReference[i * 4 + channel]) > COMPARE_CHANNEL_TOLERANCE)
+			{
+				++differentCount;
+				break;
+			}
+		}
+	}
+	stbi_image_free(pReference);
+
+	if (differentCount > COMPARE_MAX_DIFFERENT_PIXELS * pixelCount)
+	{
+		m_compareError = std::to_string(differentCount) + " of " + std::to_string(pixelCount) +
+			" pixels of the last frame differ from " + m_options.m_comparePath;
+	}
+}
+
+/**************************************************************
+* Description
+*		Create swapchain image views. There is one imageview
+*		for each swapchain image.
+* Returns
+*		void
+* Notes
+*
+**************************************************************/
+void HelloTriangleApplication::createSwapchainImageViews()
+{
+	m_vkSwapchainImageViews.resize(m_vkSwapchainImages.size());
+	for (size_t i = 0; i < m_vkSwapchainImages.size(); ++i)
+	{
+		m_vkSwapchainImageViews[i] = createImageView(
+										m_vkSwapchainImages[i],
+										m_vkSwapchainImageFormat,
+										VK_IMAGE_ASPECT_COLOR_BIT,
+										1 /*mipLevels*/);
+	}
+}
+
+/**************************************************************
+* Description
+*		Creates the pipeline layout shared by all graphics pipelines.
+*		It consists of the descriptor set layouts for the per-frame
+*		uniform object, the material table and the virtual
+*		textures, and push constant ranges for the per-draw
+*		transforms and material index.
+* Returns
+*		void
+* Notes
+*		The layout does not depend on the swapchain, so it is not
+*		recreated along with the pipelines.
+*
+**************************************************************/
+void HelloTriangleApplication::createPipelineLayout()
+{
+	std::array<VkPushConstantRange, 2> pushConstantRanges = {};
+	pushConstantRanges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	pushConstantRanges[0].offset = 0;
+	pushConstantRanges[0].size = sizeof(PushConstantObject);
+	pushConstantRanges[1].stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRanges[1].offset = sizeof(PushConstantObject);
+	pushConstantRanges[1].size = sizeof(MaterialPushConstant);
+
+	std::array<VkDescriptorSetLayout, 3> setLayouts = {
+		m_vkDescriptorSetLayout,
+		m_materialTable.getLayout(),
+		m_virtualTextures.getLayout() };
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = static_cast<uint32_t>(pushConstantRanges.size());
+	pipelineLayoutInfo.pPushConstantRanges = pushConstantRanges.data();
+
+	if (VK_SUCCESS != vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, nullptr, &m_vkPipelineLayout))
+	{
+		throw std::runtime_error("Could not create pipeline layout.");
+	}
+}
+
+/**************************************************************
+* Description
+*		Creates the graphics pipeline. This involves setting up
+*		shaders and other nonprogramming pipeline stages. These
+*		include
+*		1. Vertex and Fragment Shader
+*		2. Input Assembler
+*		3. Viewport info, set dynamically while recording
+*		4. Rasterization
+*		5. Multisampling
+*		6. Depth/Stencil Buffer
+*		7. Color/Alpha Blending
+* Returns
+*		Graphics pipeline
+* Notes
+*		The pipeline layout is shared by all pipelines and must
+*		be created before this is called. The render pass is the
+*		main one, or the feedback pass of the virtual textures.
+*		Runs on worker threads. The shader modules are owned by
+*		the caller.
+*
+**************************************************************/
+VkPipeline HelloTriangleApplication::createGraphicsPipeline(
+	VkShaderModule vertShaderModule,
+	VkShaderModule fragShaderModule,
+	VkRenderPass vkRenderPass)
+{
+	VkPipelineShaderStageCreateInfo  vertShaderStageCreateInfo = {};
+	vertShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	vertShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+	vertShaderStageCreateInfo.module = vertShaderModule;
+	vertShaderStageCreateInfo.pName = "main";
+
+	VkPipelineShaderStageCreateInfo  fragShaderStageCreateInfo = {};
+	fragShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	fragShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	fragShaderStageCreateInfo.module = fragShaderModule;
+	fragShaderStageCreateInfo.pName = "main";
 
 	VkPipelineShaderStageCreateInfo shaderStageCreateInfos[] = { vertShaderStageCreateInfo, fragShaderStageCreateInfo };
 
@@ -1966,24 +2738,21 @@ VkPipeline HelloTriangleApplication::createGraphicsPipeline(std::string fragShad
 	inputAssemblyInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssemblyInfo.primitiveRestartEnable = VK_FALSE;
 
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = static_cast<float>(m_vkSwapchainExtent.width);
-	viewport.height = static_cast<float>(m_vkSwapchainExtent.height);
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	VkRect2D scissorRectangle = {};
-	scissorRectangle.extent = m_vkSwapchainExtent;
-	scissorRectangle.offset = { 0, 0 };
-
+	// The viewport and scissor are set while recording, so the
+	// pipeline does not have to be rebuilt when the window is resized.
+	//
 	VkPipelineViewportStateCreateInfo viewportStateInfo = {};
 	viewportStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportStateInfo.viewportCount = 1;
-	viewportStateInfo.pViewports = &viewport;
+	viewportStateInfo.pViewports = nullptr;
 	viewportStateInfo.scissorCount = 1;
-	viewportStateInfo.pScissors = &scissorRectangle;
+	viewportStateInfo.pScissors = nullptr;
+
+	VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	VkPipelineDynamicStateCreateInfo dynamicStateInfo = {};
+	dynamicStateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicStateInfo.dynamicStateCount = 2;
+	dynamicStateInfo.pDynamicStates = dynamicStates;
 
 	VkPipelineRasterizationStateCreateInfo rasterizerInfo = {};
 	rasterizerInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -2044,20 +2813,6 @@ VkPipeline HelloTriangleApplication::createGraphicsPipeline(std::string fragShad
 	colorBlendingInfo.blendConstants[2] = 0.0f;
 	colorBlendingInfo.blendConstants[3] = 0.0f;
 
-	// NOTE : Can we not create descriptor set layout here?
-	//
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;
-	pipelineLayoutInfo.pSetLayouts = &m_vkDescriptorSetLayout;
-	pipelineLayoutInfo.pushConstantRangeCount = 0;
-	pipelineLayoutInfo.pPushConstantRanges = 0;
-
-	if (VK_SUCCESS != vkCreatePipelineLayout(m_vkDevice, &pipelineLayoutInfo, nullptr, &m_vkPipelineLayout))
-	{
-		throw std::runtime_error("Could not create pipeline layout.");
-	}
-
 	VkGraphicsPipelineCreateInfo pipelineInfo = {};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	pipelineInfo.stageCount = 2;
@@ -2069,23 +2824,20 @@ VkPipeline HelloTriangleApplication::createGraphicsPipeline(std::string fragShad
 	pipelineInfo.pMultisampleState = &multisamplingInfo;
 	pipelineInfo.pDepthStencilState = nullptr;
 	pipelineInfo.pColorBlendState = &colorBlendingInfo;
-	pipelineInfo.pDynamicState = nullptr;
+	pipelineInfo.pDynamicState = &dynamicStateInfo;
 	pipelineInfo.layout = m_vkPipelineLayout;
-	pipelineInfo.renderPass = m_vkRenderPass;
+	pipelineInfo.renderPass = vkRenderPass;
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.basePipelineIndex = -1;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 
 	VkPipeline pipeline;
-	if (VK_SUCCESS != vkCreateGraphicsPipelines(m_vkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline))
+	if (VK_SUCCESS != vkCreateGraphicsPipelines(m_vkDevice, m_pipelineCache.get(), 1, &pipelineInfo, nullptr, &pipeline))
 	{
 		throw std::runtime_error("Could not create graphics pipeline");
 	}
 
-	vkDestroyShaderModule(m_vkDevice, vertShaderModule, nullptr);
-	vkDestroyShaderModule(m_vkDevice, fragShaderModule, nullptr);
-
 	return pipeline;
 }
 
@@ -2116,14 +2868,44 @@ void HelloTriangleApplication::createLogicalDevice()
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 	
+	// Block compressed textures are loaded in whichever formats the
+	// device supports.
+	//
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(m_vkPhysicalDevice, &supportedFeatures);
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+	deviceFeatures.textureCompressionETC2 = supportedFeatures.textureCompressionETC2;
+
+	// The bindless texture array is indexed with the material of the
+	// draw, a dynamically uniform value.
+	//
+	deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+
+	// Frames and uploads are synchronized with timeline semaphores.
+	//
+	VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+	timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+	timelineFeatures.timelineSemaphore = VK_TRUE;
+
+	// Textures are indexed from a partially bound array that is
+	// updated after being bound.
+	//
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	timelineFeatures.pNext = &indexingFeatures;
 
 	VkDeviceCreateInfo deviceCreateInfo = {};
 	deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	deviceCreateInfo.pNext = &timelineFeatures;
 	deviceCreateInfo.pQueueCreateInfos = queueCreateInfos.data();
 	deviceCreateInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
+	std::vector<const char*> deviceExtensions = getDeviceExtensions();
 	deviceCreateInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
 	deviceCreateInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
@@ -2169,6 +2951,30 @@ VkShaderModule HelloTriangleApplication::createShaderModule(const std::vector<ch
 	return vkShaderModule;
 }
 
+/**************************************************************
+* Description
+*		Returns the shader module for the SPIR-V file, loading and
+*		creating it the first time it is asked for.
+* Returns
+*		VkShaderModule
+* Notes
+*		The modules live until cleanup, so recreating the
+*		pipelines after a resize does not read the files again.
+*
+**************************************************************/
+VkShaderModule HelloTriangleApplication::getShaderModule(const std::string &path)
+{
+	auto it = m_vkShaderModules.find(path);
+	if (m_vkShaderModules.end() != it)
+	{
+		return it->second;
+	}
+
+	VkShaderModule vkShaderModule = createShaderModule(readFile(path));
+	m_vkShaderModules[path] = vkShaderModule;
+	return vkShaderModule;
+}
+
 /**************************************************************
 * Description
 *		Create render pass. This involes creation of attachments,
@@ -2181,7 +2987,8 @@ VkShaderModule HelloTriangleApplication::createShaderModule(const std::vector<ch
 **************************************************************/
 void HelloTriangleApplication::createRenderPass()
 {
-	// Color attachment is representation of swapchain images
+	// Color attachment is representation of swapchain images. The
+	// offscreen image of headless runs is left ready to be copied.
 	//
 	VkAttachmentDescription colorAttachment = {};
 	colorAttachment.format = m_vkSwapchainImageFormat;
@@ -2191,7 +2998,7 @@ void HelloTriangleApplication::createRenderPass()
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = m_options.m_fHeadless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	// We need to create an attachment reference which can be used
 	// by the subpass.
@@ -2294,6 +3101,13 @@ void HelloTriangleApplication::createFrameBuffers()
 * Returns
 *		void
 * Notes
+*		Command buffers are re-recorded every frame, so the pool
+*		allows resetting them individually.
+*		Command pools must not be used from two threads at once,
+*		so every recording batch gets a pool of its own for its
+*		secondary command buffers.
+*		The primary buffer of the frame comes from a transient
+*		pool of its own, which is reset every frame.
 *
 **************************************************************/
 void HelloTriangleApplication::createCommandPool()
@@ -2302,89 +3116,715 @@ void HelloTriangleApplication::createCommandPool()
 	VkCommandPoolCreateInfo commandPoolInfo = {};
 	commandPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	commandPoolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily;
-	commandPoolInfo.flags = 0;
+	commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 	if (VK_SUCCESS != vkCreateCommandPool(m_vkDevice, &commandPoolInfo, nullptr, &m_vkCommandPool))
 	{
 		throw std::runtime_error("Could not create command pool.");
 	}
+
+	VkCommandPoolCreateInfo framePoolInfo = commandPoolInfo;
+	framePoolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+	if (VK_SUCCESS != vkCreateCommandPool(m_vkDevice, &framePoolInfo, nullptr, &m_vkFrameCommandPool))
+	{
+		throw std::runtime_error("Could not create frame command pool.");
+	}
+
+	m_recordingSlots.resize(m_threadPool.getThreadCount() + 1);
+	for (auto &slot : m_recordingSlots)
+	{
+		if (VK_SUCCESS != vkCreateCommandPool(m_vkDevice, &commandPoolInfo, nullptr, &slot.m_vkCommandPool))
+		{
+			throw std::runtime_error("Could not create recording command pool.");
+		}
+	}
 }
 
 /**************************************************************
 * Description
-*		Create command buffers and record them. Each command buffer
-*		is linked to a framebuffer, so we have to create one for each
-*		framebuffer.
-*		We also record drawing commands to the command buffers. These include
-*		1. Start Command buffer
-*		2. Start Render Pass
-*		3. Bind the graphics pipeline
-*		4. Bind Vertex Buffer, Index Buffer and Descriptor Sets
-*		5. Draw command!
+*		Creates the primary command buffer recorded every frame.
 * Returns
 *		void
 * Notes
+*		The secondary command buffers of the draw segments are
+*		allocated as the segments are first needed.
 *
 **************************************************************/
-void HelloTriangleApplication::createAndFillCommandBuffers()
+void HelloTriangleApplication::createCommandBuffers()
 {
-	m_vkCommandBuffers.resize(m_vkSwapchainFrameBuffers.size());
 	VkCommandBufferAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = m_vkCommandPool;
+	allocInfo.commandPool = m_vkFrameCommandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t)m_vkCommandBuffers.size();
-	if (VK_SUCCESS != vkAllocateCommandBuffers(m_vkDevice, &allocInfo, m_vkCommandBuffers.data()))
+	allocInfo.commandBufferCount = 1;
+	if (VK_SUCCESS != vkAllocateCommandBuffers(m_vkDevice, &allocInfo, &m_vkFrameCommandBuffer))
 	{
 		throw std::runtime_error("Could not create command buffers");
 	}
+}
+
+/**************************************************************
+* Description
+*		Records the command buffer of the frame. The visible draws
+*		are recorded into secondary command buffers, which the
+*		primary buffer executes inside the render pass.
+* Returns
+*		void
+* Notes
+*		The frame command pool is reset and the primary buffer
+*		recorded from scratch every frame. Only the segments of the
+*		draw list that changed are recorded again.
+*		The render pass is bracketed by timestamps when they are
+*		supported, along with the feedback pass of the virtual
+*		textures that comes before it.
+*
+**************************************************************/
+void HelloTriangleApplication::recordFrameCommandBuffer(uint32_t imageIndex)
+{
+	CpuTimer recordTimer;
+	recordCommandSegments(m_visibleDrawList, 0, true);
+
+	vkResetCommandPool(m_vkDevice, m_vkFrameCommandPool, 0);
+	VkCommandBuffer commandBuffer = m_vkFrameCommandBuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr;
+
+	if (VK_SUCCESS != vkBeginCommandBuffer(commandBuffer, &beginInfo))
+	{
+		throw std::runtime_error("Failed to begin command buffer.");
+	}
+
+	if (VK_NULL_HANDLE != m_vkTimestampQueryPool)
+	{
+		vkCmdResetQueryPool(commandBuffer, m_vkTimestampQueryPool, 0, 2);
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_vkTimestampQueryPool, 0);
+	}
+
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = m_vkRenderPass;
+	renderPassInfo.framebuffer = m_vkSwapchainFrameBuffers[imageIndex];
+	renderPassInfo.renderArea.offset = { 0, 0 };
+	renderPassInfo.renderArea.extent = m_vkSwapchainExtent;
+
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0].color = { 0.5f, 0.5f, 0.5f, 1.0f };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
+
+	if (0 != m_virtualTextures.getTextureCount())
+	{
+		recordFeedbackPass(commandBuffer);
+	}
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	if (!m_vkSegmentCommandBuffers.empty())
+	{
+		vkCmdExecuteCommands(
+			commandBuffer,
+			static_cast<uint32_t>(m_vkSegmentCommandBuffers.size()),
+			m_vkSegmentCommandBuffers.data());
+	}
+	vkCmdEndRenderPass(commandBuffer);
+
+	if (VK_NULL_HANDLE != m_vkTimestampQueryPool)
+	{
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_vkTimestampQueryPool, 1);
+	}
+
+	if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer))
+	{
+		throw std::runtime_error("Failed to record comand buffer.");
+	}
+
+	uint32_t pipelineBinds = 0;
+	uint32_t descriptorSetBinds = 0;
+	uint32_t meshBinds = 0;
+	for (const auto &segment : m_commandSegments)
+	{
+		pipelineBinds += segment.m_pipelineBinds;
+		descriptorSetBinds += segment.m_descriptorSetBinds;
+		meshBinds += segment.m_meshBinds;
+	}
+
+	m_frameStatistics.addSample("record cpu (us)", recordTimer.elapsedMicroseconds());
+	m_frameStatistics.addSample("pipeline binds", pipelineBinds);
+	m_frameStatistics.addSample("descriptor set binds", descriptorSetBinds);
+	m_frameStatistics.addSample("mesh binds", meshBinds);
+	m_frameStatistics.addSample("recorded segments", static_cast<double>(m_dirtySegments.size()));
+	m_frameStatistics.addSample("cached segments", static_cast<double>(m_commandSegments.size() - m_dirtySegments.size()));
+}
+
+/**************************************************************
+* Description
+*		Returns the secondary command buffer of a draw segment,
+*		allocating it on first use.
+* Returns
+*		VkCommandBuffer
+* Notes
+*		Segment i always belongs to recording slot
+*		i % slot count, so a cached buffer is recorded again from
+*		the pool it was allocated from. Must be called on the main
+*		thread, before the segments are recorded.
+*
+**************************************************************/
+VkCommandBuffer HelloTriangleApplication::getSegmentCommandBuffer(size_t segmentIndex)
+{
+	RecordingSlot &slot = m_recordingSlots[segmentIndex % m_recordingSlots.size()];
+	size_t bufferIndex = segmentIndex / m_recordingSlots.size();
+	while (slot.m_vkSecondaryCommandBuffers.size() <= bufferIndex)
+	{
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = slot.m_vkCommandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		if (VK_SUCCESS != vkAllocateCommandBuffers(m_vkDevice, &allocInfo, &commandBuffer))
+		{
+			throw std::runtime_error("Could not create secondary command buffers");
+		}
+		slot.m_vkSecondaryCommandBuffers.push_back(commandBuffer);
+	}
+	return slot.m_vkSecondaryCommandBuffers[bufferIndex];
+}
 
-	for (size_t i = 0; i < m_vkCommandBuffers.size(); ++i)
+/**************************************************************
+* Description
+*		Splits the draw list into segments of DRAWS_PER_SEGMENT
+*		draws and records the segments that changed since they
+*		were last recorded on the thread pool.
+* Returns
+*		void
+* Notes
+*		The command buffers of all the segments are left in
+*		m_vkSegmentCommandBuffers, in draw list order.
+*		The work is split by recording slot, so no two threads
+*		ever record from the same pool. A thread count of zero
+*		uses every slot. When fUseCache is false every segment is
+*		recorded.
+*
+**************************************************************/
+void HelloTriangleApplication::recordCommandSegments(
+	const std::vector<uint32_t> &drawList,
+	uint32_t threadCount,
+	bool fUseCache)
+{
+	assert(threadCount <= m_recordingSlots.size());
+	size_t segmentCount = (drawList.size() + DRAWS_PER_SEGMENT - 1) / DRAWS_PER_SEGMENT;
+	m_commandSegments.resize(segmentCount);
+	m_vkSegmentCommandBuffers.resize(segmentCount);
+	m_dirtySegments.clear();
+
+	for (size_t segmentIndex = 0; segmentIndex < segmentCount; ++segmentIndex)
 	{
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-		beginInfo.pInheritanceInfo = nullptr;
+		CommandSegment &segment = m_commandSegments[segmentIndex];
+		auto drawsBegin = drawList.begin() + segmentIndex * DRAWS_PER_SEGMENT;
+		auto drawsEnd = drawList.begin() + std::min(drawList.size(), (segmentIndex + 1) * DRAWS_PER_SEGMENT);
 
-		vkBeginCommandBuffer(m_vkCommandBuffers[i], &beginInfo);
+		bool fDirty = !fUseCache || !segment.m_fRecorded ||
+			!std::equal(drawsBegin, drawsEnd, segment.m_drawIndices.begin(), segment.m_drawIndices.end());
+		for (auto it = drawsBegin; !fDirty && it != drawsEnd; ++it)
+		{
+			fDirty = m_drawTransformFrames[*it] >= segment.m_recordedFrame;
+		}
 
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = m_vkRenderPass;
-		renderPassInfo.framebuffer = m_vkSwapchainFrameBuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = m_vkSwapchainExtent;
+		m_vkSegmentCommandBuffers[segmentIndex] = getSegmentCommandBuffer(segmentIndex);
+		if (fDirty)
+		{
+			segment.m_drawIndices.assign(drawsBegin, drawsEnd);
+			segment.m_recordedFrame = m_frameIndex + 1;
+			segment.m_fRecorded = true;
+			m_dirtySegments.push_back(static_cast<uint32_t>(segmentIndex));
+		}
+	}
 
-		std::array<VkClearValue, 2> clearValues = {};
-		clearValues[0].color = { 0.5f, 0.5f, 0.5f, 1.0f };
-		clearValues[1].depthStencil = { 1.0f, 0 };
-		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassInfo.pClearValues = clearValues.data();
+	auto recordSlots = [this](size_t, size_t slotBegin, size_t slotEnd)
+	{
+		for (uint32_t segmentIndex : m_dirtySegments)
+		{
+			size_t slot = segmentIndex % m_recordingSlots.size();
+			if (slot >= slotBegin && slot < slotEnd)
+			{
+				recordDraws(m_vkSegmentCommandBuffers[segmentIndex], m_commandSegments[segmentIndex]);
+			}
+		}
+	};
+
+	if (m_dirtySegments.size() <= 1)
+	{
+		recordSlots(0, 0, m_recordingSlots.size());
+	}
+	else
+	{
+		m_threadPool.parallelFor(
+			m_recordingSlots.size(),
+			1,
+			recordSlots,
+			0 != threadCount ? threadCount : static_cast<uint32_t>(m_recordingSlots.size()));
+	}
+}
+
+/**************************************************************
+* Description
+*		Records the draws of a segment into a secondary command
+*		buffer. These include
+*		1. Start Command buffer, continuing the render pass
+*		2. Set the viewport and scissor
+*		3. Bind the per-frame, material table and virtual texture Descriptor Sets
+*		4. Bind the graphics pipeline
+*		5. Push the per-draw transforms and material index
+*		6. Bind Vertex Buffer and Index Buffer
+*		7. Draw command!
+* Returns
+*		void
+* Notes
+*		Runs on worker threads. Secondary command buffers do not
+*		inherit any state from the primary buffer, so each one
+*		sets the viewport and binds the descriptor sets itself.
+*		The framebuffer is left out of the inheritance info so the
+*		buffer can be executed for any swapchain image.
+*		State that is already bound is not bound again. The number
+*		of binds is stored in the segment.
+*
+**************************************************************/
+void HelloTriangleApplication::recordDraws(VkCommandBuffer commandBuffer, CommandSegment &segment)
+{
+	VkCommandBufferInheritanceInfo inheritanceInfo = {};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = m_vkRenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
 
-		vkCmdBeginRenderPass(m_vkCommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	if (VK_SUCCESS != vkBeginCommandBuffer(commandBuffer, &beginInfo))
+	{
+		throw std::runtime_error("Failed to begin secondary command buffer.");
+	}
 
-		for (int j = 0; j < m_models.size(); ++j)
+	// Dynamic state is not inherited from the primary buffer.
+	//
+	VkViewport viewport = {};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = static_cast<float>(m_vkSwapchainExtent.width);
+	viewport.height = static_cast<float>(m_vkSwapchainExtent.height);
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+	VkRect2D scissorRectangle = {};
+	scissorRectangle.extent = m_vkSwapchainExtent;
+	scissorRectangle.offset = { 0, 0 };
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissorRectangle);
+
+	// All the pipelines share the layout, and every draw finds its
+	// material through the push constants, so the sets are bound once.
+	//
+	std::array<VkDescriptorSet, 3> descriptorSets = { m_vkDescriptorSet, m_materialTable.getSet(), m_virtualTextures.getSet() };
+	vkCmdBindDescriptorSets(
+		commandBuffer,
+		VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_vkPipelineLayout,
+		0,
+		static_cast<uint32_t>(descriptorSets.size()),
+		descriptorSets.data(),
+		0,
+		nullptr);
+
+	segment.m_pipelineBinds = 0;
+	segment.m_descriptorSetBinds = 1;
+	segment.m_meshBinds = 0;
+	VkPipeline boundPipeline = VK_NULL_HANDLE;
+	uint32_t boundMesh = std::numeric_limits<uint32_t>::max();
+
+	for (uint32_t modelIndex : segment.m_drawIndices)
+	{
+		Model &model = m_models[modelIndex];
+		VkPipeline pipeline = m_vkGraphicsPipelines[model.getPipelineIndex()]; // Resolved by updateVisibleDrawList.
+		if (pipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+			boundPipeline = pipeline;
+			++segment.m_pipelineBinds;
+		}
+
+		vkCmdPushConstants(
+			commandBuffer,
+			m_vkPipelineLayout,
+			VK_SHADER_STAGE_VERTEX_BIT,
+			0,
+			sizeof(PushConstantObject),
+			&m_drawTransforms[modelIndex]);
+
+		MaterialPushConstant material = { model.getMaterialIndex() };
+		vkCmdPushConstants(
+			commandBuffer,
+			m_vkPipelineLayout,
+			VK_SHADER_STAGE_FRAGMENT_BIT,
+			sizeof(PushConstantObject),
+			sizeof(MaterialPushConstant),
+			&material);
+
+		if (modelIndex != boundMesh)
 		{
-			vkCmdBindPipeline(m_vkCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_models[j].getGraphicsPipeline());
-			VkBuffer vertexBuffers[] = { m_models[j].getVertexBuffer() };
+			VkBuffer vertexBuffers[] = { model.getVertexBuffer() };
 			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(m_vkCommandBuffers[i], 0, 1, vertexBuffers, offsets);
-			vkCmdBindIndexBuffer(m_vkCommandBuffers[i], m_models[j].getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
-			vkCmdBindDescriptorSets(
-				m_vkCommandBuffers[i],
-				VK_PIPELINE_BIND_POINT_GRAPHICS,
-				m_vkPipelineLayout,
-				0,
-				1,
-				&m_vkDescriptorSets[j],
-				0,
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+			vkCmdBindIndexBuffer(commandBuffer, model.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+			boundMesh = modelIndex;
+			++segment.m_meshBinds;
+		}
+		vkCmdDrawIndexed(commandBuffer, model.getIndicesSize(), 1, 0, 0, 0);
+	}
+
+	if (VK_SUCCESS != vkEndCommandBuffer(commandBuffer))
+	{
+		throw std::runtime_error("Failed to record secondary comand buffer.");
+	}
+}
+
+/**************************************************************
+* Description
+*		Records the feedback pass of the virtual textures into
+*		the frame command buffer. Every visible model is drawn
+*		at the low resolution of the pass, the virtually textured
+*		ones writing the pages they need and the others only
+*		occluding them.
+* Returns
+*		void
+* Notes
+*		The draws are few and recorded inline, the segment cache
+*		is not used. The requests are read back by the update of
+*		the virtual textures once the frame has completed.
+*
+**************************************************************/
+void HelloTriangleApplication::recordFeedbackPass(VkCommandBuffer commandBuffer)
+{
+	m_virtualTextures.beginFeedbackPass(commandBuffer);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, getGraphicsPipeline(PIPELINE_VIRTUAL_FEEDBACK));
+
+	std::array<VkDescriptorSet, 3> descriptorSets = { m_vkDescriptorSet, m_materialTable.getSet(), m_virtualTextures.getSet() };
+	vkCmdBindDescriptorSets(
+		commandBuffer,
+		VK_PIPELINE_BIND_POINT_GRAPHICS,
+		m_vkPipelineLayout,
+		0,
+		static_cast<uint32_t>(descriptorSets.size()),
+		descriptorSets.data(),
+		0,
+		nullptr);
+
+	for (uint32_t modelIndex : m_visibleDrawList)
+	{
+		Model &model = m_models[modelIndex];
+		vkCmdPushConstants(
+			commandBuffer,
+			m_vkPipelineLayout,
+			VK_SHADER_STAGE_VERTEX_BIT,
+			0,
+			sizeof(PushConstantObject),
+			&m_drawTransforms[modelIndex]);
+
+		MaterialPushConstant material = { model.getMaterialIndex() };
+		vkCmdPushConstants(
+			commandBuffer,
+			m_vkPipelineLayout,
+			VK_SHADER_STAGE_FRAGMENT_BIT,
+			sizeof(PushConstantObject),
+			sizeof(MaterialPushConstant),
+			&material);
+
+		VkBuffer vertexBuffers[] = { model.getVertexBuffer() };
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, model.getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+		vkCmdDrawIndexed(commandBuffer, model.getIndicesSize(), 1, 0, 0, 0);
+	}
+	m_virtualTextures.endFeedbackPass(commandBuffer);
+}
+
+/**************************************************************
+* Description
+*		Measures how long recording BENCHMARK_DRAW_COUNT draws
+*		takes with one thread up to every recording slot, and
+*		prints the results. Triggered by the B key.
+* Returns
+*		void
+* Notes
+*		The draws cycle through the loaded models. They are only
+*		recorded, never submitted, with the segment cache
+*		bypassed. The segments are recorded again for the next
+*		frame.
+*
+**************************************************************/
+void HelloTriangleApplication::benchmarkCommandRecording()
+{
+	const uint32_t repeatCount = 10;
+
+	// The segment command buffers recorded below are used by the
+	// last frame.
+	//
+	m_graphicsTimeline.wait(m_lastFrameValue);
+
+	std::vector<uint32_t> drawList(BENCHMARK_DRAW_COUNT);
+	for (uint32_t i = 0; i < BENCHMARK_DRAW_COUNT; ++i)
+	{
+		drawList[i] = i % static_cast<uint32_t>(m_models.size());
+	}
+	for (uint32_t i = 0; i < PIPELINE_COUNT; ++i)
+	{
+		getGraphicsPipeline(i);
+	}
+
+	std::cout << "Recording " << BENCHMARK_DRAW_COUNT << " draws:" << std::endl;
+	double singleThreadMilliseconds = 0.0;
+	for (uint32_t threadCount = 1; threadCount <= m_recordingSlots.size(); ++threadCount)
+	{
+		CpuTimer timer;
+		for (uint32_t repeat = 0; repeat < repeatCount; ++repeat)
+		{
+			recordCommandSegments(drawList, threadCount, false);
+		}
+
+		double milliseconds = timer.elapsedMilliseconds() / repeatCount;
+		if (1 == threadCount)
+		{
+			singleThreadMilliseconds = milliseconds;
+		}
+		std::cout << "  " << threadCount << " thread(s): " << milliseconds << " ms, speedup "
+			<< singleThreadMilliseconds / milliseconds << std::endl;
+	}
+
+	m_commandSegments.clear();
+}
+
+/**************************************************************
+* Description
+*		Measures how long loading BENCHMARK_TEXTURE_COUNT
+*		textures takes when they are decoded one after the other
+*		on the main thread and in parallel on the thread pool,
+*		then in parallel from the KTX2 files made by texconvert,
+*		and prints the times and the bytes uploaded. Triggered
+*		by the T key.
+* Returns
+*		void
+* Notes
+*		The time runs from the first request until every upload
+*		has completed on the GPU. Each run uses a texture manager
+*		of its own with deduplication disabled, so every file is
+*		decoded, and without a material table, so the bindless
+*		slots are left alone.
+*
+**************************************************************/
+void HelloTriangleApplication::benchmarkTextureLoading()
+{
+	const uint32_t pathCount = sizeof(BENCHMARK_TEXTURE_PATHS) / sizeof(BENCHMARK_TEXTURE_PATHS[0]);
+
+	std::cout << "Loading " << BENCHMARK_TEXTURE_COUNT << " textures:" << std::endl;
+	double serialMilliseconds = 0.0;
+	for (uint32_t run = 0; run < 3; ++run)
+	{
+		bool fParallel = (run > 0);
+		bool fCompressed = (2 == run);
+		TextureManager textureManager;
+		textureManager.setDeduplicate(false);
+		textureManager.setPreferCompressed(fCompressed);
+		textureManager.create(
+			m_vkDevice,
+			m_vkPhysicalDevice,
+			m_vkCommandPool,
+			&m_graphicsTimeline,
+			&m_deletionQueue,
+			nullptr,
+			fParallel ? &m_threadPool : nullptr);
+
+		CpuTimer timer;
+		for (uint32_t i = 0; i < BENCHMARK_TEXTURE_COUNT; ++i)
+		{
+			textureManager.load(BENCHMARK_TEXTURE_PATHS[i % pathCount]);
+		}
+		textureManager.waitForAll();
+		m_graphicsTimeline.wait(textureManager.getLastUploadValue());
+		double milliseconds = timer.elapsedMilliseconds();
+
+		if (!fParallel)
+		{
+			serialMilliseconds = milliseconds;
+		}
+		const char *runName = fCompressed ? "parallel, KTX2 where converted: " : (fParallel ? "parallel: " : "serial: ");
+		std::cout << "  " << runName << milliseconds << " ms, speedup " << serialMilliseconds / milliseconds
+			<< ", uploaded " << textureManager.getUploadedBytes() / (1024.0 * 1024.0) << " MB"
+			<< ", images " << textureManager.getImageBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+		textureManager.destroy();
+	}
+}
+
+/**************************************************************
+* Description
+*		Measures how long the GPU takes to upload the first
+*		benchmark texture and generate its mip chain with blits
+*		and with the compute downsampler, and prints the average
+*		of each. Triggered by the G key or --benchmark-mips.
+* Returns
+*		void
+* Notes
+*		Both include the copy of level 0. Each upload is timed
+*		with timestamps around its command buffer, once it has
+*		completed. The textures are decoded on the main thread
+*		before the upload, with the KTX2 files and the mip cache
+*		disabled. Each one is released before the next is
+*		loaded.
+*
+**************************************************************/
+void HelloTriangleApplication::benchmarkMipGeneration()
+{
+	const MipGeneration mipGenerations[] = { MIP_GENERATION_BLIT, MIP_GENERATION_COMPUTE };
+	const char *runNames[] = { "blit: ", "compute: " };
+
+	std::cout << "Generating the mip chain of " << BENCHMARK_TEXTURE_PATHS[0] << ":" << std::endl;
+	for (uint32_t run = 0; run < 2; ++run)
+	{
+		double milliseconds = 0.0;
+		for (uint32_t i = 0; i < BENCHMARK_MIP_GENERATION_REPEATS; ++i)
+		{
+			// A manager of its own per upload, destroyed once the upload is
+			// timed, so only one image is alive at a time.
+			//
+			TextureManager textureManager;
+			textureManager.setPreferCompressed(false);
+			textureManager.setMipGeneration(mipGenerations[run]);
+			textureManager.setGpuTimestamps(m_timestampValidBits);
+			textureManager.create(
+				m_vkDevice,
+				m_vkPhysicalDevice,
+				m_vkCommandPool,
+				&m_graphicsTimeline,
+				&m_deletionQueue,
+				nullptr,
 				nullptr);
-			vkCmdDrawIndexed(m_vkCommandBuffers[i], m_models[j].getIndicesSize(), 1, 0, 0, 0);
+			textureManager.load(BENCHMARK_TEXTURE_PATHS[0]);
+			textureManager.update();
+			m_graphicsTimeline.wait(textureManager.getLastUploadValue());
+			milliseconds += textureManager.getLastUploadGpuMilliseconds();
+			textureManager.destroy();
+			m_deletionQueue.release(m_graphicsTimeline.getCompletedValue());
+		}
+		std::cout << "  " << runNames[run] << milliseconds / BENCHMARK_MIP_GENERATION_REPEATS << " ms" << std::endl;
+	}
+}
+
+/**************************************************************
+* Description
+*		Loads the benchmark script given on the command line
+*		and replaces the default models with its scene.
+* Returns
+*		void
+* Notes
+*		Called before Vulkan is initialized. The run renders
+*		the warm up and measured frames of the script and keeps
+*		every frame sample for the results.
+*
+**************************************************************/
+void HelloTriangleApplication::loadBenchmarkScene()
+{
+	std::string error;
+	if (!m_benchmarkScript.load(m_options.m_benchmarkScriptPath, error))
+	{
+		throw std::runtime_error(error);
+	}
+
+	const std::vector<ScriptedModel> &scriptedModels = m_benchmarkScript.getModels();
+	m_scene = Scene();
+	m_models.clear();
+	m_models.resize(scriptedModels.size());
+	for (size_t i = 0; i < scriptedModels.size(); ++i)
+	{
+		const ScriptedModel &scriptedModel = scriptedModels[i];
+		Model &model = m_models[i];
+		model.setSceneNode(m_scene.addNode());
+		model.setModelPath(scriptedModel.m_modelPath);
+		model.setPipelineIndex(scriptedModel.m_fTextured ? PIPELINE_TEXTURE_SHADING : PIPELINE_COLOR_SHADING);
+		if (!scriptedModel.m_texturePath.empty())
+		{
+			model.setDiffuseTexturePath(scriptedModel.m_texturePath);
+		}
+		if (!scriptedModel.m_virtualTexturePath.empty())
+		{
+			model.setVirtualTexturePath(scriptedModel.m_virtualTexturePath);
 		}
-		vkCmdEndRenderPass(m_vkCommandBuffers[i]);
+		m_scene.translate(model.getSceneNode(), scriptedModel.m_position);
+		m_scene.setScale(model.getSceneNode(), glm::vec3(scriptedModel.m_scale));
+	}
+
+	m_options.m_frameCount = m_benchmarkScript.getWarmupFrameCount() + m_benchmarkScript.getFrameCount();
+	m_frameStatistics.setHistoryEnabled(true);
+}
 
-		if (VK_SUCCESS != vkEndCommandBuffer(m_vkCommandBuffers[i]))
+/**************************************************************
+* Description
+*		Moves the camera and the animated models to where the
+*		benchmark script has them at the time.
+* Returns
+*		void
+* Notes
+*		The camera no longer follows the mouse.
+*
+**************************************************************/
+void HelloTriangleApplication::applyBenchmarkScript(float time)
+{
+	glm::vec3 eye, target;
+	m_benchmarkScript.getCamera(time, eye, target);
+	m_camera.setLookAt(eye, target);
+
+	for (uint32_t i = 0; i < m_models.size(); ++i)
+	{
+		if (m_benchmarkScript.fAnimated(i))
 		{
-			throw std::runtime_error("Failed to record comand buffer.");
+			m_scene.setOrientation(m_models[i].getSceneNode(), m_benchmarkScript.getOrientation(i, time));
 		}
 	}
 }
+
+/**************************************************************
+* Description
+*		Writes the frame samples of the measured frames of a
+*		benchmark run to the results file.
+* Returns
+*		void
+* Notes
+*		The GPU timing sample of a frame is collected during the
+*		next one, so the first measured sample belongs to the
+*		last warm up frame.
+*
+**************************************************************/
+void HelloTriangleApplication::saveBenchmarkResults(double seconds)
+{
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(m_vkPhysicalDevice, &deviceProperties);
+
+	BenchmarkResults results = {};
+	results.m_scriptPath = m_benchmarkScript.getPath();
+	results.m_deviceName = deviceProperties.deviceName;
+	results.m_width = m_vkSwapchainExtent.width;
+	results.m_height = m_vkSwapchainExtent.height;
+	results.m_timestep = m_benchmarkScript.getTimestep();
+	results.m_warmupFrameCount = m_benchmarkScript.getWarmupFrameCount();
+	results.m_frameCount = m_benchmarkScript.getFrameCount();
+	results.m_seconds = seconds;
+	results.m_samples = m_frameStatistics.getHistory();
+	if (!writeBenchmarkResults(m_options.m_benchmarkResultsPath, results))
+	{
+		std::cerr << "Could not write " << m_options.m_benchmarkResultsPath << std::endl;
+		return;
+	}
+	std::cout << "Benchmark results written to " << m_options.m_benchmarkResultsPath << std::endl;
+}
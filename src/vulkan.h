@@ -1,7 +1,13 @@
 #pragma once
 
-#define GLFW_INCLUDE_VULKAN
+#include <vulkan/vulkan.h>
+#ifdef RENDERER_GLFW
 #include <GLFW/glfw3.h>
+#else
+// Builds without GLFW only run headless and never create the window.
+//
+struct GLFWwindow;
+#endif
 
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/gtx/hash.hpp>
@@ -13,14 +19,79 @@
 #include <vector>
 #include <cstring>
 #include <array>
+#include <atomic>
+#include <future>
+#include <map>
+#include "benchmarkscript.h"
 #include "camera.h"
+#include "deletionqueue.h"
+#include "descriptorallocator.h"
+#include "drawlist.h"
+#include "materialtable.h"
 #include "model.h"
+#include "pipelinecache.h"
+#include "scene.h"
+#include "statistics.h"
+#include "textureatlas.h"
+#include "texturemanager.h"
+#include "threadpool.h"
+#include "timeline.h"
+#include "transform.h"
 #include "utilities.h"
+#include "virtualtexture.h"
 
 const int WIDTH = 800;
 const int HEIGHT = 600;
 
+// Texture of the texture shaded models whose material has none.
+//
 const std::string TEXTURE_PATH = "textures/teapot.png";
+const std::string PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+
+// Sampled through the virtual texture system by the third model.
+//
+const std::string VIRTUAL_TEXTURE_PATH = "textures/chalet.jpg";
+
+// Mip chains built on the CPU are cached in this directory, in files
+// named by the hash of the image.
+//
+const std::string MIP_CACHE_DIRECTORY = "mipcache";
+
+// Bytes of texture levels streamed per frame once the smallest levels of
+// a texture are shown.
+//
+const VkDeviceSize TEXTURE_STREAMING_BUDGET = 4 * 1024 * 1024;
+
+// Pages of virtual textures copied to the page cache per frame.
+//
+const uint32_t VIRTUAL_TEXTURE_PAGE_BUDGET = 16;
+
+// Format of the color image rendered to in headless mode. Like the
+// swapchain format it is UNORM, so frames read back match the window.
+//
+const VkFormat HEADLESS_COLOR_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+// Frames rendered in headless mode when no frame count is given.
+//
+const uint32_t HEADLESS_FRAME_COUNT = 100;
+
+// Results of scripted benchmark runs are written here unless another
+// file is given on the command line.
+//
+const std::string BENCHMARK_RESULTS_PATH = "benchmark_results.json";
+
+const float Z_NEAR = 0.1f;
+const float Z_FAR = 10.0f;
+
+// The graphics pipelines, indices into m_vkGraphicsPipelines.
+//
+enum PipelineIndex
+{
+	PIPELINE_COLOR_SHADING,
+	PIPELINE_TEXTURE_SHADING,
+	PIPELINE_VIRTUAL_FEEDBACK, // Draws into the feedback pass of the virtual texture system.
+	PIPELINE_COUNT
+};
 
 #ifdef NDEBUG
 const bool g_enableValidationLayers = false;
@@ -47,10 +118,60 @@ struct SwapChainSupportDetails
 	std::vector<VkPresentModeKHR> m_presentModes;
 };
 
+// The descriptors of the frame set, laid out for its update template.
+//
+struct FrameDescriptors
+{
+	VkDescriptorBufferInfo m_uniformBuffer; // Binding 0.
+};
+
+// A command pool owned by one recording batch and the secondary command
+// buffers allocated from it. A batch runs on one thread at a time, so
+// the pool is never used concurrently.
+//
+struct RecordingSlot
+{
+	VkCommandPool m_vkCommandPool;
+	std::vector<VkCommandBuffer> m_vkSecondaryCommandBuffers;
+};
+
+// A fixed size run of the visible draw list recorded into a secondary
+// command buffer. The buffer is reused as long as the segment holds the
+// same draws and none of their transforms changed since it was recorded.
+//
+struct CommandSegment
+{
+	std::vector<uint32_t> m_drawIndices;
+	uint64_t m_recordedFrame = 0; // Transforms changed from this frame on are not in the buffer.
+	bool m_fRecorded = false;
+	uint32_t m_pipelineBinds = 0; // State changes recorded into the buffer.
+	uint32_t m_descriptorSetBinds = 0;
+	uint32_t m_meshBinds = 0;
+};
+
+// How the application runs, set from the command line.
+//
+struct RunOptions
+{
+	bool m_fHeadless = false; // Render to an offscreen image, without a window, surface or swapchain. Always set without RENDERER_GLFW.
+	uint32_t m_frameCount = 0; // Frames rendered before exiting, 0 to run until the window is closed.
+	uint32_t m_width = WIDTH; // Of the offscreen image.
+	uint32_t m_height = HEIGHT;
+	std::string m_readbackPrefix; // Headless frames are written to PNG files starting with this, unless empty.
+	uint32_t m_readbackInterval = 0; // Frames between files, 0 for the last frame only.
+	std::string m_benchmarkScriptPath; // Scene and animation played back on a fixed timestep, unless empty.
+	std::string m_benchmarkResultsPath = BENCHMARK_RESULTS_PATH;
+	std::string m_comparePath; // Reference PNG the last headless frame has to match, unless empty. Implies m_fFailOnValidationErrors.
+	bool m_fFailOnValidationErrors = false; // Exit with a failure if the validation layers reported an error.
+	bool m_fBenchmarkMipGeneration = false; // Time the mip generation once before the first frame, as the G key does.
+	MipGeneration m_mipGeneration = MIP_GENERATION_BLIT; // The texture manager falls back to the CPU for formats the GPU cannot filter.
+};
+
 class HelloTriangleApplication
 {
 public:
 	void run();
+	void setOptions(const RunOptions &options) { m_options = options; }
 	HelloTriangleApplication()
 		:m_vkPhysicalDevice(VK_NULL_HANDLE),
 		m_vkInstance(VK_NULL_HANDLE),
@@ -61,21 +182,51 @@ public:
 		m_vkCallback(VK_NULL_HANDLE),
 		m_vkSurface(VK_NULL_HANDLE),
 		m_vkSwapchain(VK_NULL_HANDLE),
+		m_vkOffscreenImageMemory(VK_NULL_HANDLE),
+		m_fSwapchainDirty(false),
 		m_vkRenderPass(VK_NULL_HANDLE),
 		m_vkPipelineLayout(VK_NULL_HANDLE),
-		m_vkGraphicsPipelineWithColorShading(VK_NULL_HANDLE),
-		m_vkGraphicsPipelineWithTextureShading(VK_NULL_HANDLE),
+		m_fPipelineCacheWarm(false),
 		m_vkCommandPool(VK_NULL_HANDLE),
 		m_vkImageAvailableSemaphore(VK_NULL_HANDLE),
-		m_vkRenderFinishedSemaphore(VK_NULL_HANDLE)
+		m_vkUniformBuffer(VK_NULL_HANDLE),
+		m_vkUniformBufferMemory(VK_NULL_HANDLE),
+		m_pUniformBufferData(nullptr),
+		m_vkFrameDescriptorTemplate(VK_NULL_HANDLE),
+		m_vkDescriptorSet(VK_NULL_HANDLE),
+		m_vkTimestampQueryPool(VK_NULL_HANDLE),
+		m_timestampPeriod(0.0f),
+		m_timestampValidBits(0),
+		m_fProjectionDirty(true),
+		m_vkFrameCommandPool(VK_NULL_HANDLE),
+		m_vkFrameCommandBuffer(VK_NULL_HANDLE),
+		m_fUniformBufferDirty(false),
+		m_fGpuTimingsPending(false),
+		m_frameIndex(0),
+		m_lastFrameValue(0),
+		m_frameWaitMilliseconds(0.0),
+		m_validationErrorCount(0)
 	{
-		m_models.resize(2);
+		m_models.resize(3);
+		for (auto &model : m_models)
+		{
+			model.setSceneNode(m_scene.addNode());
+		}
 		m_models[0].setModelPath("models/cube.obj");
-		m_models[0].translate(glm::vec3(3.0f, 0.0f, 0.0f));
+		m_models[0].setPipelineIndex(PIPELINE_COLOR_SHADING);
+		m_scene.translate(m_models[0].getSceneNode(), glm::vec3(3.0f, 0.0f, 0.0f));
 		m_models[1].setModelPath("models/teapot.obj");
-		m_models[1].translate(glm::vec3(0.0f, -1.0f, 0.0f));
-		m_models[1].setScale(glm::vec3(0.03f));
-		m_vkDescriptorSets.resize(2);
+		m_models[1].setPipelineIndex(PIPELINE_TEXTURE_SHADING);
+		m_scene.translate(m_models[1].getSceneNode(), glm::vec3(0.0f, -1.0f, 0.0f));
+		m_scene.setScale(m_models[1].getSceneNode(), glm::vec3(0.03f));
+		m_models[2].setModelPath("models/teapot.obj");
+		m_models[2].setPipelineIndex(PIPELINE_TEXTURE_SHADING);
+		m_models[2].setVirtualTexturePath(VIRTUAL_TEXTURE_PATH);
+		m_scene.translate(m_models[2].getSceneNode(), glm::vec3(-3.0f, -1.0f, 0.0f));
+		m_scene.setScale(m_models[2].getSceneNode(), glm::vec3(0.03f));
+#ifndef NDEBUG
+		m_frameStatistics.setReportEnabled(true);
+#endif
 	}
 
 private:
@@ -88,6 +239,7 @@ private:
 	void cleanup();
 	void cleanupSwapchain();
 	void initWindow();
+	bool pollWindowEvents();
 	static void onWindowResize(GLFWwindow *window, int width, int height);
 	static void onKeyPress(GLFWwindow *window, int key, int scanCode, int action, int mods);
 	static void onMouseClick(GLFWwindow *window, int button, int action, int mods);
@@ -97,33 +249,58 @@ private:
 	void createLogicalDevice();
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
 	bool ifDeviceSuitable(VkPhysicalDevice device);
+	std::vector<const char*> getDeviceExtensions() const;
 	bool checkDeviceExtensionsSupport(VkPhysicalDevice device);
 	SwapChainSupportDetails querySwapChainSupportDetails(VkPhysicalDevice device);
 	VkSurfaceFormatKHR chooseSwapChainSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &availableFormats);
 	VkPresentModeKHR chooseSwapChainPresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes);
 	VkExtent2D chooseSwapExtent(const VkSurfaceCapabilitiesKHR &surfaceCapabilities);
 	void createSwapChain();
+	void createOffscreenTarget();
+	void readbackFrame(std::vector<uint8_t> &pixels);
+	void compareFrame(const std::vector<uint8_t> &pixels);
 	void recreateSwapchain();
+	void retireSwapchain();
 	void createSwapchainImageViews();
+	void createPipelineLayout();
 	void createGraphicsPipelines();
-	VkPipeline createGraphicsPipeline(std::string fragShaderPath);
+	VkPipeline createGraphicsPipeline(VkShaderModule vertShaderModule, VkShaderModule fragShaderModule, VkRenderPass vkRenderPass);
+	VkPipeline getGraphicsPipeline(uint32_t pipelineIndex);
+	void waitForGraphicsPipelines();
+	void destroyGraphicsPipelines();
 	VkShaderModule createShaderModule(const std::vector<char> &code);
+	VkShaderModule getShaderModule(const std::string &path);
 	void createRenderPass();
 	void createFrameBuffers();
 	void createCommandPool();
-	void createAndFillCommandBuffers();
+	void createCommandBuffers();
+	void recordFrameCommandBuffer(uint32_t imageIndex);
+	void recordCommandSegments(const std::vector<uint32_t> &drawList, uint32_t threadCount, bool fUseCache);
+	VkCommandBuffer getSegmentCommandBuffer(size_t segmentIndex);
+	void recordDraws(VkCommandBuffer commandBuffer, CommandSegment &segment);
+	void recordFeedbackPass(VkCommandBuffer commandBuffer);
+	void updateVisibleDrawList();
+	void benchmarkCommandRecording();
+	void benchmarkTextureLoading();
+	void benchmarkMipGeneration();
+	void loadBenchmarkScene();
+	void applyBenchmarkScript(float time);
+	void saveBenchmarkResults(double seconds);
 	void loadModels();
 	void createVertexBuffers();
 	void createIndexBuffers();
 	void drawFrame();
 	void createSemaphores();
+	void createRenderFinishedSemaphores();
 	void createUniformBuffer();
 	uint32_t findMemoryType(int32_t typeFilter, VkMemoryPropertyFlags properties);
 	void createDescriptorSetLayout();
-	void updateUniformBuffer();
-	void createDescriptorPool();
+	void updateScene(float deltaTime);
+	void updateDrawTransforms(bool fViewProjChanged, float deltaTime);
+	void createTimestampQueryPool();
+	void collectGpuTimings();
 	void createDescriptorSet();
-	void createTextureImage();
+	void createMaterials();
 	void createImage(uint32_t width,
 		uint32_t height,
 		uint32_t mipLevels,
@@ -142,7 +319,6 @@ private:
 		VkImageLayout newLayout,
 		uint32_t mipLevels);
 
-	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 		VkDebugReportFlagsEXT flags,
 		VkDebugReportObjectTypeEXT objType,
@@ -152,14 +328,12 @@ private:
 		const char *layerPrefix,
 		const char *msg,
 		void *userData);
-	void createTextureImageView();
 	VkImageView createImageView(
 		VkImage image,
 		VkFormat format,
 		VkImageAspectFlags aspectFlags,
 		uint32_t mipLevels);
 
-	void createTextureSampler();
 	void createDepthResources();
 	VkFormat findSupportedFormat(
 		const std::vector<VkFormat>&candidates,
@@ -168,49 +342,85 @@ private:
 	);
 	VkFormat findDepthFormat();
 	bool hasStencilComponent(VkFormat format);
-	void generateMipmaps(
-		VkImage image,
-		int32_t texWidth,
-		int32_t texHeight,
-		uint32_t mipLevels
-	);
 
-	GLFWwindow *m_glfwWindow;
+	RunOptions m_options;
+	GLFWwindow *m_glfwWindow; // Null in headless mode, GLFW is not initialized.
 	VkInstance m_vkInstance;
 	VkDevice m_vkDevice;
 	VkPhysicalDevice m_vkPhysicalDevice;
 	VkQueue m_vkGraphicsQueue;
 	VkQueue m_vkPresentQueue;
-	const std::vector<const char*> validationLayers = { "VK_LAYER_LUNARG_standard_validation" };
-	const std::vector<const char*> deviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };
+	const std::vector<const char*> validationLayers = { "VK_LAYER_KHRONOS_validation" };
 	VkDebugReportCallbackEXT m_vkCallback;
 	VkSurfaceKHR m_vkSurface;
 	VkSwapchainKHR m_vkSwapchain;
-	std::vector<VkImage> m_vkSwapchainImages;
+	std::vector<VkImage> m_vkSwapchainImages; // The offscreen color image in headless mode.
+	VkDeviceMemory m_vkOffscreenImageMemory;
 	VkFormat m_vkSwapchainImageFormat;
 	VkExtent2D m_vkSwapchainExtent;
 	std::vector<VkImageView> m_vkSwapchainImageViews;
+	bool m_fSwapchainDirty; // Set by resize events, the swapchain is recreated at the start of the next frame.
 	VkRenderPass m_vkRenderPass;
 	VkPipelineLayout m_vkPipelineLayout;
-	VkPipeline m_vkGraphicsPipelineWithColorShading;
-	VkPipeline m_vkGraphicsPipelineWithTextureShading;
+	std::vector<VkPipeline> m_vkGraphicsPipelines; // Indexed by PipelineIndex, null until first needed.
+	std::vector<std::future<VkPipeline>> m_pipelineFutures; // Pipelines still being compiled on the thread pool.
+	CpuTimer m_pipelineTimer; // Started when the pipelines are submitted.
+	bool m_fPipelineCacheWarm;
+	std::map<std::string, VkShaderModule> m_vkShaderModules; // Loaded once, by path.
+	PipelineCache m_pipelineCache; // Used by every pipeline, saved at shutdown.
+	DeletionQueue m_deletionQueue; // Keyed by frame value, released as frames complete.
 	std::vector<VkFramebuffer> m_vkSwapchainFrameBuffers;
 	VkCommandPool m_vkCommandPool;
-	std::vector<VkCommandBuffer> m_vkCommandBuffers;
+	VkCommandPool m_vkFrameCommandPool; // Reset every frame.
+	VkCommandBuffer m_vkFrameCommandBuffer; // Primary buffer recorded every frame.
+	std::vector<RecordingSlot> m_recordingSlots; // One for each worker thread and one for the main thread.
+	std::vector<CommandSegment> m_commandSegments; // The visible draw list, in order.
+	std::vector<VkCommandBuffer> m_vkSegmentCommandBuffers; // Executed by the frame command buffer.
+	std::vector<uint32_t> m_dirtySegments;
 	VkSemaphore m_vkImageAvailableSemaphore; // Image available for rendering.
-	VkSemaphore m_vkRenderFinishedSemaphore; // Image available for presentation.
+	std::vector<VkSemaphore> m_vkRenderFinishedSemaphores; // Image available for presentation, one per swapchain image.
+	Timeline m_graphicsTimeline; // Signalled by every submission to the graphics queue.
 	VkDescriptorSetLayout m_vkDescriptorSetLayout;
-	VkDescriptorPool m_vkDescriptorPool;
-	std::vector<VkDescriptorSet> m_vkDescriptorSets;
-	VkImage m_vkTextureImage;
-	VkDeviceMemory m_vkTextureMemory;
-	VkImageView m_vkTextureImageView;
-	VkSampler m_vkTextureSampler;
+	DescriptorAllocator m_descriptorAllocator; // Grows its pools as sets are allocated.
+	VkDescriptorUpdateTemplate m_vkFrameDescriptorTemplate; // Writes FrameDescriptors.
+	VkDescriptorSet m_vkDescriptorSet;
+	MaterialTable m_materialTable; // Bound once per command buffer, next to the frame set.
+	VkBuffer m_vkUniformBuffer;
+	VkDeviceMemory m_vkUniformBufferMemory;
+	void *m_pUniformBufferData; // Persistently mapped, the memory is host coherent.
+	UniformBufferObject m_uniformBufferObject; // Copied to the buffer once the previous frame has completed.
+	bool m_fUniformBufferDirty;
+	TextureManager m_textureManager; // Fills the bindless slots of the material table.
+	TextureAtlas m_textureAtlas; // Pages of the small textures, added to the texture manager.
+	VirtualTextureSystem m_virtualTextures; // Its set is bound after the material table.
 	VkImage m_vkDepthImage;
 	VkDeviceMemory m_vkDepthImageMemory;
 	VkImageView m_vkDepthImageView;
-	uint32_t m_mipLevels;
 	Camera m_camera;
+	Scene m_scene;
 	std::vector<Model> m_models;
+	std::vector<uint32_t> m_drawList; // Indices of the models to draw, in order.
+	std::vector<uint32_t> m_visibleDrawList; // The draw list after frustum culling, sorted by state.
+	std::vector<DrawItem> m_drawItems;
+	std::vector<DrawItem> m_drawItemScratch;
+	glm::mat4 m_viewProj;
+	bool m_fProjectionDirty; // Set when the swapchain extent changes.
+	std::vector<PushConstantObject> m_drawTransforms; // One for each model, pushed while recording.
+	std::vector<size_t> m_changedModelIndices;
+	std::vector<glm::mat4> m_changedModelMatrices;
+	std::vector<PushConstantObject> m_changedDrawTransforms;
+	std::vector<uint64_t> m_drawTransformFrames; // The frame each draw transform last changed in.
+	uint64_t m_frameIndex;
+	uint64_t m_lastFrameValue; // Graphics timeline value of the last frame submitted.
+	VkQueryPool m_vkTimestampQueryPool; // Null if the device cannot write timestamps.
+	float m_timestampPeriod; // Nanoseconds per timestamp tick.
+	uint32_t m_timestampValidBits; // Of the graphics queue family, 0 if the pool is not created.
+	bool m_fGpuTimingsPending; // The last frame submitted wrote timestamps that were not read yet.
+	FrameStatistics m_frameStatistics;
+	double m_frameWaitMilliseconds; // Spent by the last frame waiting for the previous one.
+	BenchmarkScript m_benchmarkScript;
+	ThreadPool m_threadPool;
+	std::atomic<uint32_t> m_validationErrorCount; // Errors reported by the validation layers, from any thread.
+	std::string m_compareError; // Why the last frame does not match the reference image, empty if it does.
 };
 